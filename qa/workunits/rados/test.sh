@@ -1,6 +1,7 @@
 #!/bin/sh -e
 
 test_rados_api_aio
+test_rados_api_c_ops
 test_rados_api_io
 test_rados_api_list
 test_rados_api_misc
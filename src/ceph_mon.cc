@@ -41,6 +41,8 @@ using namespace std;
 #include "global/global_init.h"
 #include "global/signal_handler.h"
 
+#include <boost/scoped_ptr.hpp>
+
 #include "include/assert.h"
 
 #define dout_subsys ceph_subsys_mon
@@ -200,8 +202,8 @@ int main(int argc, const char **argv)
     }
 
     // go
-    MonitorStore store(g_conf->mon_data);
-    Monitor mon(g_ceph_context, g_conf->name.get_id(), &store, 0, &monmap);
+    boost::scoped_ptr<MonitorStore> store(MonitorStore::create(g_conf->mon_data));
+    Monitor mon(g_ceph_context, g_conf->name.get_id(), store.get(), 0, &monmap);
     int r = mon.mkfs(osdmapbl);
     if (r < 0) {
       cerr << argv[0] << ": error creating monfs: " << cpp_strerror(r) << std::endl;
@@ -215,15 +217,15 @@ int main(int argc, const char **argv)
   CompatSet mon_features = get_ceph_mon_feature_compat_set();
   CompatSet ondisk_features;
 
-  MonitorStore store(g_conf->mon_data);
-  err = store.mount();
+  boost::scoped_ptr<MonitorStore> store(MonitorStore::create(g_conf->mon_data));
+  err = store->mount();
   if (err < 0) {
     cerr << "problem opening monitor store in " << g_conf->mon_data << ": " << cpp_strerror(err) << std::endl;
     exit(1);
   }
 
   bufferlist magicbl;
-  err = store.get_bl_ss(magicbl, "magic", 0);
+  err = store->get_bl_ss(magicbl, "magic", 0);
   if (err < 0) {
     cerr << "unable to read magic from mon data.. did you run mkcephfs?" << std::endl;
     exit(1);
@@ -235,7 +237,7 @@ int main(int argc, const char **argv)
   }
 
   bufferlist features;
-  store.get_bl_ss(features, COMPAT_SET_LOC, 0);
+  store->get_bl_ss(features, COMPAT_SET_LOC, 0);
   if (features.length() == 0) {
     cerr << "WARNING: mon fs missing feature list.\n"
 	 << "Assuming it is old-style and introducing one." << std::endl;
@@ -269,7 +271,7 @@ int main(int argc, const char **argv)
     }
 
     // get next version
-    version_t v = store.get_int("monmap", "last_committed");
+    version_t v = store->get_int("monmap", "last_committed");
     cout << "last committed monmap epoch is " << v << ", injected map will be " << (v+1) << std::endl;
     v++;
 
@@ -287,9 +289,12 @@ int main(int argc, const char **argv)
     ::encode(mapbl, final);
 
     // save it
-    store.put_bl_sn(mapbl, "monmap", v);
-    store.put_bl_ss(final, "monmap", "latest");
-    store.put_int(v, "monmap", "last_committed");
+    MonitorStore::Transaction t;
+    t.put_bl_sn(mapbl, "monmap", v);
+    t.put_bl_ss(final, "monmap", "latest");
+    t.put_int(v, "monmap", "last_committed");
+    r = store->apply_transaction(t);
+    assert(r == 0);
 
     cout << "done." << std::endl;
     exit(0);
@@ -301,14 +306,14 @@ int main(int argc, const char **argv)
   {
     bufferlist mapbl;
     bufferlist latest;
-    store.get_bl_ss(latest, "monmap", "latest");
+    store->get_bl_ss(latest, "monmap", "latest");
     if (latest.length() > 0) {
       bufferlist::iterator p = latest.begin();
       version_t v;
       ::decode(v, p);
       ::decode(mapbl, p);
     } else {
-      store.get_bl_ss(mapbl, "mkfs", "monmap");
+      store->get_bl_ss(mapbl, "mkfs", "monmap");
       if (mapbl.length() == 0) {
 	cerr << "mon fs missing 'monmap/latest' and 'mkfs/monmap'" << std::endl;
 	exit(1);
@@ -414,9 +419,18 @@ int main(int argc, const char **argv)
     return 1;
 
   // start monitor
-  mon = new Monitor(g_ceph_context, g_conf->name.get_id(), &store, messenger, &monmap);
+  mon = new Monitor(g_ceph_context, g_conf->name.get_id(), store.get(), messenger, &monmap);
 
+  // neither the store lock nor leveldb's threads survive the fork, so
+  // close the store across it
+  store->umount();
   global_init_daemonize(g_ceph_context, 0);
+  err = store->mount();
+  if (err < 0) {
+    derr << "problem reopening monitor store in " << g_conf->mon_data << ": "
+	 << cpp_strerror(err) << dendl;
+    exit(1);
+  }
   common_init_finish(g_ceph_context);
   global_init_chdir(g_ceph_context);
   messenger->start();
@@ -434,7 +448,7 @@ int main(int argc, const char **argv)
   unregister_async_signal_handler(SIGINT, handle_mon_signal);
   unregister_async_signal_handler(SIGTERM, handle_mon_signal);
 
-  store.umount();
+  store->umount();
   delete mon;
   delete messenger;
 
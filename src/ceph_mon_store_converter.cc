@@ -0,0 +1,215 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Convert a monitor's file-per-value store into a LevelDB store in
+ * <mon data>/store.db.  The old files are left alone; once store.db
+ * exists ceph-mon uses it instead of them.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "mon/MonitorStore.h"
+#include "mon/LevelDBMonitorStore.h"
+#include "common/ceph_argparse.h"
+#include "common/errno.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+
+// flush the batch when it grows past this many values or bytes
+static const unsigned MAX_BATCH_OPS = 1000;
+static const uint64_t MAX_BATCH_BYTES = 64 << 20;
+
+void usage()
+{
+  cerr << "usage: ceph-mon-store-converter <mon data dir>" << std::endl;
+  exit(1);
+}
+
+static bool skip_entry(const char *name)
+{
+  size_t len = strlen(name);
+  return strcmp(name, ".") == 0 ||
+    strcmp(name, "..") == 0 ||
+    strcmp(name, "lock") == 0 ||
+    strcmp(name, LevelDBMonitorStore::DB_DIR) == 0 ||
+    (len > 4 && strcmp(name + len - 4, ".new") == 0);  // half-written
+}
+
+struct Converter {
+  string dir;
+  MonitorStore &src;
+  LevelDBMonitorStore &dst;
+  MonitorStore::Transaction t;
+  unsigned batch_ops;
+  uint64_t batch_bytes;
+  uint64_t total_ops, total_bytes;
+
+  Converter(const string &d, MonitorStore &s, LevelDBMonitorStore &ds)
+    : dir(d), src(s), dst(ds),
+      batch_ops(0), batch_bytes(0), total_ops(0), total_bytes(0) {}
+
+  int flush() {
+    if (t.empty())
+      return 0;
+    int r = dst.apply_transaction(t);
+    t = MonitorStore::Transaction();
+    batch_ops = batch_bytes = 0;
+    return r;
+  }
+
+  int copy(const char *a, const char *b) {
+    bufferlist bl;
+    int r = src.get_bl_ss(bl, a, b);
+    if (r < 0) {
+      cerr << "error reading " << a << (b ? "/" : "") << (b ? b : "")
+	   << ": " << cpp_strerror(r) << std::endl;
+      return r;
+    }
+    t.put_bl_ss(bl, a, b);
+    batch_ops++;
+    batch_bytes += bl.length();
+    total_ops++;
+    total_bytes += bl.length();
+    if (batch_ops >= MAX_BATCH_OPS || batch_bytes >= MAX_BATCH_BYTES)
+      return flush();
+    return 0;
+  }
+
+  int copy_dir(const char *a) {
+    string path = dir + "/" + a;
+    DIR *d = ::opendir(path.c_str());
+    if (!d) {
+      int r = -errno;
+      cerr << "unable to open " << path << ": " << cpp_strerror(r) << std::endl;
+      return r;
+    }
+    int r = 0;
+    unsigned n = 0;
+    struct dirent *de;
+    while ((de = ::readdir(d)) != NULL) {
+      if (skip_entry(de->d_name))
+	continue;
+      r = copy(a, de->d_name);
+      if (r < 0)
+	break;
+      n++;
+    }
+    ::closedir(d);
+    if (r == 0)
+      cout << " " << a << ": " << n << " values" << std::endl;
+    return r;
+  }
+
+  int run() {
+    DIR *d = ::opendir(dir.c_str());
+    if (!d) {
+      int r = -errno;
+      cerr << "unable to open " << dir << ": " << cpp_strerror(r) << std::endl;
+      return r;
+    }
+    int r = 0;
+    struct dirent *de;
+    while ((de = ::readdir(d)) != NULL) {
+      if (skip_entry(de->d_name) || strcmp(de->d_name, "magic") == 0)
+	continue;
+      string path = dir + "/" + de->d_name;
+      struct stat st;
+      if (::stat(path.c_str(), &st) < 0)
+	continue;
+      if (S_ISDIR(st.st_mode))
+	r = copy_dir(de->d_name);
+      else if (S_ISREG(st.st_mode))
+	r = copy(de->d_name, 0);
+      if (r < 0)
+	break;
+    }
+    ::closedir(d);
+    if (r < 0)
+      return r;
+
+    // magic goes last: a store.db cut short by a crash has none, so
+    // ceph-mon will refuse to start on it
+    r = flush();
+    if (r < 0)
+      return r;
+    r = copy("magic", 0);
+    if (r < 0)
+      return r;
+    return flush();
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_MON, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  if (args.size() != 1)
+    usage();
+  string dir = args[0];
+
+  struct stat st;
+  string db = dir + "/" + LevelDBMonitorStore::DB_DIR;
+  if (::stat(db.c_str(), &st) == 0) {
+    cerr << db << " already exists; remove it to convert again" << std::endl;
+    return 1;
+  }
+
+  // mounting the old store takes the lock, keeping ceph-mon out
+  MonitorStore src(dir);
+  int r = src.mount();
+  if (r < 0) {
+    cerr << "unable to mount monitor store in " << dir << ": "
+	 << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+  if (!src.exists_bl_ss("magic", 0)) {
+    cerr << dir << " does not look like a monitor store (no magic)" << std::endl;
+    return 1;
+  }
+
+  LevelDBMonitorStore dst(dir);
+  r = dst.mkfs();
+  if (r < 0) {
+    cerr << "unable to create " << db << ": " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+
+  cout << "converting " << dir << std::endl;
+  Converter c(dir, src, dst);
+  r = c.run();
+  if (r < 0) {
+    cerr << "conversion failed: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+  cout << "converted " << c.total_ops << " values, " << c.total_bytes
+       << " bytes, into " << db << std::endl;
+
+  dst.umount();
+  src.umount();
+  return 0;
+}
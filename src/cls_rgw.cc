@@ -28,14 +28,6 @@ cls_method_handle_t h_rgw_user_usage_log_add;
 cls_method_handle_t h_rgw_user_usage_log_read;
 cls_method_handle_t h_rgw_user_usage_log_trim;
 
-
-#define ROUND_BLOCK_SIZE 4096
-
-static uint64_t get_rounded_size(uint64_t size)
-{
-  return (size + ROUND_BLOCK_SIZE - 1) & ~(ROUND_BLOCK_SIZE - 1);
-}
-
 int rgw_bucket_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 {
   bufferlist::iterator iter = in->begin();
@@ -270,7 +262,7 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
     struct rgw_bucket_category_stats& stats = header.stats[entry.meta.category];
     stats.num_entries--;
     stats.total_size -= entry.meta.size;
-    stats.total_size_rounded -= get_rounded_size(entry.meta.size);
+    stats.total_size_rounded -= cls_rgw_get_rounded_size(entry.meta.size);
   }
 
   switch (op.op) {
@@ -302,7 +294,7 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
       entry.exists = true;
       stats.num_entries++;
       stats.total_size += meta.size;
-      stats.total_size_rounded += get_rounded_size(meta.size);
+      stats.total_size_rounded += cls_rgw_get_rounded_size(meta.size);
       bufferlist new_key_bl;
       ::encode(entry, new_key_bl);
       int ret = cls_cxx_map_set_val(hctx, op.name, &new_key_bl);
@@ -382,7 +374,7 @@ int rgw_dir_suggest_changes(cls_method_context_t hctx, bufferlist *in, bufferlis
       if (cur_disk.exists) {
         stats.num_entries--;
         stats.total_size -= cur_disk.meta.size;
-        stats.total_size_rounded -= get_rounded_size(cur_disk.meta.size);
+        stats.total_size_rounded -= cls_rgw_get_rounded_size(cur_disk.meta.size);
         header_changed = true;
       }
       switch(op) {
@@ -394,7 +386,7 @@ int rgw_dir_suggest_changes(cls_method_context_t hctx, bufferlist *in, bufferlis
       case CEPH_RGW_UPDATE:
         stats.num_entries++;
         stats.total_size += cur_change.meta.size;
-        stats.total_size_rounded += get_rounded_size(cur_change.meta.size);
+        stats.total_size_rounded += cls_rgw_get_rounded_size(cur_change.meta.size);
         bufferlist cur_state_bl;
         ::encode(cur_change, cur_state_bl);
         ret = cls_cxx_map_set_val(hctx, cur_change.name, &cur_state_bl);
@@ -0,0 +1,120 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_PRIORITIZEDQUEUE_H
+#define CEPH_PRIORITIZEDQUEUE_H
+
+#include "include/assert.h"
+
+#include <list>
+#include <map>
+
+/**
+ * Weighted round-robin queue.
+ *
+ * Items are kept in a FIFO per priority.  Each round, every non-empty
+ * FIFO is granted as many dequeues as its priority, and FIFOs are
+ * drained highest priority first within the round.  With priorities
+ * 63 and 10, for example, the lower priority items still get 10 of
+ * every 73 dequeues rather than being starved.
+ *
+ * Not thread safe; callers provide their own locking.
+ */
+template <typename T>
+class PrioritizedQueue {
+  struct SubQueue {
+    std::list<T> q;
+    unsigned tokens;
+    SubQueue() : tokens(0) {}
+  };
+  typedef std::map<unsigned, SubQueue> SubQueues;
+  SubQueues queues;
+  unsigned total;
+
+  void refill() {
+    for (typename SubQueues::iterator p = queues.begin();
+	 p != queues.end();
+	 ++p)
+      p->second.tokens = p->first;
+  }
+
+public:
+  PrioritizedQueue() : total(0) {}
+
+  unsigned length() const {
+    return total;
+  }
+  bool empty() const {
+    return !total;
+  }
+
+  void enqueue(unsigned priority, T item) {
+    if (priority == 0)
+      priority = 1;
+    queues[priority].q.push_back(item);
+    ++total;
+  }
+
+  /// remove every queued instance of item; returns the number removed
+  unsigned remove(T item) {
+    unsigned removed = 0;
+    for (typename SubQueues::iterator p = queues.begin();
+	 p != queues.end();
+	 ) {
+      std::list<T> &q = p->second.q;
+      for (typename std::list<T>::iterator i = q.begin(); i != q.end(); ) {
+	if (*i == item) {
+	  q.erase(i++);
+	  ++removed;
+	} else {
+	  ++i;
+	}
+      }
+      if (q.empty())
+	queues.erase(p++);
+      else
+	++p;
+    }
+    total -= removed;
+    return removed;
+  }
+
+  T dequeue() {
+    assert(total);
+    while (true) {
+      for (typename SubQueues::reverse_iterator p = queues.rbegin();
+	   p != queues.rend();
+	   ++p) {
+	if (!p->second.tokens)
+	  continue;
+	p->second.tokens--;
+	T ret = p->second.q.front();
+	p->second.q.pop_front();
+	if (p->second.q.empty())
+	  queues.erase(p->first);   // an idle queue does not bank tokens
+	--total;
+	return ret;
+      }
+      // every non-empty queue has used up its share; start a new round
+      refill();
+    }
+  }
+
+  void clear() {
+    queues.clear();
+    total = 0;
+  }
+};
+
+#endif
@@ -25,6 +25,14 @@
 #undef dout_prefix
 #define dout_prefix *_dout << name << " "
 
+/// what reset_tp_timeout() needs to know about the current pool thread
+struct tp_thread_state {
+  CephContext *cct;
+  heartbeat_handle_d *hb;
+  time_t grace, suicide_grace;
+};
+static __thread tp_thread_state *tp_state = NULL;
+
 
 void ThreadPool::worker()
 {
@@ -34,6 +42,8 @@ void ThreadPool::worker()
   std::stringstream ss;
   ss << name << " thread " << (void*)pthread_self();
   heartbeat_handle_d *hb = cct->get_heartbeat_map()->add_worker(ss.str());
+  tp_thread_state state = { cct, hb, 0, 0 };
+  tp_state = &state;
 
   while (!_stop) {
     if (!_pause && work_queues.size()) {
@@ -50,6 +60,8 @@ void ThreadPool::worker()
 	  processing++;
 	  ldout(cct,12) << "worker wq " << wq->name << " start processing " << item << dendl;
 	  _lock.Unlock();
+	  state.grace = wq->timeout_interval;
+	  state.suicide_grace = wq->suicide_interval;
 	  cct->get_heartbeat_map()->reset_timeout(hb, wq->timeout_interval, wq->suicide_interval);
 	  wq->_void_process(item);
 	  _lock.Lock();
@@ -72,11 +84,20 @@ void ThreadPool::worker()
   }
   ldout(cct,1) << "worker finish" << dendl;
 
+  tp_state = NULL;
   cct->get_heartbeat_map()->remove_worker(hb);
 
   _lock.Unlock();
 }
 
+void ThreadPool::reset_tp_timeout()
+{
+  if (!tp_state)
+    return;
+  tp_state->cct->get_heartbeat_map()->reset_timeout(tp_state->hb, tp_state->grace,
+						    tp_state->suicide_grace);
+}
+
 void ThreadPool::start()
 {
   ldout(cct,10) << "start" << dendl;
@@ -91,6 +91,16 @@ public:
       pool->_lock.Unlock();
       return r;
     }
+    /// queue several items under one lock and wake every worker for them
+    void queue(const list<T*> &items) {
+      pool->_lock.Lock();
+      for (typename list<T*>::const_iterator i = items.begin();
+	   i != items.end();
+	   ++i)
+	_enqueue(*i);
+      pool->_cond.Signal();
+      pool->_lock.Unlock();
+    }
     void dequeue(T *item) {
       pool->_lock.Lock();
       _dequeue(item);
@@ -282,6 +292,14 @@ public:
   void unpause();
   /// wait for all work to complete
   void drain(WorkQueue_* wq = 0);
+
+  /**
+   * Push out the heartbeat timeout of the pool thread we are running
+   * on by the current work queue's interval.  Work items that may
+   * legitimately run for a long time (e.g. throttled scans) call this
+   * between steps.  Does nothing outside of a pool thread.
+   */
+  static void reset_tp_timeout();
 };
 
 
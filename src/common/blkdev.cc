@@ -15,6 +15,11 @@
 #include <sys/disk.h>
 #endif
 
+#if defined(__linux__) && !defined(BLKDISCARD)
+// from linux/fs.h, which does not mix well with sys/mount.h
+#define BLKDISCARD _IO(0x12,119)
+#endif
+
 int get_block_device_size(int fd, int64_t *psize)
 {
   int ret = 0;
@@ -38,3 +43,20 @@ int get_block_device_size(int fd, int64_t *psize)
     ret = -errno;
   return ret;
 }
+
+/**
+ * tell the device it no longer needs to keep offset~len
+ *
+ * @return 0, or -EOPNOTSUPP if the device (or platform) can't discard
+ */
+int block_device_discard(int fd, int64_t offset, int64_t len)
+{
+#if defined(__linux__)
+  uint64_t range[2] = { (uint64_t)offset, (uint64_t)len };
+  if (::ioctl(fd, BLKDISCARD, range) < 0)
+    return -errno;
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
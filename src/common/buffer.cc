@@ -23,6 +23,7 @@
 #include "include/compat.h"
 
 #include <errno.h>
+#include <map>
 #include <fstream>
 #include <sstream>
 #include <sys/uio.h>
@@ -39,30 +40,100 @@ static uint32_t simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZE
 # define bendl std::endl; }
 #endif
 
-atomic_t buffer_total_alloc;
+/*
+ * allocation accounting is spread over cache-line sized shards, each
+ * thread counting into its own, and summed on read.  a buffer freed by
+ * another thread than the one that allocated it leaves one shard
+ * negative; only the sum means anything.
+ */
+#define BUFFER_ALLOC_SHARDS 32
+struct buffer_alloc_shard_t {
+  atomic_t total;
+  char __pad[64 - sizeof(atomic_t)];
+};
+static buffer_alloc_shard_t buffer_total_alloc[BUFFER_ALLOC_SHARDS];
+static atomic_t buffer_alloc_next_shard;
+static __thread int buffer_alloc_my_shard = -1;
 bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
+static atomic_t buffer_cached_crc;
+static atomic_t buffer_cached_crc_adjusted;
+static bool buffer_track_crc = get_env_bool("CEPH_BUFFER_TRACK");
+
+static inline atomic_t& my_alloc_shard() {
+  if (buffer_alloc_my_shard < 0)
+    buffer_alloc_my_shard = buffer_alloc_next_shard.inc() % BUFFER_ALLOC_SHARDS;
+  return buffer_total_alloc[buffer_alloc_my_shard].total;
+}
+
   void buffer::inc_total_alloc(unsigned len) {
     if (buffer_track_alloc)
-      buffer_total_alloc.add(len);
+      my_alloc_shard().add(len);
   }
   void buffer::dec_total_alloc(unsigned len) {
     if (buffer_track_alloc)
-      buffer_total_alloc.sub(len);
+      my_alloc_shard().sub(len);
   }
   int buffer::get_total_alloc() {
-    return buffer_total_alloc.read();
+    int total = 0;
+    for (int i = 0; i < BUFFER_ALLOC_SHARDS; i++)
+      total += (int)buffer_total_alloc[i].total.read();
+    return total;
+  }
+
+  void buffer::track_cached_crc(bool b) {
+    buffer_track_crc = b;
+  }
+  int buffer::get_cached_crc() {
+    return buffer_cached_crc.read();
+  }
+  int buffer::get_cached_crc_adjusted() {
+    return buffer_cached_crc_adjusted.read();
   }
 
+/*
+ * free lists for the buffer sizes we allocate most (a page, and the
+ * 64K the messenger and journal favor).  freed buffers of exactly
+ * these sizes are linked through their first bytes and handed out
+ * again, page aligned, instead of going back to malloc.  plain old
+ * data, so it is usable before static constructors have run.
+ */
+struct buffer_pool_t {
+  unsigned size;
+  unsigned max;      // free buffers kept; the rest are freed
+  simple_spinlock_t lock;
+  char *head;
+  unsigned count;
+};
+static buffer_pool_t buffer_pools[] = {
+  { 4096, 512, SIMPLE_SPINLOCK_INITIALIZER, 0, 0 },
+  { 65536, 32, SIMPLE_SPINLOCK_INITIALIZER, 0, 0 },
+};
+bool buffer_use_pools = !get_env_bool("CEPH_BUFFER_NOPOOL");
+
+static buffer_pool_t *get_buffer_pool(unsigned len) {
+  if (!buffer_use_pools)
+    return 0;
+  for (unsigned i = 0; i < sizeof(buffer_pools) / sizeof(buffer_pools[0]); i++)
+    if (buffer_pools[i].size == len)
+      return &buffer_pools[i];
+  return 0;
+}
+
   class buffer::raw {
   public:
     char *data;
     unsigned len;
     atomic_t nref;
 
-    raw(unsigned l) : len(l), nref(0)
+    // crc32c of (from, to) ranges: (seed, crc); cleared by any write
+    simple_spinlock_t crc_spinlock;
+    std::map<pair<unsigned, unsigned>, pair<__u32, __u32> > crc_map;
+
+    raw(unsigned l) : len(l), nref(0), crc_spinlock(SIMPLE_SPINLOCK_INITIALIZER)
     { }
-    raw(char *c, unsigned l) : data(c), len(l), nref(0)
+    raw(char *c, unsigned l) : data(c), len(l), nref(0),
+			       crc_spinlock(SIMPLE_SPINLOCK_INITIALIZER)
     { }
     virtual ~raw() {};
 
@@ -83,6 +154,35 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     bool is_n_page_sized() {
       return (len & ~CEPH_PAGE_MASK) == 0;
     }
+
+    bool get_crc(const pair<unsigned, unsigned> &fromto,
+		 pair<__u32, __u32> *crc) {
+      simple_spin_lock(&crc_spinlock);
+      std::map<pair<unsigned, unsigned>, pair<__u32, __u32> >::iterator i =
+	crc_map.find(fromto);
+      bool found = i != crc_map.end();
+      if (found)
+	*crc = i->second;
+      simple_spin_unlock(&crc_spinlock);
+      return found;
+    }
+    void set_crc(const pair<unsigned, unsigned> &fromto,
+		 const pair<__u32, __u32> &crc) {
+      simple_spin_lock(&crc_spinlock);
+      if (crc_map.size() >= 16)   // someone is slicing this up; start over
+	crc_map.clear();
+      crc_map[fromto] = crc;
+      simple_spin_unlock(&crc_spinlock);
+    }
+    void invalidate_crc() {
+      // unlocked peek: writing data another thread is checksumming is
+      // already a race
+      if (crc_map.empty())
+	return;
+      simple_spin_lock(&crc_spinlock);
+      crc_map.clear();
+      simple_spin_unlock(&crc_spinlock);
+    }
   };
 
   class buffer::raw_malloc : public buffer::raw {
@@ -213,6 +313,49 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     }
   };
 
+  class buffer::raw_pooled : public buffer::raw {
+    buffer_pool_t *pool;
+  public:
+    raw_pooled(buffer_pool_t *p) : raw(p->size), pool(p) {
+      simple_spin_lock(&pool->lock);
+      data = pool->head;
+      if (data) {
+	pool->head = *(char**)data;
+	pool->count--;
+      }
+      simple_spin_unlock(&pool->lock);
+      if (!data) {
+#ifdef DARWIN
+	data = (char *) valloc(len);
+#else
+	int r = ::posix_memalign((void**)(void*)&data, CEPH_PAGE_SIZE, len);
+	if (r)
+	  throw bad_alloc();
+#endif /* DARWIN */
+	if (!data)
+	  throw bad_alloc();
+      }
+      inc_total_alloc(len);
+      bdout << "raw_pooled " << this << " alloc " << (void *)data << " " << len << " " << buffer::get_total_alloc() << bendl;
+    }
+    ~raw_pooled() {
+      dec_total_alloc(len);
+      bdout << "raw_pooled " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
+      simple_spin_lock(&pool->lock);
+      if (pool->count < pool->max) {
+	*(char**)data = pool->head;
+	pool->head = data;
+	pool->count++;
+	data = 0;
+      }
+      simple_spin_unlock(&pool->lock);
+      ::free(data);
+    }
+    raw* clone_empty() {
+      return new raw_pooled(pool);
+    }
+  };
+
   class buffer::raw_static : public buffer::raw {
   public:
     raw_static(const char *d, unsigned l) : raw((char*)d, l) { }
@@ -223,11 +366,14 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   };
 
   buffer::raw* buffer::copy(const char *c, unsigned len) {
-    raw* r = new raw_char(len);
+    raw* r = create(len);
     memcpy(r->data, c, len);
     return r;
   }
   buffer::raw* buffer::create(unsigned len) {
+    buffer_pool_t *pool = get_buffer_pool(len);
+    if (pool)
+      return new raw_pooled(pool);
     return new raw_char(len);
   }
   buffer::raw* buffer::claim_char(unsigned len, char *buf) {
@@ -243,6 +389,9 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     return new raw_static(buf, len);
   }
   buffer::raw* buffer::create_page_aligned(unsigned len) {
+    buffer_pool_t *pool = get_buffer_pool(len);
+    if (pool)
+      return new raw_pooled(pool);
 #ifndef __CYGWIN__
     //return new raw_mmap_pages(len);
     return new raw_posix_aligned(len);
@@ -334,7 +483,11 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   bool buffer::ptr::at_buffer_tail() const { return _off + _len == _raw->len; }
 
   const char *buffer::ptr::c_str() const { assert(_raw); return _raw->data + _off; }
-  char *buffer::ptr::c_str() { assert(_raw); return _raw->data + _off; }
+  char *buffer::ptr::c_str() {
+    assert(_raw);
+    _raw->invalidate_crc();  // the caller may write through it
+    return _raw->data + _off;
+  }
 
   unsigned buffer::ptr::unused_tail_length() const
   {
@@ -353,6 +506,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   {
     assert(_raw);
     assert(n < _len);
+    _raw->invalidate_crc();
     return _raw->data[_off + n];
   }
 
@@ -1259,6 +1413,46 @@ int buffer::list::write_fd(int fd) const
   return 0;
 }
 
+/*
+ * segments shorter than this are cheaper to checksum again than to
+ * look up
+ */
+#define CRC_CACHE_MIN_LEN 1024
+
+__u32 buffer::list::crc32c(__u32 crc) const
+{
+  for (std::list<ptr>::const_iterator it = _buffers.begin();
+       it != _buffers.end();
+       ++it) {
+    if (!it->length())
+      continue;
+    if (it->length() < CRC_CACHE_MIN_LEN) {
+      crc = ceph_crc32c_le(crc, (unsigned char*)it->c_str(), it->length());
+      continue;
+    }
+    raw *r = it->get_raw();
+    pair<unsigned, unsigned> fromto(it->offset(), it->end());
+    pair<__u32, __u32> cached;
+    if (r->get_crc(fromto, &cached)) {
+      if (cached.first == crc) {
+	crc = cached.second;
+	if (buffer_track_crc)
+	  buffer_cached_crc.inc();
+      } else {
+	// same data, different seed
+	crc = cached.second ^ ceph_crc32c_zeros(cached.first ^ crc, it->length());
+	if (buffer_track_crc)
+	  buffer_cached_crc_adjusted.inc();
+      }
+    } else {
+      __u32 seed = crc;
+      crc = ceph_crc32c_le(crc, (unsigned char*)it->c_str(), it->length());
+      r->set_crc(fromto, make_pair(seed, crc));
+    }
+  }
+  return crc;
+}
+
 
 void buffer::list::hexdump(std::ostream &out) const
 {
@@ -98,9 +98,12 @@ OPTION(ms_bind_ipv6, OPT_BOOL, false)
 OPTION(ms_rwthread_stack_bytes, OPT_U64, 1024 << 10)
 OPTION(ms_tcp_read_timeout, OPT_U64, 900)
 OPTION(ms_inject_socket_failures, OPT_U64, 0)
+OPTION(ms_event_workers, OPT_INT, 0)  // >0 services open connections from this many epoll threads instead of a reader+writer thread per Pipe
+OPTION(ms_dispatch_threads, OPT_INT, 1)  // >1 dispatches from this many threads; each connection's messages stay on one, in order
 OPTION(mon_data, OPT_STR, "/var/lib/ceph/mon/$cluster-$id")
 OPTION(mon_initial_members, OPT_STR, "")    // list of initial cluster mon ids; if specified, need majority to form initial quorum and create new cluster
 OPTION(mon_sync_fs_threshold, OPT_INT, 5)   // sync() when writing this many objects; 0 to disable.
+OPTION(mon_leveldb, OPT_BOOL, false)   // mkfs a leveldb store rather than a file per value
 OPTION(mon_tick_interval, OPT_INT, 5)
 OPTION(mon_subscribe_interval, OPT_DOUBLE, 300)
 OPTION(mon_osd_auto_mark_in, OPT_BOOL, false)         // mark any booting osds 'in'
@@ -286,7 +289,17 @@ OPTION(osd_map_cache_size, OPT_INT, 500)
 OPTION(osd_map_cache_bl_size, OPT_INT, 50)
 OPTION(osd_map_cache_bl_inc_size, OPT_INT, 100)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
+OPTION(osd_pg_object_context_cache_count, OPT_INT, 64)  // idle object contexts kept per pg
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_peering_wq_batch_size, OPT_U64, 20)  // pgs a peering thread takes at a time
+OPTION(osd_map_max_advance, OPT_INT, 200)  // epochs a pg advances before yielding its peering thread
+OPTION(osd_rx_buffer_chunk, OPT_U32, 65536)  // receive op data into page aligned chunks of this size; 0 == let the messenger allocate
+OPTION(osd_op_fast_dispatch, OPT_BOOL, true)  // queue client ops from the messenger threads, without osd_lock, when possible
+OPTION(osd_op_num_shards, OPT_INT, 5)   // client/replica ops are hashed by pg onto this many independent queues
+OPTION(osd_op_shard_threads, OPT_INT, 2)  // worker threads per op shard
+OPTION(osd_client_op_priority, OPT_INT, 63)    // relative weight of client ops in the op shards
+OPTION(osd_recovery_op_priority, OPT_INT, 10)  // ... of push/pull/backfill ops
+OPTION(osd_scrub_op_priority, OPT_INT, 5)      // ... of scrub reservation/map ops
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
@@ -322,6 +335,11 @@ OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
 OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 60*60*24)   // once a day
+OPTION(osd_scrub_chunk_min, OPT_INT, 5)   // scrub this many objects at a time, blocking writes only to them
+OPTION(osd_scrub_chunk_max, OPT_INT, 25)
+OPTION(osd_deep_scrub_interval, OPT_FLOAT, 60*60*24*7) // once a week
+OPTION(osd_deep_scrub_stride, OPT_INT, 524288)    // read size for deep scrub
+OPTION(osd_deep_scrub_max_bytes_per_sec, OPT_U64, 16 << 20)  // 0 = unlimited
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_error_timeout, OPT_DOUBLE, 60.0)  // seconds
 OPTION(osd_class_timeout, OPT_DOUBLE, 60*60.0) // seconds
@@ -344,6 +362,7 @@ OPTION(osd_op_history_size, OPT_U32, 20)    // Max number of completed ops to tr
 OPTION(osd_op_history_duration, OPT_U32, 600) // Oldest completed op to track
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
+OPTION(filestore_omap_header_cache_size, OPT_INT, 1024) // omap headers cached in memory (each of object and parent headers); 0 to disable
 // Use omap for xattrs for attrs over
 OPTION(filestore_xattr_use_omap, OPT_BOOL, false)
 // filestore_max_inline_xattr_size or
@@ -381,6 +400,11 @@ OPTION(filestore_dump_file, OPT_STR, "")         // file onto which store transa
 OPTION(filestore_kill_at, OPT_INT, 0)            // inject a failure at the n'th opportunity
 OPTION(journal_dio, OPT_BOOL, true)
 OPTION(journal_aio, OPT_BOOL, false)
+OPTION(journal_aio_queue_depth, OPT_INT, 32)  // max aio writes in flight; several may go in one io_submit
+OPTION(journal_discard, OPT_BOOL, false)  // discard committed journal space (block device journals only)
+OPTION(journal_discard_min_bytes, OPT_U64, 16 << 20)  // discard in pieces of this many bytes, once that many are ready
+OPTION(journal_discard_max_bytes_per_sec, OPT_U64, 256 << 20)  // rate limit on discards; 0 == unlimited
+OPTION(journal_debug_discard_file, OPT_BOOL, false)  // with journal_discard, punch holes in a file journal; for testing
 OPTION(journal_block_align, OPT_BOOL, true)
 OPTION(journal_max_write_bytes, OPT_INT, 10 << 20)
 OPTION(journal_max_write_entries, OPT_INT, 100)
@@ -407,6 +431,7 @@ OPTION(rgw_remote_addr_param, OPT_STR, "REMOTE_ADDR")  // e.g. X-Forwarded-For,
 OPTION(rgw_op_thread_timeout, OPT_INT, 10*60)
 OPTION(rgw_op_thread_suicide_timeout, OPT_INT, 0)
 OPTION(rgw_thread_pool_size, OPT_INT, 100)
+OPTION(rgw_get_obj_window_size, OPT_INT, 16 << 20) // bytes of an object GET read ahead of the client
 OPTION(rgw_maintenance_tick_interval, OPT_DOUBLE, 10.0)
 OPTION(rgw_pools_preallocate_max, OPT_INT, 100)
 OPTION(rgw_pools_preallocate_threshold, OPT_INT, 70)
@@ -415,6 +440,7 @@ OPTION(rgw_log_object_name, OPT_STR, "%Y-%m-%d-%H-%i-%n")      // man date to se
 OPTION(rgw_log_object_name_utc, OPT_BOOL, false)
 OPTION(rgw_usage_max_shards, OPT_INT, 32)
 OPTION(rgw_usage_max_user_shards, OPT_INT, 1)
+OPTION(rgw_bucket_index_shards, OPT_INT, 0) // index objects per new bucket, 0 for a single .dir object
 OPTION(rgw_enable_ops_log, OPT_BOOL, true) // enable logging every rgw operation
 OPTION(rgw_enable_usage_log, OPT_BOOL, true) // enable logging bandwidth usage
 OPTION(rgw_usage_log_flush_threshold, OPT_INT, 1024) // threshold to flush pending log data
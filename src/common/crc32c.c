@@ -0,0 +1,102 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/crc32c.h"
+
+#include <pthread.h>
+
+static uint32_t crc32c_first(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * Racing first callers all pick the same function, so the unlocked
+ * update is harmless.
+ */
+static ceph_crc32c_func_t crc32c_func = crc32c_first;
+
+ceph_crc32c_func_t ceph_choose_crc32(void)
+{
+  if (ceph_crc32c_intel_probe())
+    return ceph_crc32c_intel;
+  return ceph_crc32c_sctp;
+}
+
+static uint32_t crc32c_first(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  crc32c_func = ceph_choose_crc32();
+  return crc32c_func(crc, data, length);
+}
+
+uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  return crc32c_func(crc, data, length);
+}
+
+/*
+ * Appending a zero bit to the message is multiplication by x modulo
+ * the (reflected) polynomial, a linear map on the 32 crc bits; as in
+ * zlib's crc32_combine, keep it as a 32x32 matrix over GF(2), one
+ * word per column.  zeros_op[k] advances a crc over 2^k zero bytes.
+ */
+static uint32_t zeros_op[32][32];
+static pthread_once_t zeros_op_once = PTHREAD_ONCE_INIT;
+
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+  uint32_t sum = 0;
+  while (vec) {
+    if (vec & 1)
+      sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+  int n;
+  for (n = 0; n < 32; n++)
+    square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+static void init_zeros_op(void)
+{
+  uint32_t bit[32], tmp[32];
+  uint32_t row = 1;
+  int n;
+
+  bit[0] = 0x82f63b78;  /* one zero bit */
+  for (n = 1; n < 32; n++) {
+    bit[n] = row;
+    row <<= 1;
+  }
+  gf2_matrix_square(tmp, bit);               /* two bits */
+  gf2_matrix_square(bit, tmp);               /* four bits */
+  gf2_matrix_square(zeros_op[0], bit);       /* one byte */
+  for (n = 1; n < 32; n++)
+    gf2_matrix_square(zeros_op[n], zeros_op[n-1]);
+}
+
+uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned length)
+{
+  int k;
+
+  if (!crc)
+    return 0;
+  pthread_once(&zeros_op_once, init_zeros_op);
+  for (k = 0; length; k++, length >>= 1)
+    if (length & 1)
+      crc = gf2_matrix_times(zeros_op[k], crc);
+  return crc;
+}
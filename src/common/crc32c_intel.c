@@ -0,0 +1,101 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/crc32c.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+
+#include <cpuid.h>
+
+int ceph_crc32c_intel_probe(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  return (ecx & bit_SSE4_2) != 0;
+}
+
+/*
+ * The crc32 instruction is emitted directly so that this file builds
+ * without -msse4.2; it is only ever called once the probe succeeds.
+ * Like the table version it neither inverts the seed nor the result.
+ */
+static inline uint32_t crc32c_u8(uint32_t crc, uint8_t v)
+{
+  __asm__("crc32b %1, %0" : "+r" (crc) : "rm" (v));
+  return crc;
+}
+
+#ifdef __x86_64__
+typedef uint64_t crc32c_word_t;
+
+static inline uint32_t crc32c_word(uint32_t crc, uint64_t v)
+{
+  uint64_t c = crc;
+  __asm__("crc32q %1, %0" : "+r" (c) : "rm" (v));
+  return c;
+}
+#else
+typedef uint32_t crc32c_word_t;
+
+static inline uint32_t crc32c_word(uint32_t crc, uint32_t v)
+{
+  __asm__("crc32l %1, %0" : "+r" (crc) : "rm" (v));
+  return crc;
+}
+#endif
+
+uint32_t ceph_crc32c_intel(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  // head, up to word alignment
+  while (length && ((uintptr_t)data & (sizeof(crc32c_word_t) - 1))) {
+    crc = crc32c_u8(crc, *data++);
+    length--;
+  }
+
+  // body, a word at a time, unrolled to keep the pipeline busy
+  const crc32c_word_t *p = (const crc32c_word_t *)data;
+  while (length >= 4 * sizeof(crc32c_word_t)) {
+    crc = crc32c_word(crc, p[0]);
+    crc = crc32c_word(crc, p[1]);
+    crc = crc32c_word(crc, p[2]);
+    crc = crc32c_word(crc, p[3]);
+    p += 4;
+    length -= 4 * sizeof(crc32c_word_t);
+  }
+  while (length >= sizeof(crc32c_word_t)) {
+    crc = crc32c_word(crc, *p++);
+    length -= sizeof(crc32c_word_t);
+  }
+
+  // tail
+  data = (unsigned char const *)p;
+  while (length--)
+    crc = crc32c_u8(crc, *data++);
+  return crc;
+}
+
+#else
+
+int ceph_crc32c_intel_probe(void)
+{
+  return 0;
+}
+
+uint32_t ceph_crc32c_intel(uint32_t crc, unsigned char const *data, unsigned length)
+{
+  return ceph_crc32c_sctp(crc, data, length);
+}
+
+#endif
@@ -36,7 +36,17 @@ class SimpleLRU {
     }
   }
 
+  void _clear(K key) {
+    typename map<K, typename list<pair<K, V> >::iterator>::iterator i =
+      contents.find(key);
+    if (i == contents.end())
+      return;
+    lru.erase(i->second);
+    contents.erase(i);
+  }
+
   void _add(K key, V value) {
+    _clear(key);  // replace, don't leave the old value on the list
     lru.push_front(make_pair(key, value));
     contents[key] = lru.begin();
     trim_cache();
@@ -63,6 +73,11 @@ public:
     pinned.clear();
   }
 
+  void clear(K key) {
+    Mutex::Locker l(lock);
+    _clear(key);
+  }
+
   void set_size(size_t new_size) {
     Mutex::Locker l(lock);
     max_size = new_size;
@@ -87,6 +87,9 @@ int CrushCompiler::decompile_bucket_impl(int i, ostream &out)
     out << "\t# do not change pos for existing items unnecessarily";
     dopos = true;
     break;
+  case CRUSH_BUCKET_STRAW_TREE:
+    out << "\t# add new items at the end; do not change order unnecessarily";
+    break;
   }
   out << "\n";
 
@@ -403,6 +406,8 @@ int CrushCompiler::parse_bucket(iter_t const& i)
 	alg = CRUSH_BUCKET_TREE;
       else if (a == "straw")
 	alg = CRUSH_BUCKET_STRAW;
+      else if (a == "straw_tree")
+	alg = CRUSH_BUCKET_STRAW_TREE;
       else {
 	err << "unknown bucket alg '" << a << "'" << std::endl << std::endl;
 	return -EINVAL;
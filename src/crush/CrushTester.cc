@@ -1,8 +1,12 @@
 
 #include "CrushTester.h"
+#include "common/Formatter.h"
+#include "common/errno.h"
 
 // a better RNG to be found within
 #include <stdlib.h>
+#include <math.h>
+#include <algorithm>
 
 
 void CrushTester::set_device_weight(int dev, float f)
@@ -88,6 +92,26 @@ map<int,int> CrushTester::get_collapsed_mapping()
   return collapse_mask;
 }
 
+void CrushTester::get_weights(vector<__u32>& weight)
+{
+  // initial osd weights
+  weight.clear();
+  for (int o = 0; o < crush.get_max_devices(); o++) {
+    if (device_weight.count(o)) {
+      weight.push_back(device_weight[o]);
+    } else if (crush.check_item_present(o)) {
+      weight.push_back(0x10000);
+    } else {
+      weight.push_back(0);
+    }
+  }
+  if (output_utilization_all)
+    err << "devices weights (hex): " << hex << weight << dec << std::endl;
+
+  // make adjustments
+  adjust_weights(weight);
+}
+
 void CrushTester::adjust_weights(vector<__u32>& weight)
 {
 
@@ -354,22 +378,8 @@ int CrushTester::test()
     max_x = 1023;
   }
 
-  // initial osd weights
   vector<__u32> weight;
-  for (int o = 0; o < crush.get_max_devices(); o++) {
-    if (device_weight.count(o)) {
-      weight.push_back(device_weight[o]);
-    } else if (crush.check_item_present(o)) {
-      weight.push_back(0x10000);
-    } else {
-      weight.push_back(0);
-    }
-  }
-  if (output_utilization_all)
-    err << "devices weights (hex): " << hex << weight << dec << std::endl;
-
-  // make adjustments
-  adjust_weights(weight);
+  get_weights(weight);
 
 
   int num_devices_active = 0;
@@ -401,6 +411,7 @@ int CrushTester::test()
     for (int nr = minr; nr <= maxr; nr++) {
       vector<int> per(crush.get_max_devices());
       map<int,int> sizes;
+      uint64_t num_moved = 0, num_placed = 0;
 
       int num_objects = ((max_x - min_x) + 1);
       float num_devices = (float) per.size(); // get the total number of devices, better to cast as a float here 
@@ -467,6 +478,18 @@ int CrushTester::test()
         // create a vector to hold placement results temporarily 
         vector<int> temporary_per ( per.size() );
 
+        // map the whole batch in one call
+        vector<vector<int> > batch_out, compare_out;
+        if (use_crush) {
+          vector<int> batch_x;
+          for (int x = batch_min; x <= batch_max; x++)
+            batch_x.push_back(x);
+          crush.do_rule_batch(r, batch_x, batch_out, nr, weight, num_threads);
+          if (compare_to)
+            compare_to->do_rule_batch(r, batch_x, compare_out, nr, weight,
+                                      num_threads);
+        }
+
         for (int x = batch_min; x <= batch_max; x++) {
           // create a vector to hold the results of a CRUSH placement or RNG simulation
           vector<int> out;
@@ -474,7 +497,14 @@ int CrushTester::test()
           if (use_crush) {
             if (output_statistics)
               err << "CRUSH"; // prepend CRUSH to placement output
-            crush.do_rule(r, x, out, nr, weight);
+            out.swap(batch_out[x - batch_min]);
+            if (compare_to) {
+              const vector<int>& was = compare_out[x - batch_min];
+              for (unsigned i = 0; i < out.size(); i++)
+                if (find(was.begin(), was.end(), out[i]) == was.end())
+                  num_moved++;
+              num_placed += out.size();
+            }
           } else {
             if (output_statistics)
               err << "RNG"; // prepend RNG to placement output to denote simulation
@@ -509,6 +539,13 @@ int CrushTester::test()
           err << "  device " << i
           << ":\t" << per[i] << std::endl;
 
+      if (compare_to && use_crush)
+        err << "rule " << r << " (" << crush.get_rule_name(r)
+            << ") num_rep " << nr << " moved " << num_moved
+            << "/" << num_placed << " replicas ("
+            << (num_placed ? (float)num_moved * 100.0 / (float)num_placed : 0.0)
+            << "%)" << std::endl;
+
       for (map<int,int>::iterator p = sizes.begin(); p != sizes.end(); p++)
         if ( output_statistics || p->first != nr)
           err << "rule " << r << " (" << crush.get_rule_name(r) << ") num_rep " << nr
@@ -575,3 +612,286 @@ int CrushTester::test()
 
   return 0;
 }
+
+/*
+ * the share of the rule's data each device should get: its weight in
+ * its bucket, summed over everything under the rule's take steps and
+ * scaled by the device's reweight.
+ */
+void CrushTester::get_rule_device_weights(int ruleno, map<int,float>& dw)
+{
+  list<int> q;
+  for (int i = 0; i < crush.get_rule_len(ruleno); i++)
+    if (crush.get_rule_op(ruleno, i) == CRUSH_RULE_TAKE)
+      q.push_back(crush.get_rule_arg1(ruleno, i));
+
+  set<int> seen;
+  while (!q.empty()) {
+    int id = q.front();
+    q.pop_front();
+    if (id >= 0 || seen.count(id) || !crush.bucket_exists(id))
+      continue;
+    seen.insert(id);
+    for (int pos = 0; pos < crush.get_bucket_size(id); pos++) {
+      int item = crush.get_bucket_item(id, pos);
+      if (item < 0)
+	q.push_back(item);
+      else
+	dw[item] += (float)crush.get_bucket_item_weight(id, pos) / (float)0x10000;
+    }
+  }
+}
+
+int CrushTester::load_checkpoint(crush_sim_checkpoint_t& cp)
+{
+  bufferlist bl;
+  string error;
+  int r = bl.read_file(checkpoint_file.c_str(), &error);
+  if (r == -ENOENT)
+    return 0;
+  if (r < 0) {
+    err << "error reading checkpoint " << checkpoint_file << ": " << error << std::endl;
+    return r;
+  }
+  try {
+    bufferlist::iterator p = bl.begin();
+    ::decode(cp, p);
+  } catch (buffer::error& e) {
+    err << "checkpoint " << checkpoint_file << " is corrupt" << std::endl;
+    return -EINVAL;
+  }
+  return 0;
+}
+
+int CrushTester::save_checkpoint(const crush_sim_checkpoint_t& cp)
+{
+  // write aside and rename, so a kill never leaves half a checkpoint
+  bufferlist bl;
+  ::encode(cp, bl);
+  string tmp = checkpoint_file + ".tmp";
+  int r = bl.write_file(tmp.c_str());
+  if (r < 0)
+    return r;
+  if (::rename(tmp.c_str(), checkpoint_file.c_str()) < 0)
+    return -errno;
+  return 0;
+}
+
+void CrushTester::dump_sim_pass(int ruleno, int nr, const crush_sim_pass_t& p,
+				const vector<__u32>& weight,
+				Formatter *f, ostream& out)
+{
+  map<int,float> dw;
+  get_rule_device_weights(ruleno, dw);
+  float total_weight = 0;
+  for (map<int,float>::iterator q = dw.begin(); q != dw.end(); ++q) {
+    if (q->first < (int)weight.size())
+      q->second *= (float)weight[q->first] / (float)0x10000;
+    else
+      q->second = 0;
+    total_weight += q->second;
+  }
+
+  // spread of what each device got around what its weight asks for
+  double sum_sq = 0, max_overload = 0;
+  int num_devices = 0;
+  for (unsigned i = 0; i < p.stored.size(); i++) {
+    double expected = total_weight > 0 && dw.count(i) ?
+      (double)p.placed * dw[i] / total_weight : 0;
+    if (expected <= 0)
+      continue;
+    double d = (double)p.stored[i] - expected;
+    sum_sq += d * d;
+    num_devices++;
+    max_overload = max(max_overload, (double)p.stored[i] / expected);
+  }
+  double stddev = num_devices ? sqrt(sum_sq / num_devices) : 0;
+  double mean = num_devices ? (double)p.placed / num_devices : 0;
+  double moved_ratio = p.placed ? (double)p.moved / (double)p.placed : 0;
+
+  err << "rule " << ruleno << " (" << crush.get_rule_name(ruleno)
+      << ") num_rep " << nr << " x " << min_x << ".." << max_x
+      << ": placed " << p.placed << " on " << num_devices << " devices"
+      << ", stddev " << stddev << " (" << (mean > 0 ? stddev / mean : 0) << " of mean)"
+      << ", max/expected " << max_overload;
+  if (compare_to)
+    err << ", moved " << p.moved << " (" << moved_ratio * 100.0 << "%)";
+  err << std::endl;
+
+  if (f) {
+    f->open_object_section("pass");
+    f->dump_int("rule", ruleno);
+    f->dump_string("rule_name", crush.get_rule_name(ruleno));
+    f->dump_int("num_rep", nr);
+    f->dump_int("min_x", min_x);
+    f->dump_int("max_x", max_x);
+    f->dump_unsigned("placed", p.placed);
+    f->dump_float("stddev", stddev);
+    f->dump_float("max_overload", max_overload);
+    if (compare_to) {
+      f->dump_unsigned("moved", p.moved);
+      f->dump_float("moved_ratio", moved_ratio);
+    }
+    f->open_array_section("devices");
+  }
+  for (unsigned i = 0; i < p.stored.size(); i++) {
+    float w = dw.count(i) ? dw[i] : 0;
+    double expected = total_weight > 0 ? (double)p.placed * w / total_weight : 0;
+    if (!expected && !p.stored[i] && !p.moved_out[i])
+      continue;
+    double deviation = expected > 0 ? ((double)p.stored[i] - expected) / expected : 0;
+    if (f) {
+      f->open_object_section("device");
+      f->dump_int("id", i);
+      f->dump_float("weight", w);
+      f->dump_float("expected", expected);
+      f->dump_unsigned("stored", p.stored[i]);
+      f->dump_float("deviation", deviation);
+      if (compare_to) {
+	f->dump_unsigned("moved_in", p.moved_in[i]);
+	f->dump_unsigned("moved_out", p.moved_out[i]);
+      }
+      f->close_section();
+    } else {
+      out << ruleno << ',' << nr << ',' << i << ',' << w << ','
+	  << expected << ',' << p.stored[i] << ',' << deviation << ','
+	  << p.moved_in[i] << ',' << p.moved_out[i] << std::endl;
+    }
+  }
+  if (f) {
+    f->close_section();
+    f->close_section();
+    f->flush(out);
+  }
+  out.flush();
+}
+
+int CrushTester::simulate(ostream& out)
+{
+  const int64_t chunk = 1 << 18;   // inputs mapped between checkpoints
+
+  if (min_rule < 0 || max_rule < 0) {
+    min_rule = 0;
+    max_rule = crush.get_max_rules() - 1;
+  }
+  // each bound defaults on its own: --max-x alone is the usual way to
+  // ask for a big range
+  if (min_x < 0)
+    min_x = 0;
+  if (max_x < 0)
+    max_x = 1023;
+
+  vector<__u32> weight;
+  get_weights(weight);
+
+  // a checkpoint only applies to the run that made it
+  bufferlist crcbl;
+  crush.encode(crcbl);
+  if (compare_to)
+    compare_to->encode(crcbl);
+  ::encode(weight, crcbl);
+  ::encode(min_x, crcbl);
+  ::encode(max_x, crcbl);
+
+  crush_sim_checkpoint_t cp;
+  if (!checkpoint_file.empty()) {
+    int r = load_checkpoint(cp);
+    if (r < 0)
+      return r;
+    if (!cp.passes.empty() && cp.crc != crcbl.crc32c(0)) {
+      err << "checkpoint " << checkpoint_file << " was made with different maps, "
+	  << "weights or inputs; remove it to start over" << std::endl;
+      return -EINVAL;
+    }
+    if (!cp.passes.empty())
+      err << "resuming from " << checkpoint_file << std::endl;
+  }
+  cp.crc = crcbl.crc32c(0);
+
+  Formatter *f = NULL;
+  if (output_json) {
+    f = new JSONFormatter(true);
+    f->open_array_section("passes");
+  } else {
+    out << "rule,num_rep,device,weight,expected,stored,deviation,moved_in,moved_out"
+	<< std::endl;
+  }
+
+  int ret = 0;
+  for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+    if (!crush.rule_exists(r))
+      continue;
+    int minr = min_rep, maxr = max_rep;
+    if (min_rep < 0 || max_rep < 0) {
+      minr = crush.get_rule_mask_min_size(r);
+      maxr = crush.get_rule_mask_max_size(r);
+    }
+
+    for (int nr = minr; nr <= maxr; nr++) {
+      crush_sim_pass_t& p = cp.passes[make_pair(r, nr)];
+      if (p.stored.empty()) {
+	p.next_x = min_x;
+	p.stored.resize(weight.size());
+	p.moved_in.resize(weight.size());
+	p.moved_out.resize(weight.size());
+      }
+
+      vector<int> x;
+      vector<vector<int> > now, was;
+      while (p.next_x <= max_x) {
+	int64_t end = min(p.next_x + chunk - 1, (int64_t)max_x);
+	x.clear();
+	for (int64_t i = p.next_x; i <= end; i++)
+	  x.push_back(i);
+	crush.do_rule_batch(r, x, now, nr, weight, num_threads);
+	if (compare_to)
+	  compare_to->do_rule_batch(r, x, was, nr, weight, num_threads);
+
+	for (unsigned i = 0; i < x.size(); i++) {
+	  for (unsigned j = 0; j < now[i].size(); j++) {
+	    int d = now[i][j];
+	    p.stored[d]++;
+	    p.placed++;
+	    if (compare_to &&
+		find(was[i].begin(), was[i].end(), d) == was[i].end()) {
+	      p.moved_in[d]++;
+	      p.moved++;
+	    }
+	  }
+	  if (compare_to)
+	    for (unsigned j = 0; j < was[i].size(); j++) {
+	      int d = was[i][j];
+	      if (d < (int)p.moved_out.size() &&
+		  find(now[i].begin(), now[i].end(), d) == now[i].end())
+		p.moved_out[d]++;
+	    }
+	}
+	p.next_x = end + 1;
+
+	if (!checkpoint_file.empty()) {
+	  int rc = save_checkpoint(cp);
+	  if (rc < 0) {
+	    err << "error writing checkpoint " << checkpoint_file << ": "
+		<< cpp_strerror(rc) << std::endl;
+	    ret = rc;
+	    goto done;
+	  }
+	}
+	if (verbose > 1)
+	  err << "rule " << r << " num_rep " << nr << " mapped x .. " << end
+	      << std::endl;
+      }
+
+      dump_sim_pass(r, nr, p, weight, f, out);
+    }
+  }
+
+ done:
+  if (f) {
+    f->close_section();
+    f->flush(out);
+    out << std::endl;
+    delete f;
+  }
+  return ret;
+}
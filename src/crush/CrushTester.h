@@ -9,8 +9,65 @@
 #include <fstream>
 #include <sstream>
 
+/// what simulate() has counted so far for one (rule, num_rep)
+struct crush_sim_pass_t {
+  int64_t next_x;             ///< first input not yet mapped
+  uint64_t placed;            ///< replicas placed
+  uint64_t moved;             ///< of those, not where the compare map put them
+  vector<uint64_t> stored;    ///< by device
+  vector<uint64_t> moved_in;  ///< by device: arrived relative to the compare map
+  vector<uint64_t> moved_out; ///< by device: left relative to the compare map
+
+  crush_sim_pass_t() : next_x(0), placed(0), moved(0) {}
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(next_x, bl);
+    ::encode(placed, bl);
+    ::encode(moved, bl);
+    ::encode(stored, bl);
+    ::encode(moved_in, bl);
+    ::encode(moved_out, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& p) {
+    DECODE_START(1, p);
+    ::decode(next_x, p);
+    ::decode(placed, p);
+    ::decode(moved, p);
+    ::decode(stored, p);
+    ::decode(moved_in, p);
+    ::decode(moved_out, p);
+    DECODE_FINISH(p);
+  }
+};
+WRITE_CLASS_ENCODER(crush_sim_pass_t)
+
+/// simulate() progress, saved so an interrupted run can pick up again
+struct crush_sim_checkpoint_t {
+  __u32 crc;   ///< of the maps, weights and x range it was made with
+  map<pair<int,int>, crush_sim_pass_t> passes;  ///< by (rule, num_rep)
+
+  crush_sim_checkpoint_t() : crc(0) {}
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(crc, bl);
+    ::encode(passes, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& p) {
+    DECODE_START(1, p);
+    ::decode(crc, p);
+    ::decode(passes, p);
+    DECODE_FINISH(p);
+  }
+};
+WRITE_CLASS_ENCODER(crush_sim_checkpoint_t)
+
 class CrushTester {
   CrushWrapper& crush;
+  const CrushWrapper *compare_to;  ///< map to measure data movement against
   ostream& err;
   int verbose;
 
@@ -36,8 +93,18 @@ class CrushTester {
 
   string output_data_file_name;
 
+  int num_threads;
+  string checkpoint_file;
+  bool output_json;
 
+
+  void get_weights(vector<__u32>& weight);
   void adjust_weights(vector<__u32>& weight);
+  void get_rule_device_weights(int ruleno, map<int,float>& dw);
+  int load_checkpoint(crush_sim_checkpoint_t& cp);
+  int save_checkpoint(const crush_sim_checkpoint_t& cp);
+  void dump_sim_pass(int ruleno, int nr, const crush_sim_pass_t& p,
+		     const vector<__u32>& weight, Formatter *f, ostream& out);
   int get_maximum_affected_by_rule(int ruleno);
   map<int,int> get_collapsed_mapping();
   bool check_valid_placement(int ruleno, vector<int> out, const vector<__u32>& weight);
@@ -135,7 +202,7 @@ class CrushTester {
 
 public:
   CrushTester(CrushWrapper& c, ostream& eo, int verbosity=0)
-    : crush(c), err(eo), verbose(verbosity),
+    : crush(c), compare_to(NULL), err(eo), verbose(verbosity),
       min_rule(-1), max_rule(-1),
       min_x(-1), max_x(-1),
       min_rep(-1), max_rep(-1),
@@ -150,7 +217,9 @@ public:
       output_choose_tries(false),
       output_data_file(false),
       output_csv(false),
-      output_data_file_name("")
+      output_data_file_name(""),
+      num_threads(1),
+      output_json(false)
 
   { }
 
@@ -185,6 +254,22 @@ public:
   void set_random_placement() {
     use_crush = false;
   }
+  void set_num_threads(int n) {
+    num_threads = n;
+  }
+  void set_checkpoint_file(string fn) {
+    checkpoint_file = fn;
+  }
+  void set_output_json(bool b) {
+    output_json = b;
+  }
+  /**
+   * also map every input with @a c and report how many of the
+   * replicas ended up on a different device
+   */
+  void set_compare_map(const CrushWrapper *c) {
+    compare_to = c;
+  }
   void set_bucket_down_ratio(float bucket_ratio) {
     mark_down_bucket_ratio = bucket_ratio;
   }
@@ -224,6 +309,15 @@ public:
   }
 
   int test();
+
+  /**
+   * map the input range on num_threads threads and write per-device
+   * utilization (and movement against the compare map, if any) to
+   * @a out as CSV or JSON, one (rule, num_rep) at a time.  with a
+   * checkpoint file, progress is saved as it goes and a rerun with
+   * the same maps and range continues where the last one stopped.
+   */
+  int simulate(ostream& out);
 };
 
 #endif
@@ -1,6 +1,7 @@
 
 #include "common/debug.h"
 #include "common/Formatter.h"
+#include "common/Thread.h"
 
 #include "CrushWrapper.h"
 
@@ -443,6 +444,12 @@ void CrushWrapper::encode(bufferlist& bl, bool lean) const
       }
       break;
 
+    case CRUSH_BUCKET_STRAW_TREE:
+      // the group weights are sums of these; decode recomputes them
+      for (unsigned j=0; j<crush->buckets[i]->size; j++)
+	::encode(((crush_bucket_straw_tree*)crush->buckets[i])->item_weights[j], bl);
+      break;
+
     default:
       assert(0);
       break;
@@ -577,6 +584,9 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
   case CRUSH_BUCKET_STRAW:
     size = sizeof(crush_bucket_straw);
     break;
+  case CRUSH_BUCKET_STRAW_TREE:
+    size = sizeof(crush_bucket_straw_tree);
+    break;
   default:
     {
       char str[128];
@@ -640,6 +650,17 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
     break;
   }
 
+  case CRUSH_BUCKET_STRAW_TREE: {
+    crush_bucket_straw_tree* cbst = (crush_bucket_straw_tree*)bucket;
+    cbst->item_weights = (__u32*)calloc(1, bucket->size * sizeof(__u32));
+    for (unsigned j = 0; j < bucket->size; ++j) {
+      ::decode(cbst->item_weights[j], blp);
+    }
+    if (crush_calc_straw_tree(cbst) < 0)
+      throw buffer::malformed_input("bad straw_tree bucket weights");
+    break;
+  }
+
   default:
     // We should have handled this case in the first switch statement
     assert(0);
@@ -773,6 +794,77 @@ void CrushWrapper::dump(Formatter *f) const
   f->close_section();
 }
 
+/// maps one slice of a do_rule_batch with its own workspace
+struct CrushBatchThread : public Thread {
+  const crush_map *map;
+  int rule;
+  const int *x;
+  int num;
+  int *result, *result_len;
+  int maxout;
+  const __u32 *weight;
+  int weight_max;
+
+  CrushBatchThread(const crush_map *m, int r, const int *x, int n,
+		   int *res, int *res_len, int maxout,
+		   const __u32 *w, int wmax)
+    : map(m), rule(r), x(x), num(n), result(res), result_len(res_len),
+      maxout(maxout), weight(w), weight_max(wmax) {}
+
+  void *entry() {
+    void *work = malloc(crush_work_size(map));
+    crush_init_workspace(map, work);
+    crush_do_rule_batch(map, rule, x, num, result, maxout, result_len,
+			weight, weight_max, work);
+    free(work);
+    return 0;
+  }
+};
+
+void CrushWrapper::do_rule_batch(int rule, const vector<int>& x,
+				 vector<vector<int> >& out, int maxout,
+				 const vector<__u32>& weight,
+				 int num_threads) const
+{
+  const int min_per_thread = 1024;
+  int num = x.size();
+  out.clear();
+  out.resize(num);
+  if (!num || maxout <= 0)
+    return;
+
+  // the choose_tries profile is only counted right from one thread
+  if (crush->choose_tries || num_threads < 1)
+    num_threads = 1;
+  if (num_threads > num / min_per_thread)
+    num_threads = MAX(num / min_per_thread, 1);
+
+  vector<int> result(num * maxout), result_len(num);
+  const __u32 *w = weight.empty() ? NULL : &weight[0];
+  vector<CrushBatchThread*> threads;
+  int per = num / num_threads;
+  for (int i = 0; i < num_threads; i++) {
+    int start = i * per;
+    int n = (i == num_threads - 1) ? num - start : per;
+    threads.push_back(new CrushBatchThread(crush, rule, &x[start], n,
+					   &result[start * maxout],
+					   &result_len[start], maxout,
+					   w, weight.size()));
+  }
+  // the last slice runs here
+  for (int i = 0; i < num_threads - 1; i++)
+    threads[i]->create();
+  threads[num_threads - 1]->entry();
+  for (int i = 0; i < num_threads; i++) {
+    if (i < num_threads - 1)
+      threads[i]->join();
+    delete threads[i];
+  }
+
+  for (int i = 0; i < num; i++)
+    out[i].assign(&result[i * maxout], &result[i * maxout] + result_len[i]);
+}
+
 void CrushWrapper::generate_test_instances(list<CrushWrapper*>& o)
 {
   o.push_back(new CrushWrapper);
@@ -542,6 +542,13 @@ public:
     if (IS_ERR(b)) return PTR_ERR(b);
     return b->alg;
   }
+  /// true if any bucket is a straw_tree, which older code can't decode
+  bool has_straw_tree_buckets() const {
+    for (int i = 0; i < get_max_buckets(); i++)
+      if (crush->buckets[i] && crush->buckets[i]->alg == CRUSH_BUCKET_STRAW_TREE)
+	return true;
+    return false;
+  }
   int get_bucket_hash(int id) const {
     const crush_bucket *b = get_bucket(id);
     if (IS_ERR(b)) return PTR_ERR(b);
@@ -618,6 +625,15 @@ public:
       out[i] = rawout[i];
   }
 
+  /**
+   * do_rule for every input in x, with per-caller scratch space instead
+   * of the mapper lock.  batches big enough to be worth it are split
+   * over up to num_threads threads.  out[i] is the mapping of x[i].
+   */
+  void do_rule_batch(int rule, const vector<int>& x, vector<vector<int> >& out,
+		     int maxout, const vector<__u32>& weight,
+		     int num_threads=1) const;
+
   int read_from_file(const char *fn) {
     bufferlist bl;
     std::string error;
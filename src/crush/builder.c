@@ -500,6 +500,116 @@ err:
 
 
 
+/* straw_tree bucket */
+
+/*
+ * recompute the group weights (and the number of levels) from the
+ * item weights.  items keep their positions, so a group keeps its
+ * place in the tree, and its hash, as items come and go.
+ */
+int crush_calc_straw_tree(struct crush_bucket_straw_tree *bucket)
+{
+	__u32 count, below, num_nodes, levels;
+	__u32 i, start, below_start;
+	__u32 *weights;
+
+	/* size the tree */
+	levels = 0;
+	num_nodes = 0;
+	count = bucket->h.size;
+	while (count > 1 || (count == 1 && levels == 0)) {
+		count = crush_straw_tree_parents(count);
+		num_nodes += count;
+		levels++;
+	}
+
+	weights = realloc(bucket->node_weights, sizeof(__u32)*num_nodes);
+	if (num_nodes && !weights)
+		return -ENOMEM;
+	bucket->node_weights = weights;
+	bucket->num_levels = levels;
+	if (!num_nodes)
+		return 0;
+	memset(weights, 0, sizeof(__u32)*num_nodes);
+
+	/* groups of items */
+	below = bucket->h.size;
+	for (i = 0; i < below; i++) {
+		__u32 *w = &weights[i / CRUSH_STRAW_TREE_FANOUT];
+		if (crush_addition_is_unsafe(*w, bucket->item_weights[i]))
+			return -ERANGE;
+		*w += bucket->item_weights[i];
+	}
+
+	/* and groups of groups */
+	below_start = 0;
+	start = count = crush_straw_tree_parents(below);
+	while (count > 1) {
+		below = count;
+		count = crush_straw_tree_parents(below);
+		for (i = 0; i < below; i++) {
+			__u32 *w = &weights[start + i / CRUSH_STRAW_TREE_FANOUT];
+			if (crush_addition_is_unsafe(*w, weights[below_start + i]))
+				return -ERANGE;
+			*w += weights[below_start + i];
+		}
+		below_start = start;
+		start += count;
+	}
+
+	bucket->h.weight = weights[num_nodes - 1];
+	return 0;
+}
+
+struct crush_bucket_straw_tree *
+crush_make_straw_tree_bucket(int hash,
+			     int type,
+			     int size,
+			     int *items,
+			     int *weights)
+{
+	struct crush_bucket_straw_tree *bucket;
+	int i;
+
+	bucket = malloc(sizeof(*bucket));
+        if (!bucket)
+                return NULL;
+	memset(bucket, 0, sizeof(*bucket));
+	bucket->h.alg = CRUSH_BUCKET_STRAW_TREE;
+	bucket->h.hash = hash;
+	bucket->h.type = type;
+	bucket->h.size = size;
+
+        bucket->h.items = malloc(sizeof(__u32)*size);
+        if (!bucket->h.items)
+                goto err;
+	bucket->h.perm = malloc(sizeof(__u32)*size);
+        if (!bucket->h.perm)
+                goto err;
+	bucket->item_weights = malloc(sizeof(__u32)*size);
+        if (!bucket->item_weights)
+                goto err;
+
+	for (i=0; i<size; i++) {
+		bucket->h.items[i] = items[i];
+		bucket->item_weights[i] = weights[i];
+	}
+
+        if (crush_calc_straw_tree(bucket) < 0)
+                goto err;
+
+	return bucket;
+err:
+        free(bucket->node_weights);
+        free(bucket->item_weights);
+        free(bucket->h.perm);
+        free(bucket->h.items);
+        free(bucket);
+        return NULL;
+}
+
+
+
 struct crush_bucket*
 crush_make_bucket(int alg, int hash, int type, int size,
 		  int *items,
@@ -523,6 +633,9 @@ crush_make_bucket(int alg, int hash, int type, int size,
 
 	case CRUSH_BUCKET_STRAW:
 		return (struct crush_bucket *)crush_make_straw_bucket(hash, type, size, items, weights);
+
+	case CRUSH_BUCKET_STRAW_TREE:
+		return (struct crush_bucket *)crush_make_straw_tree_bucket(hash, type, size, items, weights);
 	}
 	return 0;
 }
@@ -632,6 +745,25 @@ int crush_add_straw_bucket_item(struct crush_bucket_straw *bucket, int item, int
 	return crush_calc_straw(bucket);
 }
 
+int crush_add_straw_tree_bucket_item(struct crush_bucket_straw_tree *bucket, int item, int weight)
+{
+	int newsize = bucket->h.size + 1;
+
+	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
+	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
+	bucket->item_weights = realloc(bucket->item_weights, sizeof(__u32)*newsize);
+
+	bucket->h.items[newsize-1] = item;
+	bucket->item_weights[newsize-1] = weight;
+
+	if (crush_addition_is_unsafe(bucket->h.weight, weight))
+                return -ERANGE;
+
+	bucket->h.size++;
+
+	return crush_calc_straw_tree(bucket);
+}
+
 int crush_bucket_add_item(struct crush_bucket *b, int item, int weight)
 {
 	/* invalidate perm cache */
@@ -646,6 +778,8 @@ int crush_bucket_add_item(struct crush_bucket *b, int item, int weight)
 		return crush_add_tree_bucket_item((struct crush_bucket_tree *)b, item, weight);
 	case CRUSH_BUCKET_STRAW:
 		return crush_add_straw_bucket_item((struct crush_bucket_straw *)b, item, weight);
+	case CRUSH_BUCKET_STRAW_TREE:
+		return crush_add_straw_tree_bucket_item((struct crush_bucket_straw_tree *)b, item, weight);
 	default:
 		return -1;
 	}
@@ -786,6 +920,32 @@ int crush_remove_straw_bucket_item(struct crush_bucket_straw *bucket, int item)
 	return crush_calc_straw(bucket);
 }
 
+/*
+ * move the last item into the hole rather than shifting everything
+ * down: only that item changes groups.
+ */
+int crush_remove_straw_tree_bucket_item(struct crush_bucket_straw_tree *bucket, int item)
+{
+	int newsize = bucket->h.size - 1;
+	unsigned i;
+
+	for (i = 0; i < bucket->h.size; i++)
+		if (bucket->h.items[i] == item)
+			break;
+	if (i == bucket->h.size)
+		return -ENOENT;
+
+	bucket->h.items[i] = bucket->h.items[newsize];
+	bucket->item_weights[i] = bucket->item_weights[newsize];
+	bucket->h.size--;
+
+	bucket->h.items = realloc(bucket->h.items, sizeof(__u32)*newsize);
+	bucket->h.perm = realloc(bucket->h.perm, sizeof(__u32)*newsize);
+	bucket->item_weights = realloc(bucket->item_weights, sizeof(__u32)*newsize);
+
+	return crush_calc_straw_tree(bucket);
+}
+
 int crush_bucket_remove_item(struct crush_bucket *b, int item)
 {
 	/* invalidate perm cache */
@@ -800,6 +960,8 @@ int crush_bucket_remove_item(struct crush_bucket *b, int item)
 		return crush_remove_tree_bucket_item((struct crush_bucket_tree *)b, item);
 	case CRUSH_BUCKET_STRAW:
 		return crush_remove_straw_bucket_item((struct crush_bucket_straw *)b, item);
+	case CRUSH_BUCKET_STRAW_TREE:
+		return crush_remove_straw_tree_bucket_item((struct crush_bucket_straw_tree *)b, item);
 	default:
 		return -1;
 	}
@@ -891,6 +1053,28 @@ int crush_adjust_straw_bucket_item_weight(struct crush_bucket_straw *bucket, int
 	return diff;
 }
 
+int crush_adjust_straw_tree_bucket_item_weight(struct crush_bucket_straw_tree *bucket, int item, int weight)
+{
+	unsigned idx;
+	int diff;
+        int r;
+
+	for (idx = 0; idx < bucket->h.size; idx++)
+		if (bucket->h.items[idx] == item)
+			break;
+	if (idx == bucket->h.size)
+		return 0;
+
+	diff = weight - bucket->item_weights[idx];
+	bucket->item_weights[idx] = weight;
+
+	r = crush_calc_straw_tree(bucket);
+        if (r < 0)
+                return r;
+
+	return diff;
+}
+
 int crush_bucket_adjust_item_weight(struct crush_bucket *b, int item, int weight)
 {
 	switch (b->alg) {
@@ -906,6 +1090,9 @@ int crush_bucket_adjust_item_weight(struct crush_bucket *b, int item, int weight
 	case CRUSH_BUCKET_STRAW:
 		return crush_adjust_straw_bucket_item_weight((struct crush_bucket_straw *)b,
 							     item, weight);
+	case CRUSH_BUCKET_STRAW_TREE:
+		return crush_adjust_straw_tree_bucket_item_weight((struct crush_bucket_straw_tree *)b,
+								  item, weight);
 	default:
 		return -1;
 	}
@@ -1011,6 +1198,22 @@ static int crush_reweight_straw_bucket(struct crush_map *crush, struct crush_buc
 	return 0;
 }
 
+static int crush_reweight_straw_tree_bucket(struct crush_map *crush, struct crush_bucket_straw_tree *bucket)
+{
+	unsigned i;
+
+	for (i = 0; i < bucket->h.size; i++) {
+		int id = bucket->h.items[i];
+		if (id < 0) {
+			struct crush_bucket *c = crush->buckets[-1-id];
+			crush_reweight_bucket(crush, c);
+			bucket->item_weights[i] = c->weight;
+		}
+	}
+
+	return crush_calc_straw_tree(bucket);
+}
+
 int crush_reweight_bucket(struct crush_map *crush, struct crush_bucket *b)
 {
 	switch (b->alg) {
@@ -1022,6 +1225,8 @@ int crush_reweight_bucket(struct crush_map *crush, struct crush_bucket *b)
 		return crush_reweight_tree_bucket(crush, (struct crush_bucket_tree *)b);
 	case CRUSH_BUCKET_STRAW:
 		return crush_reweight_straw_bucket(crush, (struct crush_bucket_straw *)b);
+	case CRUSH_BUCKET_STRAW_TREE:
+		return crush_reweight_straw_tree_bucket(crush, (struct crush_bucket_straw_tree *)b);
 	default:
 		return -1;
 	}
@@ -39,5 +39,10 @@ struct crush_bucket_straw *
 crush_make_straw_bucket(int hash, int type, int size,
 			int *items,
 			int *weights);
+struct crush_bucket_straw_tree *
+crush_make_straw_tree_bucket(int hash, int type, int size,
+			     int *items,
+			     int *weights);
+extern int crush_calc_straw_tree(struct crush_bucket_straw_tree *bucket);
 
 #endif
@@ -97,12 +97,22 @@ struct crush_rule {
  *  list            O(n)       optimal      poor
  *  tree            O(log n)   good         good
  *  straw           O(n)       optimal      optimal
+ *  straw_tree      O(log n)   good         good
+ *
+ * A straw_tree bucket is a straw draw over groups of items: a root
+ * draws among groups of up to CRUSH_STRAW_TREE_FANOUT subtrees, each
+ * of those among its own, down to the items.  Only the groups on the
+ * path to an item are hashed, and each draw only shifts inputs
+ * toward a group that got heavier (or away from one that got
+ * lighter), so a weight change moves data into or out of the
+ * changed item's ancestor groups and nowhere else.
  */
 enum {
 	CRUSH_BUCKET_UNIFORM = 1,
 	CRUSH_BUCKET_LIST = 2,
 	CRUSH_BUCKET_TREE = 3,
-	CRUSH_BUCKET_STRAW = 4
+	CRUSH_BUCKET_STRAW = 4,
+	CRUSH_BUCKET_STRAW_TREE = 5
 };
 extern const char *crush_bucket_alg_name(int alg);
 
@@ -149,6 +159,18 @@ struct crush_bucket_straw {
 	__u32 *straws;         /* 16-bit fixed point */
 };
 
+#define CRUSH_STRAW_TREE_FANOUT      16
+#define CRUSH_STRAW_TREE_MAX_LEVELS  8   /* 16^8 covers any __u32 size */
+
+struct crush_bucket_straw_tree {
+	struct crush_bucket h;
+	__u32 *item_weights;   /* 16-bit fixed point */
+	__u32 num_levels;      /* levels of groups above the items */
+	__u32 *node_weights;   /* 16-bit fixed point.  group weights,
+				  the groups of items first, then each
+				  level above, ending with the root */
+};
+
 
 
 /*
@@ -182,6 +204,7 @@ extern void crush_destroy_bucket_uniform(struct crush_bucket_uniform *b);
 extern void crush_destroy_bucket_list(struct crush_bucket_list *b);
 extern void crush_destroy_bucket_tree(struct crush_bucket_tree *b);
 extern void crush_destroy_bucket_straw(struct crush_bucket_straw *b);
+extern void crush_destroy_bucket_straw_tree(struct crush_bucket_straw_tree *b);
 extern void crush_destroy_bucket(struct crush_bucket *b);
 extern void crush_destroy(struct crush_map *map);
 
@@ -190,4 +213,11 @@ static inline int crush_calc_tree_node(int i)
 	return ((i+1) << 1)-1;
 }
 
+/* number of straw_tree groups needed to hold n nodes of the level below */
+static inline __u32 crush_straw_tree_parents(__u32 n)
+{
+	return n / CRUSH_STRAW_TREE_FANOUT +
+		(n % CRUSH_STRAW_TREE_FANOUT ? 1 : 0);
+}
+
 #endif
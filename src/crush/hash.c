@@ -123,6 +123,45 @@ __u32 crush_hash32_3(int type, __u32 a, __u32 b, __u32 c)
 	}
 }
 
+/*
+ * crush_hash32_rjenkins1_3 for each of @n values of @b.  The lanes
+ * are independent and the loop body is straight-line arithmetic, so
+ * the compiler can vectorize it.
+ */
+static void crush_hash32_rjenkins1_3_n(__u32 a, const __u32 *bs, __u32 c,
+				       __u32 *out, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		__u32 la = a, lb = bs[i], lc = c;
+		__u32 hash = crush_hash_seed ^ la ^ lb ^ lc;
+		__u32 x = 231232;
+		__u32 y = 1232;
+		crush_hashmix(la, lb, hash);
+		crush_hashmix(lc, x, hash);
+		crush_hashmix(y, la, hash);
+		crush_hashmix(lb, x, hash);
+		crush_hashmix(y, lc, hash);
+		out[i] = hash;
+	}
+}
+
+void crush_hash32_3_n(int type, __u32 a, const __u32 *b, __u32 c,
+		      __u32 *out, int n)
+{
+	int i;
+
+	switch (type) {
+	case CRUSH_HASH_RJENKINS1:
+		crush_hash32_rjenkins1_3_n(a, b, c, out, n);
+		break;
+	default:
+		for (i = 0; i < n; i++)
+			out[i] = 0;
+	}
+}
+
 __u32 crush_hash32_4(int type, __u32 a, __u32 b, __u32 c, __u32 d)
 {
 	switch (type) {
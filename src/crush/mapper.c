@@ -4,6 +4,7 @@
 # include <linux/slab.h>
 # include <linux/bug.h>
 # include <linux/kernel.h>
+# include <linux/math64.h>
 # ifndef dprintk
 #  define dprintk(args...)
 # endif
@@ -16,10 +17,12 @@
 # define dprintk(args...) /* printf(args) */
 # define kmalloc(x, f) malloc(x)
 # define kfree(x) free(x)
+# define div64_s64(a, b) ((a) / (b))
 #endif
 
 #include "crush.h"
 #include "hash.h"
+#include "mapper.h"
 
 /*
  * Implement the core CRUSH mapping algorithm.
@@ -64,60 +67,67 @@ int crush_find_rule(const struct crush_map *map, int ruleset, int type, int size
  * calculate an actual random permutation of the bucket members.
  * Since this is expensive, we optimize for the r=0 case, which
  * captures the vast majority of calls.
+ *
+ * The permutation is cached in @work if there is one (batch mapping),
+ * or in the bucket itself.
  */
 static int bucket_perm_choose(struct crush_bucket *bucket,
+			      struct crush_work_bucket *work,
 			      int x, int r)
 {
 	unsigned pr = r % bucket->size;
 	unsigned i, s;
+	__u32 *perm_x = work ? &work->perm_x : &bucket->perm_x;
+	__u32 *perm_n = work ? &work->perm_n : &bucket->perm_n;
+	__u32 *perm = work ? work->perm : bucket->perm;
 
 	/* start a new permutation if @x has changed */
-	if (bucket->perm_x != (__u32)x || bucket->perm_n == 0) {
+	if (*perm_x != (__u32)x || *perm_n == 0) {
 		dprintk("bucket %d new x=%d\n", bucket->id, x);
-		bucket->perm_x = x;
+		*perm_x = x;
 
 		/* optimize common r=0 case */
 		if (pr == 0) {
 			s = crush_hash32_3(bucket->hash, x, bucket->id, 0) %
 				bucket->size;
-			bucket->perm[0] = s;
-			bucket->perm_n = 0xffff;   /* magic value, see below */
+			perm[0] = s;
+			*perm_n = 0xffff;   /* magic value, see below */
 			goto out;
 		}
 
 		for (i = 0; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm_n = 0;
-	} else if (bucket->perm_n == 0xffff) {
+			perm[i] = i;
+		*perm_n = 0;
+	} else if (*perm_n == 0xffff) {
 		/* clean up after the r=0 case above */
 		for (i = 1; i < bucket->size; i++)
-			bucket->perm[i] = i;
-		bucket->perm[bucket->perm[0]] = 0;
-		bucket->perm_n = 1;
+			perm[i] = i;
+		perm[perm[0]] = 0;
+		*perm_n = 1;
 	}
 
 	/* calculate permutation up to pr */
-	for (i = 0; i < bucket->perm_n; i++)
-		dprintk(" perm_choose have %d: %d\n", i, bucket->perm[i]);
-	while (bucket->perm_n <= pr) {
-		unsigned p = bucket->perm_n;
+	for (i = 0; i < *perm_n; i++)
+		dprintk(" perm_choose have %d: %d\n", i, perm[i]);
+	while (*perm_n <= pr) {
+		unsigned p = *perm_n;
 		/* no point in swapping the final entry */
 		if (p < bucket->size - 1) {
 			i = crush_hash32_3(bucket->hash, x, bucket->id, p) %
 				(bucket->size - p);
 			if (i) {
-				unsigned t = bucket->perm[p + i];
-				bucket->perm[p + i] = bucket->perm[p];
-				bucket->perm[p] = t;
+				unsigned t = perm[p + i];
+				perm[p + i] = perm[p];
+				perm[p] = t;
 			}
 			dprintk(" perm_choose swap %d with %d\n", p, p+i);
 		}
-		bucket->perm_n++;
+		(*perm_n)++;
 	}
 	for (i = 0; i < bucket->size; i++)
-		dprintk(" perm_choose  %d: %d\n", i, bucket->perm[i]);
+		dprintk(" perm_choose  %d: %d\n", i, perm[i]);
 
-	s = bucket->perm[pr];
+	s = perm[pr];
 out:
 	dprintk(" perm_choose %d sz=%d x=%d r=%d (%d) s=%d\n", bucket->id,
 		bucket->size, x, r, pr, s);
@@ -126,9 +136,10 @@ out:
 
 /* uniform */
 static int bucket_uniform_choose(struct crush_bucket_uniform *bucket,
+				 struct crush_work_bucket *work,
 				 int x, int r)
 {
-	return bucket_perm_choose(&bucket->h, x, r);
+	return bucket_perm_choose(&bucket->h, work, x, r);
 }
 
 /* list */
@@ -216,34 +227,178 @@ static int bucket_tree_choose(struct crush_bucket_tree *bucket,
 
 /* straw */
 
+/*
+ * hash the items a chunk at a time: the hashes are independent of
+ * each other, so crush_hash32_3_n can compute several at once.
+ */
+#define CRUSH_STRAW_CHUNK 16
+
 static int bucket_straw_choose(struct crush_bucket_straw *bucket,
 			       int x, int r)
 {
-	__u32 i;
+	__u32 hashes[CRUSH_STRAW_CHUNK];
+	__u32 i, j, n;
 	int high = 0;
 	__u64 high_draw = 0;
 	__u64 draw;
 
-	for (i = 0; i < bucket->h.size; i++) {
-		draw = crush_hash32_3(bucket->h.hash, x, bucket->h.items[i], r);
-		draw &= 0xffff;
-		draw *= bucket->straws[i];
-		if (i == 0 || draw > high_draw) {
-			high = i;
-			high_draw = draw;
+	for (i = 0; i < bucket->h.size; i += n) {
+		n = bucket->h.size - i;
+		if (n > CRUSH_STRAW_CHUNK)
+			n = CRUSH_STRAW_CHUNK;
+		crush_hash32_3_n(bucket->h.hash, x,
+				 (const __u32 *)bucket->h.items + i, r,
+				 hashes, n);
+		for (j = 0; j < n; j++) {
+			draw = hashes[j] & 0xffff;
+			draw *= bucket->straws[i + j];
+			if (i + j == 0 || draw > high_draw) {
+				high = i + j;
+				high_draw = draw;
+			}
 		}
 	}
 	return bucket->h.items[high];
 }
 
-static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
+/* straw_tree */
+
+/* log2(1 + k/128) for k in [0, 128], 32.32 fixed point */
+static const __u64 crush_log2_tbl[129] = {
+	0x000000000ull, 0x002dfca17ull, 0x005b9e5a1ull, 0x0088e68ebull,
+	0x00b5d69bbull, 0x00e26fd5dull, 0x010eb38a0ull, 0x013aa2fddull,
+	0x01663f6fbull, 0x01918a16eull, 0x01bc84241ull, 0x01e72ec11ull,
+	0x02118b11aull, 0x023b9a32full, 0x02655d3c5ull, 0x028ed53f3ull,
+	0x02b803474ull, 0x02e0e85aaull, 0x0309857a0ull, 0x0331dba0full,
+	0x0359ebc5bull, 0x0381b6d9cull, 0x03a93dc98ull, 0x03d0817cfull,
+	0x03f782d72ull, 0x041e42b6full, 0x0444c1f6bull, 0x046b016caull,
+	0x049101eacull, 0x04b6c43f1ull, 0x04dc4933bull, 0x0501918ecull,
+	0x05269e12full, 0x054b6f7f1ull, 0x0570068e8ull, 0x059463f92ull,
+	0x05b888736ull, 0x05dc74aeaull, 0x06002958cull, 0x0623a71ccull,
+	0x0646eea24ull, 0x066a008e4ull, 0x068cdd82aull, 0x06af861e6ull,
+	0x06d1fafddull, 0x06f43cba8ull, 0x07164beb5ull, 0x073829249ull,
+	0x0759d4f81ull, 0x077b4ff51ull, 0x079c9aa88ull, 0x07bdb59cdull,
+	0x07dea15a3ull, 0x07ff5e66aull, 0x081fed45dull, 0x08404e794ull,
+	0x086082807ull, 0x088089d8bull, 0x08a064fd5ull, 0x08c01467cull,
+	0x08df988f5ull, 0x08fef1e98ull, 0x091e20ea1ull, 0x093d2602cull,
+	0x095c01a3aull, 0x097ab43afull, 0x09993e356ull, 0x09b79ffdbull,
+	0x09d5d9fd5ull, 0x09f3ec9bdull, 0x0a11d83f5ull, 0x0a2f9d4c5ull,
+	0x0a4d3c25eull, 0x0a6ab52daull, 0x0a8808c38ull, 0x0aa537465ull,
+	0x0ac241135ull, 0x0adf26866ull, 0x0afbe7fa1ull, 0x0b1885c7bull,
+	0x0b3500472ull, 0x0b5157cf3ull, 0x0b6d8cb54ull, 0x0b899f4d9ull,
+	0x0ba58feb2ull, 0x0bc15edffull, 0x0bdd0c7caull, 0x0bf89910cull,
+	0x0c1404eaeull, 0x0c2f50586ull, 0x0c4a7ba58ull, 0x0c65871daull,
+	0x0c80730b0ull, 0x0c9b3fb6dull, 0x0cb5ed695ull, 0x0cd07c69eull,
+	0x0ceaecfebull, 0x0d053f6d2ull, 0x0d1f73f9cull, 0x0d398ae81ull,
+	0x0d53847acull, 0x0d6d60f39ull, 0x0d8720936ull, 0x0da0c39a5ull,
+	0x0dba4a47bull, 0x0dd3b4d9dull, 0x0ded038e6ull, 0x0e0636a24ull,
+	0x0e1f4e517ull, 0x0e384ad75ull, 0x0e512c6e5ull, 0x0e69f3506ull,
+	0x0e829fb69ull, 0x0e9b31d94ull, 0x0eb3a9f02ull, 0x0ecc08322ull,
+	0x0ee44cd5aull, 0x0efc78104ull, 0x0f148a170ull, 0x0f2c831e4ull,
+	0x0f446359bull, 0x0f5c2afc6ull, 0x0f73da38eull, 0x0f8b7140full,
+	0x0fa2f045eull, 0x0fba57787ull, 0x0fd1a708cull, 0x0fe8df264ull,
+	0x100000000ull,
+};
+
+/*
+ * log2(u) for u in [1, 0x10000], 32.32 fixed point.  The fraction
+ * is interpolated linearly between table entries, which keeps the
+ * result strictly increasing in u; the draws depend on that more
+ * than on the last few bits of precision.
+ */
+static __u64 crush_log2_16(__u32 u)
+{
+	__u32 bits = 0, m, k, rem;
+	__u64 lo, hi;
+
+	while (u >> (bits + 1))
+		bits++;
+	m = (u << (16 - bits)) & 0xffff;   /* bits below the leading one */
+	k = m >> 9;
+	rem = m & 0x1ff;
+	lo = crush_log2_tbl[k];
+	hi = crush_log2_tbl[k + 1];
+	return ((__u64)bits << 32) + lo + (((hi - lo) * rem) >> 9);
+}
+
+/*
+ * An exponentially distributed draw scaled by 1/weight: ln(u)/w, in
+ * log2 units.  The largest draw wins with probability proportional
+ * to weight, and changing one weight only moves the winner to or
+ * from that entry.
+ */
+static __s64 straw_tree_draw(__u32 hash, __u32 weight)
+{
+	__s64 ln = crush_log2_16((hash & 0xffff) + 1) - (16ll << 32);
+	return div64_s64(ln, (__s64)weight);
+}
+
+static int bucket_straw_tree_choose(struct crush_bucket_straw_tree *bucket,
+				    int x, int r)
+{
+	__u32 count[CRUSH_STRAW_TREE_MAX_LEVELS + 1];
+	__u32 start[CRUSH_STRAW_TREE_MAX_LEVELS + 1];
+	__u32 hashes[CRUSH_STRAW_TREE_FANOUT];
+	const __u32 *weights;
+	__u32 node = 0;   /* the root is alone on the top level */
+	__u32 first, n, i, level;
+	int high;
+	__s64 draw, high_draw = 0;
+
+	/* level 0 is the items; node_weights holds levels 1.. in order */
+	count[0] = bucket->h.size;
+	start[1] = 0;
+	for (level = 1; level <= bucket->num_levels; level++) {
+		count[level] = crush_straw_tree_parents(count[level-1]);
+		if (level > 1)
+			start[level] = start[level-1] + count[level-1];
+	}
+
+	for (level = bucket->num_levels; level > 0; level--) {
+		first = node * CRUSH_STRAW_TREE_FANOUT;
+		n = count[level-1] - first;
+		if (n > CRUSH_STRAW_TREE_FANOUT)
+			n = CRUSH_STRAW_TREE_FANOUT;
+
+		if (level > 1) {
+			weights = bucket->node_weights + start[level-1] + first;
+			for (i = 0; i < n; i++)
+				hashes[i] = crush_hash32_4(bucket->h.hash, x,
+						((level-1) << 24) | (first + i),
+						r, bucket->h.id);
+		} else {
+			weights = bucket->item_weights + first;
+			crush_hash32_3_n(bucket->h.hash, x,
+					 (const __u32 *)bucket->h.items + first,
+					 r, hashes, n);
+		}
+
+		/* zero weight children never win; if all are, take the first */
+		high = -1;
+		for (i = 0; i < n; i++) {
+			if (!weights[i])
+				continue;
+			draw = straw_tree_draw(hashes[i], weights[i]);
+			if (high < 0 || draw > high_draw) {
+				high = i;
+				high_draw = draw;
+			}
+		}
+		node = first + (high < 0 ? 0 : high);
+	}
+	return bucket->h.items[node];
+}
+
+static int crush_bucket_choose(struct crush_bucket *in,
+			       struct crush_work_bucket *work,
+			       int x, int r)
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
 	BUG_ON(in->size == 0);
 	switch (in->alg) {
 	case CRUSH_BUCKET_UNIFORM:
 		return bucket_uniform_choose((struct crush_bucket_uniform *)in,
-					  x, r);
+					     work, x, r);
 	case CRUSH_BUCKET_LIST:
 		return bucket_list_choose((struct crush_bucket_list *)in,
 					  x, r);
@@ -253,6 +408,9 @@ static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 	case CRUSH_BUCKET_STRAW:
 		return bucket_straw_choose((struct crush_bucket_straw *)in,
 					   x, r);
+	case CRUSH_BUCKET_STRAW_TREE:
+		return bucket_straw_tree_choose(
+			(struct crush_bucket_straw_tree *)in, x, r);
 	default:
 		dprintk("unknown bucket %d alg %d\n", in->id, in->alg);
 		return in->items[0];
@@ -289,6 +447,7 @@ static int is_out(const struct crush_map *map, const __u32 *weight, int weight_m
  * @param firstn true if choosing "first n" items, false if choosing "indep"
  * @param recurseto_leaf: true if we want one device under each item of given type
  * @param out2 second output vector for leaf items (if @a recurse_to_leaf)
+ * @param cw scratch space, or NULL to keep permutations in the buckets
  */
 static int crush_choose(const struct crush_map *map,
 			struct crush_bucket *bucket,
@@ -296,7 +455,7 @@ static int crush_choose(const struct crush_map *map,
 			int x, int numrep, int type,
 			int *out, int outpos,
 			int firstn, int recurse_to_leaf,
-			int *out2)
+			int *out2, struct crush_work *cw)
 {
 	int rep;
 	unsigned int ftotal, flocal;
@@ -354,9 +513,13 @@ static int crush_choose(const struct crush_map *map,
 				if (map->choose_local_fallback_tries > 0 &&
 				    flocal >= (in->size>>1) &&
 				    flocal > map->choose_local_fallback_tries)
-					item = bucket_perm_choose(in, x, r);
+					item = bucket_perm_choose(in,
+						cw ? cw->work[-1-in->id] : NULL,
+						x, r);
 				else
-					item = crush_bucket_choose(in, x, r);
+					item = crush_bucket_choose(in,
+						cw ? cw->work[-1-in->id] : NULL,
+						x, r);
 				if (item >= map->max_devices) {
 					dprintk("   bad item %d\n", item);
 					skip_rep = 1;
@@ -400,7 +563,7 @@ static int crush_choose(const struct crush_map *map,
 							 x, outpos+1, 0,
 							 out2, outpos,
 							 firstn, 0,
-							 NULL) <= outpos)
+							 NULL, cw) <= outpos)
 							/* didn't get leaf */
 							reject = 1;
 					} else {
@@ -462,22 +625,17 @@ reject:
 }
 
 
-/**
- * crush_do_rule - calculate a mapping with the given input and rule
- * @param map the crush_map
- * @param ruleno the rule id
- * @param x hash input
- * @param result pointer to result vector
- * @param resultmax: maximum result size
+/*
+ * the rule interpreter behind crush_do_rule and crush_do_rule_batch.
+ * @a, @b and @c are the working vectors (CRUSH_MAX_SET each).
  */
-int crush_do_rule(const struct crush_map *map,
-		  int ruleno, int x, int *result, int result_max,
-		  const __u32 *weight, int weight_max)
+static int crush_do_rule_work(const struct crush_map *map,
+			      int ruleno, int x, int *result, int result_max,
+			      const __u32 *weight, int weight_max,
+			      int *a, int *b, int *c,
+			      struct crush_work *cw)
 {
 	int result_len;
-	int a[CRUSH_MAX_SET];
-	int b[CRUSH_MAX_SET];
-	int c[CRUSH_MAX_SET];
 	int recurse_to_leaf;
 	int *w;
 	int wsize = 0;
@@ -548,7 +706,8 @@ int crush_do_rule(const struct crush_map *map,
 						      curstep->arg2,
 						      o+osize, j,
 						      firstn,
-						      recurse_to_leaf, c+osize);
+						      recurse_to_leaf, c+osize,
+						      cw);
 			}
 
 			if (recurse_to_leaf)
@@ -580,4 +739,101 @@ int crush_do_rule(const struct crush_map *map,
 	return result_len;
 }
 
+/**
+ * crush_do_rule - calculate a mapping with the given input and rule
+ * @param map the crush_map
+ * @param ruleno the rule id
+ * @param x hash input
+ * @param result pointer to result vector
+ * @param resultmax: maximum result size
+ */
+int crush_do_rule(const struct crush_map *map,
+		  int ruleno, int x, int *result, int result_max,
+		  const __u32 *weight, int weight_max)
+{
+	int a[CRUSH_MAX_SET];
+	int b[CRUSH_MAX_SET];
+	int c[CRUSH_MAX_SET];
+
+	return crush_do_rule_work(map, ruleno, x, result, result_max,
+				  weight, weight_max, a, b, c, NULL);
+}
+
+
+/**
+ * crush_work_size - bytes of scratch space crush_do_rule_batch needs
+ * @param map the crush_map
+ */
+size_t crush_work_size(const struct crush_map *map)
+{
+	size_t size = sizeof(struct crush_work);
+	int b;
+
+	size += map->max_buckets * sizeof(struct crush_work_bucket *);
+	for (b = 0; b < map->max_buckets; b++) {
+		if (!map->buckets[b])
+			continue;
+		size += sizeof(struct crush_work_bucket);
+		size += map->buckets[b]->size * sizeof(__u32);
+	}
+	return size;
+}
+
+/**
+ * crush_init_workspace - lay out scratch space in @v
+ * @param map the crush_map
+ * @param v crush_work_size(map) bytes
+ */
+void crush_init_workspace(const struct crush_map *map, void *v)
+{
+	struct crush_work *w = v;
+	char *point = v;
+	int b;
+
+	point += sizeof(struct crush_work);
+	w->work = (struct crush_work_bucket **)point;
+	point += map->max_buckets * sizeof(struct crush_work_bucket *);
+	for (b = 0; b < map->max_buckets; b++) {
+		if (!map->buckets[b]) {
+			w->work[b] = NULL;
+			continue;
+		}
+		w->work[b] = (struct crush_work_bucket *)point;
+		point += sizeof(struct crush_work_bucket);
+		w->work[b]->perm_x = 0;
+		w->work[b]->perm_n = 0;
+		w->work[b]->perm = (__u32 *)point;
+		point += map->buckets[b]->size * sizeof(__u32);
+	}
+	BUG_ON((char *)point - (char *)w != crush_work_size(map));
+}
+
+/**
+ * crush_do_rule_batch - map many inputs with one rule
+ * @param map the crush_map
+ * @param ruleno the rule id
+ * @param x hash inputs
+ * @param num number of inputs
+ * @param result num * result_max result slots
+ * @param result_max maximum result size
+ * @param result_len num result sizes
+ * @param work scratch space from crush_init_workspace
+ */
+int crush_do_rule_batch(const struct crush_map *map,
+			int ruleno,
+			const int *x, int num,
+			int *result, int result_max, int *result_len,
+			const __u32 *weight, int weight_max,
+			void *work)
+{
+	struct crush_work *cw = work;
+	int i;
 
+	for (i = 0; i < num; i++)
+		result_len[i] = crush_do_rule_work(map, ruleno, x[i],
+						   result + i * result_max,
+						   result_max,
+						   weight, weight_max,
+						   cw->a, cw->b, cw->c, cw);
+	return num;
+}
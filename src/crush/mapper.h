@@ -16,4 +16,40 @@ extern int crush_do_rule(const struct crush_map *map,
 			 int x, int *result, int result_max,
 			 const __u32 *weights, int weight_max);
 
+/*
+ * Scratch space for crush_do_rule_batch: the bucket permutation state
+ * that crush_do_rule keeps in the (shared) map, and the rule's working
+ * vectors.  Each caller, or each thread, gets its own, so batches can
+ * run concurrently on the same map.  Size it with crush_work_size() and
+ * set it up with crush_init_workspace(); it stays valid until the map's
+ * buckets change.
+ */
+struct crush_work_bucket {
+	__u32 perm_x;  /* @x for which *perm is defined */
+	__u32 perm_n;  /* num elements of *perm that are permuted/defined */
+	__u32 *perm;
+};
+
+struct crush_work {
+	struct crush_work_bucket **work;  /* one per bucket, by -1-id */
+	int a[CRUSH_MAX_SET];
+	int b[CRUSH_MAX_SET];
+	int c[CRUSH_MAX_SET];
+};
+
+extern size_t crush_work_size(const struct crush_map *map);
+extern void crush_init_workspace(const struct crush_map *map, void *v);
+
+/*
+ * map @num inputs @x[] with one rule.  result i goes in
+ * result[i*result_max ...], its length in result_len[i].  the results
+ * are the same as calling crush_do_rule for each input.
+ */
+extern int crush_do_rule_batch(const struct crush_map *map,
+			       int ruleno,
+			       const int *x, int num,
+			       int *result, int result_max, int *result_len,
+			       const __u32 *weights, int weight_max,
+			       void *work);
+
 #endif
@@ -94,13 +94,22 @@ void usage()
   cout << "                         specify output for for (de)compilation\n";
   cout << "   --build --num_osds N layer1 ...\n";
   cout << "                         build a new map, where each 'layer' is\n";
-  cout << "                           'name (uniform|straw|list|tree) size'\n";
+  cout << "                           'name (uniform|straw|straw_tree|list|tree) size'\n";
   cout << "   -i mapfn --test       test a range of inputs on the map\n";
   cout << "      [--min-x x] [--max-x x] [--x x]\n";
   cout << "      [--min-rule r] [--max-rule r] [--rule r]\n";
   cout << "      [--num-rep n]\n";
   cout << "      [--batches b]      split the CRUSH mapping into b rounds\n";
   cout << "    --simulate           simulate placements using a RNG\n";
+  cout << "      [--threads n]      map the inputs on n threads\n";
+  cout << "   -i mapfn --stats      like --test, but only count per-device utilization\n";
+  cout << "                         and data movement, for large input ranges\n";
+  cout << "      [--compare mapfn2] count replicas that moved relative to mapfn2\n";
+  cout << "      [--stats-out file] write per-device results to file (default stdout)\n";
+  cout << "      [--stats-format csv|json]\n";
+  cout << "      [--checkpoint file]\n";
+  cout << "                         save progress to file, and resume from it if\n";
+  cout << "                         it exists\n";
   cout << "      [--weight|-w devno weight]\n";
   cout << "                         where weight is 0 to 1.0\n";
   cout << "   -i mapfn --add-item id weight name [--loc type name ...]\n";
@@ -121,6 +130,9 @@ void usage()
   cout << "   --show-statistics     show chi squared statistics\n";
   cout << "   --show-bad-mappings   show bad mappings\n";
   cout << "   --show-choose-tries   show choose tries histogram\n";
+  cout << "   --show-movement       with --test, also map the inputs with the map as\n";
+  cout << "                         it was before --add-item, --reweight-item etc.\n";
+  cout << "                         and report how many replicas moved\n";
   cout << "   --set-choose-local-tries N\n";
   cout << "                         set choose local retries before re-descent\n";
   cout << "   --set-choose-local-fallback-tries N\n";
@@ -145,6 +157,7 @@ struct bucket_types_t {
   { "uniform", CRUSH_BUCKET_UNIFORM },
   { "list", CRUSH_BUCKET_LIST },
   { "straw", CRUSH_BUCKET_STRAW },
+  { "straw_tree", CRUSH_BUCKET_STRAW_TREE },
   { "tree", CRUSH_BUCKET_TREE },
   { 0, 0 },
 };
@@ -167,6 +180,9 @@ int main(int argc, const char **argv)
   bool test = false;
   bool verbose = false;
   bool unsafe_tunables = false;
+  bool show_movement = false;
+  bool stats = false;
+  std::string compare_fn, stats_out_fn;
 
   bool reweight = false;
   int add_item = -1;
@@ -186,6 +202,7 @@ int main(int argc, const char **argv)
   int choose_total_tries = -1;
 
   CrushWrapper crush;
+  CrushWrapper before;  // for --show-movement or --compare
 
   CrushTester tester(crush, cerr, 1);
 
@@ -222,6 +239,33 @@ int main(int argc, const char **argv)
       tester.set_output_bad_mappings(true);
     } else if (ceph_argparse_flag(args, i, "--show_choose_tries", (char*)NULL)) {
       tester.set_output_choose_tries(true);
+    } else if (ceph_argparse_flag(args, i, "--show_movement", (char*)NULL)) {
+      show_movement = true;
+    } else if (ceph_argparse_flag(args, i, "--stats", (char*)NULL)) {
+      stats = true;
+    } else if (ceph_argparse_witharg(args, i, &val, "--compare", (char*)NULL)) {
+      compare_fn = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--stats_out", (char*)NULL)) {
+      stats_out_fn = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--stats_format", (char*)NULL)) {
+      if (val == "json") {
+	tester.set_output_json(true);
+      } else if (val != "csv") {
+	cerr << "unknown stats format '" << val << "'" << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_witharg(args, i, &val, "--checkpoint", (char*)NULL)) {
+      tester.set_checkpoint_file(val);
+    } else if (ceph_argparse_withint(args, i, &x, &err, "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      if (x < 1) {
+	cerr << "--threads must be at least 1" << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      tester.set_num_threads(x);
     } else if (ceph_argparse_witharg(args, i, &val, "-c", "--compile", (char*)NULL)) {
       srcfn = val;
       compile = true;
@@ -384,7 +428,11 @@ int main(int argc, const char **argv)
   if (decompile + compile + build > 1) {
     usage();
   }
-  if (!compile && !decompile && !build && !test && !reweight && !adjust &&
+  if (show_movement && !compare_fn.empty()) {
+    cerr << "--show-movement and --compare are mutually exclusive" << std::endl;
+    usage();
+  }
+  if (!compile && !decompile && !build && !test && !stats && !reweight && !adjust &&
       add_item < 0 &&
       remove_name.empty() && reweight_name.empty()) {
     usage();
@@ -572,6 +620,29 @@ int main(int argc, const char **argv)
     modified = true;
   }
 
+  if (!compare_fn.empty()) {
+    bufferlist bl;
+    std::string error;
+    int r = bl.read_file(compare_fn.c_str(), &error);
+    if (r < 0) {
+      cerr << me << ": error reading '" << compare_fn << "': "
+	   << error << std::endl;
+      exit(1);
+    }
+    bufferlist::iterator p = bl.begin();
+    before.decode(p);
+    tester.set_compare_map(&before);
+  }
+
+  if (show_movement) {
+    crush.finalize();
+    bufferlist bl;
+    crush.encode(bl);
+    bufferlist::iterator p = bl.begin();
+    before.decode(p);
+    tester.set_compare_map(&before);
+  }
+
   if (!reweight_name.empty()) {
     cout << me << " reweighting item " << reweight_name << " to " << reweight_weight << std::endl;
     int r;
@@ -678,5 +749,19 @@ int main(int argc, const char **argv)
       exit(1);
   }
 
+  if (stats) {
+    ofstream o;
+    if (!stats_out_fn.empty()) {
+      o.open(stats_out_fn.c_str(), ios::out | ios::trunc);
+      if (!o.is_open()) {
+	cerr << me << ": error writing '" << stats_out_fn << "'" << std::endl;
+	exit(1);
+      }
+    }
+    int r = tester.simulate(stats_out_fn.empty() ? cout : o);
+    if (r < 0)
+      exit(1);
+  }
+
   return 0;
 }
@@ -106,6 +106,12 @@ public:
 
   static int get_total_alloc();
 
+  /// list::crc32c results served from the per-raw cache, as is or
+  /// adjusted for a different seed (counted only while tracking)
+  static int get_cached_crc();
+  static int get_cached_crc_adjusted();
+  static void track_cached_crc(bool b);
+
 private:
  
   /* hack for memory utilization debugging. */
@@ -122,6 +128,7 @@ private:
   class raw_posix_aligned;
   class raw_hack_aligned;
   class raw_char;
+  class raw_pooled;
 
   friend std::ostream& operator<<(std::ostream& out, const raw &r);
 
@@ -416,14 +423,7 @@ public:
     ssize_t read_fd(int fd, size_t len);
     int write_file(const char *fn, int mode=0644);
     int write_fd(int fd) const;
-    __u32 crc32c(__u32 crc) {
-      for (std::list<ptr>::const_iterator it = _buffers.begin(); 
-	   it != _buffers.end(); 
-	   it++)
-	if (it->length())
-	  crc = ceph_crc32c_le(crc, (unsigned char*)it->c_str(), it->length());
-      return crc;
-    }
+    __u32 crc32c(__u32 crc) const;
 
   };
 };
@@ -23,6 +23,8 @@
 #define CEPH_FEATURE_QUERY_T        (1<<16)
 #define CEPH_FEATURE_INDEP_PG_MAP   (1<<17)
 #define CEPH_FEATURE_CRUSH_TUNABLES (1<<18)
+#define CEPH_FEATURE_CHUNKY_SCRUB   (1<<19)
+#define CEPH_FEATURE_CRUSH_STRAW_TREE (1<<20)
 
 /*
  * Features supported.  Should be everything above.
@@ -46,7 +48,9 @@
 	 CEPH_FEATURE_QUERY_T |		 \
 	 CEPH_FEATURE_MONENC |		 \
 	 CEPH_FEATURE_INDEP_PG_MAP |	 \
-	 CEPH_FEATURE_CRUSH_TUNABLES)
+	 CEPH_FEATURE_CRUSH_TUNABLES |	 \
+	 CEPH_FEATURE_CHUNKY_SCRUB |	 \
+	 CEPH_FEATURE_CRUSH_STRAW_TREE)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
@@ -1,12 +1,38 @@
 #ifndef CEPH_CRC32C_H
 #define CEPH_CRC32C_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef uint32_t (*ceph_crc32c_func_t)(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * ceph_crc32c_le dispatches to the fastest implementation the cpu
+ * supports, picked on first use.  The individual implementations are
+ * exported for testing and benchmarking.
+ */
 uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length);
 
+/*
+ * crc of length zero bytes, without touching any memory.  crc32c is
+ * linear (there is no final inversion), so
+ *   crc32c_le(a ^ b, d, n) == crc32c_le(a, d, n) ^ crc32c_zeros(b, n)
+ * which lets a crc computed with one seed be reused for another.
+ */
+uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned length);
+
+ceph_crc32c_func_t ceph_choose_crc32(void);
+
+/* portable slice-by-8 tables */
+uint32_t ceph_crc32c_sctp(uint32_t crc, unsigned char const *data, unsigned length);
+
+/* SSE4.2 crc32 instruction; only valid if ceph_crc32c_intel_probe() */
+int ceph_crc32c_intel_probe(void);
+uint32_t ceph_crc32c_intel(uint32_t crc, unsigned char const *data, unsigned length);
+
 #ifdef __cplusplus
 }
 #endif
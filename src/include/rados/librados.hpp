@@ -136,6 +136,16 @@ namespace librados
     void src_cmpxattr(const std::string& src_oid,
 		      const char *name, int op, uint64_t v);
     void exec(const char *cls, const char *method, bufferlist& inbl);
+    /**
+     * Call a class method, keeping its output and return value
+     *
+     * The output is only filled in for read operations.
+     *
+     * @param obl [out] where to store the method's output on completion
+     * @param prval [out] where to store the method's return value on completion
+     */
+    void exec(const char *cls, const char *method, bufferlist& inbl,
+	      bufferlist *obl, int *prval);
     /**
      * Guard operation with a check that object version == ver
      *
@@ -166,10 +166,8 @@ int librados::IoCtxImpl::selfmanaged_snap_rollback_object(const object_t& oid,
   bool done;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &reply);
 
-  lock->Lock();
   objecter->rollback_object(oid, oloc, snapc, snapid,
 			    ceph_clock_now(client->cct), onack, NULL);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done) cond.Wait(mylock);
@@ -314,9 +312,7 @@ int librados::IoCtxImpl::list(Objecter::ListContext *context, int max_entries)
 
   context->max_entries = max_entries;
 
-  lock->Lock();
   objecter->list_objects(context, new C_SafeCond(&mylock, &cond, &done, &r));
-  lock->Unlock();
 
   mylock.Lock();
   while(!done)
@@ -342,11 +338,9 @@ int librados::IoCtxImpl::create(const object_t& oid, bool exclusive)
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->create(oid, oloc,
 		  snapc, ut, 0, (exclusive ? CEPH_OSD_OP_FLAG_EXCL : 0),
 		  onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -378,9 +372,7 @@ int librados::IoCtxImpl::create(const object_t& oid, bool exclusive,
   ::ObjectOperation o;
   o.create(exclusive ? CEPH_OSD_OP_FLAG_EXCL : 0, category);
 
-  lock->Lock();
   objecter->mutate(oid, oloc, o, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -440,11 +432,9 @@ int librados::IoCtxImpl::write(const object_t& oid, bufferlist& bl,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->write(oid, oloc,
 		  off, len, snapc, bl, ut, 0,
 		  onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -478,11 +468,9 @@ int librados::IoCtxImpl::append(const object_t& oid, bufferlist& bl, size_t len)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->append(oid, oloc,
 		   len, snapc, bl, ut, 0,
 		   onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -517,11 +505,9 @@ int librados::IoCtxImpl::write_full(const object_t& oid, bufferlist& bl)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->write_full(oid, oloc,
 		       snapc, bl, ut, 0,
 		       onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -554,12 +540,10 @@ int librados::IoCtxImpl::clone_range(const object_t& dst_oid,
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&wr);
   wr.clone_range(src_oid, src_offset, len, dst_offset);
   objecter->mutate(dst_oid, oloc, wr, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -596,11 +580,9 @@ int librados::IoCtxImpl::operate(const object_t& oid, ::ObjectOperation *o,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->mutate(oid, oloc,
 	           *o, snapc, ut, 0,
 	           onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -626,11 +608,9 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->read(oid, oloc,
 	           *o, snap_seq, pbl, 0,
 	           onack, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -652,17 +632,23 @@ int librados::IoCtxImpl::aio_operate_read(const object_t &oid,
   c->io = this;
   c->pbl = pbl;
 
-  Mutex::Locker l(*lock);
+  // the ack copies c->bl to pbl, so the data has to land in c->bl
   objecter->read(oid, oloc,
-		 *o, snap_seq, pbl, 0,
+		 *o, snap_seq, &c->bl, 0,
 		 onack, &c->objver);
   return 0;
 }
 
 int librados::IoCtxImpl::aio_operate(const object_t& oid,
-				     ::ObjectOperation *o, AioCompletionImpl *c)
+				     ::ObjectOperation *o, AioCompletionImpl *c,
+				     time_t *pmtime)
 {
-  utime_t ut = ceph_clock_now(client->cct);
+  utime_t ut;
+  if (pmtime) {
+    ut = utime_t(*pmtime, 0);
+  } else {
+    ut = ceph_clock_now(client->cct);
+  }
   /* can't write to a snapshot */
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
@@ -673,7 +659,6 @@ int librados::IoCtxImpl::aio_operate(const object_t& oid,
   c->io = this;
   queue_aio_write(c);
 
-  Mutex::Locker l(*lock);
   objecter->mutate(oid, oloc, *o, snapc, ut, 0, onack, oncommit, &c->objver);
 
   return 0;
@@ -692,7 +677,6 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->io = this;
   c->pbl = pbl;
 
-  Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
 		 off, len, snap_seq, &c->bl, 0,
 		 onack, &c->objver);
@@ -712,7 +696,6 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->buf = buf;
   c->maxlen = len;
 
-  Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
 		 off, len, snap_seq, &c->bl, 0,
 		 onack, &c->objver);
@@ -737,7 +720,6 @@ int librados::IoCtxImpl::aio_sparse_read(const object_t oid,
   c->io = this;
   c->pbl = NULL;
 
-  Mutex::Locker l(*lock);
   objecter->sparse_read(oid, oloc,
 		 off, len, snap_seq, &c->bl, 0,
 		 onack);
@@ -761,7 +743,6 @@ int librados::IoCtxImpl::aio_write(const object_t &oid, AioCompletionImpl *c,
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->write(oid, oloc,
 		  off, len, snapc, bl, ut, 0,
 		  onack, onsafe, &c->objver);
@@ -784,7 +765,6 @@ int librados::IoCtxImpl::aio_append(const object_t &oid, AioCompletionImpl *c,
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->append(oid, oloc,
 		   len, snapc, bl, ut, 0,
 		   onack, onsafe, &c->objver);
@@ -808,7 +788,6 @@ int librados::IoCtxImpl::aio_write_full(const object_t &oid,
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->write_full(oid, oloc,
 		       snapc, bl, ut, 0,
 		       onack, onsafe, &c->objver);
@@ -834,11 +813,9 @@ int librados::IoCtxImpl::remove(const object_t& oid)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->remove(oid, oloc,
 		   snapc, ut, 0,
 		   onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -869,12 +846,10 @@ int librados::IoCtxImpl::trunc(const object_t& oid, uint64_t size)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->trunc(oid, oloc,
 		  snapc, ut, 0,
 		  size, 0,
 		  onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -903,12 +878,10 @@ int librados::IoCtxImpl::tmap_update(const object_t& oid, bufferlist& cmdbl)
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&wr);
   wr.tmap_update(cmdbl);
   objecter->mutate(oid, oloc, wr, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -937,12 +910,10 @@ int librados::IoCtxImpl::tmap_put(const object_t& oid, bufferlist& bl)
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&wr);
   wr.tmap_put(bl);
   objecter->mutate(oid, oloc, wr, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -969,12 +940,10 @@ int librados::IoCtxImpl::tmap_get(const object_t& oid, bufferlist& bl)
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.tmap_get(&bl, NULL);
   objecter->read(oid, oloc, rd, snap_seq, 0, 0, onack, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -999,12 +968,10 @@ int librados::IoCtxImpl::exec(const object_t& oid,
   eversion_t ver;
 
 
-  lock->Lock();
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.call(cls, method, inbl);
   objecter->read(oid, oloc, rd, snap_seq, &outbl, 0, onack, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1025,7 +992,6 @@ int librados::IoCtxImpl::aio_exec(const object_t& oid, AioCompletionImpl *c,
   c->is_read = true;
   c->io = this;
 
-  Mutex::Locker l(*lock);
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.call(cls, method, inbl);
@@ -1051,11 +1017,9 @@ int librados::IoCtxImpl::read(const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->read(oid, oloc,
 		 off, len, snap_seq, &bl, 0,
 		 onack, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1088,11 +1052,9 @@ int librados::IoCtxImpl::mapext(const object_t& oid,
   int r;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->mapext(oid, oloc,
 		   off, len, snap_seq, &bl, 0,
 		   onack);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1125,11 +1087,9 @@ int librados::IoCtxImpl::sparse_read(const object_t& oid,
   int r;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->sparse_read(oid, oloc,
 			off, len, snap_seq, &bl, 0,
 			onack);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1164,11 +1124,9 @@ int librados::IoCtxImpl::stat(const object_t& oid, uint64_t *psize, time_t *pmti
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->stat(oid, oloc,
 		 snap_seq, psize, &mtime, 0,
 		 onack, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1198,11 +1156,9 @@ int librados::IoCtxImpl::getxattr(const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->getxattr(oid, oloc,
 		     name, snap_seq, &bl, 0,
 		     onack, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1237,11 +1193,9 @@ int librados::IoCtxImpl::rmxattr(const object_t& oid, const char *name)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->removexattr(oid, oloc, name,
 			snapc, ut, 0,
 			onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1276,11 +1230,9 @@ int librados::IoCtxImpl::setxattr(const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->setxattr(oid, oloc, name,
 		     snapc, bl, ut, 0,
 		     onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1309,12 +1261,10 @@ int librados::IoCtxImpl::getxattrs(const object_t& oid,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   map<string, bufferlist> aset;
   objecter->getxattrs(oid, oloc, snap_seq,
 		      aset,
 		      0, onack, &ver, pop);
-  lock->Unlock();
 
   attrset.clear();
 
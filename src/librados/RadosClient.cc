@@ -255,6 +255,13 @@ bool librados::RadosClient::ms_dispatch(Message *m)
 {
   bool ret;
 
+  // op replies are handled under the objecter's own locks, so they
+  // are not serialized behind everything else that takes ours
+  if (m->get_type() == CEPH_MSG_OSD_OPREPLY) {
+    objecter->handle_osd_op_reply((class MOSDOpReply*)m);
+    return true;
+  }
+
   lock.Lock();
   if (state == DISCONNECTED) {
     ldout(cct, 10) << "disconnected, discarding " << *m << dendl;
@@ -291,9 +298,6 @@ bool librados::RadosClient::_dispatch(Message *m)
 {
   switch (m->get_type()) {
   // OSD
-  case CEPH_MSG_OSD_OPREPLY:
-    objecter->handle_osd_op_reply((class MOSDOpReply*)m);
-    break;
   case CEPH_MSG_OSD_MAP:
     objecter->handle_osd_map((MOSDMap*)m);
     cond.Signal();
@@ -115,6 +115,13 @@ void librados::ObjectOperation::exec(const char *cls, const char *method, buffer
   o->call(cls, method, inbl);
 }
 
+void librados::ObjectOperation::exec(const char *cls, const char *method, bufferlist& inbl,
+				     bufferlist *obl, int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  o->call(cls, method, inbl, obl, NULL, prval);
+}
+
 void librados::ObjectReadOperation::stat(uint64_t *psize, time_t *pmtime, int *prval)
 {
   ::ObjectOperation *o = (::ObjectOperation *)impl;
@@ -816,7 +823,8 @@ int librados::IoCtx::operate(const std::string& oid, librados::ObjectReadOperati
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectWriteOperation *o)
 {
   object_t obj(oid);
-  return io_ctx_impl->aio_operate(obj, (::ObjectOperation*)o->impl, c->pc);
+  return io_ctx_impl->aio_operate(obj, (::ObjectOperation*)o->impl, c->pc,
+				  o->pmtime);
 }
 
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectReadOperation *o, bufferlist *pbl)
@@ -2124,6 +2132,451 @@ extern "C" int rados_aio_flush(rados_ioctx_t io)
   return 0;
 }
 
+// compound operations
+
+static int translate_flags(int flags)
+{
+  int rados_flags = 0;
+  if (flags & LIBRADOS_OP_FLAG_EXCL)
+    rados_flags |= CEPH_OSD_OP_FLAG_EXCL;
+  if (flags & LIBRADOS_OP_FLAG_FAILOK)
+    rados_flags |= CEPH_OSD_OP_FLAG_FAILOK;
+  return rados_flags;
+}
+
+extern "C" rados_write_op_t rados_create_write_op(void)
+{
+  return new (std::nothrow)::ObjectOperation;
+}
+
+extern "C" void rados_release_write_op(rados_write_op_t write_op)
+{
+  delete (::ObjectOperation*)write_op;
+}
+
+extern "C" void rados_write_op_set_flags(rados_write_op_t write_op, int flags)
+{
+  ((::ObjectOperation *)write_op)->set_last_op_flags(translate_flags(flags));
+}
+
+extern "C" void rados_write_op_assert_version(rados_write_op_t write_op, uint64_t ver)
+{
+  ((::ObjectOperation *)write_op)->assert_version(ver);
+}
+
+extern "C" void rados_write_op_cmpxattr(rados_write_op_t write_op,
+                                       const char *name,
+				       uint8_t comparison_operator,
+				       const char *value,
+				       size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)write_op)->cmpxattr(name,
+					    comparison_operator,
+					    CEPH_OSD_CMPXATTR_MODE_STRING,
+					    bl);
+}
+
+extern "C" void rados_write_op_setxattr(rados_write_op_t write_op,
+                                       const char *name,
+				       const char *value,
+				       size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)write_op)->setxattr(name, bl);
+}
+
+extern "C" void rados_write_op_rmxattr(rados_write_op_t write_op,
+                                       const char *name)
+{
+  ((::ObjectOperation *)write_op)->rmxattr(name);
+}
+
+extern "C" void rados_write_op_create(rados_write_op_t write_op,
+                                      int exclusive,
+				      const char* category)
+{
+  ::ObjectOperation *oo = (::ObjectOperation *) write_op;
+  if (category)
+    oo->create(!!exclusive, category);
+  else
+    oo->create(!!exclusive);
+}
+
+extern "C" void rados_write_op_write(rados_write_op_t write_op,
+				     const char *buffer,
+				     size_t len,
+				     uint64_t offset)
+{
+  bufferlist bl;
+  bl.append(buffer,len);
+  ((::ObjectOperation *)write_op)->write(offset, bl);
+}
+
+extern "C" void rados_write_op_write_full(rados_write_op_t write_op,
+				          const char *buffer,
+				          size_t len)
+{
+  bufferlist bl;
+  bl.append(buffer,len);
+  ((::ObjectOperation *)write_op)->write_full(bl);
+}
+
+extern "C" void rados_write_op_append(rados_write_op_t write_op,
+				      const char *buffer,
+				      size_t len)
+{
+  bufferlist bl;
+  bl.append(buffer,len);
+  ((::ObjectOperation *)write_op)->append(bl);
+}
+
+extern "C" void rados_write_op_remove(rados_write_op_t write_op)
+{
+  ((::ObjectOperation *)write_op)->remove();
+}
+
+extern "C" void rados_write_op_truncate(rados_write_op_t write_op,
+				        uint64_t offset)
+{
+  ((::ObjectOperation *)write_op)->truncate(offset);
+}
+
+extern "C" void rados_write_op_zero(rados_write_op_t write_op,
+				    uint64_t offset,
+				    uint64_t len)
+{
+  ((::ObjectOperation *)write_op)->zero(offset, len);
+}
+
+extern "C" void rados_write_op_exec(rados_write_op_t write_op,
+				    const char *cls,
+				    const char *method,
+				    const char *in_buf,
+				    size_t in_len,
+				    int *prval)
+{
+  bufferlist inbl;
+  inbl.append(in_buf, in_len);
+  ((::ObjectOperation *)write_op)->call(cls, method, inbl, NULL, NULL, prval);
+}
+
+extern "C" void rados_write_op_omap_set(rados_write_op_t write_op,
+				        char const* const* keys,
+				        char const* const* vals,
+				        const size_t *lens,
+				        size_t num)
+{
+  std::map<std::string, bufferlist> entries;
+  for (size_t i = 0; i < num; ++i) {
+    bufferlist bl(lens[i]);
+    bl.append(vals[i], lens[i]);
+    entries[keys[i]] = bl;
+  }
+  ((::ObjectOperation *)write_op)->omap_set(entries);
+}
+
+extern "C" void rados_write_op_omap_rm_keys(rados_write_op_t write_op,
+				            char const* const* keys,
+				            size_t keys_len)
+{
+  std::set<std::string> to_remove(keys, keys + keys_len);
+  ((::ObjectOperation *)write_op)->omap_rm_keys(to_remove);
+}
+
+extern "C" void rados_write_op_omap_clear(rados_write_op_t write_op)
+{
+  ((::ObjectOperation *)write_op)->omap_clear();
+}
+
+extern "C" int rados_write_op_operate(rados_write_op_t write_op,
+                                      rados_ioctx_t io,
+                                      const char *oid,
+				      time_t *mtime)
+{
+  object_t obj(oid);
+  ::ObjectOperation *oo = (::ObjectOperation *) write_op;
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  return ctx->operate(obj, oo, mtime);
+}
+
+extern "C" int rados_aio_write_op_operate(rados_write_op_t write_op,
+					  rados_ioctx_t io,
+					  rados_completion_t completion,
+					  const char *oid,
+					  time_t *mtime)
+{
+  object_t obj(oid);
+  ::ObjectOperation *oo = (::ObjectOperation *) write_op;
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  librados::AioCompletionImpl *c = (librados::AioCompletionImpl*)completion;
+  return ctx->aio_operate(obj, oo, c, mtime);
+}
+
+extern "C" rados_read_op_t rados_create_read_op(void)
+{
+  return new (std::nothrow)::ObjectOperation;
+}
+
+extern "C" void rados_release_read_op(rados_read_op_t read_op)
+{
+  delete (::ObjectOperation *)read_op;
+}
+
+extern "C" void rados_read_op_set_flags(rados_read_op_t read_op, int flags)
+{
+  ((::ObjectOperation *)read_op)->set_last_op_flags(translate_flags(flags));
+}
+
+extern "C" void rados_read_op_assert_version(rados_read_op_t read_op, uint64_t ver)
+{
+  ((::ObjectOperation *)read_op)->assert_version(ver);
+}
+
+extern "C" void rados_read_op_cmpxattr(rados_read_op_t read_op,
+				       const char *name,
+				       uint8_t comparison_operator,
+				       const char *value,
+				       size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)read_op)->cmpxattr(name,
+					   comparison_operator,
+					   CEPH_OSD_CMPXATTR_MODE_STRING,
+					   bl);
+}
+
+extern "C" void rados_read_op_stat(rados_read_op_t read_op,
+				   uint64_t *psize,
+				   time_t *pmtime,
+				   int *prval)
+{
+  ((::ObjectOperation *)read_op)->stat(psize, pmtime, prval);
+}
+
+/// copy a read or exec result into a caller-supplied buffer
+class C_bl_to_buf : public Context {
+  char *out_buf;
+  size_t out_len;
+  size_t *bytes_read;
+  int *prval;
+public:
+  bufferlist out_bl;
+  C_bl_to_buf(char *out_buf,
+	      size_t out_len,
+	      size_t *bytes_read,
+	      int *prval) : out_buf(out_buf), out_len(out_len),
+			    bytes_read(bytes_read), prval(prval) {}
+  void finish(int r) {
+    if (out_bl.length() > out_len) {
+      if (prval)
+	*prval = -ERANGE;
+      if (bytes_read)
+	*bytes_read = 0;
+      return;
+    }
+    if (bytes_read)
+      *bytes_read = out_bl.length();
+    out_bl.copy(0, out_bl.length(), out_buf);
+  }
+};
+
+extern "C" void rados_read_op_read(rados_read_op_t read_op,
+				   uint64_t offset,
+				   size_t len,
+				   char *buf,
+				   size_t *bytes_read,
+				   int *prval)
+{
+  ::ObjectOperation *oo = (::ObjectOperation *)read_op;
+  C_bl_to_buf *ctx = new C_bl_to_buf(buf, len, bytes_read, prval);
+  oo->read(offset, len, &ctx->out_bl, prval);
+  oo->out_handler[oo->ops.size() - 1] = ctx;
+}
+
+extern "C" void rados_read_op_exec(rados_read_op_t read_op,
+				   const char *cls,
+				   const char *method,
+				   const char *in_buf,
+				   size_t in_len,
+				   char *out_buf,
+				   size_t out_len,
+				   size_t *used_len,
+				   int *prval)
+{
+  bufferlist inbl;
+  inbl.append(in_buf, in_len);
+  C_bl_to_buf *ctx = new C_bl_to_buf(out_buf, out_len, used_len, prval);
+  ((::ObjectOperation *)read_op)->call(cls, method, inbl, &ctx->out_bl, ctx,
+				       prval);
+}
+
+/// point an xattrs iterator at the values once they are decoded
+class C_XattrsIter : public Context {
+  Context *decoder;
+  RadosXattrsIter *iter;
+public:
+  C_XattrsIter(Context *decoder, RadosXattrsIter *iter)
+    : decoder(decoder), iter(iter) {}
+  void finish(int r) {
+    decoder->complete(r);
+    iter->i = iter->attrset.begin();
+  }
+};
+
+extern "C" void rados_read_op_getxattrs(rados_read_op_t read_op,
+					rados_xattrs_iter_t *iter,
+					int *prval)
+{
+  ::ObjectOperation *oo = (::ObjectOperation *)read_op;
+  RadosXattrsIter *xattrs_iter = new RadosXattrsIter;
+  oo->getxattrs(&xattrs_iter->attrset, prval);
+  unsigned p = oo->ops.size() - 1;
+  oo->out_handler[p] = new C_XattrsIter(oo->out_handler[p], xattrs_iter);
+  *iter = xattrs_iter;
+}
+
+class RadosOmapIter {
+public:
+  std::map<std::string, bufferlist> values;
+  std::map<std::string, bufferlist>::iterator i;
+  RadosOmapIter() {
+    i = values.end();
+  }
+};
+
+/// point an omap iterator at the values once they are decoded
+class C_OmapIter : public Context {
+  Context *decoder;
+  RadosOmapIter *iter;
+public:
+  C_OmapIter(Context *decoder, RadosOmapIter *iter)
+    : decoder(decoder), iter(iter) {}
+  void finish(int r) {
+    decoder->complete(r);
+    iter->i = iter->values.begin();
+  }
+};
+
+/// like C_OmapIter, for a listing of keys without values
+class C_OmapKeysIter : public Context {
+  RadosOmapIter *iter;
+public:
+  Context *decoder;
+  std::set<std::string> keys;
+  C_OmapKeysIter(RadosOmapIter *iter) : iter(iter), decoder(NULL) {}
+  void finish(int r) {
+    decoder->complete(r);
+    for (std::set<std::string>::iterator p = keys.begin();
+	 p != keys.end();
+	 ++p)
+      iter->values[*p];
+    iter->i = iter->values.begin();
+  }
+};
+
+extern "C" void rados_read_op_omap_get_vals(rados_read_op_t read_op,
+					    const char *start_after,
+					    const char *filter_prefix,
+					    uint64_t max_return,
+					    rados_omap_iter_t *iter,
+					    int *prval)
+{
+  ::ObjectOperation *oo = (::ObjectOperation *)read_op;
+  RadosOmapIter *omap_iter = new RadosOmapIter;
+  const char *start = start_after ? start_after : "";
+  const char *filter = filter_prefix ? filter_prefix : "";
+  oo->omap_get_vals(start, filter, max_return, &omap_iter->values, prval);
+  unsigned p = oo->ops.size() - 1;
+  oo->out_handler[p] = new C_OmapIter(oo->out_handler[p], omap_iter);
+  *iter = omap_iter;
+}
+
+extern "C" void rados_read_op_omap_get_keys(rados_read_op_t read_op,
+					    const char *start_after,
+					    uint64_t max_return,
+					    rados_omap_iter_t *iter,
+					    int *prval)
+{
+  ::ObjectOperation *oo = (::ObjectOperation *)read_op;
+  RadosOmapIter *omap_iter = new RadosOmapIter;
+  C_OmapKeysIter *ctx = new C_OmapKeysIter(omap_iter);
+  oo->omap_get_keys(start_after ? start_after : "", max_return,
+		    &ctx->keys, prval);
+  unsigned p = oo->ops.size() - 1;
+  ctx->decoder = oo->out_handler[p];
+  oo->out_handler[p] = ctx;
+  *iter = omap_iter;
+}
+
+extern "C" void rados_read_op_omap_get_vals_by_keys(rados_read_op_t read_op,
+						    char const* const* keys,
+						    size_t keys_len,
+						    rados_omap_iter_t *iter,
+						    int *prval)
+{
+  ::ObjectOperation *oo = (::ObjectOperation *)read_op;
+  std::set<std::string> to_get(keys, keys + keys_len);
+  RadosOmapIter *omap_iter = new RadosOmapIter;
+  oo->omap_get_vals_by_keys(to_get, &omap_iter->values, prval);
+  unsigned p = oo->ops.size() - 1;
+  oo->out_handler[p] = new C_OmapIter(oo->out_handler[p], omap_iter);
+  *iter = omap_iter;
+}
+
+extern "C" int rados_omap_get_next(rados_omap_iter_t iter,
+                                   char **key,
+                                   char **val,
+                                   size_t *len)
+{
+  RadosOmapIter *it = (RadosOmapIter *)iter;
+  if (it->i == it->values.end()) {
+    *key = NULL;
+    *val = NULL;
+    *len = 0;
+    return 0;
+  }
+  if (key)
+    *key = (char*)it->i->first.c_str();
+  if (val)
+    *val = it->i->second.length() ? it->i->second.c_str() : NULL;
+  if (len)
+    *len = it->i->second.length();
+  ++it->i;
+  return 0;
+}
+
+extern "C" void rados_omap_get_end(rados_omap_iter_t iter)
+{
+  RadosOmapIter *it = (RadosOmapIter *)iter;
+  delete it;
+}
+
+extern "C" int rados_read_op_operate(rados_read_op_t read_op,
+				     rados_ioctx_t io,
+				     const char *oid)
+{
+  object_t obj(oid);
+  ::ObjectOperation *oo = (::ObjectOperation *)read_op;
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  return ctx->operate_read(obj, oo, NULL);
+}
+
+extern "C" int rados_aio_read_op_operate(rados_read_op_t read_op,
+					 rados_ioctx_t io,
+					 rados_completion_t completion,
+					 const char *oid)
+{
+  object_t obj(oid);
+  ::ObjectOperation *oo = (::ObjectOperation *)read_op;
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  librados::AioCompletionImpl *c = (librados::AioCompletionImpl*)completion;
+  return ctx->aio_operate_read(obj, oo, c, NULL);
+}
+
 struct C_WatchCB : public librados::WatchCtx {
   rados_watchcb_t wcb;
   void *arg;
@@ -22,19 +22,21 @@
 
 class MOSDBoot : public PaxosServiceMessage {
 
-  static const int HEAD_VERSION = 2;
+  static const int HEAD_VERSION = 3;
 
  public:
   OSDSuperblock sb;
   entity_addr_t hb_addr;
   entity_addr_t cluster_addr;
+  uint64_t osd_features;  ///< CEPH_FEATURE_* the osd supports; 0 if it didn't say
 
-  MOSDBoot() : PaxosServiceMessage(MSG_OSD_BOOT, 0, HEAD_VERSION) { }
+  MOSDBoot() : PaxosServiceMessage(MSG_OSD_BOOT, 0, HEAD_VERSION), osd_features(0) { }
   MOSDBoot(OSDSuperblock& s, const entity_addr_t& hb_addr_ref,
-           const entity_addr_t& cluster_addr_ref)
+           const entity_addr_t& cluster_addr_ref, uint64_t feat)
     : PaxosServiceMessage(MSG_OSD_BOOT, s.current_epoch, HEAD_VERSION),
       sb(s),
-      hb_addr(hb_addr_ref), cluster_addr(cluster_addr_ref) {
+      hb_addr(hb_addr_ref), cluster_addr(cluster_addr_ref),
+      osd_features(feat) {
   }
   
 private:
@@ -51,6 +53,7 @@ public:
     ::encode(sb, payload);
     ::encode(hb_addr, payload);
     ::encode(cluster_addr, payload);
+    ::encode(osd_features, payload);
   }
   void decode_payload() {
     bufferlist::iterator p = payload.begin();
@@ -59,6 +62,8 @@ public:
     ::decode(hb_addr, p);
     if (header.version >= 2)
       ::decode(cluster_addr, p);
+    if (header.version >= 3)
+      ::decode(osd_features, p);
   }
 };
 
@@ -24,21 +24,38 @@
 
 struct MOSDRepScrub : public Message {
 
-  static const int HEAD_VERSION = 2;
+  static const int HEAD_VERSION = 4;
 
   pg_t pgid;             // PG to scrub
   eversion_t scrub_from; // only scrub log entries after scrub_from
   eversion_t scrub_to;   // last_update_applied when message sent
   epoch_t map_epoch;
+  bool chunky;           // scrub only [start, end), once scrub_to is applied
+  hobject_t start;
+  hobject_t end;
+  bool deep;             // also digest object data and omap
 
-  MOSDRepScrub() : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION) { }
+  MOSDRepScrub() : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION), chunky(false),
+		   deep(false) { }
   MOSDRepScrub(pg_t pgid, eversion_t scrub_from, eversion_t scrub_to,
-	       epoch_t map_epoch)
+	       epoch_t map_epoch, bool deep)
     : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION),
       pgid(pgid),
       scrub_from(scrub_from),
       scrub_to(scrub_to),
-      map_epoch(map_epoch) { }
+      map_epoch(map_epoch),
+      chunky(false),
+      deep(deep) { }
+  MOSDRepScrub(pg_t pgid, eversion_t scrub_to, epoch_t map_epoch,
+	       hobject_t start, hobject_t end, bool deep)
+    : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION),
+      pgid(pgid),
+      scrub_to(scrub_to),
+      map_epoch(map_epoch),
+      chunky(true),
+      start(start),
+      end(end),
+      deep(deep) { }
   
 private:
   ~MOSDRepScrub() {}
@@ -49,6 +66,10 @@ public:
     out << "replica scrub(pg: ";
     out << pgid << ",from:" << scrub_from << ",to:" << scrub_to
 	<< "epoch:" << map_epoch;
+    if (chunky)
+      out << ",chunk:[" << start << "," << end << ")";
+    if (deep)
+      out << ",deep";
     out << ")";
   }
 
@@ -57,6 +78,10 @@ public:
     ::encode(scrub_from, payload);
     ::encode(scrub_to, payload);
     ::encode(map_epoch, payload);
+    ::encode(chunky, payload);
+    ::encode(start, payload);
+    ::encode(end, payload);
+    ::encode(deep, payload);
   }
   void decode_payload() {
     bufferlist::iterator p = payload.begin();
@@ -64,6 +89,18 @@ public:
     ::decode(scrub_from, p);
     ::decode(scrub_to, p);
     ::decode(map_epoch, p);
+    if (header.version >= 3) {
+      ::decode(chunky, p);
+      ::decode(start, p);
+      ::decode(end, p);
+    } else {
+      chunky = false;
+    }
+    if (header.version >= 4) {
+      ::decode(deep, p);
+    } else {
+      deep = false;
+    }
   }
 };
 
@@ -0,0 +1,242 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "LevelDBMonitorStore.h"
+#include "os/LevelDBStore.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/config.h"
+
+#include <errno.h>
+#include <sstream>
+
+#define dout_subsys ceph_subsys_mon
+#undef dout_prefix
+#define dout_prefix _prefix(_dout, dir)
+static ostream& _prefix(std::ostream *_dout, const string& dir) {
+  return *_dout << "store(" << dir << ") ";
+}
+
+const char *LevelDBMonitorStore::DB_DIR = "store.db";
+
+LevelDBMonitorStore::LevelDBMonitorStore(const std::string &d)
+  : MonitorStore(d)
+{
+}
+
+LevelDBMonitorStore::~LevelDBMonitorStore()
+{
+}
+
+void LevelDBMonitorStore::get_key(const char *a, const char *b,
+				  string *prefix, string *key)
+{
+  if (b) {
+    *prefix = a;
+    *key = b;
+  } else {
+    *prefix = string();
+    *key = a;
+  }
+}
+
+int LevelDBMonitorStore::open_db()
+{
+  if (db)
+    return 0;
+  string path = dir + "/" + DB_DIR;
+  LevelDBStore *store = new LevelDBStore(path);
+  ostringstream err;
+  int r = store->init(err);
+  if (r < 0) {
+    derr << "unable to open leveldb at " << path << ": " << err.str() << dendl;
+    delete store;
+    return r;
+  }
+  db.reset(store);
+  dout(10) << "opened leveldb at " << path << dendl;
+  return 0;
+}
+
+int LevelDBMonitorStore::mkfs()
+{
+  int r = MonitorStore::mkfs();
+  if (r < 0)
+    return r;
+  return open_db();
+}
+
+int LevelDBMonitorStore::mount()
+{
+  int r = MonitorStore::mount();
+  if (r < 0)
+    return r;
+  return open_db();
+}
+
+int LevelDBMonitorStore::umount()
+{
+  db.reset();
+  return MonitorStore::umount();
+}
+
+version_t LevelDBMonitorStore::get_int(const char *a, const char *b)
+{
+  bufferlist bl;
+  int r = get_bl_ss(bl, a, b);
+  if (r < 0)
+    return 0;   // like a missing file
+  version_t val = decode_int(bl);
+  if (b) {
+    dout(15) << "get_int " << a << "/" << b << " = " << val << dendl;
+  } else {
+    dout(15) << "get_int " << a << " = " << val << dendl;
+  }
+  return val;
+}
+
+void LevelDBMonitorStore::put_int(version_t val, const char *a, const char *b)
+{
+  if (b) {
+    dout(15) << "set_int " << a << "/" << b << " = " << val << dendl;
+  } else {
+    dout(15) << "set_int " << a << " = " << val << dendl;
+  }
+  bufferlist bl;
+  encode_int(val, bl);
+  int r = write_bl_ss(bl, a, b, false);
+  if (r < 0) {
+    derr << "LevelDBMonitorStore::put_int: failed to write " << a << "/"
+	 << (b ? b : "") << ": " << cpp_strerror(r) << dendl;
+    ceph_abort();
+  }
+}
+
+bool LevelDBMonitorStore::exists_bl_ss(const char *a, const char *b)
+{
+  bufferlist bl;
+  return get_bl_ss(bl, a, b) >= 0;
+}
+
+int LevelDBMonitorStore::get_bl_ss(bufferlist& bl, const char *a, const char *b)
+{
+  assert(db);
+  string prefix, key;
+  get_key(a, b, &prefix, &key);
+  set<string> keys;
+  keys.insert(key);
+  map<string,bufferlist> out;
+  db->get(prefix, keys, &out);
+  if (!out.count(key)) {
+    dout(15) << "get_bl " << prefix << "/" << key << " dne" << dendl;
+    return -ENOENT;
+  }
+  bl.clear();
+  bl.claim(out[key]);
+  dout(15) << "get_bl " << prefix << "/" << key << " = " << bl.length()
+	   << " bytes" << dendl;
+  return bl.length();
+}
+
+int LevelDBMonitorStore::write_bl_ss(bufferlist& bl, const char *a,
+				     const char *b, bool append)
+{
+  Transaction t;
+  if (append) {
+    bufferlist old;
+    get_bl_ss(old, a, b);
+    old.append(bl);
+    t.put_bl_ss(old, a, b);
+  } else {
+    t.put_bl_ss(bl, a, b);
+  }
+  int r = apply_transaction(t);
+  if (r < 0)
+    derr << "write_bl_ss " << a << "/" << (b ? b : "") << " got error "
+	 << cpp_strerror(r) << dendl;
+  assert(r == 0);  // for now, like the file store
+  return 0;
+}
+
+int LevelDBMonitorStore::put_bl_sn_map(const char *a,
+				       map<version_t,bufferlist>::iterator start,
+				       map<version_t,bufferlist>::iterator end)
+{
+  Transaction t;
+  t.put_bl_sn_map(a, start, end);
+  return apply_transaction(t);
+}
+
+int LevelDBMonitorStore::erase_ss(const char *a, const char *b)
+{
+  Transaction t;
+  t.erase_ss(a, b);
+  return apply_transaction(t);
+}
+
+int LevelDBMonitorStore::apply_transaction(Transaction& t)
+{
+  assert(db);
+  KeyValueDB::Transaction dbt = db->get_transaction();
+  for (list<Transaction::Op>::iterator p = t.ops.begin();
+       p != t.ops.end();
+       ++p) {
+    const char *b = p->b.length() ? p->b.c_str() : 0;
+    string prefix, key;
+    get_key(p->a.c_str(), b, &prefix, &key);
+    switch (p->op) {
+    case Transaction::OP_PUT:
+      {
+	dout(15) << "put_bl " << prefix << "/" << key << " = "
+		 << p->bl.length() << " bytes" << dendl;
+	map<string,bufferlist> to_set;
+	to_set[key] = p->bl;
+	dbt->set(prefix, to_set);
+      }
+      break;
+    case Transaction::OP_PUT_MAP:
+      {
+	map<string,bufferlist> to_set;
+	for (map<version_t,bufferlist>::iterator q = p->vals.begin();
+	     q != p->vals.end();
+	     ++q) {
+	  char bs[20];
+	  snprintf(bs, sizeof(bs), "%llu", (unsigned long long)q->first);
+	  to_set[bs] = q->second;
+	}
+	dout(15) << "put_bl_sn_map " << p->a << " " << to_set.size()
+		 << " values" << dendl;
+	dbt->set(p->a, to_set);
+      }
+      break;
+    case Transaction::OP_ERASE:
+      {
+	dout(15) << "erase_ss " << prefix << "/" << key << dendl;
+	set<string> keys;
+	keys.insert(key);
+	dbt->rmkeys(prefix, keys);
+      }
+      break;
+    default:
+      assert(0 == "unknown MonitorStore::Transaction op");
+    }
+  }
+  int r = db->submit_transaction_sync(dbt);
+  if (r < 0) {
+    derr << "apply_transaction failed to commit " << t.ops.size()
+	 << " ops" << dendl;
+    return -EIO;
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MON_LEVELDBMONITORSTORE_H
+#define CEPH_MON_LEVELDBMONITORSTORE_H
+
+#include "MonitorStore.h"
+
+#include <boost/scoped_ptr.hpp>
+
+class LevelDBStore;
+
+/**
+ * MonitorStore kept in a LevelDB under <mon data>/store.db instead of a
+ * file per value.
+ *
+ * a/b is stored as key b with prefix a, and a top-level a as key a with
+ * an empty prefix; values, including ints, are stored byte for byte as
+ * the file store would write them, so a store can be converted by
+ * copying each file into its key.  The lock file is still used to keep
+ * a second ceph-mon off the same data.
+ */
+class LevelDBMonitorStore : public MonitorStore {
+  boost::scoped_ptr<LevelDBStore> db;
+
+  int open_db();
+  static void get_key(const char *a, const char *b,
+		      string *prefix, string *key);
+
+protected:
+  int write_bl_ss(bufferlist& bl, const char *a, const char *b,
+		  bool append);
+
+public:
+  static const char *DB_DIR;
+
+  LevelDBMonitorStore(const std::string &d);
+  ~LevelDBMonitorStore();
+
+  bool is_leveldb() const { return true; }
+
+  int mkfs();
+  int mount();
+  int umount();
+
+  version_t get_int(const char *a, const char *b=0);
+  void put_int(version_t v, const char *a, const char *b=0);
+
+  bool exists_bl_ss(const char *a, const char *b=0);
+  int get_bl_ss(bufferlist& bl, const char *a, const char *b);
+  int put_bl_sn_map(const char *a,
+		    map<version_t,bufferlist>::iterator start,
+		    map<version_t,bufferlist>::iterator end);
+  int erase_ss(const char *a, const char *b);
+
+  int apply_transaction(Transaction& t);
+};
+
+#endif
@@ -888,15 +888,18 @@ void Monitor::handle_probe_data(MMonProbe *m)
 
   // store any new stuff
   if (m->paxos_values.size()) {
+    MonitorStore::Transaction t;
     for (map<string, map<version_t, bufferlist> >::iterator p = m->paxos_values.begin();
 	 p != m->paxos_values.end();
 	 ++p) {
-      store->put_bl_sn_map(p->first.c_str(), p->second.begin(), p->second.end());
+      t.put_bl_sn_map(p->first.c_str(), p->second.begin(), p->second.end());
     }
 
     pax->last_committed = m->paxos_values.begin()->second.rbegin()->first;
-    store->put_int(pax->last_committed, m->machine_name.c_str(),
-		   "last_committed");
+    t.put_int(pax->last_committed, m->machine_name.c_str(),
+	      "last_committed");
+    int r = store->apply_transaction(t);
+    assert(r == 0);
   }
 
   // latest?
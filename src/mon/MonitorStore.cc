@@ -13,6 +13,7 @@
  */
 
 #include "MonitorStore.h"
+#include "LevelDBMonitorStore.h"
 #include "common/Clock.h"
 #include "common/debug.h"
 #include "common/entity_name.h"
@@ -45,6 +46,20 @@ static ostream& _prefix(std::ostream *_dout, const string& dir) {
 #include <sstream>
 #include <sys/file.h>
 
+MonitorStore *MonitorStore::create(const string &d)
+{
+  struct stat st;
+  string db = d + "/" + LevelDBMonitorStore::DB_DIR;
+  if (::stat(db.c_str(), &st) == 0)
+    return new LevelDBMonitorStore(d);
+  string magic = d + "/magic";
+  if (::stat(magic.c_str(), &st) == 0)
+    return new MonitorStore(d);
+  if (g_conf->mon_leveldb)
+    return new LevelDBMonitorStore(d);
+  return new MonitorStore(d);
+}
+
 int MonitorStore::mount()
 {
   char t[1024];
@@ -420,3 +435,31 @@ int MonitorStore::put_bl_sn_map(const char *a,
   return 0;
 }
 
+int MonitorStore::apply_transaction(Transaction& t)
+{
+  dout(15) << "apply_transaction " << t.ops.size() << " ops" << dendl;
+  for (list<Transaction::Op>::iterator p = t.ops.begin();
+       p != t.ops.end();
+       ++p) {
+    const char *b = p->b.length() ? p->b.c_str() : 0;
+    int err = 0;
+    switch (p->op) {
+    case Transaction::OP_PUT:
+      err = put_bl_ss(p->bl, p->a.c_str(), b);
+      break;
+    case Transaction::OP_PUT_MAP:
+      if (!p->vals.empty())
+	err = put_bl_sn_map(p->a.c_str(), p->vals.begin(), p->vals.end());
+      break;
+    case Transaction::OP_ERASE:
+      // like erase_ss, a missing file is not an error
+      erase_ss(p->a.c_str(), b);
+      break;
+    default:
+      assert(0 == "unknown MonitorStore::Transaction op");
+    }
+    if (err < 0)
+      return err;
+  }
+  return 0;
+}
@@ -20,31 +20,48 @@
 
 #include <iosfwd>
 #include <string.h>
+#include <stdlib.h>
 
 class MonitorStore {
+protected:
   string dir;
   int lock_fd;
 
+private:
   int write_bl_ss_impl(bufferlist& bl, const char *a, const char *b,
 		       bool append);
-  int write_bl_ss(bufferlist& bl, const char *a, const char *b,
-		  bool append);
+protected:
+  virtual int write_bl_ss(bufferlist& bl, const char *a, const char *b,
+			  bool append);
 public:
-  MonitorStore(const std::string &d) : dir(d) { }
-  ~MonitorStore() { }
+  MonitorStore(const std::string &d) : dir(d), lock_fd(-1) { }
+  virtual ~MonitorStore() { }
 
-  int mkfs();  // wipe
-  int mount();
-  int umount();
+  /**
+   * Create the right store for dir: LevelDB if dir already holds one,
+   * the file-per-version layout if it holds one of those, and otherwise
+   * (for mkfs) whichever mon_leveldb asks for.
+   *
+   * @param d - monitor data directory
+   * @return a new, unmounted store
+   */
+  static MonitorStore *create(const std::string &d);
+
+  /// true if this store is backed by a LevelDB rather than files
+  virtual bool is_leveldb() const { return false; }
+
+  virtual int mkfs();  // wipe
+  virtual int mount();
+  virtual int umount();
 
   // ints (stored as ascii)
-  version_t get_int(const char *a, const char *b=0);
-  void put_int(version_t v, const char *a, const char *b=0);
+  virtual version_t get_int(const char *a, const char *b=0);
+  virtual void put_int(version_t v, const char *a, const char *b=0);
 
   // buffers
   // ss and sn varieties.
-  bool exists_bl_ss(const char *a, const char *b=0);
-  int get_bl_ss(bufferlist& bl, const char *a, const char *b);
+  virtual bool exists_bl_ss(const char *a, const char *b=0);
+  virtual int get_bl_ss(bufferlist& bl, const char *a, const char *b);
   int put_bl_ss(bufferlist& bl, const char *a, const char *b) {
     return write_bl_ss(bl, a, b, false);
   }
@@ -73,17 +90,88 @@ public:
    * @param vals - map of int name -> values
    * @return 0 for success or negative error code
    */
-  int put_bl_sn_map(const char *a,
-		    map<version_t,bufferlist>::iterator start,
-		    map<version_t,bufferlist>::iterator end);
+  virtual int put_bl_sn_map(const char *a,
+			    map<version_t,bufferlist>::iterator start,
+			    map<version_t,bufferlist>::iterator end);
 
-  int erase_ss(const char *a, const char *b);
+  virtual int erase_ss(const char *a, const char *b);
   int erase_sn(const char *a, version_t b) {
     char bs[20];
     snprintf(bs, sizeof(bs), "%llu", (unsigned long long)b);
     return erase_ss(a, bs);
   }
 
+  /**
+   * A batch of updates for apply_transaction().
+   *
+   * A LevelDB store applies the whole batch atomically with a single
+   * sync, so e.g. a paxos value and last_committed can never be seen
+   * out of step.  The file store applies the updates one at a time, in
+   * order, exactly as if they had been made directly.
+   */
+  struct Transaction {
+    enum {
+      OP_PUT = 1,      // a/b = bl
+      OP_PUT_MAP = 2,  // a/<version> = vals[version]
+      OP_ERASE = 3,    // remove a/b
+    };
+    struct Op {
+      int op;
+      string a, b;     // empty b means just a
+      bufferlist bl;
+      map<version_t,bufferlist> vals;
+      Op(int o, const char *a_, const char *b_)
+	: op(o), a(a_), b(b_ ? b_ : "") {}
+    };
+    list<Op> ops;
+
+    bool empty() const {
+      return ops.empty();
+    }
+    void put_bl_ss(bufferlist& bl, const char *a, const char *b) {
+      ops.push_back(Op(OP_PUT, a, b));
+      ops.back().bl = bl;
+    }
+    void put_bl_sn(bufferlist& bl, const char *a, version_t b) {
+      char bs[20];
+      snprintf(bs, sizeof(bs), "%llu", (unsigned long long)b);
+      put_bl_ss(bl, a, bs);
+    }
+    void put_bl_sn_map(const char *a,
+		       map<version_t,bufferlist>::iterator start,
+		       map<version_t,bufferlist>::iterator end) {
+      ops.push_back(Op(OP_PUT_MAP, a, 0));
+      ops.back().vals.insert(start, end);
+    }
+    void put_int(version_t v, const char *a, const char *b=0) {
+      bufferlist bl;
+      encode_int(v, bl);
+      put_bl_ss(bl, a, b);
+    }
+    void erase_ss(const char *a, const char *b) {
+      ops.push_back(Op(OP_ERASE, a, b));
+    }
+    void erase_sn(const char *a, version_t b) {
+      char bs[20];
+      snprintf(bs, sizeof(bs), "%llu", (unsigned long long)b);
+      erase_ss(a, bs);
+    }
+  };
+
+  /// apply t; see Transaction
+  virtual int apply_transaction(Transaction& t);
+
+  /// the on-disk (ascii) representation of an int
+  static void encode_int(version_t v, bufferlist& bl) {
+    char vs[30];
+    snprintf(vs, sizeof(vs), "%lld\n", (unsigned long long)v);
+    bl.append(vs);
+  }
+  static version_t decode_int(bufferlist& bl) {
+    string s(bl.c_str(), bl.length());
+    return strtoull(s.c_str(), NULL, 10);
+  }
+
   /*
   version_t get_incarnation() { return get_int("incarnation"); }
   void set_incarnation(version_t i) { set_int(i, "incarnation"); }
@@ -739,6 +739,9 @@ bool OSDMonitor::preprocess_boot(MOSDBoot *m)
   }
 
   assert(m->get_orig_source_inst().name.is_osd());
+
+  // every monitor records these, so that whichever leads next knows
+  osd_features[from] = m->osd_features;
   
   // already booted?
   if (osdmap.is_up(from) &&
@@ -765,6 +768,32 @@ bool OSDMonitor::preprocess_boot(MOSDBoot *m)
   return true;
 }
 
+/*
+ * a crush map using features that a monitor in the quorum or an up osd
+ * doesn't advertise would leave it unable to decode the osdmap.
+ */
+bool OSDMonitor::check_crush_features(CrushWrapper& crush, ostream& ss)
+{
+  if (!crush.has_straw_tree_buckets())
+    return true;
+  if ((mon->get_quorum_features() & CEPH_FEATURE_CRUSH_STRAW_TREE) == 0) {
+    ss << "not all monitors in the quorum support straw_tree buckets";
+    return false;
+  }
+  for (int o = 0; o < osdmap.get_max_osd(); o++) {
+    if (!osdmap.is_up(o))
+      continue;
+    map<int,uint64_t>::iterator p = osd_features.find(o);
+    if (p == osd_features.end() ||
+	(p->second & CEPH_FEATURE_CRUSH_STRAW_TREE) == 0) {
+      ss << "osd." << o << " has not advertised straw_tree support"
+	 << (p == osd_features.end() ? " since this monitor started" : "");
+      return false;
+    }
+  }
+  return true;
+}
+
 bool OSDMonitor::prepare_boot(MOSDBoot *m)
 {
   dout(7) << "prepare_boot from " << m->get_orig_source_inst() << " sb " << m->sb
@@ -1027,7 +1056,11 @@ bool OSDMonitor::prepare_remove_snaps(MRemoveSnaps *m)
   for (map<int, vector<snapid_t> >::iterator p = m->snaps.begin(); 
        p != m->snaps.end();
        p++) {
-    pg_pool_t& pi = osdmap.pools[p->first];
+    if (!osdmap.have_pg_pool(p->first)) {
+      dout(10) << " ignoring removed_snaps " << p->second << " on non-existent pool " << p->first << dendl;
+      continue;
+    }
+    const pg_pool_t& pi = *osdmap.get_pg_pool(p->first);
     for (vector<snapid_t>::iterator q = p->second.begin();
 	 q != p->second.end();
 	 q++) {
@@ -1594,10 +1627,11 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	r = 0;
       }
     }
-    else if ((m->cmd[1] == "scrub" || m->cmd[1] == "repair")) {
+    else if ((m->cmd[1] == "scrub" || m->cmd[1] == "deep-scrub" ||
+	      m->cmd[1] == "repair")) {
       if (m->cmd.size() <= 2) {
 	r = -EINVAL;
-	ss << "usage: osd [scrub|repair] <who>";
+	ss << "usage: osd [scrub|deep-scrub|repair] <who>";
 	goto out;
       }
       if (m->cmd[2] == "*") {
@@ -1607,7 +1641,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	  if (osdmap.is_up(i)) {
 	    ss << (c++ ? ",":"") << i;
 	    mon->try_send_message(new MOSDScrub(osdmap.get_fsid(),
-						m->cmd[1] == "repair"),
+						m->cmd[1] == "repair",
+						m->cmd[1] == "deep-scrub"),
 				  osdmap.get_inst(i));
 	  }	    
 	r = 0;
@@ -1616,7 +1651,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	long osd = strtol(m->cmd[2].c_str(), 0, 10);
 	if (osdmap.is_up(osd)) {
 	  mon->try_send_message(new MOSDScrub(osdmap.get_fsid(),
-					      m->cmd[1] == "repair"),
+					      m->cmd[1] == "repair",
+					      m->cmd[1] == "deep-scrub"),
 				osdmap.get_inst(osd));
 	  r = 0;
 	  ss << "osd." << osd << " instructed to " << m->cmd[1];
@@ -1629,8 +1665,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
       if (m->cmd.size() > 2) {
 	uid_pools = strtol(m->cmd[2].c_str(), NULL, 10);
       }
-      for (map<int64_t, pg_pool_t>::iterator p = osdmap.pools.begin();
-	   p != osdmap.pools.end();
+      for (map<int64_t, pg_pool_t>::iterator p = osdmap.pools->begin();
+	   p != osdmap.pools->end();
 	   ++p) {
 	if (!uid_pools || p->second.auid == uid_pools) {
 	  ss << p->first << ' ' << osdmap.pool_name[p->first] << ',';
@@ -1777,6 +1813,11 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	goto out;
       }
 
+      if (!check_crush_features(crush, ss)) {
+	err = -EPERM;
+	goto out;
+      }
+
       // sanity check: test some inputs to make sure this map isn't totally broken
       dout(10) << " testing map" << dendl;
       stringstream ess;
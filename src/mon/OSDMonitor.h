@@ -50,6 +50,11 @@ private:
 
   map<int,double> osd_weight;
 
+  /// features each osd reported when it last booted through us; an up
+  /// osd that isn't here may be too old for new map features
+  map<int,uint64_t> osd_features;
+  bool check_crush_features(CrushWrapper& crush, ostream& ss);
+
   // map thrashing
   int thrash_map;
   int thrash_last_up_osd;
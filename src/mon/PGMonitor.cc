@@ -684,8 +684,8 @@ bool PGMonitor::register_new_pgs()
   OSDMap *osdmap = &mon->osdmon()->osdmap;
 
   int created = 0;
-  for (map<int64_t,pg_pool_t>::iterator p = osdmap->pools.begin();
-       p != osdmap->pools.end();
+  for (map<int64_t,pg_pool_t>::iterator p = osdmap->pools->begin();
+       p != osdmap->pools->end();
        p++) {
     int64_t poolid = p->first;
     pg_pool_t &pool = p->second;
@@ -991,7 +991,8 @@ bool PGMonitor::preprocess_command(MMonCommand *m)
       } else
 	ss << "invalid pgid '" << m->cmd[2] << "'";
     }
-    else if ((m->cmd[1] == "scrub" || m->cmd[1] == "repair") && m->cmd.size() == 3) {
+    else if ((m->cmd[1] == "scrub" || m->cmd[1] == "deep-scrub" ||
+	      m->cmd[1] == "repair") && m->cmd.size() == 3) {
       pg_t pgid;
       r = -EINVAL;
       if (pgid.parse(m->cmd[2].c_str())) {
@@ -1002,7 +1003,8 @@ bool PGMonitor::preprocess_command(MMonCommand *m)
 	      vector<pg_t> pgs(1);
 	      pgs[0] = pgid;
 	      mon->try_send_message(new MOSDScrub(mon->monmap->fsid, pgs,
-						  m->cmd[1] == "repair"),
+						  m->cmd[1] == "repair",
+						  m->cmd[1] == "deep-scrub"),
 				    mon->osdmon()->osdmap.get_inst(osd));
 	      ss << "instructing pg " << pgid << " on osd." << osd << " to " << m->cmd[1];
 	      r = 0;
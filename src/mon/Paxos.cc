@@ -210,9 +210,12 @@ void Paxos::store_state(MMonPaxos *m)
 
     first_committed = m->latest_version;
     last_committed = m->latest_version;
-    mon->store->put_bl_sn(start->second, machine_name, m->latest_version);
-    mon->store->put_int(first_committed, machine_name, "first_committed");
-    mon->store->put_int(last_committed, machine_name, "last_committed");
+    MonitorStore::Transaction t;
+    t.put_bl_sn(start->second, machine_name, m->latest_version);
+    t.put_int(first_committed, machine_name, "first_committed");
+    t.put_int(last_committed, machine_name, "last_committed");
+    int r = mon->store->apply_transaction(t);
+    assert(r == 0);
   }
 
   // build map of values to store
@@ -243,9 +246,12 @@ void Paxos::store_state(MMonPaxos *m)
     dout(10) << "store_state [" << start->first << ".." 
 	     << last_committed << "]" << dendl;
 
-    mon->store->put_bl_sn_map(machine_name, start, end);
-    mon->store->put_int(last_committed, machine_name, "last_committed");
-    mon->store->put_int(first_committed, machine_name, "first_committed");
+    MonitorStore::Transaction t;
+    t.put_bl_sn_map(machine_name, start, end);
+    t.put_int(last_committed, machine_name, "last_committed");
+    t.put_int(first_committed, machine_name, "first_committed");
+    int r = mon->store->apply_transaction(t);
+    assert(r == 0);
   }
 }
 
@@ -519,11 +525,14 @@ void Paxos::commit()
   // commit locally
   last_committed++;
   last_commit_time = ceph_clock_now(g_ceph_context);
-  mon->store->put_int(last_committed, machine_name, "last_committed");
+  MonitorStore::Transaction t;
+  t.put_int(last_committed, machine_name, "last_committed");
   if (!first_committed) {
     first_committed = last_committed;
-    mon->store->put_int(last_committed, machine_name, "first_committed");
+    t.put_int(last_committed, machine_name, "first_committed");
   }
+  int r = mon->store->apply_transaction(t);
+  assert(r == 0);
 
   // tell everyone
   for (set<int>::const_iterator p = mon->get_quorum().begin();
@@ -751,17 +760,20 @@ void Paxos::trim_to(version_t first, bool force)
   if (first_committed >= first)
     return;
 
+  MonitorStore::Transaction t;
   while (first_committed < first &&
 	 (force || first_committed < latest_stashed)) {
     dout(10) << "trim " << first_committed << dendl;
-    mon->store->erase_sn(machine_name, first_committed);
+    t.erase_sn(machine_name, first_committed);
     for (list<string>::iterator p = extra_state_dirs.begin();
 	 p != extra_state_dirs.end();
 	 ++p)
-      mon->store->erase_sn(p->c_str(), first_committed);
+      t.erase_sn(p->c_str(), first_committed);
     first_committed++;
   }
-  mon->store->put_int(first_committed, machine_name, "first_committed");
+  t.put_int(first_committed, machine_name, "first_committed");
+  int r = mon->store->apply_transaction(t);
+  assert(r == 0);
 }
 
 /*
@@ -33,6 +33,35 @@ public:
   // how i receive messages
   virtual bool ms_dispatch(Message *m) = 0;
 
+  /**
+   * Say whether m can be handed to ms_fast_dispatch() instead of being
+   * queued for ms_dispatch(). This is called from the thread that read
+   * the message, so it must be quick and must not block. It may be
+   * asked more than once about the same Message and must give the same
+   * answer each time.
+   *
+   * @param m The Message. You are not granted a reference to it.
+   * @return True if ms_fast_dispatch() should get m.
+   */
+  virtual bool ms_can_fast_dispatch(Message *m) { return false; }
+  /**
+   * Handle a Message straight from the thread that read it, ahead of
+   * anything still queued for ms_dispatch() on the same Connection.
+   * Only Messages for which ms_can_fast_dispatch() returned true get
+   * here. Nothing more is read from the Connection until this returns
+   * (nor, with ms_event_workers, from the other Connections of the same
+   * worker), so implementations should not block on locks that
+   * ms_dispatch() may hold for long (e.g. the daemon's big lock).
+   * Return false instead, and m is queued for ms_dispatch() behind
+   * whatever is already queued on its Connection; keeping later Messages
+   * from overtaking it is then up to the Dispatcher.
+   *
+   * @param m The Message. You are granted a reference to it only if you
+   * return true.
+   * @return True if m was handled, false to queue it for ms_dispatch().
+   */
+  virtual bool ms_fast_dispatch(Message *m) { assert(0); return false; }
+
   /**
    * This function will be called whenever a new Connection is made to the
    * Messenger.
@@ -64,6 +93,27 @@ public:
    * a reference to it.
    */
   virtual void ms_handle_remote_reset(Connection *con) = 0;
+
+  /**
+   * Supply the buffer an incoming message's data payload should be
+   * read into. This is called from the reader before any data has
+   * arrived, with no messenger locks held, so the Dispatcher can hand
+   * out memory that is already laid out the way it will be consumed
+   * (e.g. page aligned for an O_DIRECT journal write) instead of
+   * having it copied later. Buffers posted for a tid with
+   * Connection::post_rx_buffer() take precedence.
+   *
+   * @param con The Connection the message is arriving on. You are not
+   * granted a reference to it.
+   * @param header The header of the incoming message.
+   * @param data Output param: an empty bufferlist to fill in. It must be
+   * at least header.data_len bytes long; anything beyond that is ignored.
+   *
+   * @return True if data was filled in, false to let the Messenger
+   * allocate the buffer itself.
+   */
+  virtual bool ms_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+				bufferlist& data) { return false; }
   
   /**
    * @defgroup Authentication
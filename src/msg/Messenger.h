@@ -509,6 +509,39 @@ protected:
     dout_emergency(oss.str());
     assert(0);
   }
+  /**
+   * Check whether any Dispatcher wants m via ms_fast_dispatch().
+   *
+   * @param m The Message in question.
+   * @return True if ms_deliver_fast_dispatch() can deliver m.
+   */
+  bool ms_can_fast_dispatch(Message *m) {
+    for (list<Dispatcher*>::iterator p = dispatchers.begin();
+	 p != dispatchers.end();
+	 p++)
+      if ((*p)->ms_can_fast_dispatch(m))
+	return true;
+    return false;
+  }
+  /**
+   * Deliver a single Message to the first Dispatcher that can fast
+   * dispatch it. Only call this after ms_can_fast_dispatch() said yes.
+   *
+   * @param m The Message to deliver. We take ownership of
+   * one reference to it if it is handled.
+   * @return False if the Dispatcher declined m, which must then be
+   * queued for ms_deliver_dispatch().
+   */
+  bool ms_deliver_fast_dispatch(Message *m) {
+    m->set_dispatch_stamp(ceph_clock_now(cct));
+    for (list<Dispatcher*>::iterator p = dispatchers.begin();
+	 p != dispatchers.end();
+	 p++)
+      if ((*p)->ms_can_fast_dispatch(m))
+	return (*p)->ms_fast_dispatch(m);
+    assert(0);
+    return false;
+  }
   /**
    * Notify each Dispatcher of a new Connection. Call
    * this function whenever a new Connection is initiated.
@@ -548,6 +581,24 @@ protected:
 	 p++)
       (*p)->ms_handle_remote_reset(con);
   }
+  /**
+   * Ask each Dispatcher in turn for the buffer an incoming message's
+   * data payload should be read into.
+   *
+   * @param con The Connection the message is arriving on.
+   * @param header The header of the incoming message.
+   * @param data Output param: filled in by the Dispatcher, if any.
+   * @return True if a Dispatcher supplied the buffer, false otherwise.
+   */
+  bool ms_deliver_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+				bufferlist& data) {
+    for (list<Dispatcher*>::iterator p = dispatchers.begin();
+	 p != dispatchers.end();
+	 p++)
+      if ((*p)->ms_get_rx_buffer(con, header, data))
+	return true;
+    return false;
+  }
   /**
    * Get the AuthAuthorizer for a new outgoing Connection.
    *
@@ -24,6 +24,7 @@
 #include <limits.h>
 #include <sys/user.h>
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "common/config.h"
 #include "global/global_init.h"
@@ -38,6 +39,7 @@
 #include "common/Timer.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/pipe.h"
 #include "include/page.h"
 
 #include "include/compat.h"
@@ -379,9 +381,11 @@ void SimpleMessenger::DispatchQueue::entry()
   lock.Unlock();
 }
 
-void SimpleMessenger::dispatch_entry()
+void SimpleMessenger::dispatch_entry(DispatchQueue *dq)
 {
-  dispatch_queue.entry();
+  dq->entry();
+  if (dq != &dispatch_queue)
+    return;
 
   //tell everything else it's time to stop
   lock.Lock();
@@ -390,11 +394,35 @@ void SimpleMessenger::dispatch_entry()
   lock.Unlock();
 }
 
+bool SimpleMessenger::fast_dispatch(Message *m)
+{
+  uint64_t msize = m->get_dispatch_throttle_size();
+  m->set_dispatch_throttle_size(0);
+
+  ldout(cct,1) << "<== " << m->get_source_inst()
+	       << " " << m->get_seq()
+	       << " ==== " << *m
+	       << " ==== " << m->get_payload().length() << "+" << m->get_middle().length()
+	       << "+" << m->get_data().length()
+	       << " " << m << " con " << m->get_connection()
+	       << " (fast)" << dendl;
+  if (!ms_deliver_fast_dispatch(m)) {
+    ldout(cct,20) << "fast dispatch declined " << m << ", queueing" << dendl;
+    m->set_dispatch_throttle_size(msize);
+    return false;
+  }
+
+  dispatch_throttle_release(msize);
+  return true;
+}
+
 void SimpleMessenger::ready()
 {
   ldout(cct,10) << "ready " << get_myaddr() << dendl;
-  assert(!dispatch_thread.is_started());
-  dispatch_thread.create();
+  for (unsigned i = 0; i < dispatch_threads.size(); i++) {
+    assert(!dispatch_threads[i]->is_started());
+    dispatch_threads[i]->create();
+  }
 }
 
 
@@ -402,16 +430,19 @@ int SimpleMessenger::shutdown()
 {
   ldout(cct,10) << "shutdown " << get_myaddr() << dendl;
 
-  // stop my dispatch thread
-  if (dispatch_thread.am_self()) {
-    ldout(cct,10) << "shutdown i am dispatch, setting stop flag" << dendl;
-    dispatch_queue.stop = true;
-  } else {
-    ldout(cct,10) << "shutdown i am not dispatch, setting stop flag and joining thread." << dendl;
-    dispatch_queue.lock.Lock();
-    dispatch_queue.stop = true;
-    dispatch_queue.cond.Signal();
-    dispatch_queue.lock.Unlock();
+  // stop my dispatch threads
+  for (unsigned i = 0; i < dispatch_queues.size(); i++) {
+    DispatchQueue *dq = dispatch_queues[i];
+    if (dispatch_threads[i]->am_self()) {
+      ldout(cct,10) << "shutdown i am dispatch, setting stop flag" << dendl;
+      dq->stop = true;
+    } else {
+      ldout(cct,10) << "shutdown i am not dispatch, setting stop flag and joining thread." << dendl;
+      dq->lock.Lock();
+      dq->stop = true;
+      dq->cond.Signal();
+      dq->lock.Unlock();
+    }
   }
 
   mark_down_all();
@@ -527,7 +558,7 @@ ostream& SimpleMessenger::Pipe::_pipe_prefix(std::ostream *_dout) {
 void SimpleMessenger::Pipe::queue_received(Message *m, int priority)
 {
   assert(pipe_lock.is_locked());
-  in_q->queue(m, priority, &msgr->dispatch_queue);
+  in_q->queue(m, priority);
 }
 
 
@@ -753,6 +784,22 @@ int SimpleMessenger::Pipe::accept()
       }
 
       if (connect.connect_seq == existing->connect_seq) {
+	// if the existing connection already opened, this is not a race
+	// to resolve here: the peer's last attempt got far enough for us to
+	// open it (and e.g. fault before it saw our READY), so have it bump
+	// its connect_seq and retry.
+	if (existing->state == STATE_OPEN) {
+	  ldout(msgr->cct,10) << "accept connection race, existing " << existing
+			      << ".cseq " << existing->connect_seq
+			      << " == " << connect.connect_seq
+			      << ", OPEN, RETRY_SESSION" << dendl;
+	  reply.tag = CEPH_MSGR_TAG_RETRY_SESSION;
+	  reply.connect_seq = existing->connect_seq + 1;
+	  existing->pipe_lock.Unlock();
+	  msgr->lock.Unlock();
+	  goto reply;
+	}
+
 	// connection race?
 	if (peer_addr < msgr->my_inst.addr ||
 	    existing->policy.server ||
@@ -862,7 +909,8 @@ int SimpleMessenger::Pipe::accept()
     in_q->pipe = this;
     in_q->restart_queue();
     in_q->lock.Unlock();
-    existing->in_q = new IncomingQueue(msgr->cct, existing);
+    existing->in_q = new IncomingQueue(msgr->cct, existing,
+				       msgr->pick_dispatch_queue());
 
     // steal outgoing queue and out_seq
     existing->requeue_sent();
@@ -928,6 +976,12 @@ int SimpleMessenger::Pipe::accept()
 
   pipe_lock.Lock();
   if (state != STATE_CLOSED) {
+    if (start_event_mode()) {
+      ldout(msgr->cct,10) << "accept handed socket to event worker, " << "state=" << state << dendl;
+      reader_running = false;
+      pipe_lock.Unlock();
+      return 1;   // success; the reader must not touch us again.
+    }
     ldout(msgr->cct,10) << "accept starting writer, " << "state=" << state << dendl;
     start_writer();
   }
@@ -1257,12 +1311,15 @@ int SimpleMessenger::Pipe::connect()
       
       if (!msgr->destination_stopped) {
 	Connection * cstate = connection_state->get();
+	DispatchQueue *dq = in_q->dq;
 	pipe_lock.Unlock();
-	msgr->dispatch_queue.queue_connect(cstate);
+	dq->queue_connect(cstate);
 	pipe_lock.Lock();
       }
       
-      if (!reader_running) {
+      if (start_event_mode()) {
+	ldout(msgr->cct,20) << "connect handed socket to event worker" << dendl;
+      } else if (!reader_running) {
 	ldout(msgr->cct,20) << "connect starting reader" << dendl;
 	start_reader();
       }
@@ -1336,7 +1393,7 @@ void SimpleMessenger::Pipe::discard_queue()
 {
   ldout(msgr->cct,10) << "discard_queue" << dendl;
 
-  in_q->discard_queue(msgr, &msgr->dispatch_queue);
+  in_q->discard_queue(msgr);
   ldout(msgr->cct,20) << " dequeued pipe " << dendl;
 
   for (list<Message*>::iterator p = sent.begin(); p != sent.end(); p++) {
@@ -1434,8 +1491,9 @@ void SimpleMessenger::Pipe::fail()
   
   if (!msgr->destination_stopped) {
     Connection * cstate = connection_state->get();
+    DispatchQueue *dq = in_q->dq;
     pipe_lock.Unlock();
-    msgr->dispatch_queue.queue_reset(cstate);
+    dq->queue_reset(cstate);
     pipe_lock.Lock();
   }
 }
@@ -1449,8 +1507,9 @@ void SimpleMessenger::Pipe::was_session_reset()
 
   if (!msgr->destination_stopped) {
     Connection * cstate = connection_state->get();
+    DispatchQueue *dq = in_q->dq;
     pipe_lock.Unlock();
-    msgr->dispatch_queue.queue_remote_reset(cstate);
+    dq->queue_remote_reset(cstate);
     pipe_lock.Lock();
   }
 
@@ -1474,8 +1533,10 @@ void SimpleMessenger::Pipe::stop()
  */
 void SimpleMessenger::Pipe::reader()
 {
-  if (state == STATE_ACCEPTING) 
-    accept();
+  if (state == STATE_ACCEPTING) {
+    if (accept() > 0)
+      return;  // an EventWorker owns the socket now
+  }
 
   pipe_lock.Lock();
 
@@ -1569,7 +1630,15 @@ void SimpleMessenger::Pipe::reader()
       ldout(msgr->cct,10) << "reader got message "
 	       << m->get_seq() << " " << m << " " << *m
 	       << dendl;
-      queue_received(m);
+      if (msgr->ms_can_fast_dispatch(m)) {
+	pipe_lock.Unlock();
+	bool handled = msgr->fast_dispatch(m);
+	pipe_lock.Lock();
+	if (!handled)
+	  queue_received(m);
+      } else {
+	queue_received(m);
+      }
     } 
     
     else if (tag == CEPH_MSGR_TAG_CLOSE) {
@@ -1619,6 +1688,12 @@ void SimpleMessenger::Pipe::writer()
 	state = STATE_STANDBY;
       } else {
 	connect();
+	if (event_worker) {
+	  ldout(msgr->cct,10) << "writer handing off to event worker" << dendl;
+	  writer_running = false;
+	  pipe_lock.Unlock();
+	  return;
+	}
 	continue;
       }
     }
@@ -1755,6 +1830,24 @@ static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
   }
 }
 
+void SimpleMessenger::Pipe::alloc_rx_data(const ceph_msg_header& header, bufferlist& data)
+{
+  unsigned data_len = le32_to_cpu(header.data_len);
+  if (msgr->ms_deliver_get_rx_buffer(connection_state, header, data)) {
+    ldout(msgr->cct,20) << "reader using dispatcher rx buffer len " << data.length()
+			<< " for tid " << header.tid << dendl;
+    if (data.length() < data_len) {
+      data.push_back(buffer::create(data_len - data.length()));
+    } else if (data.length() > data_len) {
+      bufferlist exact;
+      exact.substr_of(data, 0, data_len);
+      data.swap(exact);
+    }
+    return;
+  }
+  alloc_aligned_buffer(data, data_len, le32_to_cpu(header.data_off));
+}
+
 int SimpleMessenger::Pipe::read_message(Message **pm)
 {
   int ret = -1;
@@ -1854,6 +1947,16 @@ int SimpleMessenger::Pipe::read_message(Message **pm)
     bufferlist newbuf, rxbuf;
     bufferlist::iterator blp;
     int rxbuf_version = 0;
+
+    // unless the caller posted a buffer for this tid, ask the
+    // dispatchers for one now, while we hold no locks.
+    connection_state->lock.Lock();
+    bool posted = connection_state->rx_buffers.count(header.tid);
+    connection_state->lock.Unlock();
+    if (!posted) {
+      alloc_rx_data(header, newbuf);
+      blp = newbuf.begin();
+    }
 	
     while (left > 0) {
       // wait for data
@@ -2166,6 +2269,767 @@ int SimpleMessenger::Pipe::write_message(Message *m)
 }
 
 
+/**************************************
+ * Pipe event mode
+ */
+
+bool SimpleMessenger::Pipe::start_event_mode()
+{
+  assert(pipe_lock.is_locked());
+  assert(!event_worker);
+  if (msgr->event_workers.empty() || state != STATE_OPEN)
+    return false;
+
+  EventWorker *w = msgr->event_workers[msgr->event_worker_rr.inc() %
+				       msgr->event_workers.size()];
+  ev_in_state = EV_IN_TAG;
+  ev_in_pos = 0;
+  ev_last_rx = ceph_clock_now(msgr->cct);
+  w->add_pipe(this);
+  return event_worker != NULL;
+}
+
+void SimpleMessenger::Pipe::_kick_event_worker()
+{
+  if (event_worker)
+    event_worker->kick(this);
+}
+
+/*
+ * Receive into buf until it holds len bytes, remembering our progress in
+ * ev_in_pos across calls.
+ *
+ * @return 1 once buf is full, 0 if the socket would block, -1 on error.
+ */
+int SimpleMessenger::Pipe::event_recv(char *buf, unsigned len)
+{
+  if (msgr->cct->_conf->ms_inject_socket_failures) {
+    if (rand() % msgr->cct->_conf->ms_inject_socket_failures == 0) {
+      ldout(msgr->cct,0) << "event_recv injecting socket failure" << dendl;
+      ::shutdown(sd, SHUT_RDWR);
+    }
+  }
+
+  while (ev_in_pos < len) {
+    int got = ::recv(sd, buf + ev_in_pos, len - ev_in_pos, MSG_DONTWAIT);
+    if (got < 0) {
+      if (errno == EINTR)
+	continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	return 0;
+      return -1;
+    }
+    if (got == 0)
+      return -1;  // peer sent a FIN
+    ev_in_pos += got;
+  }
+  ev_last_rx = ceph_clock_now(msgr->cct);
+  ev_in_pos = 0;
+  return 1;
+}
+
+/*
+ * Same as event_recv(), but for the (possibly multi-segment) data payload.
+ */
+int SimpleMessenger::Pipe::event_recv_data()
+{
+  while (ev_in_pos < ev_data.length()) {
+    unsigned off = 0;
+    std::list<bufferptr>::const_iterator p = ev_data.buffers().begin();
+    while (off + p->length() <= ev_in_pos) {
+      off += p->length();
+      ++p;
+    }
+    unsigned pos = ev_in_pos - off;
+    int got = ::recv(sd, (char*)p->c_str() + pos, p->length() - pos, MSG_DONTWAIT);
+    if (got < 0) {
+      if (errno == EINTR)
+	continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	return 0;
+      return -1;
+    }
+    if (got == 0)
+      return -1;
+    ev_in_pos += got;
+  }
+  ev_last_rx = ceph_clock_now(msgr->cct);
+  ev_in_pos = 0;
+  return 1;
+}
+
+/*
+ * Release anything reserved for a partially read Message, and drop
+ * any partially written output.
+ */
+void SimpleMessenger::Pipe::event_discard_partial()
+{
+  if (ev_in_msg_size) {
+    if (policy.throttler) {
+      ldout(msgr->cct,10) << "event_discard_partial releasing " << ev_in_msg_size
+			  << " to policy throttler " << policy.throttler->get_current()
+			  << "/" << policy.throttler->get_max() << dendl;
+      policy.throttler->put(ev_in_msg_size);
+    }
+    msgr->dispatch_throttle_release(ev_in_msg_size);
+    ev_in_msg_size = 0;
+  }
+  ev_front.clear();
+  ev_middle.clear();
+  ev_data.clear();
+  ev_out.clear();
+  ev_in_state = EV_IN_TAG;
+  ev_in_pos = 0;
+}
+
+int SimpleMessenger::Pipe::event_read()
+{
+  assert(pipe_lock.is_locked());
+  assert(event_worker);
+  int r;
+  __u32 header_crc;
+  uint64_t message_size;
+
+  while (true) {
+    if (state == STATE_CLOSED)
+      return -1;
+
+    switch (ev_in_state) {
+    case EV_IN_TAG:
+      r = event_recv(&ev_tag, 1);
+      if (r <= 0)
+	return r;
+      if (ev_tag == CEPH_MSGR_TAG_KEEPALIVE) {
+	ldout(msgr->cct,20) << "event_read got KEEPALIVE" << dendl;
+      } else if (ev_tag == CEPH_MSGR_TAG_ACK) {
+	ldout(msgr->cct,20) << "event_read got ACK" << dendl;
+	ev_in_state = EV_IN_ACK;
+      } else if (ev_tag == CEPH_MSGR_TAG_MSG) {
+	ldout(msgr->cct,20) << "event_read got MSG" << dendl;
+	ev_recv_stamp = ceph_clock_now(msgr->cct);
+	ev_in_state = EV_IN_HEADER;
+      } else if (ev_tag == CEPH_MSGR_TAG_CLOSE) {
+	ldout(msgr->cct,20) << "event_read got CLOSE" << dendl;
+	if (state == STATE_CLOSING)
+	  state = STATE_CLOSED;
+	else
+	  state = STATE_CLOSING;
+	return 0;  // event_write will answer with our own CLOSE
+      } else {
+	ldout(msgr->cct,0) << "event_read bad tag " << (int)ev_tag << dendl;
+	return -1;
+      }
+      break;
+
+    case EV_IN_ACK:
+      r = event_recv((char*)&ev_ack_seq, sizeof(ev_ack_seq));
+      if (r <= 0)
+	return r;
+      ev_in_state = EV_IN_TAG;
+      handle_ack(ev_ack_seq);
+      break;
+
+    case EV_IN_HEADER:
+      if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
+	r = event_recv((char*)&ev_header, sizeof(ev_header));
+	if (r <= 0)
+	  return r;
+	header_crc = ceph_crc32c_le(0, (unsigned char *)&ev_header,
+				    sizeof(ev_header) - sizeof(ev_header.crc));
+      } else {
+	r = event_recv((char*)&ev_oldheader, sizeof(ev_oldheader));
+	if (r <= 0)
+	  return r;
+	memcpy(&ev_header, &ev_oldheader, sizeof(ev_header));
+	ev_header.src = ev_oldheader.src.name;
+	ev_header.reserved = ev_oldheader.reserved;
+	ev_header.crc = ev_oldheader.crc;
+	header_crc = ceph_crc32c_le(0, (unsigned char *)&ev_oldheader,
+				    sizeof(ev_oldheader) - sizeof(ev_oldheader.crc));
+      }
+      ldout(msgr->cct,20) << "event_read got envelope type=" << ev_header.type
+			  << " src " << entity_name_t(ev_header.src)
+			  << " front=" << ev_header.front_len
+			  << " data=" << ev_header.data_len
+			  << " off " << ev_header.data_off
+			  << dendl;
+      if (header_crc != ev_header.crc) {
+	ldout(msgr->cct,0) << "event_read got bad header crc " << header_crc
+			   << " != " << ev_header.crc << dendl;
+	return -1;
+      }
+      ev_in_state = EV_IN_THROTTLE;
+      // fall through
+
+    case EV_IN_THROTTLE:
+      // same two throttlers, in the same order, as read_message(), but
+      // we cannot block the worker: park the Pipe and retry instead.
+      message_size = ev_header.front_len + ev_header.middle_len + ev_header.data_len;
+      if (message_size) {
+	if (policy.throttler &&
+	    !policy.throttler->get_or_fail(message_size)) {
+	  ldout(msgr->cct,10) << "event_read waiting for " << message_size
+			      << " from policy throttler "
+			      << policy.throttler->get_current() << "/"
+			      << policy.throttler->get_max() << dendl;
+	  event_worker->update_events(this, ev_events & ~EPOLLIN);
+	  event_worker->wait_for_throttle(this);
+	  return 0;
+	}
+	if (!msgr->dispatch_throttler.get_or_fail(message_size)) {
+	  ldout(msgr->cct,10) << "event_read waiting for " << message_size
+			      << " from dispatch throttler "
+			      << msgr->dispatch_throttler.get_current() << "/"
+			      << msgr->dispatch_throttler.get_max() << dendl;
+	  if (policy.throttler)
+	    policy.throttler->put(message_size);
+	  event_worker->update_events(this, ev_events & ~EPOLLIN);
+	  event_worker->wait_for_throttle(this);
+	  return 0;
+	}
+	ev_in_msg_size = message_size;
+      }
+      if (!(ev_events & EPOLLIN))
+	event_worker->update_events(this, ev_events | EPOLLIN);
+      ev_throttle_stamp = ceph_clock_now(msgr->cct);
+
+      if (ev_header.front_len)
+	ev_front.push_back(buffer::create(ev_header.front_len));
+      if (ev_header.middle_len)
+	ev_middle.push_back(buffer::create(ev_header.middle_len));
+      if (ev_header.data_len)
+	alloc_rx_data(ev_header, ev_data);
+      ev_in_state = EV_IN_FRONT;
+      // fall through
+
+    case EV_IN_FRONT:
+      if (ev_front.length()) {
+	r = event_recv(ev_front.c_str(), ev_front.length());
+	if (r <= 0)
+	  return r;
+      }
+      ev_in_state = EV_IN_MIDDLE;
+      // fall through
+
+    case EV_IN_MIDDLE:
+      if (ev_middle.length()) {
+	r = event_recv(ev_middle.c_str(), ev_middle.length());
+	if (r <= 0)
+	  return r;
+      }
+      ev_in_state = EV_IN_DATA;
+      // fall through
+
+    case EV_IN_DATA:
+      r = event_recv_data();
+      if (r <= 0)
+	return r;
+      ev_in_state = EV_IN_FOOTER;
+      // fall through
+
+    case EV_IN_FOOTER:
+      r = event_recv((char*)&ev_footer, sizeof(ev_footer));
+      if (r <= 0)
+	return r;
+      ev_in_state = EV_IN_TAG;
+      if (event_deliver() < 0)
+	return -1;
+      break;
+
+    default:
+      assert(0);
+    }
+  }
+}
+
+/*
+ * A whole Message has been read: decode and queue it, exactly as
+ * reader() does with the result of read_message().
+ *
+ * @return 0, or -1 if the Pipe should fault.
+ */
+int SimpleMessenger::Pipe::event_deliver()
+{
+  if ((ev_footer.flags & CEPH_MSG_FOOTER_COMPLETE) == 0) {
+    ldout(msgr->cct,0) << "event_read got " << ev_front.length() << " + " << ev_middle.length()
+		       << " + " << ev_data.length() << " byte message.. ABORTED" << dendl;
+    event_discard_partial();
+    return 0;
+  }
+
+  ldout(msgr->cct,20) << "event_read got " << ev_front.length() << " + " << ev_middle.length()
+		      << " + " << ev_data.length() << " byte message" << dendl;
+
+  // decoding can be expensive (think OSDMap); don't hold up senders.
+  pipe_lock.Unlock();
+  Message *m = decode_message(msgr->cct, ev_header, ev_footer, ev_front, ev_middle, ev_data);
+  pipe_lock.Lock();
+  if (!m) {
+    event_discard_partial();
+    return -1;
+  }
+  ev_front.clear();
+  ev_middle.clear();
+  ev_data.clear();
+
+  m->set_throttler(policy.throttler);
+  m->set_dispatch_throttle_size(ev_in_msg_size);
+  m->set_recv_stamp(ev_recv_stamp);
+  m->set_throttle_stamp(ev_throttle_stamp);
+  m->set_recv_complete_stamp(ceph_clock_now(msgr->cct));
+  ev_in_msg_size = 0;
+
+  if (state == STATE_CLOSED ||
+      state == STATE_CONNECTING) {
+    msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
+    m->put();
+    return -1;
+  }
+
+  // see reader() for why we only drop old messages here
+  if (m->get_seq() <= in_seq) {
+    ldout(msgr->cct,0) << "event_read got old message "
+		       << m->get_seq() << " <= " << in_seq << " " << m << " " << *m
+		       << ", discarding" << dendl;
+    msgr->dispatch_throttle_release(m->get_dispatch_throttle_size());
+    m->put();
+    return 0;
+  }
+
+  m->set_connection(connection_state->get());
+  in_seq = m->get_seq();
+
+  ldout(msgr->cct,10) << "event_read got message "
+		      << m->get_seq() << " " << m << " " << *m
+		      << dendl;
+  if (msgr->ms_can_fast_dispatch(m)) {
+    pipe_lock.Unlock();
+    bool handled = msgr->fast_dispatch(m);
+    pipe_lock.Lock();
+    if (!handled)
+      queue_received(m);
+  } else {
+    queue_received(m);
+  }
+  return 0;
+}
+
+/*
+ * Append the wire encoding of m to ev_out. This mirrors write_message(),
+ * but leaves the actual sending to event_send().
+ */
+void SimpleMessenger::Pipe::event_encode_message(Message *m)
+{
+  ceph_msg_header& header = m->get_header();
+  ceph_msg_footer& footer = m->get_footer();
+
+  header.front_len = m->get_payload().length();
+  header.middle_len = m->get_middle().length();
+  header.data_len = m->get_data().length();
+  footer.flags = CEPH_MSG_FOOTER_COMPLETE;
+  m->calc_header_crc();
+
+  ev_out.append((char)CEPH_MSGR_TAG_MSG);
+  if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
+    ev_out.append((char*)&header, sizeof(header));
+  } else {
+    ceph_msg_header_old oldheader;
+    memcpy(&oldheader, &header, sizeof(header));
+    oldheader.src.name = header.src;
+    oldheader.src.addr = connection_state->get_peer_addr();
+    oldheader.orig_src = oldheader.src;
+    oldheader.reserved = header.reserved;
+    oldheader.crc = ceph_crc32c_le(0, (unsigned char*)&oldheader,
+				   sizeof(oldheader) - sizeof(oldheader.crc));
+    ev_out.append((char*)&oldheader, sizeof(oldheader));
+  }
+  // the payload is shared, not copied
+  ev_out.append(m->get_payload());
+  ev_out.append(m->get_middle());
+  ev_out.append(m->get_data());
+  ev_out.append((char*)&footer, sizeof(footer));
+}
+
+/*
+ * Hand as much of ev_out to the socket as it will take without blocking.
+ *
+ * @return 0, or -1 on error (unrecoverable -- close the socket).
+ */
+int SimpleMessenger::Pipe::event_send()
+{
+  struct iovec msgvec[IOV_MAX];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = msgvec;
+
+  for (std::list<bufferptr>::const_iterator p = ev_out.buffers().begin();
+       p != ev_out.buffers().end() && msg.msg_iovlen < IOV_MAX;
+       ++p) {
+    if (!p->length())
+      continue;
+    msgvec[msg.msg_iovlen].iov_base = (void*)p->c_str();
+    msgvec[msg.msg_iovlen].iov_len = p->length();
+    msg.msg_iovlen++;
+  }
+
+  int r = ::sendmsg(sd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (r < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return 0;
+    char buf[80];
+    ldout(msgr->cct,1) << "event_send error " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    return -1;
+  }
+  if (r > 0)
+    ev_out.splice(0, r);
+  return 0;
+}
+
+int SimpleMessenger::Pipe::event_write()
+{
+  assert(pipe_lock.is_locked());
+  assert(event_worker);
+
+  while (true) {
+    if (!ev_out.length()) {
+      if (state == STATE_CLOSING) {
+	ldout(msgr->cct,20) << "event_write writing CLOSE tag" << dendl;
+	char tag = CEPH_MSGR_TAG_CLOSE;
+	state = STATE_CLOSED;
+	// we don't care if this succeeds.
+	::send(sd, &tag, 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+	return -1;
+      }
+      if (state != STATE_OPEN)
+	return -1;
+
+      if (keepalive) {
+	ldout(msgr->cct,10) << "event_write keepalive" << dendl;
+	ev_out.append((char)CEPH_MSGR_TAG_KEEPALIVE);
+	keepalive = false;
+      }
+
+      if (in_seq > in_seq_acked) {
+	ldout(msgr->cct,10) << "event_write ack " << in_seq << dendl;
+	ceph_le64 s;
+	s = in_seq;
+	ev_out.append((char)CEPH_MSGR_TAG_ACK);
+	ev_out.append((char*)&s, sizeof(s));
+	in_seq_acked = in_seq;
+      }
+
+      Message *m = _get_next_outgoing();
+      if (m) {
+	m->set_seq(++out_seq);
+	if (!policy.lossy || close_on_empty) {
+	  // put on sent list
+	  sent.push_back(m);
+	  m->get();
+	}
+	pipe_lock.Unlock();
+
+	ldout(msgr->cct,20) << "event_write encoding " << m->get_seq() << " " << m << " " << *m << dendl;
+	m->set_connection(connection_state->get());
+	m->encode(connection_state->get_features(), !msgr->cct->_conf->ms_nocrc);
+
+	pipe_lock.Lock();
+	event_encode_message(m);
+	m->put();
+      }
+
+      if (!ev_out.length()) {
+	if (sent.empty() && close_on_empty) {
+	  ldout(msgr->cct,10) << "event_write out and sent queues empty, closing" << dendl;
+	  stop();
+	  return -1;
+	}
+	break;
+      }
+    }
+
+    if (event_send() < 0)
+      return -1;
+    if (ev_out.length())
+      break;  // socket is full; wait for EPOLLOUT
+  }
+
+  uint32_t want = ev_events & ~EPOLLOUT;
+  if (ev_out.length())
+    want |= EPOLLOUT;
+  if (want != ev_events)
+    event_worker->update_events(this, want);
+  return 0;
+}
+
+void SimpleMessenger::Pipe::event_fault()
+{
+  assert(pipe_lock.is_locked());
+  assert(!event_worker);
+
+  event_discard_partial();
+  if (state == STATE_CLOSED)
+    return;
+
+  fault(false, true);
+
+  // reconnecting, standby and closing all live on the Writer thread.
+  if (state != STATE_CLOSED) {
+    ldout(msgr->cct,10) << "event_fault starting writer, state=" << state << dendl;
+    start_writer();
+  }
+}
+
+
+/**************************************
+ * EventWorker
+ */
+
+#undef dout_prefix
+#define dout_prefix _prefix(_dout, msgr) << "event_worker(" << this << ")."
+
+int SimpleMessenger::EventWorker::init()
+{
+  epfd = ::epoll_create(1024);
+  if (epfd < 0)
+    return -errno;
+
+  int r = pipe_cloexec(wakeup_fds);
+  if (r < 0)
+    return r;
+  ::fcntl(wakeup_fds[0], F_SETFL, O_NONBLOCK);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, wakeup_fds[0], &ev) < 0)
+    return -errno;
+  return 0;
+}
+
+void SimpleMessenger::EventWorker::stop()
+{
+  ldout(msgr->cct,10) << "stop" << dendl;
+  lock.Lock();
+  stopping = true;
+  lock.Unlock();
+  char c = 0;
+  if (::write(wakeup_fds[1], &c, 1) < 0)
+    ldout(msgr->cct,0) << "stop failed to wake worker" << dendl;
+  join();
+
+  while (!kicked.empty()) {
+    kicked.front()->put();
+    kicked.pop_front();
+  }
+  while (!throttled.empty()) {
+    throttled.front()->put();
+    throttled.pop_front();
+  }
+  ::close(wakeup_fds[0]);
+  ::close(wakeup_fds[1]);
+  ::close(epfd);
+}
+
+void SimpleMessenger::EventWorker::add_pipe(Pipe *p)
+{
+  assert(p->pipe_lock.is_locked());
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = p;
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, p->sd, &ev) < 0) {
+    char buf[80];
+    ldout(msgr->cct,0) << "add_pipe " << p << " failed: "
+		       << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    return;
+  }
+  ldout(msgr->cct,10) << "add_pipe " << p << " sd " << p->sd << dendl;
+  p->event_worker = this;
+  p->ev_events = ev.events;
+  p->ev_kicked = false;  // a kick from an earlier stint is stale
+
+  lock.Lock();
+  pipes.insert((Pipe *)p->get());
+  lock.Unlock();
+
+  // anything queued during the handshake
+  kick(p);
+}
+
+void SimpleMessenger::EventWorker::remove_pipe(Pipe *p)
+{
+  assert(p->pipe_lock.is_locked());
+  assert(p->event_worker == this);
+  ldout(msgr->cct,10) << "remove_pipe " << p << " sd " << p->sd << dendl;
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ::epoll_ctl(epfd, EPOLL_CTL_DEL, p->sd, &ev);
+  p->event_worker = NULL;
+  p->ev_events = 0;
+  // a kick that arrived while we were unlocked (e.g. decoding) may still
+  // be queued; it will be skipped as stale, so don't let it swallow the
+  // kicks that follow a reconnect.
+  p->ev_kicked = false;
+
+  lock.Lock();
+  pipes.erase(p);
+  lock.Unlock();
+  // the caller drops the reference pipes held
+}
+
+void SimpleMessenger::EventWorker::update_events(Pipe *p, uint32_t events)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = p;
+  if (::epoll_ctl(epfd, EPOLL_CTL_MOD, p->sd, &ev) == 0)
+    p->ev_events = events;
+}
+
+void SimpleMessenger::EventWorker::kick(Pipe *p)
+{
+  assert(p->pipe_lock.is_locked());
+  if (p->ev_kicked)
+    return;
+  p->ev_kicked = true;
+
+  Mutex::Locker l(lock);
+  bool wake = kicked.empty();
+  kicked.push_back((Pipe *)p->get());
+  if (wake) {
+    char c = 0;
+    if (::write(wakeup_fds[1], &c, 1) < 0)
+      ldout(msgr->cct,0) << "kick failed to wake worker" << dendl;
+  }
+}
+
+/*
+ * Service one Pipe. On any error the Pipe leaves event mode and goes
+ * through the usual fault path.
+ */
+void SimpleMessenger::EventWorker::process(Pipe *p, uint32_t events)
+{
+  p->get();
+  p->pipe_lock.Lock();
+  if (p->event_worker != this) {
+    // already dropped; this is a stale kick or throttle retry
+    p->pipe_lock.Unlock();
+    p->put();
+    return;
+  }
+
+  p->ev_kicked = false;
+  int r = 0;
+  if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+    r = p->event_read();
+  if (r == 0 && (events & (EPOLLERR | EPOLLHUP)))
+    r = -1;  // e.g. waiting on a throttler; don't spin on a dead socket
+  if (r == 0)
+    r = p->event_write();
+
+  if (r < 0) {
+    remove_pipe(p);
+    p->event_fault();
+    p->put();  // pipes' reference
+    p->unlock_maybe_reap();
+  } else {
+    p->pipe_lock.Unlock();
+  }
+  p->put();
+}
+
+/*
+ * The Reader threads time out reads after ms_tcp_read_timeout; do the
+ * same for idle sockets here, by shutting them down so that the next
+ * epoll_wait reports them.
+ */
+void SimpleMessenger::EventWorker::check_timeouts()
+{
+  if (msgr->timeout <= 0)
+    return;
+  utime_t now = ceph_clock_now(msgr->cct);
+  if (now - last_timeout_check < utime_t(1, 0))
+    return;
+  last_timeout_check = now;
+
+  utime_t cutoff = now;
+  cutoff -= (double)msgr->timeout / 1000.0;
+
+  list<Pipe*> ls;
+  lock.Lock();
+  for (set<Pipe*>::iterator p = pipes.begin(); p != pipes.end(); ++p)
+    ls.push_back((Pipe *)(*p)->get());
+  lock.Unlock();
+
+  for (list<Pipe*>::iterator i = ls.begin(); i != ls.end(); ++i) {
+    Pipe *p = *i;
+    p->pipe_lock.Lock();
+    if (p->event_worker == this && p->ev_last_rx < cutoff) {
+      ldout(msgr->cct,2) << "check_timeouts " << p << " idle since " << p->ev_last_rx
+			 << ", shutting down socket" << dendl;
+      p->shutdown_socket();
+    }
+    p->pipe_lock.Unlock();
+    p->put();
+  }
+}
+
+void *SimpleMessenger::EventWorker::entry()
+{
+  ldout(msgr->cct,10) << "entry start" << dendl;
+  const int max_events = 128;
+  struct epoll_event events[max_events];
+
+  lock.Lock();
+  while (!stopping) {
+    lock.Unlock();
+
+    int n = ::epoll_wait(epfd, events, max_events, throttled.empty() ? 1000 : 10);
+    if (n < 0 && errno != EINTR) {
+      char buf[80];
+      lderr(msgr->cct) << "epoll_wait failed: " << strerror_r(errno, buf, sizeof(buf)) << dendl;
+    }
+    for (int i = 0; i < n; i++) {
+      if (!events[i].data.ptr) {
+	char buf[64];
+	while (::read(wakeup_fds[0], buf, sizeof(buf)) > 0) ;
+	continue;
+      }
+      process((Pipe *)events[i].data.ptr, events[i].events);
+    }
+
+    // new outgoing work
+    list<Pipe*> ls;
+    lock.Lock();
+    ls.swap(kicked);
+    lock.Unlock();
+    while (!ls.empty()) {
+      process(ls.front(), EPOLLOUT);
+      ls.front()->put();
+      ls.pop_front();
+    }
+
+    // reads that were waiting for throttler space
+    ls.swap(throttled);
+    while (!ls.empty()) {
+      process(ls.front(), EPOLLIN);
+      ls.front()->put();
+      ls.pop_front();
+    }
+
+    check_timeouts();
+    lock.Lock();
+  }
+  lock.Unlock();
+  ldout(msgr->cct,10) << "entry done" << dendl;
+  return 0;
+}
+
+
 /**************************************
  * IncomingQueue
  */
@@ -2173,7 +3037,7 @@ int SimpleMessenger::Pipe::write_message(Message *m)
 #undef dout_prefix
 #define dout_prefix pipe->_pipe_prefix(_dout) << "incomingqueue."
 
-void SimpleMessenger::IncomingQueue::queue(Message *m, int priority, DispatchQueue *dq)
+void SimpleMessenger::IncomingQueue::queue(Message *m, int priority)
 {
   Mutex::Locker l(lock);
   ldout(cct,20) << "queue " << m << " prio " << priority << dendl;
@@ -2231,7 +3095,7 @@ void SimpleMessenger::IncomingQueue::queue(Message *m, int priority, DispatchQue
   }
 }
 
-void SimpleMessenger::IncomingQueue::discard_queue(SimpleMessenger *msgr, DispatchQueue *dq)
+void SimpleMessenger::IncomingQueue::discard_queue(SimpleMessenger *msgr)
 {
   halt = true;
 
@@ -2389,6 +3253,19 @@ int SimpleMessenger::start()
   if (did_bind)
     accepter.start();
 
+  for (int i = 0; i < cct->_conf->ms_event_workers; i++) {
+    EventWorker *w = new EventWorker(this);
+    int r = w->init();
+    if (r < 0) {
+      lderr(cct) << "unable to start event worker: " << cpp_strerror(r)
+		 << ", falling back to reader/writer threads" << dendl;
+      delete w;
+      break;
+    }
+    w->create();
+    event_workers.push_back(w);
+  }
+
   reaper_started = true;
   reaper_thread.create();
   return 0;
@@ -2600,8 +3477,9 @@ void SimpleMessenger::wait()
     ldout(cct,10) << "wait: woke up" << dendl;
   }
 
-  ldout(cct,10) << "wait: join dispatch thread" << dendl;
-  dispatch_thread.join();
+  ldout(cct,10) << "wait: join dispatch threads" << dendl;
+  for (unsigned i = 0; i < dispatch_threads.size(); i++)
+    dispatch_threads[i]->join();
 
   ldout(cct,10) << "wait: everything stopped" << dendl;
   lock.Unlock();
@@ -2644,12 +3522,23 @@ void SimpleMessenger::wait()
       reaper();
     }
 
-    dispatch_queue.local_pipe->pipe_lock.Lock();
-    dispatch_queue.local_pipe->discard_queue();
-    dispatch_queue.local_pipe->pipe_lock.Unlock();
+    for (unsigned i = 0; i < dispatch_queues.size(); i++) {
+      Pipe *local_pipe = dispatch_queues[i]->local_pipe;
+      local_pipe->pipe_lock.Lock();
+      local_pipe->discard_queue();
+      local_pipe->pipe_lock.Unlock();
+    }
   }
   lock.Unlock();
 
+  // every Pipe has been reaped, so the workers are idle
+  while (!event_workers.empty()) {
+    ldout(cct,20) << "wait: stopping event worker" << dendl;
+    event_workers.back()->stop();
+    delete event_workers.back();
+    event_workers.pop_back();
+  }
+
   ldout(cct,10) << "wait: done." << dendl;
   ldout(cct,1) << "shutdown complete." << dendl;
   started = false;
@@ -2766,6 +3655,9 @@ void SimpleMessenger::learned_addr(const entity_addr_t &peer_addr_for_me)
 
 void SimpleMessenger::init_local_pipe()
 {
-  dispatch_queue.local_pipe->connection_state->peer_addr = msgr->my_inst.addr;
-  dispatch_queue.local_pipe->connection_state->peer_type = msgr->my_type;
+  for (unsigned i = 0; i < dispatch_queues.size(); i++) {
+    Pipe *local_pipe = dispatch_queues[i]->local_pipe;
+    local_pipe->connection_state->peer_addr = msgr->my_inst.addr;
+    local_pipe->connection_state->peer_type = msgr->my_type;
+  }
 }
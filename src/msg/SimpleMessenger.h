@@ -66,7 +66,7 @@ public:
     accepter(this),
     dispatch_queue(cct, this),
     reaper_thread(this),
-    dispatch_thread(this),
+    dispatch_thread(this, &dispatch_queue),
     my_type(name.type()),
     nonce(_nonce),
     lock("SimpleMessenger::lock"), need_addr(true), did_bind(false),
@@ -79,8 +79,21 @@ public:
     msgr(this)
   {
     pthread_spin_init(&global_seq_lock, PTHREAD_PROCESS_PRIVATE);
-    // for local dmsg delivery
-    dispatch_queue.local_pipe = new Pipe(this, Pipe::STATE_OPEN, NULL);
+    dispatch_queues.push_back(&dispatch_queue);
+    dispatch_threads.push_back(&dispatch_thread);
+    for (int i = 1; i < cct->_conf->ms_dispatch_threads; i++) {
+      DispatchQueue *dq = new DispatchQueue(cct, this);
+      dispatch_queues.push_back(dq);
+      dispatch_threads.push_back(new DispatchThread(this, dq));
+    }
+    // each queue delivers the connect/reset notifications for the
+    // connections it dispatches through its own local pipe; the first
+    // queue's also carries local dmsg delivery.
+    for (unsigned i = 0; i < dispatch_queues.size(); i++) {
+      DispatchQueue *dq = dispatch_queues[i];
+      dq->local_pipe = new Pipe(this, Pipe::STATE_OPEN, NULL);
+      dq->local_pipe->in_q->dq = dq;
+    }
     init_local_pipe();
   }
   /**
@@ -92,7 +105,12 @@ public:
     assert(!did_bind); // either we didn't bind or we shut down the Accepter
     assert(rank_pipe.empty()); // we don't have any running Pipes.
     assert(reaper_stop && !reaper_started); // the reaper thread is stopped
-    delete dispatch_queue.local_pipe;
+    for (unsigned i = 0; i < dispatch_queues.size(); i++)
+      delete dispatch_queues[i]->local_pipe;
+    for (unsigned i = 1; i < dispatch_queues.size(); i++) {
+      delete dispatch_threads[i];
+      delete dispatch_queues[i];
+    }
   }
   /** @defgroup Accessors
    * @{
@@ -113,7 +131,10 @@ public:
    * @return The length of the Dispatch queue.
    */
   int get_dispatch_queue_len() {
-    return dispatch_queue.get_queue_len();
+    int len = 0;
+    for (unsigned i = 0; i < dispatch_queues.size(); i++)
+      len += dispatch_queues[i]->get_queue_len();
+    return len;
   }
   /** @} Accessors */
 
@@ -378,7 +399,7 @@ protected:
    * @{
    */
   /**
-   * Start up the DispatchQueue thread once we have somebody to dispatch to.
+   * Start up the DispatchQueue threads once we have somebody to dispatch to.
    */
   virtual void ready();
   /** @} // Messenger Interfaces */
@@ -409,22 +430,25 @@ private:
 
   class DispatchQueue;
   class Pipe;
+  class EventWorker;
   struct IncomingQueue {
     CephContext *cct;
     Pipe *pipe;  // this will change
+    DispatchQueue *dq;  // never changes, so our Messages and notifications stay in order
     Mutex lock;
     map<int, list<Message*> > in_q; // and inbound ones
     int in_qlen;
     map<int, xlist<IncomingQueue *>::item* > queue_items; // protected by pipe_lock AND q.lock
     bool halt;
 
-    void queue(Message *m, int priority, DispatchQueue *dq);
-    void discard_queue(SimpleMessenger *msgr, DispatchQueue *dq);
+    void queue(Message *m, int priority);
+    void discard_queue(SimpleMessenger *msgr);
     void restart_queue();
 
-    IncomingQueue(CephContext *cct, Pipe *parent)
+    IncomingQueue(CephContext *cct, Pipe *parent, DispatchQueue *dq)
       : cct(cct),
 	pipe(parent),
+	dq(dq),
 	lock("SimpleMessenger::IncomingQueue::lock"),
 	in_qlen(0),
 	halt(false)
@@ -487,11 +511,13 @@ private:
       state(st),
       connection_state(new Connection),
       reader_running(false), reader_joining(false), writer_running(false),
-      in_q(new IncomingQueue(r->cct, this)),
+      in_q(new IncomingQueue(r->cct, this, r->pick_dispatch_queue())),
       keepalive(false),
       close_on_empty(false),
       connect_seq(0), peer_global_seq(0),
-      out_seq(0), in_seq(0), in_seq_acked(0) {
+      out_seq(0), in_seq(0), in_seq_acked(0),
+      event_worker(NULL), ev_events(0), ev_kicked(false),
+      ev_in_state(EV_IN_TAG), ev_in_pos(0), ev_in_msg_size(0) {
       if (con) {
         connection_state = con->get();
         connection_state->reset_pipe(this);
@@ -534,6 +560,7 @@ private:
 
   protected:
     friend class SimpleMessenger;
+    friend class EventWorker;
     Connection *connection_state;
 
     utime_t backoff;         // backoff time
@@ -552,6 +579,72 @@ private:
     __u32 connect_seq, peer_global_seq;
     uint64_t out_seq;
     uint64_t in_seq, in_seq_acked;
+
+    /**
+     * @defgroup Event mode
+     * Once a Pipe is open it may hand its socket to an EventWorker
+     * instead of keeping its Reader and Writer threads. The ev_* state
+     * is only touched by the owning worker, under pipe_lock.
+     * @{
+     */
+    EventWorker *event_worker;  ///< non-NULL while an EventWorker owns sd
+    uint32_t ev_events;         ///< epoll events we are registered for
+    bool ev_kicked;             ///< on event_worker's kicked list
+
+    enum {
+      EV_IN_TAG,
+      EV_IN_ACK,
+      EV_IN_HEADER,
+      EV_IN_THROTTLE,  // header read, waiting for throttler space
+      EV_IN_FRONT,
+      EV_IN_MIDDLE,
+      EV_IN_DATA,
+      EV_IN_FOOTER
+    };
+    int ev_in_state;
+    unsigned ev_in_pos;         ///< bytes of the current ev_in_state received
+    char ev_tag;
+    ceph_le64 ev_ack_seq;
+    ceph_msg_header ev_header;
+    ceph_msg_header_old ev_oldheader;
+    ceph_msg_footer ev_footer;
+    bufferlist ev_front, ev_middle, ev_data;
+    uint64_t ev_in_msg_size;    ///< bytes reserved from the throttlers
+    utime_t ev_recv_stamp, ev_throttle_stamp;
+    utime_t ev_last_rx;
+    bufferlist ev_out;          ///< encoded bytes the socket has not taken yet
+
+    /**
+     * Hand our socket to an EventWorker. The caller must be about to
+     * exit the Reader or Writer thread it is running on.
+     *
+     * @return true if a worker took the socket, false if event mode is off.
+     */
+    bool start_event_mode();
+    /**
+     * Pull whatever the socket has for us and queue any complete Messages.
+     * @return 0, or -1 if the Pipe must leave event mode.
+     */
+    int event_read();
+    /**
+     * Push acks, keepalives and queued Messages until the socket is
+     * full or we run out.
+     * @return 0, or -1 if the Pipe must leave event mode.
+     */
+    int event_write();
+    /**
+     * Called by the worker once it has dropped our socket: give back any
+     * throttle reservations and fall back to the Writer thread to
+     * reconnect or wait in standby, as the threaded path would.
+     */
+    void event_fault();
+    int event_deliver();
+    int event_recv(char *buf, unsigned len);
+    int event_recv_data();
+    int event_send();
+    void event_encode_message(Message *m);
+    void event_discard_partial();
+    /** @} Event mode */
     
     int accept();   // server handshake
     int connect();  // client handshake
@@ -559,6 +652,12 @@ private:
     void writer();
     void unlock_maybe_reap();
 
+    /**
+     * Get the buffer to read a message's data payload into: the one a
+     * Dispatcher supplies, if any, or else a fresh one laid out to
+     * match the header's data alignment.
+     */
+    void alloc_rx_data(const ceph_msg_header& header, bufferlist& data);
     int read_message(Message **pm);
     int write_message(Message *m);
     /**
@@ -607,12 +706,16 @@ private:
     void start_reader() {
       assert(pipe_lock.is_locked());
       assert(!reader_running);
+      if (reader_thread.is_started())
+	reader_thread.join();  // a previous reader handed off to an EventWorker
       reader_running = true;
       reader_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
     }
     void start_writer() {
       assert(pipe_lock.is_locked());
       assert(!writer_running);
+      if (writer_thread.is_started())
+	writer_thread.join();  // a previous writer handed off to an EventWorker
       writer_running = true;
       writer_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
     }
@@ -680,11 +783,14 @@ private:
     void _send(Message *m) {
       out_q[m->get_priority()].push_back(m);
       cond.Signal();
+      _kick_event_worker();
     }
     void _send_keepalive() {
       keepalive = true;
       cond.Signal();
+      _kick_event_worker();
     }
+    void _kick_event_worker();
     Message *_get_next_outgoing() {
       Message *m = 0;
       while (!m && !out_q.empty()) {
@@ -783,6 +889,56 @@ private:
     }
   } dispatch_queue;
 
+  /**
+   * An EventWorker services the sockets of any number of open Pipes from
+   * a single thread using epoll, so that idle connections do not each
+   * cost a Reader and a Writer thread. Connection setup (accept/connect)
+   * and fault recovery still run on the Pipe's own threads; once the
+   * handshake completes the Pipe hands its socket over with
+   * Pipe::start_event_mode(), and takes it back on any error.
+   */
+  class EventWorker : public Thread {
+    SimpleMessenger *msgr;
+    int epfd;
+    int wakeup_fds[2];
+    Mutex lock;
+    bool stopping;
+    set<Pipe*> pipes;      ///< registered Pipes; protected by lock
+    list<Pipe*> kicked;    ///< Pipes with new outgoing work; protected by lock
+    list<Pipe*> throttled; ///< Pipes waiting on throttlers; worker thread only
+    utime_t last_timeout_check;
+
+    void process(Pipe *p, uint32_t events);
+    void check_timeouts();
+  public:
+    EventWorker(SimpleMessenger *m)
+      : msgr(m), epfd(-1),
+	lock("SimpleMessenger::EventWorker::lock"),
+	stopping(false) {
+      wakeup_fds[0] = wakeup_fds[1] = -1;
+    }
+    ~EventWorker() {
+      assert(pipes.empty());
+    }
+
+    int init();
+    void stop();
+    void *entry();
+
+    /// start servicing p's socket; called with p->pipe_lock held
+    void add_pipe(Pipe *p);
+    /// stop servicing p's socket; only called by the worker thread
+    void remove_pipe(Pipe *p);
+    /// update the epoll events p is registered for
+    void update_events(Pipe *p, uint32_t events);
+    /// note p has new outgoing work; called with p->pipe_lock held
+    void kick(Pipe *p);
+    /// retry p's read once the throttlers may have room
+    void wait_for_throttle(Pipe *p) {
+      throttled.push_back((Pipe *)p->get());
+    }
+  };
+
   /**
    * A thread used to tear down Pipes when they're complete.
    */
@@ -797,14 +953,16 @@ private:
   } reaper_thread;
 
   /**
-   * The DispatchThread runs dispatch_entry to empty out the dispatch_queue.
+   * A DispatchThread runs dispatch_entry to empty out one DispatchQueue.
    */
   class DispatchThread : public Thread {
     SimpleMessenger *msgr;
+    DispatchQueue *dq;
   public:
-    DispatchThread(SimpleMessenger *_messenger) : msgr(_messenger) {}
+    DispatchThread(SimpleMessenger *_messenger, DispatchQueue *_dq)
+      : msgr(_messenger), dq(_dq) {}
     void *entry() {
-      msgr->dispatch_entry();
+      msgr->dispatch_entry(dq);
       return 0;
     }
   } dispatch_thread;
@@ -894,6 +1052,15 @@ private:
   set<Pipe*>      pipes;
   /// a list of Pipes we want to tear down
   list<Pipe*>     pipe_reap_queue;
+  /// epoll workers servicing open Pipes, if ms_event_workers > 0
+  vector<EventWorker*> event_workers;
+  /// round-robin cursor for assigning Pipes to event_workers
+  atomic_t event_worker_rr;
+  /// dispatch_queue and any more from ms_dispatch_threads, with their threads
+  vector<DispatchQueue*> dispatch_queues;
+  vector<DispatchThread*> dispatch_threads;
+  /// round-robin cursor for assigning IncomingQueues to dispatch_queues
+  atomic_t dispatch_queue_rr;
 
   /// internal cluster protocol version, if any, for talking to entities of the same type.
   int cluster_protocol;
@@ -980,14 +1147,34 @@ public:
   }
 
   /**
-   * This function is used by the dispatch thread. It runs continuously
-   * until dispatch_queue.stop is set to true, choosing what order the Pipes
+   * This function is used by the dispatch threads. It runs continuously
+   * until dq->stop is set to true, choosing what order the Pipes
    * get to deliver in, and sending out their chosen Message via the
    * ms_deliver_* functions.
-   * It should really only by dispatch_thread calling this, in our
+   * It should really only by the DispatchThreads calling this, in our
    * current implementation.
+   *
+   * @param dq The DispatchQueue this thread empties.
+   */
+  void dispatch_entry(DispatchQueue *dq);
+  /**
+   * Choose the DispatchQueue a new IncomingQueue delivers through. All
+   * of a connection's Messages go through the same queue (and thread),
+   * so they are dispatched in the order they arrived.
+   */
+  DispatchQueue *pick_dispatch_queue() {
+    return dispatch_queues[dispatch_queue_rr.inc() % dispatch_queues.size()];
+  }
+  /**
+   * Hand a Message to a Dispatcher that can handle it without queueing,
+   * from the thread that read it, and release its dispatch throttle.
+   * Callers must not hold the Pipe's lock.
+   *
+   * @param m The Message, which ms_can_fast_dispatch() accepted.
+   * @return False if the Dispatcher declined m; the caller must queue it,
+   * and it still holds its dispatch throttle.
    */
-  void dispatch_entry();
+  bool fast_dispatch(Message *m);
   /**
    * Release memory accounting back to the dispatch throttler.
    *
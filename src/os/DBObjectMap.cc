@@ -38,6 +38,24 @@ const string DBObjectMap::HOBJECT_TO_SEQ = "_HOBJTOSEQ_";
 const string DBObjectMap::LEAF_PREFIX = "_LEAF_";
 const string DBObjectMap::REVERSE_LEAF_PREFIX = "_REVLEAF_";
 
+DBObjectMap::DBObjectMap(KeyValueDB *db)
+  : db(db),
+    header_lock("DBOBjectMap"),
+    map_header_cache(g_conf->filestore_omap_header_cache_size),
+    header_cache(g_conf->filestore_omap_header_cache_size)
+{
+}
+
+void DBObjectMap::set_header_cache_size(size_t size)
+{
+  map_header_cache.set_size(0);
+  header_cache.set_size(0);
+  map_header_cache.set_size(size);
+  header_cache.set_size(size);
+  header_cache_hits.set(0);
+  header_cache_misses.set(0);
+}
+
 static void append_escaped(const string &in, string *out)
 {
   for (string::const_iterator i = in.begin(); i != in.end(); ++i) {
@@ -1078,6 +1096,13 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
   while (map_header_in_use.count(hoid))
     header_cond.Wait(header_lock);
 
+  _Header cached;
+  if (map_header_cache.lookup(hoid, &cached)) {
+    header_cache_hits.inc();
+    return Header(new _Header(cached), RemoveMapHeaderOnDelete(this, hoid));
+  }
+  header_cache_misses.inc();
+
   map<string, bufferlist> out;
   set<string> to_get;
   to_get.insert(map_header_key(hoid));
@@ -1090,6 +1115,7 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
   Header ret(new _Header(), RemoveMapHeaderOnDelete(this, hoid));
   bufferlist::iterator iter = out.begin()->second.begin();
   ret->decode(iter);
+  map_header_cache.add(hoid, *ret);
   return ret;
 }
 
@@ -1116,6 +1142,18 @@ DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
   Mutex::Locker l(header_lock);
   while (in_use.count(input->parent))
     header_cond.Wait(header_lock);
+
+  _Header cached;
+  if (header_cache.lookup(input->parent, &cached)) {
+    header_cache_hits.inc();
+    Header header = Header(new _Header(cached), RemoveOnDelete(this));
+    dout(20) << "lookup_parent: parent seq is " << header->seq << " with parent "
+	     << header->parent << " (cached)" << dendl;
+    in_use.insert(header->seq);
+    return header;
+  }
+  header_cache_misses.inc();
+
   map<string, bufferlist> out;
   set<string> keys;
   keys.insert(HEADER_KEY);
@@ -1138,6 +1176,7 @@ DBObjectMap::Header DBObjectMap::lookup_parent(Header input)
   header->decode(iter);
   dout(20) << "lookup_parent: parent seq is " << header->seq << " with parent "
        << header->parent << dendl;
+  header_cache.add(header->seq, *header);
   in_use.insert(header->seq);
   return header;
 }
@@ -1165,6 +1204,7 @@ void DBObjectMap::clear_header(Header header, KeyValueDB::Transaction t)
   set<string> keys;
   keys.insert(header_key(header->seq));
   t->rmkeys(USER_PREFIX, keys);
+  header_cache.clear(header->seq);
 }
 
 void DBObjectMap::set_header(Header header, KeyValueDB::Transaction t)
@@ -1173,6 +1213,7 @@ void DBObjectMap::set_header(Header header, KeyValueDB::Transaction t)
   map<string, bufferlist> to_write;
   header->encode(to_write[HEADER_KEY]);
   t->set(sys_prefix(header), to_write);
+  header_cache.add(header->seq, *header);
 }
 
 void DBObjectMap::remove_map_header(const hobject_t &hoid,
@@ -1184,6 +1225,7 @@ void DBObjectMap::remove_map_header(const hobject_t &hoid,
   set<string> to_remove;
   to_remove.insert(map_header_key(hoid));
   t->rmkeys(HOBJECT_TO_SEQ, to_remove);
+  map_header_cache.clear(hoid);
 }
 
 void DBObjectMap::set_map_header(const hobject_t &hoid, _Header header,
@@ -1195,6 +1237,7 @@ void DBObjectMap::set_map_header(const hobject_t &hoid, _Header header,
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(hoid)]);
   t->set(HOBJECT_TO_SEQ, to_set);
+  map_header_cache.add(hoid, header);
 }
 
 bool DBObjectMap::check_spos(const hobject_t &hoid,
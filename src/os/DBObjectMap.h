@@ -17,6 +17,8 @@
 #include "osd/osd_types.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/simple_cache.hpp"
+#include "include/atomic.h"
 
 /**
  * DBObjectMap: Implements ObjectMap in terms of KeyValueDB
@@ -51,6 +53,10 @@
  * the complete set, we have to check the parent if we don't find it in the
  * key set.  During rm_keys, we copy keys from the parent and update the
  * complete set to reflect the change @see rm_keys.
+ *
+ * Headers are cached in memory (@see map_header_cache, header_cache):
+ * every write of a header updates its cache entry along with the
+ * transaction, and every removal drops it.
  */
 class DBObjectMap : public ObjectMap {
 public:
@@ -69,9 +75,14 @@ public:
   set<uint64_t> in_use;
   set<hobject_t> map_header_in_use;
 
-  DBObjectMap(KeyValueDB *db) : db(db),
-				header_lock("DBOBjectMap")
-    {}
+  DBObjectMap(KeyValueDB *db);
+
+  /// Resize (0 disables) and empty the header caches, resetting their stats
+  void set_header_cache_size(size_t size);
+  void get_header_cache_stats(uint64_t *hits, uint64_t *misses) {
+    *hits = header_cache_hits.read();
+    *misses = header_cache_misses.read();
+  }
 
   int set_keys(
     const hobject_t &hoid,
@@ -274,6 +285,12 @@ private:
   /// Implicit lock on Header->seq
   typedef std::tr1::shared_ptr<_Header> Header;
 
+  /// leaf headers by object @see _lookup_map_header
+  SimpleLRU<hobject_t, _Header> map_header_cache;
+  /// interior headers by seq @see lookup_parent
+  SimpleLRU<uint64_t, _Header> header_cache;
+  atomic_t header_cache_hits, header_cache_misses;
+
   string map_header_key(const hobject_t &hoid);
   string header_key(uint64_t seq);
   string complete_prefix(Header header);
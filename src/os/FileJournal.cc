@@ -30,6 +30,16 @@
 #include <sys/mount.h>
 
 #include "common/blkdev.h"
+#include "common/admin_socket.h"
+#include "common/Formatter.h"
+
+// from include/linux/falloc.h:
+#ifndef FALLOC_FL_KEEP_SIZE
+# define FALLOC_FL_KEEP_SIZE 0x1
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+# define FALLOC_FL_PUNCH_HOLE 0x2
+#endif
 
 
 #define dout_subsys ceph_subsys_journal
@@ -96,7 +106,10 @@ int FileJournal::_open(bool forwrite, bool create)
 
 #ifdef HAVE_LIBAIO
   aio_ctx = 0;
-  ret = io_setup(128, &aio_ctx);
+  // a single write may need two iocbs (header, or wrapping), so leave
+  // room for one beyond the queue depth.
+  aio_max_num = MAX(1, g_conf->journal_aio_queue_depth);
+  ret = io_setup(MAX(128, aio_max_num + 2), &aio_ctx);
   if (ret < 0) {
     ret = errno;
     derr << "FileJournal::_open: unable to setup io_context " << cpp_strerror(ret) << dendl;
@@ -159,6 +172,8 @@ int FileJournal::_open_block_device()
   /* block devices have to write in blocks of CEPH_PAGE_SIZE */
   block_size = CEPH_PAGE_SIZE;
 
+  discard = g_conf->journal_discard;
+
   _check_disk_write_cache();
   return 0;
 }
@@ -285,6 +300,13 @@ int FileJournal::_open_file(int64_t oldsize, blksize_t blksize,
   int64_t conf_journal_sz(g_conf->osd_journal_size);
   conf_journal_sz <<= 20;
 
+  if (g_conf->journal_discard) {
+    if (g_conf->journal_debug_discard_file)
+      discard = true;
+    else
+      dout(10) << "_open_file: ignoring journal_discard, the file is preallocated" << dendl;
+  }
+
   if ((g_conf->osd_journal_size == 0) && (oldsize < ONE_MEG)) {
     derr << "I'm sorry, I don't know how large of a journal to create."
 	 << "Please specify a block device to use as the journal OR "
@@ -618,6 +640,18 @@ int FileJournal::dump(ostream& out)
 }
 
 
+class JournalDiscardHook : public AdminSocketHook {
+  FileJournal *journal;
+public:
+  JournalDiscardHook(FileJournal *j) : journal(j) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    journal->dump_discard(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 void FileJournal::start_writer()
 {
   write_stop = false;
@@ -625,6 +659,18 @@ void FileJournal::start_writer()
 #ifdef HAVE_LIBAIO
   write_finish_thread.create();
 #endif
+
+  if (discard && !discard_hook) {
+    discard_hook = new JournalDiscardHook(this);
+    int r = g_ceph_context->get_admin_socket()->register_command(
+      "dump_journal_discard", discard_hook, "show journal discard progress");
+    if (r < 0) {
+      dout(0) << "start_writer unable to register dump_journal_discard: "
+	      << cpp_strerror(r) << dendl;
+      delete discard_hook;
+      discard_hook = NULL;
+    }
+  }
 }
 
 void FileJournal::stop_writer()
@@ -647,6 +693,12 @@ void FileJournal::stop_writer()
 #ifdef HAVE_LIBAIO
   write_finish_thread.join();
 #endif
+
+  if (discard_hook) {
+    g_ceph_context->get_admin_socket()->unregister_command("dump_journal_discard");
+    delete discard_hook;
+    discard_hook = NULL;
+  }
 }
 
 
@@ -926,11 +978,41 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
   return 0;
 }
 
+static int hist_bucket(uint64_t v, uint64_t first, int shift)
+{
+  int b = 0;
+  while (b < 5 && v > (first << (shift * b)))
+    b++;
+  return b;
+}
+
+void FileJournal::note_write(uint64_t len)
+{
+  if (!logger)
+    return;
+  logger->inc(l_os_j_wr);
+  logger->finc(l_os_j_wr_bytes, len);
+  logger->inc(l_os_j_wr_size_hist + hist_bucket(len, 4096, 2));
+}
+
 void FileJournal::align_bl(off64_t pos, bufferlist& bl)
 {
   // make sure list segments are page aligned
   if (directio && (!bl.is_page_aligned() ||
 		   !bl.is_n_page_sized())) {
+    if (logger) {
+      // rebuild_page_aligned() keeps the segments that are whole pages
+      // at page aligned offsets; everything else gets copied
+      unsigned off = 0, kept = 0;
+      for (std::list<buffer::ptr>::const_iterator p = bl.buffers().begin();
+	   p != bl.buffers().end();
+	   ++p) {
+	if ((off & ~CEPH_PAGE_MASK) == 0 && p->is_page_aligned() && p->is_n_page_sized())
+	  kept += p->length();
+	off += p->length();
+      }
+      logger->inc(l_os_j_wr_realign_bytes, bl.length() - kept);
+    }
     bl.rebuild_page_aligned();
     if ((bl.length() & ~CEPH_PAGE_MASK) != 0 ||
 	(pos & ~CEPH_PAGE_MASK) != 0)
@@ -943,6 +1025,7 @@ void FileJournal::align_bl(off64_t pos, bufferlist& bl)
 int FileJournal::write_bl(off64_t& pos, bufferlist& bl)
 {
   align_bl(pos, bl);
+  note_write(bl.length());
 
   ::lseek64(fd, pos, SEEK_SET);
   int ret = bl.write_fd(fd);
@@ -961,9 +1044,11 @@ void FileJournal::do_write(bufferlist& bl)
     return;
 
   buffer::ptr hbp;
+  list<pair<off64_t,off64_t> > freed;
   if (must_write_header) {
     must_write_header = false;
     hbp = prepare_header();
+    freed.swap(discard_pending);
   }
 
   write_lock.Unlock();
@@ -1052,6 +1137,9 @@ void FileJournal::do_write(bufferlist& bl)
   utime_t lat = ceph_clock_now(g_ceph_context) - from;    
   dout(20) << "do_write latency " << lat << dendl;
 
+  if (!freed.empty())
+    queue_discard(freed);
+
   write_lock.Lock();    
 
   // wrap if we hit the end of the journal
@@ -1104,6 +1192,14 @@ void FileJournal::write_thread_entry()
       if (writeq.empty()) {
 	if (write_stop)
 	  break;
+	if (discard) {
+	  // idle: a good time to catch up on discards
+	  queue_lock.Unlock();
+	  bool did = do_discard();
+	  queue_lock.Lock();
+	  if (did)
+	    continue;
+	}
 	dout(20) << "write_thread_entry going to sleep" << dendl;
 	{
 	  if (writeq.empty()) {
@@ -1118,6 +1214,13 @@ void FileJournal::write_thread_entry()
 #ifdef HAVE_LIBAIO
     if (aio) {
       Mutex::Locker locker(aio_lock);
+      if (aio_num >= aio_max_num) {
+	dout(20) << "write_thread_entry deferring until more aios complete: "
+		 << aio_num << " aios in flight, queue depth " << aio_max_num << dendl;
+	aio_cond.Wait(aio_lock);
+	dout(20) << "write_thread_entry woke up" << dendl;
+	continue;
+      }
       // should we back off to limit aios in flight?  try to do this
       // adaptively so that we submit larger aios once we have lots of
       // them in flight.
@@ -1153,10 +1256,31 @@ void FileJournal::write_thread_entry()
     assert(r == 0);
 
 #ifdef HAVE_LIBAIO
-    if (aio)
+    if (aio) {
       do_aio_write(bl);
-    else
-      do_write(bl);
+      put_throttle(orig_ops, orig_bytes);
+
+      // if that did not drain the queue, prepare more writes while
+      // there is room in flight and hand them all to one io_submit.
+      while (true) {
+	{
+	  Mutex::Locker l(aio_lock);
+	  if (aio_num >= aio_max_num)
+	    break;
+	}
+	if (writeq_empty())
+	  break;
+	bufferlist more;
+	orig_ops = orig_bytes = 0;
+	if (prepare_multi_write(more, orig_ops, orig_bytes) < 0)
+	  break;  // full; the next pass will wait for the commit
+	do_aio_write(more);
+	put_throttle(orig_ops, orig_bytes);
+      }
+      submit_aio();
+      continue;
+    }
+    do_write(bl);
 #else
     do_write(bl);
 #endif
@@ -1174,9 +1298,11 @@ void FileJournal::do_aio_write(bufferlist& bl)
     return;
 
   buffer::ptr hbp;
+  list<pair<off64_t,off64_t> > freed;
   if (must_write_header) {
     must_write_header = false;
     hbp = prepare_header();
+    freed.swap(discard_pending);
   }
 
   // entry
@@ -1208,7 +1334,7 @@ void FileJournal::do_aio_write(bufferlist& bl)
       pos = 0;          // we included the header
     } else
       pos = get_top();  // no header, start after that
-    if (write_aio_bl(pos, second, writing_seq)) {
+    if (write_aio_bl(pos, second, writing_seq, &freed)) {
       derr << "FileJournal::do_aio_write: write_aio_bl(pos=" << pos
 	   << ") failed" << dendl;
       ceph_abort();
@@ -1219,7 +1345,7 @@ void FileJournal::do_aio_write(bufferlist& bl)
       bufferlist hbl;
       hbl.push_back(hbp);
       loff_t pos = 0;
-      if (write_aio_bl(pos, hbl, 0)) {
+      if (write_aio_bl(pos, hbl, 0, &freed)) {
 	derr << "FileJournal::do_aio_write: write_aio_bl(header) failed" << dendl;
 	ceph_abort();
       }
@@ -1239,12 +1365,13 @@ void FileJournal::do_aio_write(bufferlist& bl)
 }
 
 /**
- * write a buffer using aio
+ * prepare an aio write of a buffer; submit_aio() sends it
  *
  * @param seq seq to trigger when this aio completes.  if 0, do not update any state
  * on completion.
  */
-int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
+int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq,
+			       list<pair<off64_t,off64_t> > *discard)
 {
   Mutex::Locker locker(aio_lock);
   align_bl(pos, bl);
@@ -1253,6 +1380,8 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
   
   aio_queue.push_back(aio_info(bl, pos, seq));
   aio_info& aio = aio_queue.back();
+  if (discard)
+    aio.discard.swap(*discard);
 
   aio.iov = new iovec[aio.bl.buffers().size()];
   int n = 0;
@@ -1269,13 +1398,37 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
 
   aio_num++;
   aio_bytes += aio.len;
+  note_write(aio.len);
 
-  iocb *piocb = &aio.iocb;
+  aio_unsubmitted.push_back(&aio.iocb);
+  pos += aio.len;
+  return 0;
+}
+
+/**
+ * submit every aio prepared by write_aio_bl() since the last call, as
+ * few io_submit calls as the kernel allows.
+ */
+void FileJournal::submit_aio()
+{
+  Mutex::Locker locker(aio_lock);
+  if (aio_unsubmitted.empty())
+    return;
+
+  dout(20) << "submit_aio " << aio_unsubmitted.size() << " aios, "
+	   << aio_num << " in flight" << dendl;
+  if (logger) {
+    logger->set(l_os_j_aio_depth, aio_num);
+    logger->inc(l_os_j_aio_depth_hist + hist_bucket(aio_num, 1, 1));
+  }
+
+  unsigned done = 0;
   int attempts = 10;
-  do {
-    int r = io_submit(aio_ctx, 1, &piocb);
+  while (done < aio_unsubmitted.size()) {
+    int r = io_submit(aio_ctx, aio_unsubmitted.size() - done,
+		      &aio_unsubmitted[done]);
     if (r < 0) {
-      derr << "io_submit to " << aio.off << "~" << aio.len
+      derr << "io_submit of " << (aio_unsubmitted.size() - done) << " aios"
 	   << " got " << cpp_strerror(r) << dendl;
       if (r == -EAGAIN && attempts-- > 0) {
 	usleep(500);
@@ -1283,10 +1436,10 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
       }
       assert(0 == "io_submit got unexpected error");
     }
-  } while (false);
-  pos += aio.len;
+    done += r;  // the kernel may take only some of them
+  }
+  aio_unsubmitted.clear();
   write_finish_cond.Signal();
-  return 0;
 }
 #endif
 
@@ -1360,8 +1513,12 @@ void FileJournal::check_aio_completion()
     }
     aio_num--;
     aio_bytes -= p->len;
+    if (!p->discard.empty())
+      queue_discard(p->discard);
     aio_queue.erase(p++);
   }
+  if (logger)
+    logger->set(l_os_j_aio_depth, aio_num);
 
   if (completed_something) {
     // kick finisher?  
@@ -1487,6 +1644,7 @@ void FileJournal::committed_thru(uint64_t seq)
   last_committed_seq = seq;
 
   // adjust start pointer
+  off64_t old_start = header.start;
   while (!journalq.empty() && journalq.front().first <= seq) {
     journalq.pop_front();
   }
@@ -1495,6 +1653,8 @@ void FileJournal::committed_thru(uint64_t seq)
   } else {
     header.start = write_pos;
   }
+  if (discard)
+    note_trimmed(old_start, header.start);
   must_write_header = true;
   print_header();
 
@@ -1524,6 +1684,192 @@ void FileJournal::committed_thru(uint64_t seq)
 }
 
 
+/*
+ * from~to (which may wrap) no longer holds anything we will replay,
+ * but until a header saying so is on disk it is not ours to discard.
+ */
+void FileJournal::note_trimmed(off64_t from, off64_t to)
+{
+  assert(write_lock.is_locked());
+  if (from == to || from < get_top())
+    return;  // nothing trimmed, or a fresh journal
+  dout(20) << "note_trimmed " << from << " to " << to << dendl;
+  if (from < to) {
+    discard_pending.push_back(make_pair(from, to));
+  } else {
+    discard_pending.push_back(make_pair(from, header.max_size));
+    if (to > get_top())
+      discard_pending.push_back(make_pair(get_top(), to));
+  }
+}
+
+/*
+ * the header moving start past ls is on disk: queue them for
+ * do_discard(), merging with whatever they continue.
+ */
+void FileJournal::queue_discard(list<pair<off64_t,off64_t> >& ls)
+{
+  Mutex::Locker l(discard_lock);
+  for (list<pair<off64_t,off64_t> >::iterator p = ls.begin(); p != ls.end(); ++p) {
+    discard_ready_bytes += p->second - p->first;
+    if (!discard_ready.empty() && discard_ready.back().second == p->first)
+      discard_ready.back().second = p->second;
+    else
+      discard_ready.push_back(*p);
+  }
+  ls.clear();
+}
+
+/*
+ * the writer may since have wrapped into space queued for discard
+ * long ago: keep only what is still free, write_pos up to header.start
+ * (which may wrap).  whatever we drop is queued again once it is
+ * trimmed again.
+ */
+void FileJournal::clip_discard_ready()
+{
+  assert(write_lock.is_locked());
+  assert(discard_lock.is_locked());
+  pair<off64_t,off64_t> free[2];
+  int nfree = 0;
+  if (write_pos < header.start) {
+    free[nfree++] = make_pair(write_pos, header.start);
+  } else {
+    free[nfree++] = make_pair(write_pos, header.max_size);
+    free[nfree++] = make_pair(get_top(), header.start);
+  }
+
+  list<pair<off64_t,off64_t> > ls;
+  uint64_t bytes = 0;
+  for (list<pair<off64_t,off64_t> >::iterator p = discard_ready.begin();
+       p != discard_ready.end();
+       ++p) {
+    for (int i = 0; i < nfree; i++) {
+      off64_t from = MAX(p->first, free[i].first);
+      off64_t to = MIN(p->second, free[i].second);
+      if (from < to) {
+	ls.push_back(make_pair(from, to));
+	bytes += to - from;
+      }
+    }
+  }
+  if (bytes != discard_ready_bytes)
+    dout(10) << "clip_discard_ready dropped " << (discard_ready_bytes - bytes)
+	     << " bytes the writer has reused" << dendl;
+  discard_ready.swap(ls);
+  discard_ready_bytes = bytes;
+}
+
+/*
+ * discard some of discard_ready, in batches of at least
+ * journal_discard_min_bytes and no faster than
+ * journal_discard_max_bytes_per_sec.  called by the writer when it
+ * has nothing better to do.  write_lock is only held to pick what to
+ * discard: write_pos only moves in this thread, and header.start only
+ * moves on, freeing more, so what we picked stays free until we return.
+ * we discard journal_discard_min_bytes at a time, and give up on the
+ * rest (leaving it queued) as soon as there is something to write.
+ *
+ * @return true if we discarded anything
+ */
+bool FileJournal::do_discard()
+{
+  uint64_t min_bytes = g_conf->journal_discard_min_bytes;
+  uint64_t rate = g_conf->journal_discard_max_bytes_per_sec;
+  list<pair<off64_t,off64_t> > ls;
+  {
+    Mutex::Locker wl(write_lock);
+    Mutex::Locker l(discard_lock);
+    clip_discard_ready();
+    if (discard_ready_bytes == 0 || discard_ready_bytes < min_bytes)
+      return false;
+
+    utime_t now = ceph_clock_now(g_ceph_context);
+    uint64_t budget = discard_ready_bytes;
+    if (rate) {
+      double elapsed = MIN((double)(now - discard_last), 1.0);
+      budget = MIN(budget, (uint64_t)(rate * elapsed));
+      if (budget < MAX(min_bytes, (uint64_t)block_size))
+	return false;
+    }
+    budget -= budget % block_size;
+    discard_last = now;
+
+    while (budget && !discard_ready.empty()) {
+      pair<off64_t,off64_t>& r = discard_ready.front();
+      uint64_t len = MIN(budget, (uint64_t)(r.second - r.first));
+      if (min_bytes)
+	len = MIN(len, ROUND_UP_TO(min_bytes, (uint64_t)block_size));
+      ls.push_back(make_pair(r.first, r.first + len));
+      discard_ready_bytes -= len;
+      budget -= len;
+      r.first += len;
+      if (r.first == r.second)
+	discard_ready.pop_front();
+    }
+  }
+
+  bool did = false;
+  while (!ls.empty()) {
+    if (did && !writeq_empty()) {
+      // writes first; put back what is left for next time
+      Mutex::Locker l(discard_lock);
+      dout(10) << "do_discard deferring " << ls.size() << " ranges to new writes" << dendl;
+      while (!ls.empty()) {
+	discard_ready_bytes += ls.back().second - ls.back().first;
+	discard_ready.push_front(ls.back());
+	ls.pop_back();
+      }
+      break;
+    }
+    off64_t off = ls.front().first;
+    uint64_t len = ls.front().second - off;
+    ls.pop_front();
+    dout(10) << "do_discard " << off << "~" << len << dendl;
+    int r;
+    if (is_bdev) {
+      r = block_device_discard(fd, off, len);
+    } else {
+#if defined(CEPH_HAVE_FALLOCATE) && !defined(DARWIN) && !defined(__FreeBSD__)
+      r = ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len);
+      if (r < 0)
+	r = -errno;
+#else
+      r = -EOPNOTSUPP;
+#endif
+    }
+    if (r < 0) {
+      derr << "do_discard " << off << "~" << len << " got " << cpp_strerror(r)
+	   << ", disabling journal discard" << dendl;
+      discard = false;
+      return false;
+    }
+    did = true;
+    Mutex::Locker l(discard_lock);
+    discarded_bytes += len;
+    discards++;
+    if (logger)
+      logger->inc(l_os_j_discard_bytes, len);
+  }
+  return true;
+}
+
+void FileJournal::dump_discard(ostream& out)
+{
+  JSONFormatter f(true);
+  f.open_object_section("journal_discard");
+  {
+    Mutex::Locker l(discard_lock);
+    f.dump_int("enabled", discard);
+    f.dump_unsigned("discarded_bytes", discarded_bytes);
+    f.dump_unsigned("discards", discards);
+    f.dump_unsigned("ready_bytes", discard_ready_bytes);
+    f.dump_unsigned("ready_ranges", discard_ready.size());
+  }
+  f.close_section();
+  f.flush(out);
+}
+
 void FileJournal::put_throttle(uint64_t ops, uint64_t bytes)
 {
   uint64_t new_ops = throttle_ops.put(ops);
@@ -29,10 +29,12 @@ using std::deque;
 # include <libaio.h>
 #endif
 
+class AdminSocketHook;
+
 /**
  * Implements journaling on top of block device or file.
  *
- * Lock ordering is write_lock > aio_lock > queue_lock
+ * Lock ordering is write_lock > aio_lock > queue_lock, discard_lock
  */
 class FileJournal : public Journal {
 public:
@@ -183,6 +185,7 @@ private:
     bool done;
     uint64_t off, len;    ///< these are for debug only
     uint64_t seq;         ///< seq number to complete on aio completion, if non-zero
+    list<pair<off64_t,off64_t> > discard;  ///< ranges this header write frees
 
     aio_info(bufferlist& b, uint64_t o, uint64_t s)
       : iov(NULL), done(false), off(o), len(b.length()), seq(s) {
@@ -198,11 +201,35 @@ private:
   io_context_t aio_ctx;
   list<aio_info> aio_queue;
   int aio_num, aio_bytes;
+  int aio_max_num;                ///< journal_aio_queue_depth, fixed at open
+  vector<iocb*> aio_unsubmitted;  ///< prepared by write_aio_bl, for submit_aio
   /// End protected by aio_lock
 #endif
 
   uint64_t last_committed_seq;
 
+  /*
+   * journal_discard: once committed_thru() moves header.start past a
+   * range, and a header saying so is on disk, we can discard it.
+   * Only done for block devices: file journals are preallocated, and
+   * punching holes in them would just fragment them (but see
+   * journal_debug_discard_file).
+   */
+  bool discard;
+  /// trimmed by committed_thru, header not written yet; protected by write_lock
+  list<pair<off64_t,off64_t> > discard_pending;
+  Mutex discard_lock;
+  /// safe to discard, oldest first; protected by discard_lock
+  list<pair<off64_t,off64_t> > discard_ready;
+  uint64_t discard_ready_bytes, discarded_bytes, discards;  ///< discard_lock
+  utime_t discard_last;  ///< writer thread only
+  AdminSocketHook *discard_hook;
+
+  void note_trimmed(off64_t from, off64_t to);
+  void queue_discard(list<pair<off64_t,off64_t> >& ls);
+  void clip_discard_ready();
+  bool do_discard();
+
   /*
    * full states cycle at the beginnging of each commit epoch, when commit_start()
    * is called.
@@ -257,9 +284,12 @@ private:
   void write_finish_thread_entry();
   void check_aio_completion();
   void do_aio_write(bufferlist& bl);
-  int write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq);
+  int write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq,
+		   list<pair<off64_t,off64_t> > *discard = 0);
+  void submit_aio();
 
 
+  void note_write(uint64_t len);
   void align_bl(off64_t pos, bufferlist& bl);
   int write_bl(off64_t& pos, bufferlist& bl);
   void wrap_read_bl(off64_t& pos, int64_t len, bufferlist& bl);
@@ -302,9 +332,13 @@ private:
     write_pos(0), read_pos(0),
 #ifdef HAVE_LIBAIO
     aio_lock("FileJournal::aio_lock"),
-    aio_num(0), aio_bytes(0),
+    aio_num(0), aio_bytes(0), aio_max_num(0),
 #endif
     last_committed_seq(0), 
+    discard(false),
+    discard_lock("FileJournal::discard_lock"),
+    discard_ready_bytes(0), discarded_bytes(0), discards(0),
+    discard_hook(NULL),
     full_state(FULL_NOTFULL),
     fd(-1),
     writing_seq(0),
@@ -325,6 +359,7 @@ private:
   int peek_fsid(uuid_d& fsid);
 
   int dump(ostream& out);
+  void dump_discard(ostream& out);
 
   void flush();
 
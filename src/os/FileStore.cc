@@ -759,6 +759,21 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   plb.add_fl_avg(l_os_commit_len, "commitcycle_interval");
   plb.add_fl_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
+  plb.add_u64_counter(l_os_j_wr, "journal_wr");
+  plb.add_fl_avg(l_os_j_wr_bytes, "journal_wr_bytes");
+  plb.add_u64(l_os_j_aio_depth, "journal_aio_depth");
+  plb.add_u64_counter(l_os_j_discard_bytes, "journal_discard_bytes");
+  plb.add_u64_counter(l_os_j_wr_realign_bytes, "journal_wr_realign_bytes");
+  static const char *wr_size_hist[] = {
+    "journal_wr_le_4k", "journal_wr_le_16k", "journal_wr_le_64k",
+    "journal_wr_le_256k", "journal_wr_le_1m", "journal_wr_gt_1m" };
+  static const char *aio_depth_hist[] = {
+    "journal_aio_depth_le_1", "journal_aio_depth_le_2", "journal_aio_depth_le_4",
+    "journal_aio_depth_le_8", "journal_aio_depth_le_16", "journal_aio_depth_gt_16" };
+  for (int i = 0; i < 6; i++) {
+    plb.add_u64_counter(l_os_j_wr_size_hist + i, wr_size_hist[i]);
+    plb.add_u64_counter(l_os_j_aio_depth_hist + i, aio_depth_hist[i]);
+  }
 
   logger = plb.create_perf_counters();
 }
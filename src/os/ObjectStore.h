@@ -65,6 +65,13 @@ enum {
   l_os_commit_len,
   l_os_commit_lat,
   l_os_j_full,
+  l_os_j_wr,
+  l_os_j_wr_bytes,
+  l_os_j_wr_size_hist,    // 6 counters: writes by size
+  l_os_j_aio_depth = l_os_j_wr_size_hist + 6,
+  l_os_j_aio_depth_hist,  // 6 counters: submits by aios in flight
+  l_os_j_discard_bytes = l_os_j_aio_depth_hist + 6,
+  l_os_j_wr_realign_bytes,  // bytes copied to page align O_DIRECT writes
   l_os_last,
 };
 
@@ -92,6 +92,7 @@
 #include "common/safe_io.h"
 #include "common/HeartbeatMap.h"
 #include "common/admin_socket.h"
+#include "common/Formatter.h"
 
 #include "global/signal_handler.h"
 #include "global/pidfile.h"
@@ -135,6 +136,7 @@ static CompatSet get_osd_compat_set() {
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_CATEGORIES);
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_HOBJECTPOOL);
   ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_BIGINFO);
+  ceph_osd_feature_incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_LEVELDBLOG);
   return CompatSet(ceph_osd_feature_compat, ceph_osd_feature_ro_compat,
 		   ceph_osd_feature_incompat);
 }
@@ -147,7 +149,6 @@ OSDService::OSDService(OSD *osd) :
   client_messenger(osd->client_messenger),
   logger(osd->logger),
   monc(osd->monc),
-  op_wq(osd->op_wq),
   peering_wq(osd->peering_wq),
   recovery_wq(osd->recovery_wq),
   snap_trim_wq(osd->snap_trim_wq),
@@ -158,6 +159,7 @@ OSDService::OSDService(OSD *osd) :
   publish_lock("OSDService::publish_lock"),
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
+  deep_scrub_throttle_lock("OSDService::deep_scrub_throttle_lock"),
   watch_lock("OSD::watch_lock"),
   watch_timer(osd->client_messenger->cct, watch_lock),
   watch(NULL),
@@ -677,6 +679,8 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   whoami(id),
   dev_path(dev), journal_path(jdev),
   dispatch_running(false),
+  op_fast_dispatch(g_conf->osd_op_fast_dispatch),
+  fast_dispatch_lock("OSD::fast_dispatch_lock"),
   osd_compat(get_osd_compat_set()),
   state(STATE_BOOTING), boot_epoch(0), up_epoch(0), bind_epoch(0),
   op_tp(external_messenger->cct, "OSD::op_tp", g_conf->osd_op_threads),
@@ -691,13 +695,15 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   heartbeat_dispatcher(this),
   stat_lock("OSD::stat_lock"),
   finished_lock("OSD::finished_lock"),
+  waiting_op_count(0),
   admin_ops_hook(NULL),
   historic_ops_hook(NULL),
-  op_queue_len(0),
-  op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
-  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
+  op_wq(this, external_messenger->cct, g_conf->osd_op_thread_timeout),
+  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp,
+	     g_conf->osd_peering_wq_batch_size),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
+  pg_map_lock("OSD::pg_map_lock"),
   debug_drop_pg_create_probability(g_conf->osd_debug_drop_pg_create_probability),
   debug_drop_pg_create_duration(g_conf->osd_debug_drop_pg_create_duration),
   debug_drop_pg_create_left(-1),
@@ -711,6 +717,7 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   recovery_wq(this, g_conf->osd_recovery_thread_timeout, &recovery_tp),
   replay_queue_lock("OSD::replay_queue_lock"),
   snap_trim_wq(this, g_conf->osd_snap_trim_thread_timeout, &disk_tp),
+  scrubs_hook(NULL),
   scrub_wq(this, g_conf->osd_scrub_thread_timeout, &disk_tp),
   scrub_finalize_wq(this, g_conf->osd_scrub_finalize_thread_timeout, &op_tp),
   rep_scrub_wq(this, g_conf->osd_scrub_thread_timeout, &disk_tp),
@@ -771,6 +778,18 @@ public:
   }
 };
 
+class ScrubsSocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  ScrubsSocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    osd->dump_scrubs(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 
 class OpsFlightSocketHook : public AdminSocketHook {
   OSD *osd;
@@ -883,6 +902,7 @@ int OSD::init()
   osd_lock.Lock();
 
   op_tp.start();
+  op_wq.start();
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
@@ -910,6 +930,10 @@ int OSD::init()
   r = admin_socket->register_command("dump_historic_ops", historic_ops_hook,
                                          "show slowest recent ops");
   assert(r == 0);
+  scrubs_hook = new ScrubsSocketHook(this);
+  r = admin_socket->register_command("dump_scrubs", scrubs_hook,
+				     "show progress of scrubs in progress");
+  assert(r == 0);
 
   return 0;
 }
@@ -960,6 +984,9 @@ void OSD::create_logger()
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
+  osd_plb.add_u64_counter(l_osd_obc_hit, "object_context_hit");   // object contexts found in memory
+  osd_plb.add_u64_counter(l_osd_obc_miss, "object_context_miss"); // ... read from the store
+
   osd_plb.add_fl(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
 
@@ -986,6 +1013,7 @@ void OSD::suicide(int exitcode)
 
   derr << " pausing thread pools" << dendl;
   op_tp.pause();
+  op_wq.pause();
   disk_tp.pause();
   recovery_tp.pause();
   command_tp.pause();
@@ -1010,7 +1038,9 @@ int OSD::shutdown()
   
   derr << "shutdown" << dendl;
 
+  fast_dispatch_lock.get_write();
   state = STATE_STOPPING;
+  fast_dispatch_lock.put_write();
 
   timer.shutdown();
 
@@ -1031,14 +1061,18 @@ int OSD::shutdown()
   dout(10) << "no ops" << dendl;
 
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_scrubs");
   delete admin_ops_hook;
   delete historic_ops_hook;
+  delete scrubs_hook;
   admin_ops_hook = NULL;
   historic_ops_hook = NULL;
+  scrubs_hook = NULL;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
   op_tp.stop();
+  op_wq.stop();
   dout(10) << "op tp stopped" << dendl;
 
   // pause _new_ disk work first (to avoid racing with thread pool),
@@ -1110,7 +1144,9 @@ int OSD::shutdown()
     PG *pg = p->second;
     pg->put();
   }
+  pg_map_lock.get_write();
   pg_map.clear();
+  pg_map_lock.put_write();
 
   client_messenger->shutdown();
   cluster_messenger->shutdown();
@@ -1245,7 +1281,9 @@ PG *OSD::_open_lock_pg(
     assert(0);
 
   assert(pg_map.count(pgid) == 0);
+  pg_map_lock.get_write();
   pg_map[pgid] = pg;
+  pg_map_lock.put_write();
 
   if (hold_map_lock)
     pg->lock_with_map_lock_held(no_lockdep_check);
@@ -2039,6 +2077,42 @@ void OSD::ms_handle_connect(Connection *con)
   }
 }
 
+bool OSD::ms_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+			   bufferlist& data)
+{
+  // write payloads end up in the journal; lay them out so that every
+  // whole page lands in a page aligned, page sized segment and the
+  // O_DIRECT write can take them as they are.  carve the middle into
+  // chunks the buffer free lists recycle instead of one big allocation.
+  if (header.type != CEPH_MSG_OSD_OP && header.type != MSG_OSD_SUBOP)
+    return false;
+  unsigned chunk = g_conf->osd_rx_buffer_chunk & CEPH_PAGE_MASK;
+  if (!chunk)
+    return false;
+  unsigned left = le32_to_cpu(header.data_len);
+  unsigned off = le32_to_cpu(header.data_off);
+  if (left < CEPH_PAGE_SIZE)
+    return false;
+
+  if (off & ~CEPH_PAGE_MASK) {
+    unsigned head = MIN(CEPH_PAGE_SIZE - (off & ~CEPH_PAGE_MASK), left);
+    data.push_back(buffer::create(head));
+    left -= head;
+  }
+  while (left >= chunk) {
+    data.push_back(buffer::create_page_aligned(chunk));
+    left -= chunk;
+  }
+  unsigned pages = left & CEPH_PAGE_MASK;
+  if (pages) {
+    data.push_back(buffer::create_page_aligned(pages));
+    left -= pages;
+  }
+  if (left)
+    data.push_back(buffer::create(left));
+  return true;
+}
+
 void OSD::put_object_context(void *_obc, pg_t pgid)
 {
   ReplicatedPG::ObjectContext *obc = (ReplicatedPG::ObjectContext *)_obc;
@@ -2229,7 +2303,8 @@ void OSD::_send_boot()
     hbserver_messenger->set_addr_unknowns(hb_addr);
     dout(10) << " assuming hb_addr ip matches cluster_addr" << dendl;
   }
-  MOSDBoot *mboot = new MOSDBoot(superblock, hb_addr, cluster_addr);
+  MOSDBoot *mboot = new MOSDBoot(superblock, hb_addr, cluster_addr,
+				 CEPH_FEATURES_ALL);
   dout(10) << " client_addr " << client_messenger->get_myaddr()
 	   << ", cluster_addr " << cluster_addr
 	   << ", hb addr " << hb_addr
@@ -2816,10 +2891,21 @@ bool OSD::ms_dispatch(Message *m)
   }
   dispatch_running = true;
 
+  // an op ms_fast_dispatch declined; its session's later ops queue
+  // behind it until it is queued on its pg or parked
+  Session *declined = NULL;
+  if (op_fast_dispatch && m->get_type() == CEPH_MSG_OSD_OP && m->get_connection())
+    declined = (Session *)m->get_connection()->get_priv();
+
   do_waiters();
   _dispatch(m);
   do_waiters();
 
+  if (declined) {
+    declined->slow_ops.dec();
+    declined->put();
+  }
+
   dispatch_running = false;
   dispatch_cond.Signal();
 
@@ -2827,6 +2913,50 @@ bool OSD::ms_dispatch(Message *m)
   return true;
 }
 
+bool OSD::ms_can_fast_dispatch(Message *m)
+{
+  // this must give the same answer every time it is asked about m
+  switch (m->get_type()) {
+  case CEPH_MSG_PING:
+    return true;
+  case CEPH_MSG_OSD_OP:
+    return op_fast_dispatch;
+  default:
+    return false;
+  }
+}
+
+bool OSD::ms_fast_dispatch(Message *m)
+{
+  if (m->get_type() == CEPH_MSG_PING) {
+    dout(10) << "ping from " << m->get_source() << " (fast)" << dendl;
+    m->put();
+    return true;
+  }
+
+  /* A client's ops all come through here, one at a time, from the
+   * thread reading its connection.  Those that can't be queued without
+   * osd_lock go back to the messenger for ms_dispatch, and so do the
+   * ops after them until ms_dispatch has caught up, so that a later op
+   * can't overtake them.  Ops from connections without a session can't
+   * be tracked that way, so they always take the slow path. */
+  Session *session = (Session *)m->get_connection()->get_priv();
+  bool queued = false;
+  if (session && session->slow_ops.read() == 0) {
+    fast_dispatch_lock.get_read();
+    queued = fast_dispatch_op((MOSDOp*)m);
+    fast_dispatch_lock.put_read();
+  }
+  if (!queued) {
+    dout(20) << "ms_fast_dispatch " << *m << " needs osd_lock" << dendl;
+    if (session)
+      session->slow_ops.inc();
+  }
+  if (session)
+    session->put();
+  return queued;
+}
+
 bool OSD::ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new)
 {
   dout(10) << "OSD::ms_get_authorizer type=" << ceph_entity_type_name(dest_type) << dendl;
@@ -2917,8 +3047,10 @@ void OSD::do_waiters()
     dout(2) << "do_waiters -- start" << dendl;
     for (list<OpRequestRef>::iterator it = waiting.begin();
          it != waiting.end();
-         it++)
+         it++) {
       dispatch_op(*it);
+      waiting_op_count.dec();  // counted again if it is still waiting
+    }
     dout(2) << "do_waiters -- finish" << dendl;
   }
 }
@@ -3040,6 +3172,7 @@ void OSD::_dispatch(Message *m)
       if (!osdmap) {
         dout(7) << "no OSDMap, not booted" << dendl;
         waiting_for_osdmap.push_back(op);
+        waiting_op_count.inc();
         break;
       }
       
@@ -3078,6 +3211,8 @@ void OSD::handle_scrub(MOSDScrub *m)
       if (pg->is_primary()) {
 	if (m->repair)
 	  pg->state_set(PG_STATE_REPAIR);
+	if (m->deep)
+	  pg->state_set(PG_STATE_DEEP_SCRUB);
 	if (pg->queue_scrub()) {
 	  dout(10) << "queueing " << *pg << " for scrub" << dendl;
 	}
@@ -3094,6 +3229,8 @@ void OSD::handle_scrub(MOSDScrub *m)
 	if (pg->is_primary()) {
 	  if (m->repair)
 	    pg->state_set(PG_STATE_REPAIR);
+	  if (m->deep)
+	    pg->state_set(PG_STATE_DEEP_SCRUB);
 	  if (pg->queue_scrub()) {
 	    dout(10) << "queueing " << *pg << " for scrub" << dendl;
 	  }
@@ -3142,6 +3279,29 @@ bool OSDService::scrub_should_schedule()
   return loadavgs[0] < g_conf->osd_scrub_load_threshold;
 }
 
+void OSD::dump_scrubs(ostream& ss)
+{
+  JSONFormatter f(true);
+  f.open_array_section("scrubs");
+  osd_lock.Lock();
+  for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
+       p != pg_map.end();
+       ++p) {
+    PG *pg = p->second;
+    pg->lock();
+    if (pg->is_scrubbing()) {
+      f.open_object_section("pg");
+      f.dump_stream("pgid") << pg->info.pgid;
+      pg->dump_scrub_info(&f);
+      f.close_section();
+    }
+    pg->unlock();
+  }
+  osd_lock.Unlock();
+  f.close_section();
+  f.flush(ss);
+}
+
 void OSD::sched_scrub()
 {
   assert(osd_lock.is_locked());
@@ -3214,6 +3374,42 @@ void OSDService::dec_scrubs_active()
   sched_scrub_lock.Unlock();
 }
 
+/*
+ * pace deep scrub reads on this osd to osd_deep_scrub_max_bytes_per_sec.
+ * each read pushes deep_scrub_next_read out by the time it costs at that
+ * rate, and sleeps until the reads before it are paid for.  never call
+ * this with a pg lock held.  the caller is normally a disk_tp work item,
+ * so we sleep a second at a time and keep the thread's heartbeat fresh
+ * rather than trip osd_scrub_thread_timeout.
+ */
+void OSDService::throttle_deep_scrub_read(uint64_t bytes)
+{
+  uint64_t rate = g_conf->osd_deep_scrub_max_bytes_per_sec;
+  if (!rate)
+    return;
+
+  deep_scrub_throttle_lock.Lock();
+  utime_t now = ceph_clock_now(g_ceph_context);
+  if (deep_scrub_next_read < now)
+    deep_scrub_next_read = now;
+  utime_t wait = deep_scrub_next_read - now;
+  deep_scrub_next_read += (double)bytes / (double)rate;
+  deep_scrub_throttle_lock.Unlock();
+
+  if (wait > utime_t()) {
+    dout(20) << "throttle_deep_scrub_read " << bytes << " bytes, sleeping "
+	     << wait << dendl;
+    while (wait > utime_t()) {
+      utime_t t = MIN(wait, utime_t(1, 0));
+      struct timespec ts;
+      t.to_timespec(&ts);
+      nanosleep(&ts, NULL);
+      wait -= t;
+      ThreadPool::reset_tp_timeout();
+    }
+  }
+}
+
 // =====================================================
 // MAP
 
@@ -3226,6 +3422,7 @@ void OSD::wait_for_new_map(OpRequestRef op)
   }
   
   waiting_for_osdmap.push_back(op);
+  waiting_op_count.inc();
   op->mark_delayed();
 }
 
@@ -3340,12 +3537,12 @@ void OSD::handle_osd_map(MOSDMap *m)
       t.write(coll_t::META_COLL, oid, 0, bl.length(), bl);
       pin_map_inc_bl(e, bl);
 
+      // start from a copy of the previous epoch; it shares everything
+      // the incremental does not change with it.
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
 	OSDMapRef prev = get_map(e - 1);
-	prev->encode(obl);
-	o->decode(obl);
+	*o = *prev;
       }
 
       OSDMap::Incremental inc;
@@ -3513,18 +3710,28 @@ void OSD::handle_osd_map(MOSDMap *m)
   m->put();
 }
 
-void OSD::advance_pg(epoch_t osd_epoch, PG *pg, PG::RecoveryCtx *rctx)
+/**
+ * advance pg through the maps up to osd_epoch, at most
+ * osd_map_max_advance of them.  returns false if it stopped short
+ * and the pg needs to be requeued to finish.
+ */
+bool OSD::advance_pg(epoch_t osd_epoch, PG *pg, PG::RecoveryCtx *rctx)
 {
   assert(pg->is_locked());
   epoch_t next_epoch = pg->get_osdmap()->get_epoch() + 1;
   OSDMapRef lastmap = pg->get_osdmap();
 
   if (lastmap->get_epoch() == osd_epoch)
-    return;
+    return true;
   assert(lastmap->get_epoch() < osd_epoch);
 
+  epoch_t max = osd_epoch;
+  if (g_conf->osd_map_max_advance > 0 &&
+      next_epoch + g_conf->osd_map_max_advance - 1 < osd_epoch)
+    max = next_epoch + g_conf->osd_map_max_advance - 1;
+
   for (;
-       next_epoch <= osd_epoch;
+       next_epoch <= max;
        ++next_epoch) {
     OSDMapRef nextmap = get_map(next_epoch);
     vector<int> newup, newacting;
@@ -3533,6 +3740,12 @@ void OSD::advance_pg(epoch_t osd_epoch, PG *pg, PG::RecoveryCtx *rctx)
     lastmap = nextmap;
   }
   pg->handle_activate_map(rctx);
+  if (next_epoch <= osd_epoch) {
+    dout(10) << "advance_pg " << *pg << " stopped at " << max
+	     << " of " << osd_epoch << ", requeueing" << dendl;
+    return false;
+  }
+  return true;
 }
 
 /** 
@@ -3597,6 +3810,7 @@ void OSD::advance_map(ObjectStore::Transaction& t, C_Contexts *tfin)
       dout(10) << " discarding waiting ops for " << pgid << dendl;
       while (!p->second.empty()) {
 	p->second.pop_front();
+	waiting_op_count.dec();
       }
       waiting_for_pg.erase(p++);
     }
@@ -3615,32 +3829,34 @@ void OSD::activate_map()
 
   int num_pg_primary = 0, num_pg_replica = 0, num_pg_stray = 0;
 
-  epoch_t oldest_last_clean = osdmap->get_epoch();
-
-  list<PG*> to_remove;
+  list<PG*> to_remove, to_advance;
 
-  // scan pg's
+  // scan pg's.  this is done under osd_lock for every map we get, so
+  // keep it to the pg_map and the osdmap: no pg locks, which a busy pg
+  // may hold for a while.  roles are what each pg will take on once
+  // it has advanced to this map.
   for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
        it != pg_map.end();
        it++) {
     PG *pg = it->second;
-    pg->lock();
-    if (pg->is_primary())
+    if (!osdmap->have_pg_pool(it->first.pool())) {
+      //pool is deleted!
+      pg->get();
+      to_remove.push_back(pg);
+      continue;
+    }
+
+    vector<int> acting;
+    int nrep = osdmap->pg_to_acting_osds(it->first, acting);
+    int role = osdmap->calc_pg_role(whoami, acting, nrep);
+    if (role == 0)
       num_pg_primary++;
-    else if (pg->is_replica())
+    else if (role > 0)
       num_pg_replica++;
     else
       num_pg_stray++;
 
-    if (pg->is_primary() && pg->info.history.last_epoch_clean < oldest_last_clean)
-      oldest_last_clean = pg->info.history.last_epoch_clean;
-
-    if (!osdmap->have_pg_pool(pg->info.pgid.pool())) {
-      //pool is deleted!
-      pg->get();
-      to_remove.push_back(pg);
-    }
-    pg->unlock();
+    to_advance.push_back(pg);
   }
 
   for (list<PG*>::iterator i = to_remove.begin();
@@ -3655,15 +3871,10 @@ void OSD::activate_map()
 
   service.publish_map(osdmap);
 
-  // scan pg's
-  for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
-       it != pg_map.end();
-       it++) {
-    PG *pg = it->second;
-    pg->lock();
-    pg->queue_null(osdmap->get_epoch(), osdmap->get_epoch());
-    pg->unlock();
-  }
+  // hand every pg to the peering threads in one go; each one catches
+  // up on all the epochs it is behind (advance_pg) in parallel with
+  // the others.
+  peering_wq.queue(to_advance);
 
   
   logger->set(l_osd_pg, pg_map.size());
@@ -4799,7 +5010,9 @@ void OSD::_remove_pg(PG *pg)
   pg->deleting = true;
 
   // remove from map
+  pg_map_lock.get_write();
   pg_map.erase(pg->info.pgid);
+  pg_map_lock.put_write();
   pg->put(); // since we've taken it out of map
 
   service.unreg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
@@ -5100,6 +5313,7 @@ void OSD::handle_op(OpRequestRef op)
     if (osdmap->get_pg_acting_role(pgid, whoami) >= 0) {
       dout(7) << "we are valid target for op, waiting" << dendl;
       waiting_for_pg[pgid].push_back(op);
+      waiting_op_count.inc();
       op->mark_delayed();
       return;
     }
@@ -5142,6 +5356,73 @@ void OSD::handle_op(OpRequestRef op)
   pg->unlock();
 }
 
+/*
+ * Queue a client op on its pg without osd_lock, if nothing about it
+ * needs more than the published map and the pg.  Anything that may need
+ * a reply from us, a map shared or fetched, or a wait for its pg is left
+ * to handle_op; so is everything while some op is parked on the osd,
+ * which this one must not overtake.  Called with fast_dispatch_lock
+ * held for read, so that shutdown can't drain the op queue under us.
+ *
+ * @return true if m was consumed
+ */
+bool OSD::fast_dispatch_op(MOSDOp *m)
+{
+  if (!is_active() || waiting_op_count.read())
+    return false;
+
+  OSDMapRef curmap = service.get_osdmap();
+  if (!curmap ||
+      !m->get_source().is_client() ||
+      m->get_map_epoch() != curmap->get_epoch() ||
+      m->get_map_epoch() < up_epoch ||
+      op_is_discardable(m) ||
+      m->get_oid().name.size() > MAX_CEPH_OBJECT_NAME_LEN ||
+      curmap->is_blacklisted(m->get_source_addr()))
+    return false;
+
+  if (init_op_flags(m))
+    return false;
+  if (m->may_write() &&
+      (curmap->test_flag(CEPH_OSDMAP_FULL) ||
+       m->get_snapid() != CEPH_NOSNAP ||
+       (g_conf->osd_max_write_size &&
+	m->get_data_len() > g_conf->osd_max_write_size << 20)))
+    return false;
+
+  pg_t pgid = m->get_pg();
+  if ((m->get_flags() & CEPH_OSD_FLAG_PGOP) == 0 &&
+      curmap->have_pg_pool(pgid.pool()))
+    pgid = curmap->raw_pg_to_pg(pgid);
+
+  PG *pg = NULL;
+  pg_map_lock.get_read();
+  hash_map<pg_t, PG*>::iterator p = pg_map.find(pgid);
+  if (p != pg_map.end()) {
+    pg = p->second;
+    pg->get();
+  }
+  pg_map_lock.put_read();
+  if (!pg)
+    return false;
+
+  pg->lock();
+  if (pg->deleting) {
+    pg->unlock();
+    pg->put();
+    return false;
+  }
+
+  OpRequestRef op = op_tracker.create_request(m);
+  m->clear_payload();
+  dout(15) << "fast_dispatch_op " << *m << " pg " << pgid << dendl;
+  if (op_has_sufficient_caps(pg, m))
+    enqueue_op(pg, op);
+  pg->unlock();
+  pg->put();
+  return true;
+}
+
 bool OSD::op_has_sufficient_caps(PG *pg, MOSDOp *op)
 {
   Session *session = (Session *)op->get_connection()->get_priv();
@@ -5252,7 +5533,7 @@ bool OSD::op_is_discardable(MOSDOp *op)
 }
 
 /*
- * enqueue called with osd_lock held
+ * enqueue called with the pg locked
  */
 void OSD::enqueue_op(PG *pg, OpRequestRef op)
 {
@@ -5262,34 +5543,138 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
   pg->queue_op(op);
 }
 
-bool OSD::OpWQ::_enqueue(PG *pg)
+OSD::ShardedOpWQ::ShardedOpWQ(OSD *o, CephContext *cct, time_t ti)
+  : osd(o)
+{
+  int n = MAX(1, g_conf->osd_op_num_shards);
+  for (int i = 0; i < n; ++i) {
+    char name[40];
+    snprintf(name, sizeof(name), "OSD::op_shard_tp.%d", i);
+    ThreadPool *tp = new ThreadPool(cct, name, g_conf->osd_op_shard_threads);
+    tps.push_back(tp);
+    shards.push_back(new Shard(this, ti, tp));
+  }
+}
+
+OSD::ShardedOpWQ::~ShardedOpWQ()
+{
+  for (unsigned i = 0; i < shards.size(); ++i) {
+    delete shards[i];
+    delete tps[i];
+  }
+}
+
+void OSD::ShardedOpWQ::queue(PG *pg, OpRequestRef op)
+{
+  Shard *shard = get_shard(pg);
+  shard->lock();
+  shard->_enqueue(pg, get_op_priority(op));
+  shard->_wake();
+  shard->unlock();
+}
+
+void OSD::ShardedOpWQ::dequeue(PG *pg)
+{
+  get_shard(pg)->dequeue(pg);
+}
+
+void OSD::ShardedOpWQ::start()
+{
+  for (unsigned i = 0; i < tps.size(); ++i)
+    tps[i]->start();
+}
+
+void OSD::ShardedOpWQ::pause()
+{
+  for (unsigned i = 0; i < tps.size(); ++i)
+    tps[i]->pause();
+}
+
+void OSD::ShardedOpWQ::drain()
+{
+  for (unsigned i = 0; i < shards.size(); ++i)
+    shards[i]->drain();
+}
+
+void OSD::ShardedOpWQ::stop()
+{
+  for (unsigned i = 0; i < tps.size(); ++i)
+    tps[i]->stop();
+}
+
+bool OSD::ShardedOpWQ::Shard::_enqueue(PG *pg, unsigned priority)
 {
   pg->get();
-  osd->op_queue.push_back(pg);
-  osd->op_queue_len++;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  pqueue.enqueue(priority, pg);
+  wq->len.inc();
+  wq->osd->logger->set(l_osd_opq, wq->len.read());
   return true;
 }
 
-PG *OSD::OpWQ::_dequeue()
+void OSD::ShardedOpWQ::Shard::_dequeue(PG *pg)
 {
-  if (osd->op_queue.empty())
+  unsigned removed = pqueue.remove(pg);
+  for (unsigned i = 0; i < removed; ++i) {
+    pg->put();
+    wq->len.dec();
+  }
+  wq->osd->logger->set(l_osd_opq, wq->len.read());
+}
+
+PG *OSD::ShardedOpWQ::Shard::_dequeue()
+{
+  if (pqueue.empty())
     return NULL;
-  PG *pg = osd->op_queue.front();
-  osd->op_queue.pop_front();
-  osd->op_queue_len--;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  PG *pg = pqueue.dequeue();
+  wq->len.dec();
+  wq->osd->logger->set(l_osd_opq, wq->len.read());
   return pg;
 }
 
+/*
+ * Recovery and scrub traffic shares the op shards with client io;
+ * weight it so that it neither starves nor swamps client ops.
+ */
+unsigned OSD::get_op_priority(OpRequestRef op)
+{
+  switch (op->request->get_type()) {
+  case MSG_OSD_SUBOP:
+  case MSG_OSD_SUBOPREPLY:
+    {
+      vector<OSDOp> &ops = op->request->get_type() == MSG_OSD_SUBOP ?
+	static_cast<MOSDSubOp*>(op->request)->ops :
+	static_cast<MOSDSubOpReply*>(op->request)->ops;
+      if (ops.empty())
+	break;
+      switch (ops[0].op.op) {
+      case CEPH_OSD_OP_PULL:
+      case CEPH_OSD_OP_PUSH:
+	return g_conf->osd_recovery_op_priority;
+      case CEPH_OSD_OP_SCRUB_RESERVE:
+      case CEPH_OSD_OP_SCRUB_UNRESERVE:
+      case CEPH_OSD_OP_SCRUB_STOP:
+      case CEPH_OSD_OP_SCRUB_MAP:
+	return g_conf->osd_scrub_op_priority;
+      }
+    }
+    break;
+
+  case MSG_OSD_PG_SCAN:
+  case MSG_OSD_PG_BACKFILL:
+    return g_conf->osd_recovery_op_priority;
+  }
+  // client ops and the replication of their writes
+  return g_conf->osd_client_op_priority;
+}
+
 void OSDService::queue_for_peering(PG *pg)
 {
   peering_wq.queue(pg);
 }
 
-void OSDService::queue_for_op(PG *pg)
+void OSDService::queue_for_op(PG *pg, OpRequestRef op)
 {
-  op_wq.queue(pg);
+  osd->op_wq.queue(pg, op);
 }
 
 void OSD::process_peering_events(const list<PG*> &pgs)
@@ -5308,8 +5693,10 @@ void OSD::process_peering_events(const list<PG*> &pgs)
       pg->unlock();
       continue;
     }
-    advance_pg(curmap->get_epoch(), pg, &rctx);
-    if (!pg->peering_queue.empty()) {
+    if (!advance_pg(curmap->get_epoch(), pg, &rctx)) {
+      // leave any events until the pg has caught up
+      peering_wq.queue(pg);
+    } else if (!pg->peering_queue.empty()) {
       PG::CephPeeringEvtRef evt = pg->peering_queue.front();
       pg->peering_queue.pop_front();
       pg->handle_peering_event(evt, &rctx);
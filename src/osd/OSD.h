@@ -25,6 +25,7 @@
 #include "common/RWLock.h"
 #include "common/Timer.h"
 #include "common/WorkQueue.h"
+#include "common/PrioritizedQueue.h"
 #include "common/LogClient.h"
 
 #include "os/ObjectStore.h"
@@ -95,6 +96,9 @@ enum {
 
   l_osd_rop,
 
+  l_osd_obc_hit,
+  l_osd_obc_miss,
+
   l_osd_loadavg,
   l_osd_buf,
 
@@ -129,6 +133,7 @@ class AuthAuthorizeHandlerRegistry;
 
 class OpsFlightSocketHook;
 class HistoricOpsSocketHook;
+class ScrubsSocketHook;
 
 extern const coll_t meta_coll;
 
@@ -168,7 +173,6 @@ public:
   Messenger *&client_messenger;
   PerfCounters *&logger;
   MonClient   *&monc;
-  ThreadPool::WorkQueue<PG> &op_wq;
   ThreadPool::BatchWorkQueue<PG> &peering_wq;
   ThreadPool::WorkQueue<PG> &recovery_wq;
   ThreadPool::WorkQueue<PG> &snap_trim_wq;
@@ -235,6 +239,11 @@ public:
   void dec_scrubs_pending();
   void dec_scrubs_active();
 
+  // -- deep scrub read throttle --
+  Mutex deep_scrub_throttle_lock;
+  utime_t deep_scrub_next_read;  // reads issued so far are paid for until then
+  void throttle_deep_scrub_read(uint64_t bytes);
+
   void reply_op_error(OpRequestRef op, int err);
   void reply_op_error(OpRequestRef op, int err, eversion_t v);
   void handle_misdirected_op(PG *pg, OpRequestRef op);
@@ -267,7 +276,7 @@ public:
   void send_pg_temp();
 
   void queue_for_peering(PG *pg);
-  void queue_for_op(PG *pg);
+  void queue_for_op(PG *pg, OpRequestRef op);
   bool queue_for_recovery(PG *pg);
   bool queue_for_snap_trim(PG *pg) {
     return snap_trim_wq.queue(pg);
@@ -350,10 +359,16 @@ protected:
   Cond dispatch_cond;
   int dispatch_running;
 
+  /// osd_op_fast_dispatch, read once: the messenger asks us twice per message
+  bool op_fast_dispatch;
+  /// held for read across fast_dispatch_op, for write to leave STATE_ACTIVE
+  RWLock fast_dispatch_lock;
+
   void create_logger();
   void tick();
   void _dispatch(Message *m);
   void dispatch_op(OpRequestRef op);
+  bool fast_dispatch_op(class MOSDOp *m);
 
 public:
   ClassHandler  *class_handler;
@@ -431,6 +446,8 @@ public:
     Connection *con;
     std::map<void *, pg_t> watches;
     std::map<void *, entity_name_t> notifs;
+    /// ops ms_fast_dispatch handed back to the messenger, not yet dispatched
+    atomic_t slow_ops;
 
     Session() : auid(-1), last_sent_epoch(0), con(0) {}
     void add_notif(void *n, entity_name_t& name) {
@@ -509,6 +526,9 @@ private:
   // -- waiters --
   list<OpRequestRef> finished;
   Mutex finished_lock;
+  /// ops in waiting_for_osdmap, waiting_for_pg or finished, or being
+  /// redispatched from there; client ops skip the osd_lock only when 0
+  atomic_t waiting_op_count;
   
   void take_waiters(list<OpRequestRef>& ls) {
     finished_lock.Lock();
@@ -535,39 +555,61 @@ private:
   HistoricOpsSocketHook *historic_ops_hook;
 
   // -- op queue --
-  list<PG*> op_queue;
-  int op_queue_len;
+  /**
+   * PGs with pending ops are hashed by pgid onto osd_op_num_shards
+   * shards, each with its own ThreadPool, so op threads only contend
+   * with the other threads of their shard.  A shard holds one PG entry
+   * for each op in that PG's op_queue.  The priority an entry is queued
+   * at decides which PG a shard services next, but the op processed is
+   * always the front of pg->op_queue, so per-PG ordering is preserved.
+   */
+  class ShardedOpWQ {
+    struct Shard : public ThreadPool::WorkQueue<PG> {
+      ShardedOpWQ *wq;
+      PrioritizedQueue<PG*> pqueue;
+      Shard(ShardedOpWQ *w, time_t ti, ThreadPool *tp)
+	: ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), wq(w) {}
+
+      bool _enqueue(PG *pg) {
+	return _enqueue(pg, g_conf->osd_client_op_priority);
+      }
+      bool _enqueue(PG *pg, unsigned priority);
+      void _dequeue(PG *pg);
+      bool _empty() {
+	return pqueue.empty();
+      }
+      PG *_dequeue();
+      void _process(PG *pg) {
+	wq->osd->dequeue_op(pg);
+      }
+      void _clear() {
+	assert(pqueue.empty());
+      }
+    };
 
-  struct OpWQ : public ThreadPool::WorkQueue<PG> {
     OSD *osd;
-    OpWQ(OSD *o, time_t ti, ThreadPool *tp)
-      : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
+    vector<ThreadPool*> tps;
+    vector<Shard*> shards;
+    atomic_t len;
 
-    bool _enqueue(PG *pg);
-    void _dequeue(PG *pg) {
-      for (list<PG*>::iterator i = osd->op_queue.begin();
-	   i != osd->op_queue.end();
-	   ) {
-	if (*i == pg) {
-	  osd->op_queue.erase(i++);
-	  pg->put();
-	} else {
-	  ++i;
-	}
-      }
-    }
-    bool _empty() {
-      return osd->op_queue.empty();
-    }
-    PG *_dequeue();
-    void _process(PG *pg) {
-      osd->dequeue_op(pg);
-    }
-    void _clear() {
-      assert(osd->op_queue.empty());
+    Shard *get_shard(PG *pg) {
+      return shards[__gnu_cxx::hash<pg_t>()(pg->info.pgid) % shards.size()];
     }
+
+  public:
+    ShardedOpWQ(OSD *o, CephContext *cct, time_t ti);
+    ~ShardedOpWQ();
+
+    void queue(PG *pg, OpRequestRef op);
+    void dequeue(PG *pg);
+    void start();
+    void pause();
+    void drain();
+    void stop();
   } op_wq;
 
+  static unsigned get_op_priority(OpRequestRef op);
+
   void enqueue_op(PG *pg, OpRequestRef op);
   void dequeue_op(PG *pg);
   static void static_dequeueop(OSD *o, PG *pg) {
@@ -673,7 +715,7 @@ private:
   void note_down_osd(int osd);
   void note_up_osd(int osd);
   
-  void advance_pg(epoch_t advance_to, PG *pg, PG::RecoveryCtx *rctx);
+  bool advance_pg(epoch_t advance_to, PG *pg, PG::RecoveryCtx *rctx);
   void advance_map(ObjectStore::Transaction& t, C_Contexts *tfin);
   void activate_map();
 
@@ -713,6 +755,9 @@ private:
 protected:
   // -- placement groups --
   hash_map<pg_t, PG*> pg_map;
+  /// changes to pg_map hold this for write as well as osd_lock, so
+  /// fast_dispatch_op can look pgs up without osd_lock
+  RWLock pg_map_lock;
   map<pg_t, list<OpRequestRef> > waiting_for_pg;
   PGRecoveryStats pg_recovery_stats;
 
@@ -1068,6 +1113,9 @@ protected:
   // -- scrubbing --
   void sched_scrub();
   xlist<PG*> scrub_queue;
+  void dump_scrubs(ostream& ss);
+  friend class ScrubsSocketHook;
+  ScrubsSocketHook *scrubs_hook;
 
 
   struct ScrubWQ : public ThreadPool::WorkQueue<PG> {
@@ -1245,6 +1293,8 @@ protected:
 
  private:
   bool ms_dispatch(Message *m);
+  bool ms_can_fast_dispatch(Message *m);
+  bool ms_fast_dispatch(Message *m);
   bool ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new);
   bool ms_verify_authorizer(Connection *con, int peer_type,
 			    int protocol, bufferlist& authorizer, bufferlist& authorizer_reply,
@@ -1252,6 +1302,8 @@ protected:
   void ms_handle_connect(Connection *con);
   bool ms_handle_reset(Connection *con);
   void ms_handle_remote_reset(Connection *con) {}
+  bool ms_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+			bufferlist& data);
 
  public:
   /* internal and external can point to the same messenger, they will still
@@ -468,8 +468,9 @@ void OSDMap::Incremental::generate_test_instances(list<Incremental*>& o)
 void OSDMap::set_epoch(epoch_t e)
 {
   epoch = e;
-  for (map<int64_t,pg_pool_t>::iterator p = pools.begin();
-       p != pools.end();
+  _make_private(pools);
+  for (map<int64_t,pg_pool_t>::iterator p = pools->begin();
+       p != pools->end();
        p++)
     p->second.last_change = e;
 }
@@ -500,13 +501,17 @@ void OSDMap::set_max_osd(int m)
     osd_state[o] = 0;
     osd_weight[o] = CEPH_OSD_OUT;
   }
-  osd_info.resize(m);
+  _make_private(osd_info);
+  _make_private(osd_addrs);
+  _make_private(osd_uuid);
+  osd_info->resize(m);
   osd_addrs->client_addr.resize(m);
   osd_addrs->cluster_addr.resize(m);
   osd_addrs->hb_addr.resize(m);
   osd_uuid->resize(m);
 
   calc_num_osds();
+  _update_pg_mappings(false);
 }
 
 int OSDMap::calc_num_osds()
@@ -601,36 +606,59 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
   int diff = 0;
 
   // do addrs match?
-  if (o->max_osd != n->max_osd)
-    diff++;
-  for (int i = 0; i < o->max_osd && i < n->max_osd; i++) {
-    if ( n->osd_addrs->client_addr[i] &&  o->osd_addrs->client_addr[i] &&
-	*n->osd_addrs->client_addr[i] == *o->osd_addrs->client_addr[i])
-      n->osd_addrs->client_addr[i] = o->osd_addrs->client_addr[i];
-    else
-      diff++;
-    if ( n->osd_addrs->cluster_addr[i] &&  o->osd_addrs->cluster_addr[i] &&
-	*n->osd_addrs->cluster_addr[i] == *o->osd_addrs->cluster_addr[i])
-      n->osd_addrs->cluster_addr[i] = o->osd_addrs->cluster_addr[i];
-    else
-      diff++;
-    if ( n->osd_addrs->hb_addr[i] &&  o->osd_addrs->hb_addr[i] &&
-	*n->osd_addrs->hb_addr[i] == *o->osd_addrs->hb_addr[i])
-      n->osd_addrs->hb_addr[i] = o->osd_addrs->hb_addr[i];
-    else
+  if (n->osd_addrs != o->osd_addrs) {
+    _make_private(n->osd_addrs);
+    if (o->max_osd != n->max_osd)
       diff++;
-  }
-  if (diff == 0) {
-    // zoinks, no differences at all!
-    n->osd_addrs = o->osd_addrs;
+    for (int i = 0; i < o->max_osd && i < n->max_osd; i++) {
+      if ( n->osd_addrs->client_addr[i] &&  o->osd_addrs->client_addr[i] &&
+	  *n->osd_addrs->client_addr[i] == *o->osd_addrs->client_addr[i])
+	n->osd_addrs->client_addr[i] = o->osd_addrs->client_addr[i];
+      else
+	diff++;
+      if ( n->osd_addrs->cluster_addr[i] &&  o->osd_addrs->cluster_addr[i] &&
+	  *n->osd_addrs->cluster_addr[i] == *o->osd_addrs->cluster_addr[i])
+	n->osd_addrs->cluster_addr[i] = o->osd_addrs->cluster_addr[i];
+      else
+	diff++;
+      if ( n->osd_addrs->hb_addr[i] &&  o->osd_addrs->hb_addr[i] &&
+	  *n->osd_addrs->hb_addr[i] == *o->osd_addrs->hb_addr[i])
+	n->osd_addrs->hb_addr[i] = o->osd_addrs->hb_addr[i];
+      else
+	diff++;
+    }
+    if (diff == 0) {
+      // zoinks, no differences at all!
+      n->osd_addrs = o->osd_addrs;
+    }
   }
 
   // does crush match?
-  bufferlist oc, nc;
-  ::encode(*o->crush, oc);
-  ::encode(*n->crush, nc);
-  if (oc.contents_equal(nc)) {
-    n->crush = o->crush;
+  if (n->crush != o->crush) {
+    bufferlist oc, nc;
+    ::encode(*o->crush, oc);
+    ::encode(*n->crush, nc);
+    if (oc.contents_equal(nc)) {
+      n->crush = o->crush;
+    }
+  }
+
+  // do pools match?
+  if (n->pools != o->pools && n->pools->size() == o->pools->size()) {
+    bufferlist op, np;
+    ::encode(*o->pools, op, CEPH_FEATURES_ALL);
+    ::encode(*n->pools, np, CEPH_FEATURES_ALL);
+    if (op.contents_equal(np))
+      n->pools = o->pools;
+  }
+
+  // does osd_info match?
+  if (n->osd_info != o->osd_info && n->osd_info->size() == o->osd_info->size()) {
+    bufferlist oi, ni;
+    ::encode(*o->osd_info, oi);
+    ::encode(*n->osd_info, ni);
+    if (oi.contents_equal(ni))
+      n->osd_info = o->osd_info;
   }
 
   // does pg_temp match?
@@ -643,6 +671,28 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
   if (o->osd_uuid->size() == n->osd_uuid->size() &&
       *o->osd_uuid == *n->osd_uuid)
     n->osd_uuid = o->osd_uuid;
+
+  // can we share the pg mapping tables?
+  if (n->crush == o->crush &&
+      n->max_osd == o->max_osd &&
+      n->osd_weight == o->osd_weight) {
+    bool same_exists = true;
+    for (int i = 0; i < n->max_osd; i++)
+      if (n->exists(i) != o->exists(i)) {
+	same_exists = false;
+	break;
+      }
+    if (same_exists) {
+      for (map<int64_t,pool_mapping_ref>::iterator p = n->pg_mappings.begin();
+	   p != n->pg_mappings.end();
+	   ++p) {
+	map<int64_t,pool_mapping_ref>::const_iterator q = o->pg_mappings.find(p->first);
+	if (q != o->pg_mappings.end() &&
+	    q->second->matches(n->pools->find(p->first)->second))
+	  p->second = q->second;
+      }
+    }
+  }
 }
 
 int OSDMap::apply_incremental(Incremental &inc)
@@ -663,6 +713,11 @@ int OSDMap::apply_incremental(Incremental &inc)
   }
 
   // nope, incremental.
+
+  // raw pg mappings survive unless crush or the set of osds change;
+  // set_weight() and osds going away only drop the affected entries
+  bool keep_mappings = !inc.crush.length() &&
+    inc.new_max_osd < 0;
   if (inc.new_flags >= 0)
     flags = inc.new_flags;
 
@@ -672,18 +727,32 @@ int OSDMap::apply_incremental(Incremental &inc)
   if (inc.new_pool_max != -1)
     pool_max = inc.new_pool_max;
 
+  // anything this epoch changes stops being shared with the last one
+  if (!inc.old_pools.empty() || !inc.new_pools.empty())
+    _make_private(pools);
+  if (!inc.new_state.empty() || !inc.new_up_client.empty() ||
+      !inc.new_up_thru.empty() || !inc.new_last_clean_interval.empty() ||
+      !inc.new_lost.empty())
+    _make_private(osd_info);
+  if (!inc.new_up_client.empty() || !inc.new_up_internal.empty())
+    _make_private(osd_addrs);
+  if (!inc.new_state.empty() || !inc.new_uuid.empty())
+    _make_private(osd_uuid);
+  if (!inc.new_pg_temp.empty())
+    _make_private(pg_temp);
+
   for (set<int64_t>::iterator p = inc.old_pools.begin();
        p != inc.old_pools.end();
        p++) {
-    pools.erase(*p);
+    pools->erase(*p);
     name_pool.erase(pool_name[*p]);
     pool_name.erase(*p);
   }
   for (map<int64_t,pg_pool_t>::iterator p = inc.new_pools.begin();
        p != inc.new_pools.end();
        p++) {
-    pools[p->first] = p->second;
-    pools[p->first].last_change = epoch;
+    (*pools)[p->first] = p->second;
+    (*pools)[p->first].last_change = epoch;
   }
   for (map<int64_t,string>::iterator p = inc.new_pool_names.begin();
        p != inc.new_pool_names.end();
@@ -709,9 +778,15 @@ int OSDMap::apply_incremental(Incremental &inc)
        i != inc.new_state.end();
        i++) {
     int s = i->second ? i->second : CEPH_OSD_UP;
+    if (s & CEPH_OSD_EXISTS) {
+      if (exists(i->first))
+	_invalidate_pg_mappings(i->first, true);
+      else
+	keep_mappings = false;
+    }
     if ((osd_state[i->first] & CEPH_OSD_UP) &&
 	(s & CEPH_OSD_UP)) {
-      osd_info[i->first].down_at = epoch;
+      (*osd_info)[i->first].down_at = epoch;
     }
     if ((osd_state[i->first] & CEPH_OSD_EXISTS) &&
 	(s & CEPH_OSD_EXISTS))
@@ -721,13 +796,15 @@ int OSDMap::apply_incremental(Incremental &inc)
   for (map<int32_t,entity_addr_t>::iterator i = inc.new_up_client.begin();
        i != inc.new_up_client.end();
        i++) {
+    if (!exists(i->first))
+      keep_mappings = false;
     osd_state[i->first] |= CEPH_OSD_EXISTS | CEPH_OSD_UP;
     osd_addrs->client_addr[i->first].reset(new entity_addr_t(i->second));
     if (inc.new_hb_up.empty())
       osd_addrs->hb_addr[i->first].reset(new entity_addr_t(i->second)); //this is a backward-compatibility hack
     else
       osd_addrs->hb_addr[i->first].reset(new entity_addr_t(inc.new_hb_up[i->first]));
-    osd_info[i->first].up_from = epoch;
+    (*osd_info)[i->first].up_from = epoch;
   }
   for (map<int32_t,entity_addr_t>::iterator i = inc.new_up_internal.begin();
        i != inc.new_up_internal.end();
@@ -738,15 +815,15 @@ int OSDMap::apply_incremental(Incremental &inc)
   for (map<int32_t,epoch_t>::iterator i = inc.new_up_thru.begin();
        i != inc.new_up_thru.end();
        i++)
-    osd_info[i->first].up_thru = i->second;
+    (*osd_info)[i->first].up_thru = i->second;
   for (map<int32_t,pair<epoch_t,epoch_t> >::iterator i = inc.new_last_clean_interval.begin();
        i != inc.new_last_clean_interval.end();
        i++) {
-    osd_info[i->first].last_clean_begin = i->second.first;
-    osd_info[i->first].last_clean_end = i->second.second;
+    (*osd_info)[i->first].last_clean_begin = i->second.first;
+    (*osd_info)[i->first].last_clean_end = i->second.second;
   }
   for (map<int32_t,epoch_t>::iterator p = inc.new_lost.begin(); p != inc.new_lost.end(); p++)
-    osd_info[p->first].lost_at = p->second;
+    (*osd_info)[p->first].lost_at = p->second;
 
   // uuid
   for (map<int32_t,uuid_d>::iterator p = inc.new_uuid.begin(); p != inc.new_uuid.end(); ++p) 
@@ -787,6 +864,7 @@ int OSDMap::apply_incremental(Incremental &inc)
   }
 
   calc_num_osds();
+  _update_pg_mappings(keep_mappings);
   return 0;
 }
 
@@ -834,12 +912,91 @@ void OSDMap::_remove_nonexistent_osds(vector<int>& osds) const
     osds.resize(osds.size() - removed);
 }
 
+OSDMap::pool_mapping_t::pool_mapping_t(const pg_pool_t& pool)
+  : lock("OSDMap::pool_mapping_t::lock"),
+    type(pool.get_type()),
+    ruleset(pool.get_crush_ruleset()),
+    size(pool.get_size()),
+    pgp_num(pool.get_pgp_num()),
+    osds(pgp_num * size),
+    num(pgp_num, UNMAPPED)
+{
+  assert(size < UNMAPPED);
+}
+
+void OSDMap::_update_pg_mappings(bool keep)
+{
+  map<int64_t,pool_mapping_ref> old;
+  old.swap(pg_mappings);
+  for (map<int64_t,pg_pool_t>::iterator p = pools->begin(); p != pools->end(); ++p) {
+    map<int64_t,pool_mapping_ref>::iterator q = old.find(p->first);
+    if (keep && q != old.end() && q->second->matches(p->second))
+      pg_mappings[p->first] = q->second;
+    else
+      pg_mappings[p->first].reset(new pool_mapping_t(p->second));
+  }
+}
+
+void OSDMap::_invalidate_pg_mappings(int osd, bool only_with_osd)
+{
+  for (map<int64_t,pool_mapping_ref>::iterator p = pg_mappings.begin();
+       p != pg_mappings.end();
+       ++p) {
+    map<int64_t,pg_pool_t>::const_iterator pool = pools->find(p->first);
+    if (pool == pools->end())
+      continue;  // _update_pg_mappings() will drop it
+    if (!only_with_osd || !p->second->matches(pool->second)) {
+      p->second.reset(new pool_mapping_t(pool->second));
+      continue;
+    }
+
+    pool_mapping_t *m = p->second.get();
+    if (!p->second.unique()) {
+      // other maps may still be filling it in; see _pg_to_osds()
+      m = new pool_mapping_t(pool->second);
+      m->num = p->second->num;
+      __sync_synchronize();
+      m->osds = p->second->osds;
+      p->second.reset(m);
+    }
+    for (unsigned seed = 0; seed < m->pgp_num; seed++) {
+      if (m->num[seed] == pool_mapping_t::UNMAPPED)
+	continue;
+      const int32_t *o = &m->osds[seed * m->size];
+      if (std::find(o, o + m->num[seed], osd) != o + m->num[seed])
+	m->num[seed] = pool_mapping_t::UNMAPPED;
+    }
+  }
+}
+
+/*
+ * Entries in a pool_mapping_t are written once: the osds first, then
+ * (after a barrier) num.  So a hit only needs to read num before the
+ * osds, and the lock only keeps two misses on the same seed from
+ * writing at once; crush runs outside of it.
+ */
 int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
 {
   // map to osds[]
   ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
   unsigned size = pool.get_size();
 
+  // cached?
+  pool_mapping_t *m = NULL;
+  unsigned seed = 0;
+  map<int64_t,pool_mapping_ref>::const_iterator p = pg_mappings.find(pg.pool());
+  if (p != pg_mappings.end() && p->second->matches(pool)) {
+    m = p->second.get();
+    seed = ceph_stable_mod(pg.ps(), pool.get_pgp_num(), pool.get_pgp_num_mask());
+    uint8_t n = *(volatile uint8_t *)&m->num[seed];
+    if (n != pool_mapping_t::UNMAPPED) {
+      __sync_synchronize();
+      const int32_t *o = &m->osds[seed * size];
+      osds.assign(o, o + n);
+      return osds.size();
+    }
+  }
+
   // what crush rule?
   int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
   if (ruleno >= 0)
@@ -847,6 +1004,16 @@ int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
 
   _remove_nonexistent_osds(osds);
 
+  if (m) {
+    Mutex::Locker l(m->lock);
+    if (m->num[seed] == pool_mapping_t::UNMAPPED) {
+      unsigned n = std::min<unsigned>(osds.size(), size);
+      for (unsigned i = 0; i < n; i++)
+	m->osds[seed * size + i] = osds[i];
+      __sync_synchronize();
+      m->num[seed] = n;
+    }
+  }
   return osds.size();
 }
 
@@ -919,6 +1086,78 @@ void OSDMap::pg_to_up_acting_osds(pg_t pg, vector<int>& up, vector<int>& acting)
     acting = up;
 }
 
+void OSDMap::get_changed_pgs(const OSDMap& oldmap, const OSDMap& newmap,
+			     set<pg_t> *changed)
+{
+  // osds whose up/exists state differs; any pg mapped to one may change
+  int max = std::max(oldmap.max_osd, newmap.max_osd);
+  vector<bool> osd_changed(max, false);
+  for (int i = 0; i < max; i++) {
+    bool oup = i < oldmap.max_osd && oldmap.exists(i) && oldmap.is_up(i);
+    bool nup = i < newmap.max_osd && newmap.exists(i) && newmap.is_up(i);
+    osd_changed[i] = (oup != nup);
+  }
+
+  // pgs with a pg_temp entry; their acting set also depends on the
+  // state of the temp osds
+  set<pg_t> temp;
+  for (map<pg_t,vector<int> >::const_iterator p = oldmap.pg_temp->begin();
+       p != oldmap.pg_temp->end();
+       ++p)
+    temp.insert(p->first);
+  for (map<pg_t,vector<int> >::const_iterator p = newmap.pg_temp->begin();
+       p != newmap.pg_temp->end();
+       ++p)
+    temp.insert(p->first);
+
+  for (map<int64_t,pg_pool_t>::const_iterator p = newmap.pools->begin();
+       p != newmap.pools->end();
+       ++p) {
+    const pg_pool_t& pool = p->second;
+    const pg_pool_t *opool = oldmap.get_pg_pool(p->first);
+    unsigned pg_num = pool.get_pg_num();
+    if (!opool) {
+      for (unsigned ps = 0; ps < pg_num; ps++)
+	changed->insert(pg_t(ps, p->first, -1));
+      continue;
+    }
+
+    // if both maps share the raw mapping table, the raw mappings are
+    // identical and only the up/down and pg_temp filtering can differ
+    map<int64_t,pool_mapping_ref>::const_iterator om = oldmap.pg_mappings.find(p->first);
+    map<int64_t,pool_mapping_ref>::const_iterator nm = newmap.pg_mappings.find(p->first);
+    bool same_raw = om != oldmap.pg_mappings.end() &&
+      nm != newmap.pg_mappings.end() &&
+      om->second == nm->second &&
+      nm->second->matches(pool) &&
+      nm->second->matches(*opool);
+
+    vector<int> raw, oup, oacting, nup, nacting;
+    for (unsigned ps = 0; ps < pg_num; ps++) {
+      pg_t pgid(ps, p->first, -1);
+      if (ps >= opool->get_pg_num()) {
+	changed->insert(pgid);
+	continue;
+      }
+      if (same_raw && !temp.count(pgid)) {
+	newmap._pg_to_osds(pool, pgid, raw);
+	bool touched = false;
+	for (unsigned i = 0; i < raw.size(); i++)
+	  if (raw[i] >= 0 && raw[i] < max && osd_changed[raw[i]]) {
+	    touched = true;
+	    break;
+	  }
+	if (!touched)
+	  continue;
+      }
+      oldmap.pg_to_up_acting_osds(pgid, oup, oacting);
+      newmap.pg_to_up_acting_osds(pgid, nup, nacting);
+      if (oup != nup || oacting != nacting)
+	changed->insert(pgid);
+    }
+  }
+}
+
 int OSDMap::calc_pg_rank(int osd, vector<int>& acting, int nrep)
 {
   if (!nrep)
@@ -950,10 +1189,10 @@ void OSDMap::encode_client_old(bufferlist& bl) const
   ::encode(modified, bl);
 
   // for ::encode(pools, bl);
-  __u32 n = pools.size();
+  __u32 n = pools->size();
   ::encode(n, bl);
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
-       p != pools.end();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin();
+       p != pools->end();
        ++p) {
     n = p->first;
     ::encode(n, bl);
@@ -1013,7 +1252,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ::encode(created, bl);
   ::encode(modified, bl);
 
-  ::encode(pools, bl, features);
+  ::encode(*pools, bl, features);
   ::encode(pool_name, bl);
   ::encode(pool_max, bl);
 
@@ -1035,7 +1274,7 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   __u16 ev = 8;
   ::encode(ev, bl);
   ::encode(osd_addrs->hb_addr, bl);
-  ::encode(osd_info, bl);
+  ::encode(*osd_info, bl);
   ::encode(blacklist, bl);
   ::encode(osd_addrs->cluster_addr, bl);
   ::encode(cluster_snapshot_epoch, bl);
@@ -1055,6 +1294,14 @@ void OSDMap::decode(bufferlist::iterator& p)
   __u16 v;
   ::decode(v, p);
 
+  // never decode into pieces another map may be sharing
+  osd_addrs.reset(new addrs_s);
+  osd_info.reset(new vector<osd_info_t>);
+  pg_temp.reset(new map<pg_t,vector<int> >);
+  pools.reset(new map<int64_t,pg_pool_t>);
+  osd_uuid.reset(new vector<uuid_d>);
+  crush.reset(new CrushWrapper);
+
   // base
   ::decode(fsid, p);
   ::decode(epoch, p);
@@ -1067,11 +1314,10 @@ void OSDMap::decode(bufferlist::iterator& p)
       ::decode(max_pools, p);
       pool_max = max_pools;
     }
-    pools.clear();
     ::decode(n, p);
     while (n--) {
       ::decode(t, p);
-      ::decode(pools[t], p);
+      ::decode((*pools)[t], p);
     }
     if (v == 4) {
       ::decode(n, p);
@@ -1087,13 +1333,13 @@ void OSDMap::decode(bufferlist::iterator& p)
       pool_max = n;
     }
   } else {
-    ::decode(pools, p);
+    ::decode(*pools, p);
     ::decode(pool_name, p);
     ::decode(pool_max, p);
   }
   // kludge around some old bug that zeroed out pool_max (#2307)
-  if (pools.size() && pool_max < pools.rbegin()->first) {
-    pool_max = pools.rbegin()->first;
+  if (pools->size() && pool_max < pools->rbegin()->first) {
+    pool_max = pools->rbegin()->first;
   }
 
   ::decode(flags, p);
@@ -1103,7 +1349,6 @@ void OSDMap::decode(bufferlist::iterator& p)
   ::decode(osd_weight, p);
   ::decode(osd_addrs->client_addr, p);
   if (v <= 5) {
-    pg_temp->clear();
     ::decode(n, p);
     while (n--) {
       old_pg_t opg;
@@ -1125,7 +1370,7 @@ void OSDMap::decode(bufferlist::iterator& p)
   if (v >= 5)
     ::decode(ev, p);
   ::decode(osd_addrs->hb_addr, p);
-  ::decode(osd_info, p);
+  ::decode(*osd_info, p);
   if (v < 5)
     ::decode(pool_name, p);
 
@@ -1152,6 +1397,7 @@ void OSDMap::decode(bufferlist::iterator& p)
     name_pool[i->second] = i->first;
 
   calc_num_osds();
+  _update_pg_mappings(false);
 }
 
 
@@ -1177,7 +1423,7 @@ void OSDMap::dump(Formatter *f) const
   f->dump_int("max_osd", get_max_osd());
 
   f->open_array_section("pools");
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     f->open_object_section("pool");
     f->dump_int("pool", p->first);
     p->second.dump(f);
@@ -1294,7 +1540,7 @@ void OSDMap::print(ostream& out) const
     out << "cluster_snapshot " << get_cluster_snapshot() << "\n";
   out << "\n";
 
-  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools->begin(); p != pools->end(); ++p) {
     std::string name("<unknown>");
     map<int64_t,string>::const_iterator pni = pool_name.find(p->first);
     if (pni != pool_name.end())
@@ -1447,17 +1693,18 @@ void OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
 
   int poolbase = nosd ? nosd : 1;
 
+  _make_private(pools);
   for (map<int,const char*>::iterator p = rulesets.begin(); p != rulesets.end(); p++) {
     int64_t pool = ++pool_max;
-    pools[pool].type = pg_pool_t::TYPE_REP;
-    pools[pool].size = cct->_conf->osd_pool_default_size;
-    pools[pool].crush_ruleset = p->first;
-    pools[pool].object_hash = CEPH_STR_HASH_RJENKINS;
-    pools[pool].set_pg_num(poolbase << pg_bits);
-    pools[pool].set_pgp_num(poolbase << pgp_bits);
-    pools[pool].last_change = epoch;
+    (*pools)[pool].type = pg_pool_t::TYPE_REP;
+    (*pools)[pool].size = cct->_conf->osd_pool_default_size;
+    (*pools)[pool].crush_ruleset = p->first;
+    (*pools)[pool].object_hash = CEPH_STR_HASH_RJENKINS;
+    (*pools)[pool].set_pg_num(poolbase << pg_bits);
+    (*pools)[pool].set_pgp_num(poolbase << pgp_bits);
+    (*pools)[pool].last_change = epoch;
     if (p->first == CEPH_DATA_RULE)
-      pools[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
+      (*pools)[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
     pool_name[pool] = p->second;
     name_pool[p->second] = pool;
   }
@@ -1468,6 +1715,8 @@ void OSDMap::build_simple(CephContext *cct, epoch_t e, uuid_d &fsid,
     set_state(i, 0);
     set_weight(i, CEPH_OSD_OUT);
   }
+
+  _update_pg_mappings(false);
 }
 
 
@@ -1563,17 +1812,18 @@ void OSDMap::build_simple_from_conf(CephContext *cct, epoch_t e, uuid_d &fsid,
   rulesets[CEPH_METADATA_RULE] = "metadata";
   rulesets[CEPH_RBD_RULE] = "rbd";
 
+  _make_private(pools);
   for (map<int,const char*>::iterator p = rulesets.begin(); p != rulesets.end(); p++) {
     int64_t pool = ++pool_max;
-    pools[pool].type = pg_pool_t::TYPE_REP;
-    pools[pool].size = cct->_conf->osd_pool_default_size;
-    pools[pool].crush_ruleset = p->first;
-    pools[pool].object_hash = CEPH_STR_HASH_RJENKINS;
-    pools[pool].set_pg_num((maxosd + 1) << pg_bits);
-    pools[pool].set_pgp_num((maxosd + 1) << pgp_bits);
-    pools[pool].last_change = epoch;
+    (*pools)[pool].type = pg_pool_t::TYPE_REP;
+    (*pools)[pool].size = cct->_conf->osd_pool_default_size;
+    (*pools)[pool].crush_ruleset = p->first;
+    (*pools)[pool].object_hash = CEPH_STR_HASH_RJENKINS;
+    (*pools)[pool].set_pg_num((maxosd + 1) << pg_bits);
+    (*pools)[pool].set_pgp_num((maxosd + 1) << pgp_bits);
+    (*pools)[pool].last_change = epoch;
     if (p->first == CEPH_DATA_RULE)
-      pools[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
+      (*pools)[pool].crash_replay_interval = cct->_conf->osd_default_data_pool_replay_window;
     pool_name[pool] = p->second;
     name_pool[p->second] = pool;
   }
@@ -1584,6 +1834,8 @@ void OSDMap::build_simple_from_conf(CephContext *cct, epoch_t e, uuid_d &fsid,
     set_state(i, 0);
     set_weight(i, CEPH_OSD_OUT);
   }
+
+  _update_pg_mappings(false);
 }
 
 void OSDMap::build_simple_crush_map_from_conf(CephContext *cct, CrushWrapper& crush,
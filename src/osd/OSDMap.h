@@ -168,11 +168,18 @@ private:
   };
   std::tr1::shared_ptr<addrs_s> osd_addrs;
 
+  /*
+   * osd_addrs, osd_info, pg_temp, pools, osd_uuid and crush are shared
+   * with the maps this one was copied from (or dedup()ed against), so
+   * a cache of consecutive epochs holds one copy of whatever did not
+   * change between them.  Treat them as immutable: anything that
+   * modifies one first takes a private copy with _make_private().
+   */
   vector<__u32>   osd_weight;   // 16.16 fixed point, 0x10000 = "in", 0 = "out"
-  vector<osd_info_t> osd_info;
+  std::tr1::shared_ptr< vector<osd_info_t> > osd_info;
   std::tr1::shared_ptr< map<pg_t,vector<int> > > pg_temp;  // temp pg mapping (e.g. while we rebuild)
 
-  map<int64_t,pg_pool_t> pools;
+  std::tr1::shared_ptr< map<int64_t,pg_pool_t> > pools;
   map<int64_t,string> pool_name;
   map<string,int64_t> name_pool;
 
@@ -183,6 +190,52 @@ private:
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  /**
+   * Raw (CRUSH) mapping for every placement seed in a pool, filled in
+   * as pgs are looked up.
+   *
+   * It depends only on the crush map, the osd weights, which osds exist
+   * and the pool's placement parameters, so it is carried across epochs
+   * (and shared between maps by dedup()) until one of those changes.
+   */
+  struct pool_mapping_t {
+    static const uint8_t UNMAPPED = 0xff;
+
+    Mutex lock;
+    unsigned type;         // pool parameters the table was built for,
+    int ruleset;           // typed as pg_pool_t returns them
+    unsigned size, pgp_num;
+    vector<int32_t> osds;  // size slots per seed
+    vector<uint8_t> num;   // osds per seed, or UNMAPPED
+
+    pool_mapping_t(const pg_pool_t& pool);
+    bool matches(const pg_pool_t& pool) const {
+      return type == pool.get_type() &&
+	ruleset == pool.get_crush_ruleset() &&
+	size == pool.get_size() &&
+	pgp_num == pool.get_pgp_num();
+    }
+  };
+  typedef std::tr1::shared_ptr<pool_mapping_t> pool_mapping_ref;
+  map<int64_t,pool_mapping_ref> pg_mappings;
+
+  /// rebuild pg_mappings for the current pools, reusing valid tables if keep
+  void _update_pg_mappings(bool keep);
+  /**
+   * Forget the cached mappings osd's change may affect: only those that
+   * include it if only_with_osd (it lost weight or stopped existing),
+   * otherwise all of them (it may now be picked anywhere).  Tables other
+   * maps share are copied first.
+   */
+  void _invalidate_pg_mappings(int osd, bool only_with_osd);
+
+  /// copy *p if another map shares it, so it can be modified
+  template<class T>
+  static void _make_private(std::tr1::shared_ptr<T>& p) {
+    if (!p.unique())
+      p.reset(new T(*p));
+  }
+
  public:
   std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
@@ -196,7 +249,9 @@ private:
 	     flags(0),
 	     num_osd(0), max_osd(0),
 	     osd_addrs(new addrs_s),
+	     osd_info(new vector<osd_info_t>),
 	     pg_temp(new map<pg_t,vector<int> >),
+	     pools(new map<int64_t,pg_pool_t>),
 	     osd_uuid(new vector<uuid_d>),
 	     cluster_snapshot_epoch(0),
 	     crush(new CrushWrapper) {
@@ -257,16 +312,25 @@ private:
   }
   void set_state(int o, unsigned s) {
     assert(o < max_osd);
+    bool existed = exists(o);
     osd_state[o] = s;
+    if (existed != exists(o))
+      _invalidate_pg_mappings(o, existed);
   }
   void set_weightf(int o, float w) {
     set_weight(o, (int)((float)CEPH_OSD_IN * w));
   }
   void set_weight(int o, unsigned w) {
     assert(o < max_osd);
+    unsigned old = osd_weight[o];
+    bool existed = exists(o);
     osd_weight[o] = w;
     if (w)
       osd_state[o] |= CEPH_OSD_EXISTS;
+    if (w > old || existed != exists(o))
+      _invalidate_pg_mappings(o, false);
+    else if (w < old)
+      _invalidate_pg_mappings(o, true);
   }
   unsigned get_weight(int o) const {
     assert(o < max_osd);
@@ -342,19 +406,19 @@ private:
 
   const epoch_t& get_up_from(int osd) const {
     assert(exists(osd));
-    return osd_info[osd].up_from;
+    return (*osd_info)[osd].up_from;
   }
   const epoch_t& get_up_thru(int osd) const {
     assert(exists(osd));
-    return osd_info[osd].up_thru;
+    return (*osd_info)[osd].up_thru;
   }
   const epoch_t& get_down_at(int osd) const {
     assert(exists(osd));
-    return osd_info[osd].down_at;
+    return (*osd_info)[osd].down_at;
   }
   const osd_info_t& get_info(int osd) const {
     assert(osd < max_osd);
-    return osd_info[osd];
+    return (*osd_info)[osd];
   }
   
   int get_any_up_osd() const {
@@ -420,6 +484,16 @@ public:
   void pg_to_raw_up(pg_t pg, vector<int>& up) const;
   void pg_to_up_acting_osds(pg_t pg, vector<int>& up, vector<int>& acting) const;
 
+  /**
+   * Find the pgs whose up or acting set differs between two maps.
+   *
+   * Pools whose raw mappings are unchanged are only checked for pgs
+   * that map to an osd whose state changed or that have a pg_temp
+   * change.  pgs of pools that are new in newmap are all included.
+   */
+  static void get_changed_pgs(const OSDMap& oldmap, const OSDMap& newmap,
+			      set<pg_t> *changed);
+
   int64_t lookup_pg_pool_name(const char *name) {
     if (name_pool.count(name))
       return name_pool[name];
@@ -430,7 +504,7 @@ public:
     return pool_max;
   }
   const map<int64_t,pg_pool_t>& get_pools() const {
-    return pools;
+    return *pools;
   }
   const char *get_pool_name(int64_t p) const {
     map<int64_t, string>::const_iterator i = pool_name.find(p);
@@ -439,28 +513,28 @@ public:
     return 0;
   }
   bool have_pg_pool(int64_t p) const {
-    return pools.count(p);
+    return pools->count(p);
   }
   const pg_pool_t* get_pg_pool(int64_t p) const {
-    map<int64_t, pg_pool_t>::const_iterator i = pools.find(p);
-    if (i != pools.end())
+    map<int64_t, pg_pool_t>::const_iterator i = pools->find(p);
+    if (i != pools->end())
       return &i->second;
     return NULL;
   }
   unsigned get_pg_size(pg_t pg) const {
-    map<int64_t,pg_pool_t>::const_iterator p = pools.find(pg.pool());
-    assert(p != pools.end());
+    map<int64_t,pg_pool_t>::const_iterator p = pools->find(pg.pool());
+    assert(p != pools->end());
     return p->second.get_size();
   }
   int get_pg_type(pg_t pg) const {
-    assert(pools.count(pg.pool()));
-    return pools.find(pg.pool())->second.get_type();
+    assert(pools->count(pg.pool()));
+    return pools->find(pg.pool())->second.get_type();
   }
 
 
   pg_t raw_pg_to_pg(pg_t pg) const {
-    assert(pools.count(pg.pool()));
-    return pools.find(pg.pool())->second.raw_pg_to_pg(pg);
+    assert(pools->count(pg.pool()));
+    return pools->find(pg.pool())->second.raw_pg_to_pg(pg);
   }
 
   // pg -> primary osd
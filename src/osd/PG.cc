@@ -14,6 +14,7 @@
 
 #include "PG.h"
 #include "common/config.h"
+#include "common/errno.h"
 #include "OSD.h"
 #include "OpRequest.h"
 
@@ -82,6 +83,11 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   scrub_reserved(false), scrub_reserve_failed(false),
   scrub_waiting_on(0),
   active_rep_scrub(0),
+  scrub_errors(0), scrub_fixed(0),
+  scrub_deep(false),
+  scrub_chunky(false),
+  scrub_state(SCRUB_INACTIVE),
+  scrub_chunks(0), scrub_objects(0),
   recovery_state(this)
 {
 }
@@ -130,7 +136,7 @@ std::string PG::gen_prefix() const
   
 
 
-void PG::IndexedLog::trim(ObjectStore::Transaction& t, eversion_t s) 
+void PG::IndexedLog::trim(ObjectStore::Transaction& t, const hobject_t& oid, eversion_t s)
 {
   if (complete_to != log.end() &&
       complete_to->version <= s) {
@@ -138,14 +144,18 @@ void PG::IndexedLog::trim(ObjectStore::Transaction& t, eversion_t s)
 		    << " on " << *this << dendl;
   }
 
+  set<string> keys_to_rm;
   while (!log.empty()) {
     pg_log_entry_t &e = *log.begin();
     if (e.version > s)
       break;
     generic_dout(20) << "trim " << e << dendl;
+    keys_to_rm.insert(e.get_key_name());
     unindex(e);         // remove from index,
     log.pop_front();    // from log
   }
+  if (!g_conf->osd_preserve_trimmed_log)
+    t.omap_rmkeys(coll_t::META_COLL, oid, keys_to_rm);
 
   // raise tail?
   if (tail < s)
@@ -428,11 +438,14 @@ void PG::rewind_divergent_log(ObjectStore::Transaction& t, eversion_t newhead)
   if (info.last_complete > newhead)
     info.last_complete = newhead;
 
-  for (list<pg_log_entry_t>::iterator d = divergent.begin(); d != divergent.end(); d++)
+  set<string> keys_to_rm;
+  for (list<pg_log_entry_t>::iterator d = divergent.begin(); d != divergent.end(); d++) {
+    keys_to_rm.insert(d->get_key_name());
     merge_old_entry(t, *d);
+  }
+  t.omap_rmkeys(coll_t::META_COLL, log_oid, keys_to_rm);
 
   dirty_info = true;
-  dirty_log = true;
 }
 
 void PG::merge_log(ObjectStore::Transaction& t,
@@ -464,14 +477,17 @@ void PG::merge_log(ObjectStore::Transaction& t,
     dout(10) << "merge_log extending tail to " << olog.tail << dendl;
     list<pg_log_entry_t>::iterator from = olog.log.begin();
     list<pg_log_entry_t>::iterator to;
+    map<string,bufferlist> keys;
     for (to = from;
 	 to != olog.log.end();
 	 to++) {
       if (to->version > log.tail)
 	break;
       log.index(*to);
+      to->encode_with_checksum(keys[to->get_key_name()]);
       dout(15) << *to << dendl;
     }
+    t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
     assert(to != olog.log.end() ||
 	   (olog.head == info.last_update));
       
@@ -516,10 +532,12 @@ void PG::merge_log(ObjectStore::Transaction& t,
     }
 
     // index, update missing, delete deleted
+    map<string,bufferlist> keys;
     for (list<pg_log_entry_t>::iterator p = from; p != to; p++) {
       pg_log_entry_t &ne = *p;
       dout(20) << "merge_log " << ne << dendl;
       log.index(ne);
+      ne.encode_with_checksum(keys[ne.get_key_name()]);
       if (ne.soid <= info.last_backfill) {
 	missing.add_next_event(ne);
 	if (ne.is_delete())
@@ -529,6 +547,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
       
     // move aside divergent items
     list<pg_log_entry_t> divergent;
+    set<string> keys_to_rm;
     while (!log.empty()) {
       pg_log_entry_t &oe = *log.log.rbegin();
       /*
@@ -543,13 +562,16 @@ void PG::merge_log(ObjectStore::Transaction& t,
 	break;
       dout(10) << "merge_log divergent " << oe << dendl;
       divergent.push_front(oe);
+      keys_to_rm.insert(oe.get_key_name());
       log.unindex(oe);
       log.log.pop_back();
     }
 
-    // splice
+    // splice; remove divergent keys first, as a new entry may reuse one
     log.log.splice(log.log.end(), 
 		   olog.log, from, to);
+    t.omap_rmkeys(coll_t::META_COLL, log_oid, keys_to_rm);
+    t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
     log.index();   
 
     info.last_update = log.head = olog.head;
@@ -565,10 +587,8 @@ void PG::merge_log(ObjectStore::Transaction& t,
   
   dout(10) << "merge_log result " << log << " " << missing << " changed=" << changed << dendl;
 
-  if (changed) {
+  if (changed)
     dirty_info = true;
-    dirty_log = true;
-  }
 }
 
 /*
@@ -1304,9 +1324,8 @@ void PG::activate(ObjectStore::Transaction& t,
 
   need_up_thru = false;
 
-  // write pg info, log
+  // write pg info (log changes made while peering are already queued)
   dirty_info = true;
-  dirty_log = true;
 
   // clean up stray objects
   clean_up_local(t); 
@@ -1876,6 +1895,8 @@ void PG::update_stats()
     info.stats.created = info.history.epoch_created;
     info.stats.last_scrub = info.history.last_scrub;
     info.stats.last_scrub_stamp = info.history.last_scrub_stamp;
+    info.stats.last_deep_scrub = info.history.last_deep_scrub;
+    info.stats.last_deep_scrub_stamp = info.history.last_deep_scrub_stamp;
     info.stats.last_epoch_clean = info.history.last_epoch_clean;
 
     utime_t now = ceph_clock_now(g_ceph_context);
@@ -1890,8 +1911,8 @@ void PG::update_stats()
       info.stats.last_active = now;
     info.stats.last_unstale = now;
 
-    info.stats.log_size = ondisklog.length();
-    info.stats.ondisk_log_size = ondisklog.length();
+    info.stats.log_size = log.log.size();
+    info.stats.ondisk_log_size = log.log.size();
     info.stats.log_start = log.tail;
     info.stats.ondisk_log_start = log.tail;
 
@@ -2014,36 +2035,23 @@ void PG::write_log(ObjectStore::Transaction& t)
 {
   dout(10) << "write_log" << dendl;
 
-  // assemble buffer
-  bufferlist bl;
+  // start over; this also drops an old-format flat log
+  t.remove(coll_t::META_COLL, log_oid);
+  t.touch(coll_t::META_COLL, log_oid);
 
-  // build buffer
-  ondisklog.tail = 0;
+  map<string,bufferlist> keys;
   for (list<pg_log_entry_t>::iterator p = log.log.begin();
        p != log.log.end();
-       p++) {
-    uint64_t startoff = bl.length();
-
-    bufferlist ebl(sizeof(*p)*2);
-    ::encode(*p, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, bl);
-    ::encode(crc, bl);
-
-    p->offset = startoff;
-  }
-  ondisklog.head = bl.length();
-  ondisklog.has_checksums = true;
-
-  // write it
-  t.remove(coll_t::META_COLL, log_oid );
-  t.write(coll_t::META_COLL, log_oid , 0, bl.length(), bl);
+       p++)
+    p->encode_with_checksum(keys[p->get_key_name()]);
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
 
+  ondisklog.zero();
   bufferlist blb(sizeof(ondisklog));
   ::encode(ondisklog, blb);
   t.collection_setattr(coll, "ondisklog", blb);
   
-  dout(10) << "write_log to " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+  dout(10) << "write_log " << keys.size() << " entries" << dendl;
   dirty_log = false;
 }
 
@@ -2063,47 +2071,11 @@ void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
     assert(trim_to <= info.last_complete);
 
     dout(10) << "trim " << log << " to " << trim_to << dendl;
-    log.trim(t, trim_to);
+    log.trim(t, log_oid, trim_to);
     info.log_tail = log.tail;
-    trim_ondisklog(t);
   }
 }
 
-void PG::trim_ondisklog(ObjectStore::Transaction& t) 
-{
-  uint64_t new_tail;
-  if (log.empty()) {
-    new_tail = ondisklog.head;
-  } else {
-    new_tail = log.log.front().offset;
-  }
-  bool same_block = (new_tail & ~4095) == (ondisklog.tail & ~4095);
-  dout(15) << "trim_ondisklog tail " << ondisklog.tail << " -> " << new_tail
-	   << ", now " << new_tail << "~" << (ondisklog.head - new_tail)
-	   << " " << (same_block ? "(same block)" : "(different block)")
-	   << dendl;
-  assert(new_tail >= ondisklog.tail);
-  
-  if (same_block)
-    return;
-
-  ondisklog.tail = new_tail;
-
-  if (!g_conf->osd_preserve_trimmed_log) {
-    uint64_t zt = new_tail & ~4095;
-    if (zt > ondisklog.zero_to) {
-      t.zero(coll_t::META_COLL, log_oid, ondisklog.zero_to, zt - ondisklog.zero_to);
-      dout(15) << "trim_ondisklog zeroing from " << ondisklog.zero_to
-	       << " to " << zt << dendl;
-      ondisklog.zero_to = zt;
-    }
-  }
-
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
-}
-
 void PG::trim_peers()
 {
   calc_trim_to();
@@ -2116,7 +2088,7 @@ void PG::trim_peers()
   }
 }
 
-void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
+void PG::add_log_entry(pg_log_entry_t& e)
 {
   // raise last_complete only if we were previously up to date
   if (info.last_complete == info.last_update)
@@ -2128,15 +2100,6 @@ void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
 
   // log mutation
   log.add(e);
-  if (ondisklog.has_checksums) {
-    bufferlist ebl(sizeof(e)*2);
-    ::encode(e, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, log_bl);
-    ::encode(crc, log_bl);
-  } else {
-    ::encode(e, log_bl);
-  }
   dout(10) << "add_log_entry " << e << dendl;
 }
 
@@ -2145,24 +2108,16 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
 {
   dout(10) << "append_log " << log << " " << logv << dendl;
 
-  bufferlist bl;
+  map<string,bufferlist> keys;
   for (vector<pg_log_entry_t>::iterator p = logv.begin();
        p != logv.end();
        p++) {
-    p->offset = ondisklog.head + bl.length();
-    add_log_entry(*p, bl);
+    p->encode_with_checksum(keys[p->get_key_name()]);
+    add_log_entry(*p);
   }
 
-  dout(10) << "append_log  " << ondisklog.tail << "~" << ondisklog.length()
-	   << " adding " << bl.length() << dendl;
-
-  t.write(coll_t::META_COLL, log_oid, ondisklog.head, bl.length(), bl );
-  ondisklog.head += bl.length();
-
-  bufferlist blb(sizeof(ondisklog));
-  ::encode(ondisklog, blb);
-  t.collection_setattr(coll, "ondisklog", blb);
-  dout(10) << "append_log  now " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+  dout(10) << "append_log  adding " << keys.size() << " keys" << dendl;
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
 
   trim(t, trim_to);
 
@@ -2180,127 +2135,42 @@ void PG::read_log(ObjectStore *store)
   bufferlist::iterator p = blb.begin();
   ::decode(ondisklog, p);
 
-  dout(10) << "read_log " << ondisklog.tail << "~" << ondisklog.length() << dendl;
-
   log.tail = info.log_tail;
+  assert(log.empty());
 
-  // In case of sobject_t based encoding, may need to list objects in the store
-  // to find hashes
-  bool listed_collection = false;
-  vector<hobject_t> ls;
-  
   if (ondisklog.head > 0) {
-    // read
-    bufferlist bl;
-    store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
-    if (bl.length() < ondisklog.length()) {
-      std::ostringstream oss;
-      oss << "read_log got " << bl.length() << " bytes, expected "
-	  << ondisklog.head << "-" << ondisklog.tail << "="
-	  << ondisklog.length();
-      throw read_log_error(oss.str().c_str());
-    }
-    
-    pg_log_entry_t e;
-    bufferlist::iterator p = bl.begin();
-    assert(log.empty());
-    eversion_t last;
-    bool reorder = false;
-    while (!p.end()) {
-      uint64_t pos = ondisklog.tail + p.get_off();
-      if (ondisklog.has_checksums) {
-	bufferlist ebl;
-	::decode(ebl, p);
-	__u32 crc;
-	::decode(crc, p);
-	
-	__u32 got = ebl.crc32c(0);
-	if (crc == got) {
-	  bufferlist::iterator q = ebl.begin();
-	  ::decode(e, q);
-	} else {
-	  std::ostringstream oss;
-	  oss << "read_log " << pos << " bad crc got " << got << " expected" << crc;
-	  throw read_log_error(oss.str().c_str());
-	}
-      } else {
-	::decode(e, p);
-      }
-      dout(20) << "read_log " << pos << " " << e << dendl;
-
-      // [repair] in order?
-      if (e.version < last) {
-	dout(0) << "read_log " << pos << " out of order entry " << e << " follows " << last << dendl;
-	osd->clog.error() << info.pgid << " log has out of order entry "
-	      << e << " following " << last << "\n";
-	reorder = true;
-      }
-
-      if (e.version <= log.tail) {
-	dout(20) << "read_log  ignoring entry at " << pos << " below log.tail" << dendl;
-	continue;
-      }
-      if (last.version == e.version.version) {
-	dout(0) << "read_log  got dup " << e.version << " (last was " << last << ", dropping that one)" << dendl;
-	log.log.pop_back();
-	osd->clog.error() << info.pgid << " read_log got dup "
-	      << e.version << " after " << last << "\n";
-      }
-
-      if (e.invalid_hash) {
-	// We need to find the object in the store to get the hash
-	if (!listed_collection) {
-	  store->collection_list(coll, ls);
-	  listed_collection = true;
-	}
-	bool found = false;
-	for (vector<hobject_t>::iterator i = ls.begin();
-	     i != ls.end();
-	     ++i) {
-	  if (i->oid == e.soid.oid && i->snap == e.soid.snap) {
-	    e.soid = *i;
-	    found = true;
-	    break;
-	  }
+    dout(0) << "read_log converting old log " << ondisklog.tail << "~"
+	    << ondisklog.length() << " to omap" << dendl;
+    read_old_log(store);
+    dirty_log = true;  // rewritten by read_state
+  } else {
+    dout(10) << "read_log" << dendl;
+    ObjectMap::ObjectMapIterator it =
+      store->get_omap_iterator(coll_t::META_COLL, log_oid);
+    if (it) {
+      for (it->seek_to_first(); it->valid(); it->next()) {
+	bufferlist bl = it->value();
+	bufferlist::iterator bp = bl.begin();
+	pg_log_entry_t e;
+	e.decode_with_checksum(bp);
+	dout(20) << "read_log " << it->key() << " " << e << dendl;
+
+	if (e.version <= log.tail) {
+	  // kept by osd_preserve_trimmed_log
+	  dout(20) << "read_log  ignoring entry " << e.version
+		   << " below log.tail" << dendl;
+	  continue;
 	}
-	if (!found) {
-	  // Didn't find the correct hash
-	  std::ostringstream oss;
-	  oss << "Could not find hash for hoid " << e.soid << std::endl;
-	  throw read_log_error(oss.str().c_str());
+	if (e.version > info.last_update) {
+	  osd->clog.error() << info.pgid << " log has entry " << e.version
+			    << " after last_update " << info.last_update << "\n";
+	  dout(0) << "read_log  dropping entry " << e.version
+		  << " after last_update" << dendl;
+	  dirty_log = true;
+	  continue;
 	}
+	log.log.push_back(e);
       }
-
-      if (e.invalid_pool) {
-	e.soid.pool = info.pgid.pool();
-      }
-
-      e.offset = pos;
-      uint64_t endpos = ondisklog.tail + p.get_off();
-      log.log.push_back(e);
-      last = e.version;
-
-      // [repair] at end of log?
-      if (!p.end() && e.version == info.last_update) {
-	osd->clog.error() << info.pgid << " log has extra data at "
-	   << endpos << "~" << (ondisklog.head-endpos) << " after "
-	   << info.last_update << "\n";
-
-	dout(0) << "read_log " << endpos << " *** extra gunk at end of log, "
-	        << "adjusting ondisklog.head" << dendl;
-	ondisklog.head = endpos;
-	break;
-      }
-    }
-  
-    if (reorder) {
-      dout(0) << "read_log reordering log" << dendl;
-      map<eversion_t, pg_log_entry_t> m;
-      for (list<pg_log_entry_t>::iterator p = log.log.begin(); p != log.log.end(); p++)
-	m[p->version] = *p;
-      log.log.clear();
-      for (map<eversion_t, pg_log_entry_t>::iterator p = m.begin(); p != m.end(); p++)
-	log.log.push_back(p->second);
     }
   }
 
@@ -2339,6 +2209,124 @@ void PG::read_log(ObjectStore *store)
   dout(10) << "read_log done" << dendl;
 }
 
+/**
+ * read a log written to the log object's data, before log entries
+ * were kept as omap keys
+ *
+ * @param store store to read from; ondisklog holds the log bounds
+ */
+void PG::read_old_log(ObjectStore *store)
+{
+  // In case of sobject_t based encoding, may need to list objects in the store
+  // to find hashes
+  bool listed_collection = false;
+  vector<hobject_t> ls;
+  
+  // read
+  bufferlist bl;
+  store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
+  if (bl.length() < ondisklog.length()) {
+    std::ostringstream oss;
+    oss << "read_log got " << bl.length() << " bytes, expected "
+	<< ondisklog.head << "-" << ondisklog.tail << "="
+	<< ondisklog.length();
+    throw read_log_error(oss.str().c_str());
+  }
+    
+  pg_log_entry_t e;
+  bufferlist::iterator p = bl.begin();
+  eversion_t last;
+  bool reorder = false;
+  while (!p.end()) {
+    uint64_t pos = ondisklog.tail + p.get_off();
+    if (ondisklog.has_checksums) {
+      try {
+	e.decode_with_checksum(p);
+      }
+      catch (const buffer::malformed_input &err) {
+	std::ostringstream oss;
+	oss << "read_log " << pos << " bad crc";
+	throw read_log_error(oss.str().c_str());
+      }
+    } else {
+      ::decode(e, p);
+    }
+    dout(20) << "read_log " << pos << " " << e << dendl;
+
+    // [repair] in order?
+    if (e.version < last) {
+      dout(0) << "read_log " << pos << " out of order entry " << e << " follows " << last << dendl;
+      osd->clog.error() << info.pgid << " log has out of order entry "
+	    << e << " following " << last << "\n";
+      reorder = true;
+    }
+
+    if (e.version <= log.tail) {
+      dout(20) << "read_log  ignoring entry at " << pos << " below log.tail" << dendl;
+      continue;
+    }
+    if (last.version == e.version.version) {
+      dout(0) << "read_log  got dup " << e.version << " (last was " << last << ", dropping that one)" << dendl;
+      log.log.pop_back();
+      osd->clog.error() << info.pgid << " read_log got dup "
+	    << e.version << " after " << last << "\n";
+    }
+
+    if (e.invalid_hash) {
+      // We need to find the object in the store to get the hash
+      if (!listed_collection) {
+	store->collection_list(coll, ls);
+	listed_collection = true;
+      }
+      bool found = false;
+      for (vector<hobject_t>::iterator i = ls.begin();
+	   i != ls.end();
+	   ++i) {
+	if (i->oid == e.soid.oid && i->snap == e.soid.snap) {
+	  e.soid = *i;
+	  found = true;
+	  break;
+	}
+      }
+      if (!found) {
+	// Didn't find the correct hash
+	std::ostringstream oss;
+	oss << "Could not find hash for hoid " << e.soid << std::endl;
+	throw read_log_error(oss.str().c_str());
+      }
+    }
+
+    if (e.invalid_pool) {
+      e.soid.pool = info.pgid.pool();
+    }
+
+    uint64_t endpos = ondisklog.tail + p.get_off();
+    log.log.push_back(e);
+    last = e.version;
+
+    // [repair] at end of log?
+    if (!p.end() && e.version == info.last_update) {
+      osd->clog.error() << info.pgid << " log has extra data at "
+	 << endpos << "~" << (ondisklog.head-endpos) << " after "
+	 << info.last_update << "\n";
+
+      dout(0) << "read_log " << endpos << " *** extra gunk at end of log, "
+	      << "ignoring it" << dendl;
+      break;
+    }
+  }
+  
+  if (reorder) {
+    dout(0) << "read_log reordering log" << dendl;
+    map<eversion_t, pg_log_entry_t> m;
+    for (list<pg_log_entry_t>::iterator p = log.log.begin(); p != log.log.end(); p++)
+      m[p->version] = *p;
+    log.log.clear();
+    for (map<eversion_t, pg_log_entry_t>::iterator p = m.begin(); p != m.end(); p++)
+      log.log.push_back(p->second);
+  }
+}
+
 bool PG::check_log_for_corruption(ObjectStore *store)
 {
   OndiskLog bounds;
@@ -2393,6 +2381,32 @@ bool PG::check_log_for_corruption(ObjectStore *store)
 	dout(30) << " " << pos << " " << e << dendl;
       }
     }
+  } else {
+    ObjectMap::ObjectMapIterator it =
+      store->get_omap_iterator(coll_t::META_COLL, log_oid);
+    if (it) {
+      for (it->seek_to_first(); it->valid(); it->next()) {
+	bufferlist bl = it->value();
+	bufferlist::iterator bp = bl.begin();
+	pg_log_entry_t e;
+	try {
+	  e.decode_with_checksum(bp);
+	}
+	catch (const buffer::error &err) {
+	  dout(0) << "corrupt entry " << it->key() << dendl;
+	  ss << "corrupt entry " << it->key();
+	  ok = false;
+	  break;
+	}
+	if (e.get_key_name() != it->key()) {
+	  dout(0) << "entry " << e << " stored as " << it->key() << dendl;
+	  ss << "entry " << e.version << " stored as " << it->key();
+	  ok = false;
+	  break;
+	}
+	dout(30) << " " << it->key() << " " << e << dendl;
+      }
+    }
   }
   if (!ok) {
     stringstream f;
@@ -2467,6 +2481,13 @@ void PG::read_state(ObjectStore *store)
 
   try {
     read_log(store);
+    if (dirty_log) {
+      // one-time conversion of an old flat log, or repair
+      ObjectStore::Transaction t;
+      write_log(t);
+      int r = store->apply_transaction(t);
+      assert(r == 0);
+    }
   }
   catch (const buffer::error &e) {
     string cr_log_coll_name(get_corrupt_pg_log_name());
@@ -2475,8 +2496,11 @@ void PG::read_state(ObjectStore *store)
 	    << "' for later " << "analysis." << dendl;
 
     ondisklog.zero();
+    dirty_log = false;
 
     // clear log index
+    log.log.clear();
+    log.unindex();
     log.head = log.tail = info.last_update;
 
     // reset info
@@ -2488,6 +2512,10 @@ void PG::read_state(ObjectStore *store)
     t.create_collection(cr_log_coll);
     t.collection_move(cr_log_coll, coll_t::META_COLL, log_oid);
     t.touch(coll_t::META_COLL, log_oid);
+    t.omap_clear(coll_t::META_COLL, log_oid);
+    bufferlist blb;
+    ::encode(ondisklog, blb);
+    t.collection_setattr(coll, "ondisklog", blb);
     write_info(t);
     store->apply_transaction(t);
 
@@ -2618,9 +2646,9 @@ void PG::requeue_ops(list<OpRequestRef> &ls)
 {
   dout(15) << " requeue_ops " << ls << dendl;
   assert(&ls != &op_queue);
-  size_t requeue_size = ls.size();
+  for (list<OpRequestRef>::iterator i = ls.begin(); i != ls.end(); ++i)
+    osd->queue_for_op(this, *i);
   op_queue.splice(op_queue.begin(), ls, ls.begin(), ls.end());
-  for (size_t i = 0; i < requeue_size; ++i) osd->queue_for_op(this);
 }
 
 
@@ -2682,6 +2710,11 @@ bool PG::sched_scrub()
       ret = true;
     } else if (scrub_reserved_peers.size() == acting.size()) {
       dout(20) << "sched_scrub: success, reserved self and replicas" << dendl;
+      if (info.history.last_deep_scrub_stamp + g_conf->osd_deep_scrub_interval <=
+	  ceph_clock_now(g_ceph_context)) {
+	dout(10) << "sched_scrub: scrub will be deep" << dendl;
+	state_set(PG_STATE_DEEP_SCRUB);
+      }
       queue_scrub();
       ret = true;
     } else {
@@ -2712,6 +2745,16 @@ void PG::sub_op_scrub_map(OpRequestRef op)
 
   dout(10) << " got osd." << from << " scrub map" << dendl;
   bufferlist::iterator p = m->get_data().begin();
+
+  if (scrub_chunky) {
+    scrub_received_maps[from].decode(p, info.pgid.pool());
+    --scrub_waiting_on;
+    scrub_waiting_on_whom.erase(from);
+    if (scrub_waiting_on == 0)
+      osd->scrub_wq.queue(this);
+    return;
+  }
+
   if (scrub_received_maps.count(from)) {
     ScrubMap incoming;
     incoming.decode(p, info.pgid.pool());
@@ -2741,11 +2784,14 @@ void PG::sub_op_scrub_map(OpRequestRef op)
 }
 
 /* 
- * pg lock may or may not be held
+ * pg lock may or may not be held; it must not be for a throttled deep
+ * scan, which sleeps in the osd-wide read throttle
  */
-void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
+void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep,
+		    bool throttle)
 {
-  dout(10) << "_scan_list scanning " << ls.size() << " objects" << dendl;
+  dout(10) << "_scan_list scanning " << ls.size() << " objects"
+	   << (deep ? " deeply" : "") << dendl;
   int i = 0;
   for (vector<hobject_t>::iterator p = ls.begin(); 
        p != ls.end(); 
@@ -2759,6 +2805,12 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
       o.size = st.st_size;
       assert(!o.negative);
       osd->store->getattrs(coll, poid, o.attrs);
+      if (deep) {
+	_scan_object_digests(poid, o, throttle);
+	// a whole-pg deep scan can take far longer than the work queue
+	// timeout; what counts is that each object makes progress.
+	ThreadPool::reset_tp_timeout();
+      }
       dout(25) << "_scan_list  " << poid << dendl;
     } else {
       dout(25) << "_scan_list  " << poid << " got " << r << ", skipping" << dendl;
@@ -2766,13 +2818,104 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
   }
 }
 
+/*
+ * deep scrub: crc32c the object data, read osd_deep_scrub_stride at a
+ * time, and the omap header, keys and values.  if throttle, reads are
+ * charged to the osd's deep scrub throttle, so the pg lock must not be
+ * held.
+ */
+void PG::_scan_object_digests(const hobject_t &poid, ScrubMap::object &o,
+			      bool throttle)
+{
+  uint64_t stride = g_conf->osd_deep_scrub_stride;
+  if (!stride)
+    stride = 524288;
+
+  // data
+  __u32 crc = -1;
+  uint64_t pos = 0;
+  while (true) {
+    bufferlist bl;
+    int r = osd->store->read(coll, poid, pos, stride, bl);
+    if (r < 0) {
+      dout(0) << "_scan_list  " << poid << " read at " << pos
+	      << " got " << cpp_strerror(r) << dendl;
+      o.read_error = true;
+      return;
+    }
+    if (r == 0)
+      break;
+    if (throttle)
+      osd->throttle_deep_scrub_read(r);
+    crc = bl.crc32c(crc);
+    pos += r;
+    if ((uint64_t)r < stride)
+      break;
+  }
+  o.digest = crc;
+  o.digest_present = true;
+
+  // omap
+  bufferlist hdrbl;
+  int r = osd->store->omap_get_header(coll, poid, &hdrbl);
+  if (r < 0) {
+    dout(0) << "_scan_list  " << poid << " omap header got "
+	    << cpp_strerror(r) << dendl;
+    o.read_error = true;
+    return;
+  }
+  crc = hdrbl.crc32c(-1);
+  uint64_t omap_bytes = hdrbl.length();
+
+  ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(coll, poid);
+  if (!iter) {
+    dout(0) << "_scan_list  " << poid << " no omap iterator" << dendl;
+    o.read_error = true;
+    return;
+  }
+  for (iter->seek_to_first(); iter->valid(); iter->next()) {
+    bufferlist bl;
+    ::encode(iter->key(), bl);
+    ::encode(iter->value(), bl);
+    crc = bl.crc32c(crc);
+    omap_bytes += bl.length();
+  }
+  if (iter->status() < 0) {
+    dout(0) << "_scan_list  " << poid << " omap iteration got "
+	    << cpp_strerror(iter->status()) << dendl;
+    o.read_error = true;
+    return;
+  }
+  // release the iterator (and its hold on the store) before sleeping
+  iter.reset();
+  if (throttle)
+    osd->throttle_deep_scrub_read(omap_bytes);
+
+  o.omap_digest = crc;
+  o.omap_digest_present = true;
+}
+
 void PG::_request_scrub_map(int replica, eversion_t version)
 {
   assert(replica != osd->whoami);
   dout(10) << "scrub  requesting scrubmap from osd." << replica << dendl;
   MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version,
 					      last_update_applied,
-                                              get_osdmap()->get_epoch());
+                                              get_osdmap()->get_epoch(),
+					      scrub_deep);
+  osd->cluster_messenger->send_message(repscrubop,
+                                       get_osdmap()->get_cluster_inst(replica));
+}
+
+void PG::_request_scrub_map(int replica, eversion_t version,
+			    hobject_t start, hobject_t end)
+{
+  assert(replica != osd->whoami);
+  dout(10) << "scrub  requesting scrubmap for [" << start << "," << end
+	   << ") from osd." << replica << dendl;
+  MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version,
+					      get_osdmap()->get_epoch(),
+					      start, end, scrub_deep);
   osd->cluster_messenger->send_message(repscrubop,
                                        get_osdmap()->get_cluster_inst(replica));
 }
@@ -2903,7 +3046,7 @@ void PG::scrub_unreserve_replicas()
  * build a (sorted) summary of pg content for purposes of scrubbing
  * called while holding pg lock
  */ 
-void PG::build_scrub_map(ScrubMap &map)
+void PG::build_scrub_map(ScrubMap &map, bool deep)
 {
   dout(10) << "build_scrub_map" << dendl;
 
@@ -2920,7 +3063,7 @@ void PG::build_scrub_map(ScrubMap &map)
   vector<hobject_t> ls;
   osd->store->collection_list(coll, ls);
 
-  _scan_list(map, ls);
+  _scan_list(map, ls, deep);
   lock();
 
   if (epoch != info.history.same_interval_since) {
@@ -2940,11 +3083,54 @@ void PG::build_scrub_map(ScrubMap &map)
 }
 
 
+/*
+ * build a summary of the pg content in [start, end)
+ * called while holding pg lock; writes to the range must already be
+ * blocked and applied.  the lock is dropped while the objects are
+ * scanned, so callers must recheck same_interval_since afterwards and
+ * must not pass a map that on_change might clear.
+ */
+int PG::build_scrub_map_chunk(ScrubMap &map, hobject_t start, hobject_t end,
+			      bool deep)
+{
+  dout(10) << "build_scrub_map_chunk [" << start << "," << end << ")"
+	   << (deep ? " deep" : "") << dendl;
+
+  map.valid_through = info.last_update;
+
+  vector<hobject_t> ls;
+  hobject_t pos = start;
+  while (pos < end) {
+    vector<hobject_t> batch;
+    hobject_t next;
+    int r = osd->store->collection_list_partial(coll, pos,
+						osd->store->get_ideal_list_min(),
+						osd->store->get_ideal_list_max(),
+						0, &batch, &next);
+    if (r < 0)
+      return r;
+    for (vector<hobject_t>::iterator p = batch.begin(); p != batch.end(); ++p)
+      if (*p < end)
+	ls.push_back(*p);
+    if (batch.empty())
+      break;
+    pos = next;
+  }
+
+  unlock();
+  _scan_list(map, ls, deep);
+  lock();
+
+  // pg attrs
+  osd->store->collection_getattrs(coll, map.attrs);
+  return 0;
+}
+
 /* 
  * build a summary of pg content changed starting after v
  * called while holding pg lock
  */
-void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
+void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v, bool deep)
 {
   map.valid_through = last_update_applied;
   map.incr_since = v;
@@ -2968,7 +3154,9 @@ void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
     }
   }
 
-  _scan_list(map, ls);
+  // we hold the pg lock, and the objects written since the chunk was
+  // scanned are few: don't sleep in the throttle with client io blocked
+  _scan_list(map, ls, deep, false);
   // pg attrs
   osd->store->collection_getattrs(coll, map.attrs);
 
@@ -3026,7 +3214,19 @@ void PG::replica_scrub(MOSDRepScrub *msg)
   }
 
   ScrubMap map;
-  if (msg->scrub_from > eversion_t()) {
+  if (msg->chunky) {
+    if (last_update_applied < msg->scrub_to) {
+      dout(10) << "waiting for last_update_applied to reach " << msg->scrub_to
+	       << dendl;
+      active_rep_scrub = msg;
+      msg->get();
+      return;
+    }
+    // on error, send what we have; the primary will flag the difference
+    int r = build_scrub_map_chunk(map, msg->start, msg->end, msg->deep);
+    if (r < 0)
+      dout(0) << "replica_scrub failed to list chunk: " << cpp_strerror(r) << dendl;
+  } else if (msg->scrub_from > eversion_t()) {
     if (finalizing_scrub) {
       assert(last_update_applied == info.last_update);
       assert(last_update_applied == msg->scrub_to);
@@ -3038,10 +3238,10 @@ void PG::replica_scrub(MOSDRepScrub *msg)
 	return;
       }
     }
-    build_inc_scrub_map(map, msg->scrub_from);
+    build_inc_scrub_map(map, msg->scrub_from, msg->deep);
     finalizing_scrub = 0;
   } else {
-    build_scrub_map(map);
+    build_scrub_map(map, msg->deep);
   }
 
   if (msg->map_epoch < info.history.same_interval_since) {
@@ -3096,32 +3296,33 @@ void PG::scrub()
     return;
   }
 
-  if (!is_primary() || !is_active() || !is_clean() || !is_scrubbing()) {
+  // a chunky repair clears CLEAN partway through; let it carry on
+  if (!is_primary() || !is_active() || (!is_clean() && !scrub_active) ||
+      !is_scrubbing()) {
     dout(10) << "scrub -- not primary or active or not clean" << dendl;
+    if (scrub_active) {
+      scrub_clear_state();
+      scrub_unreserve_replicas();
+    }
     state_clear(PG_STATE_REPAIR);
+    state_clear(PG_STATE_DEEP_SCRUB);
     state_clear(PG_STATE_SCRUBBING);
     clear_scrub_reserved();
     unlock();
     return;
   }
 
+  if (scrub_chunky ||
+      (!scrub_active && scrub_replicas_support_chunky())) {
+    scrub_chunky = true;
+    chunky_scrub();
+    unlock();
+    return;
+  }
+
   if (!scrub_active) {
     dout(10) << "scrub start" << dendl;
-    scrub_active = true;
-
-    update_stats();
-    scrub_received_maps.clear();
-    scrub_epoch_start = info.history.same_interval_since;
-
-    osd->sched_scrub_lock.Lock();
-    if (scrub_reserved) {
-      --(osd->scrubs_pending);
-      assert(osd->scrubs_pending >= 0);
-      scrub_reserved = false;
-      scrub_reserved_peers.clear();
-    }
-    ++(osd->scrubs_active);
-    osd->sched_scrub_lock.Unlock();
+    _scrub_begin();
 
     /* scrub_waiting_on == 0 iff all replicas have sent the requested maps and
      * the primary has done a final scrub (which in turn can only happen if
@@ -3137,7 +3338,7 @@ void PG::scrub()
 
     // Unlocks and relocks...
     primary_scrubmap = ScrubMap();
-    build_scrub_map(primary_scrubmap);
+    build_scrub_map(primary_scrubmap, scrub_deep);
 
     if (scrub_epoch_start != info.history.same_interval_since) {
       dout(10) << "scrub  pg changed, aborting" << dendl;
@@ -3188,7 +3389,7 @@ void PG::scrub()
   
   if (primary_scrubmap.valid_through != log.head) {
     ScrubMap incr;
-    build_inc_scrub_map(incr, primary_scrubmap.valid_through);
+    build_inc_scrub_map(incr, primary_scrubmap.valid_through, scrub_deep);
     primary_scrubmap.merge_incr(incr);
   }
   
@@ -3202,11 +3403,268 @@ void PG::scrub()
   unlock();
 }
 
+void PG::_scrub_begin()
+{
+  scrub_active = true;
+
+  update_stats();
+  scrub_received_maps.clear();
+  scrub_epoch_start = info.history.same_interval_since;
+  scrub_errors = scrub_fixed = 0;
+  scrub_cstat = object_stat_collection_t();
+  scrub_deep = state_test(PG_STATE_DEEP_SCRUB);
+
+  osd->sched_scrub_lock.Lock();
+  if (scrub_reserved) {
+    --(osd->scrubs_pending);
+    assert(osd->scrubs_pending >= 0);
+    scrub_reserved = false;
+    scrub_reserved_peers.clear();
+  }
+  ++(osd->scrubs_active);
+  osd->sched_scrub_lock.Unlock();
+}
+
+bool PG::scrub_replicas_support_chunky()
+{
+  for (unsigned i=1; i<acting.size(); i++) {
+    Connection *con = osd->cluster_messenger->get_connection(
+      get_osdmap()->get_cluster_inst(acting[i]));
+    bool ok = con->get_features() & CEPH_FEATURE_CHUNKY_SCRUB;
+    con->put();
+    if (!ok) {
+      dout(10) << "osd." << acting[i] << " does not support chunky scrub" << dendl;
+      return false;
+    }
+  }
+  return true;
+}
+
+const char *PG::get_scrub_state_name(ScrubState s)
+{
+  switch (s) {
+  case SCRUB_INACTIVE: return "inactive";
+  case SCRUB_NEW_CHUNK: return "new_chunk";
+  case SCRUB_WAIT_LAST_UPDATE: return "wait_last_update";
+  case SCRUB_BUILD_MAP: return "build_map";
+  case SCRUB_WAIT_REPLICAS: return "wait_replicas";
+  case SCRUB_COMPARE_MAPS: return "compare_maps";
+  case SCRUB_FINISH: return "finish";
+  default: return "???";
+  }
+}
+
+/*
+ * Chunky scrub:
+ *
+ * The pg is scrubbed in chunks of between osd_scrub_chunk_min and
+ * osd_scrub_chunk_max objects, each ending on a hash boundary so that
+ * a head and its clones are always scrubbed together.  For each chunk:
+ *
+ * NEW_CHUNK         pick [scrub_start, scrub_end), block writes to it,
+ *                   note the newest log entry in the range and ask the
+ *                   replicas for their map once they have applied it.
+ * WAIT_LAST_UPDATE  wait (requeued by op_applied) until we have applied
+ *                   that entry ourselves.
+ * BUILD_MAP         scan our copy of the chunk.
+ * WAIT_REPLICAS     wait (requeued by sub_op_scrub_map) for the replica
+ *                   maps.
+ * COMPARE_MAPS      compare, unblock writes, and requeue ourselves for
+ *                   the next chunk.
+ * FINISH            after the last chunk, check the accumulated stats
+ *                   and record the scrub.
+ *
+ * Writes to objects we have already passed keep scrub_cstat current;
+ * see ReplicatedPG::prepare_transaction and trim_object.
+ *
+ * Called with the pg lock held.
+ */
+void PG::chunky_scrub()
+{
+  bool done = false;
+  while (!done) {
+    dout(20) << "scrub state " << get_scrub_state_name(scrub_state)
+	     << " [" << scrub_start << "," << scrub_end << ")" << dendl;
+
+    if (scrub_state != SCRUB_INACTIVE &&
+	scrub_epoch_start != info.history.same_interval_since) {
+      dout(10) << "scrub  pg changed, aborting" << dendl;
+      scrub_clear_state();
+      scrub_unreserve_replicas();
+      return;
+    }
+
+    switch (scrub_state) {
+    case SCRUB_INACTIVE:
+      dout(10) << "scrub start (chunky)" << dendl;
+      _scrub_begin();
+      scrub_start = hobject_t();
+      scrub_chunks = scrub_objects = 0;
+      scrub_state = SCRUB_NEW_CHUNK;
+      break;
+
+    case SCRUB_NEW_CHUNK:
+      primary_scrubmap = ScrubMap();
+      scrub_received_maps.clear();
+      _scrub_pick_chunk_end();
+      scrub_block_writes = true;
+
+      scrub_subset_last_update = eversion_t();
+      for (list<pg_log_entry_t>::iterator p = log.log.begin();
+	   p != log.log.end();
+	   ++p) {
+	if (p->soid >= scrub_start && p->soid < scrub_end)
+	  scrub_subset_last_update = p->version;
+      }
+
+      scrub_waiting_on = acting.size();
+      scrub_waiting_on_whom.insert(acting.begin(), acting.end());
+      for (unsigned i=1; i<acting.size(); i++)
+	_request_scrub_map(acting[i], scrub_subset_last_update,
+			   scrub_start, scrub_end);
+
+      scrub_state = SCRUB_WAIT_LAST_UPDATE;
+      break;
+
+    case SCRUB_WAIT_LAST_UPDATE:
+      if (last_update_applied >= scrub_subset_last_update)
+	scrub_state = SCRUB_BUILD_MAP;
+      else
+	done = true;
+      break;
+
+    case SCRUB_BUILD_MAP:
+      {
+	// drops the pg lock; on_change may reset us in the meantime
+	ScrubMap map;
+	int r = build_scrub_map_chunk(map, scrub_start, scrub_end, scrub_deep);
+	if (scrub_epoch_start != info.history.same_interval_since) {
+	  dout(10) << "scrub  pg changed, aborting" << dendl;
+	  if (scrub_active) {
+	    scrub_clear_state();
+	    scrub_unreserve_replicas();
+	  }
+	  return;
+	}
+	if (r < 0) {
+	  dout(0) << "scrub failed to list chunk: " << cpp_strerror(r) << dendl;
+	  scrub_clear_state();
+	  scrub_unreserve_replicas();
+	  return;
+	}
+	primary_scrubmap.objects.swap(map.objects);
+	primary_scrubmap.attrs.swap(map.attrs);
+	primary_scrubmap.valid_through = map.valid_through;
+      }
+      --scrub_waiting_on;
+      scrub_waiting_on_whom.erase(osd->whoami);
+      scrub_state = SCRUB_WAIT_REPLICAS;
+      break;
+
+    case SCRUB_WAIT_REPLICAS:
+      if (scrub_waiting_on > 0)
+	done = true;
+      else
+	scrub_state = SCRUB_COMPARE_MAPS;
+      break;
+
+    case SCRUB_COMPARE_MAPS:
+      scrub_compare_maps();
+      scrub_objects += primary_scrubmap.objects.size();
+      scrub_chunks++;
+
+      scrub_block_writes = false;
+      requeue_ops(waiting_for_active);
+
+      if (scrub_end.is_max()) {
+	scrub_state = SCRUB_FINISH;
+      } else {
+	// let client io at the pg before the next chunk
+	scrub_start = scrub_end;
+	scrub_state = SCRUB_NEW_CHUNK;
+	osd->scrub_wq.queue(this);
+	done = true;
+      }
+      break;
+
+    case SCRUB_FINISH:
+      scrub_finish();
+      done = true;
+      break;
+    }
+  }
+}
+
+/*
+ * set scrub_end so that [scrub_start, scrub_end) holds at least
+ * osd_scrub_chunk_min objects (unless we reach the end of the pg) and
+ * ends on a hash boundary.
+ */
+void PG::_scrub_pick_chunk_end()
+{
+  hobject_t start = scrub_start;
+  while (true) {
+    vector<hobject_t> objects;
+    hobject_t next;
+    int r = osd->store->collection_list_partial(coll, start,
+						g_conf->osd_scrub_chunk_min,
+						g_conf->osd_scrub_chunk_max,
+						0, &objects, &next);
+    assert(r >= 0);
+    if (objects.empty() || next.is_max()) {
+      scrub_end = hobject_t::get_max();
+      return;
+    }
+    start = next;
+
+    // search backward for the last change of hash
+    objects.push_back(next);
+    while (objects.size() > 1) {
+      hobject_t end = objects.back().get_boundary();
+      objects.pop_back();
+      if (objects.back().get_filestore_key() != end.get_filestore_key()) {
+	scrub_end = end;
+	return;
+      }
+    }
+    // every object shares one hash; keep listing
+  }
+}
+
+void PG::dump_scrub_info(Formatter *f)
+{
+  f->dump_stream("scrub_epoch_start") << scrub_epoch_start;
+  f->dump_int("scrub_active", scrub_active);
+  f->dump_int("scrub_deep", scrub_deep);
+  f->dump_int("scrub_block_writes", scrub_block_writes);
+  f->dump_int("finalizing_scrub", finalizing_scrub);
+  f->dump_int("scrub_waiting_on", scrub_waiting_on);
+  {
+    f->open_array_section("scrub_waiting_on_whom");
+    for (set<int>::iterator p = scrub_waiting_on_whom.begin();
+	 p != scrub_waiting_on_whom.end();
+	 ++p) {
+      f->dump_int("osd", *p);
+    }
+    f->close_section();
+  }
+  f->dump_int("scrub_chunky", scrub_chunky);
+  if (scrub_chunky) {
+    f->dump_string("scrub_state", get_scrub_state_name(scrub_state));
+    f->dump_stream("scrub_start") << scrub_start;
+    f->dump_stream("scrub_end") << scrub_end;
+    f->dump_unsigned("scrub_chunks", scrub_chunks);
+    f->dump_unsigned("scrub_objects", scrub_objects);
+    f->dump_int("scrub_errors", scrub_errors);
+  }
+}
+
 void PG::scrub_clear_state()
 {
   assert(_lock.is_locked());
   state_clear(PG_STATE_SCRUBBING);
   state_clear(PG_STATE_REPAIR);
+  state_clear(PG_STATE_DEEP_SCRUB);
   update_stats();
 
   // active -> nothing.
@@ -3217,6 +3675,13 @@ void PG::scrub_clear_state()
   finalizing_scrub = false;
   scrub_block_writes = false;
   scrub_active = false;
+  scrub_chunky = false;
+  scrub_state = SCRUB_INACTIVE;
+  scrub_start = scrub_end = hobject_t();
+  scrub_subset_last_update = eversion_t();
+  scrub_errors = scrub_fixed = 0;
+  scrub_cstat = object_stat_collection_t();
+  scrub_deep = false;
   scrub_waiting_on = 0;
   scrub_waiting_on_whom.clear();
   if (active_rep_scrub) {
@@ -3254,7 +3719,28 @@ bool PG::_compare_scrub_objects(ScrubMap::object &auth,
 				ostream &errorstream)
 {
   bool ok = true;
+  if (candidate.read_error) {
+    // we don't know enough about the candidate to compare it further
+    errorstream << "candidate had a read error";
+    return false;
+  }
+  if (auth.digest_present && candidate.digest_present &&
+      auth.digest != candidate.digest) {
+    ok = false;
+    errorstream << "digest " << candidate.digest
+		<< " != known digest " << auth.digest;
+  }
+  if (auth.omap_digest_present && candidate.omap_digest_present &&
+      auth.omap_digest != candidate.omap_digest) {
+    if (!ok)
+      errorstream << ", ";
+    ok = false;
+    errorstream << "omap_digest " << candidate.omap_digest
+		<< " != known omap_digest " << auth.omap_digest;
+  }
   if (auth.size != candidate.size) {
+    if (!ok)
+      errorstream << ", ";
     ok = false;
     errorstream << "size " << candidate.size 
 		<< " != known size " << auth.size;
@@ -3311,11 +3797,22 @@ void PG::_compare_scrubmaps(const map<int,ScrubMap*> &maps,
     map<int, ScrubMap *>::const_iterator auth = maps.end();
     set<int> cur_missing;
     set<int> cur_inconsistent;
+    // Take the first osd to have a readable copy as authoritative
+    for (j = maps.begin(); j != maps.end(); j++) {
+      i = j->second->objects.find(*k);
+      if (i == j->second->objects.end())
+	continue;
+      if (auth == maps.end() ||
+	  (auth->second->objects[*k].read_error && !i->second.read_error))
+	auth = j;
+    }
     for (j = maps.begin(); j != maps.end(); j++) {
       if (j->second->objects.count(*k)) {
-	if (auth == maps.end()) {
-	  // Take first osd to have it as authoritative
-	  auth = j;
+	if (j == auth) {
+	  if (auth->second->objects[*k].read_error)
+	    errorstream << info.pgid << " osd." << acting[j->first]
+			<< ": soid " << *k << " read error, and no readable"
+			<< " copy to compare against" << std::endl;
 	} else {
 	  // Compare 
 	  stringstream ss;
@@ -3370,7 +3867,17 @@ void PG::scrub_finalize() {
   }
 
   dout(10) << "scrub_finalize has maps, analyzing" << dendl;
-  int errors = 0, fixed = 0;
+  scrub_compare_maps();
+  scrub_finish();
+  unlock();
+}
+
+/*
+ * compare the primary and replica maps (of the whole pg, or of the
+ * current chunk), queueing repairs and adding to scrub_errors
+ */
+void PG::scrub_compare_maps()
+{
   bool repair = state_test(PG_STATE_REPAIR);
   const char *mode = repair ? "repair":"scrub";
   if (acting.size() > 1) {
@@ -3437,31 +3944,43 @@ void PG::scrub_finalize() {
   }
 
   // ok, do the pg-type specific scrubbing
-  _scrub(primary_scrubmap, errors, fixed);
+  _scrub(primary_scrubmap, scrub_errors, scrub_fixed);
+}
+
+void PG::scrub_finish()
+{
+  bool repair = state_test(PG_STATE_REPAIR);
+  const char *mode = repair ? "repair" : (scrub_deep ? "deep-scrub" : "scrub");
+
+  _scrub_finish(scrub_errors, scrub_fixed);
 
   {
     stringstream oss;
     oss << info.pgid << " " << mode << " ";
-    if (errors)
-      oss << errors << " errors";
+    if (scrub_errors)
+      oss << scrub_errors << " errors";
     else
       oss << "ok";
     if (repair)
-      oss << ", " << fixed << " fixed";
+      oss << ", " << scrub_fixed << " fixed";
     oss << "\n";
-    if (errors)
+    if (scrub_errors)
       osd->clog.error(oss);
     else
       osd->clog.info(oss);
   }
 
-  if (errors == 0 || (repair && (errors - fixed) == 0))
+  if (scrub_errors == 0 || (repair && (scrub_errors - scrub_fixed) == 0))
     state_clear(PG_STATE_INCONSISTENT);
 
   // finish up
   osd->unreg_last_pg_scrub(info.pgid, info.history.last_scrub_stamp);
   info.history.last_scrub = info.last_update;
   info.history.last_scrub_stamp = ceph_clock_now(g_ceph_context);
+  if (scrub_deep) {
+    info.history.last_deep_scrub = info.history.last_scrub;
+    info.history.last_deep_scrub_stamp = info.history.last_scrub_stamp;
+  }
   osd->reg_last_pg_scrub(info.pgid, info.history.last_scrub_stamp);
 
   {
@@ -3479,7 +3998,6 @@ void PG::scrub_finalize() {
   }
 
   dout(10) << "scrub done" << dendl;
-  unlock();
 }
 
 void PG::share_pg_info()
@@ -4096,7 +4614,7 @@ void PG::queue_op(OpRequestRef op)
     return;
   }
   op_queue.push_back(op);
-  osd->queue_for_op(this);
+  osd->queue_for_op(this, op);
 }
 
 void PG::take_waiters()
@@ -4757,20 +5275,7 @@ boost::statechart::result PG::RecoveryState::Active::react(const QueryState& q)
 
   {
     q.f->open_object_section("scrub");
-    q.f->dump_stream("scrub_epoch_start") << pg->scrub_epoch_start;
-    q.f->dump_int("scrub_active", pg->scrub_active);
-    q.f->dump_int("scrub_block_writes", pg->scrub_block_writes);
-    q.f->dump_int("finalizing_scrub", pg->finalizing_scrub);
-    q.f->dump_int("scrub_waiting_on", pg->scrub_waiting_on);
-    {
-      q.f->open_array_section("scrub_waiting_on_whom");
-      for (set<int>::iterator p = pg->scrub_waiting_on_whom.begin();
-	   p != pg->scrub_waiting_on_whom.end();
-	   ++p) {
-	q.f->dump_int("osd", *p);
-      }
-      q.f->close_section();
-    }
+    pg->dump_scrub_info(q.f);
     q.f->close_section();
   }
 
@@ -264,14 +264,21 @@ public:
       caller_ops[e.reqid] = &(log.back());
     }
 
-    void trim(ObjectStore::Transaction &t, eversion_t s);
+    /// trim entries up to s, removing their keys from the log object
+    void trim(ObjectStore::Transaction &t, const hobject_t& oid, eversion_t s);
 
     ostream& print(ostream& out) const;
   };
   
 
   /**
-   * OndiskLog - some info about how we store the log on disk.
+   * OndiskLog - bounds of the old flat log.
+   *
+   * Log entries used to be appended to the log object's data, with
+   * these offsets kept in the "ondisklog" collection attr.  They are now
+   * omap keys on the log object (see pg_log_entry_t::get_key_name()),
+   * and the attr is kept zeroed; a nonzero head marks a log in the old
+   * format, which read_log converts.
    */
   class OndiskLog {
   public:
@@ -398,7 +405,9 @@ public:
   list<OpRequestRef> op_waiters;
   list<OpRequestRef> op_queue;  // op queue
 
-  bool dirty_info, dirty_log;
+  bool dirty_info;
+  bool dirty_log;  // rewrite the whole log; appends, trims and merges
+                   // queue their own key updates
 
 public:
   // pg state
@@ -779,6 +788,39 @@ public:
   epoch_t scrub_epoch_start;
   ScrubMap primary_scrubmap;
   MOSDRepScrub *active_rep_scrub;
+  int scrub_errors, scrub_fixed;
+  object_stat_collection_t scrub_cstat;  // stats of the objects scrubbed so far
+  bool scrub_deep;  // this scrub also digests object data and omap
+
+  /*
+   * chunky scrub: when every replica supports it, the primary scrubs
+   * the pg in chunks of [scrub_start, scrub_end), only blocking writes
+   * to objects in the chunk currently being compared.
+   */
+  enum ScrubState {
+    SCRUB_INACTIVE,
+    SCRUB_NEW_CHUNK,
+    SCRUB_WAIT_LAST_UPDATE,
+    SCRUB_BUILD_MAP,
+    SCRUB_WAIT_REPLICAS,
+    SCRUB_COMPARE_MAPS,
+    SCRUB_FINISH,
+  };
+  static const char *get_scrub_state_name(ScrubState s);
+
+  bool scrub_chunky;
+  ScrubState scrub_state;
+  hobject_t scrub_start, scrub_end;
+  eversion_t scrub_subset_last_update;  // newest log entry in the chunk
+  unsigned scrub_chunks, scrub_objects; // progress
+
+  bool write_blocked_by_scrub(const hobject_t &soid) {
+    if (!scrub_block_writes)
+      return false;
+    if (!scrub_chunky)
+      return true;
+    return soid >= scrub_start && soid < scrub_end;
+  }
 
   void repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer, int ok_peer);
   bool _compare_scrub_objects(ScrubMap::object &auth,
@@ -790,14 +832,31 @@ public:
 			  map<hobject_t, int> &authoritative,
 			  ostream &errorstream);
   void scrub();
+  void _scrub_begin();
+  bool scrub_replicas_support_chunky();
+  void chunky_scrub();
+  void _scrub_pick_chunk_end();
+  void scrub_compare_maps();
+  void scrub_finish();
   void scrub_finalize();
   void scrub_clear_state();
   bool scrub_gather_replica_maps();
-  void _scan_list(ScrubMap &map, vector<hobject_t> &ls);
+  void _scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep,
+		  bool throttle = true);
+  void _scan_object_digests(const hobject_t &poid, ScrubMap::object &o,
+			    bool throttle);
   void _request_scrub_map(int replica, eversion_t version);
-  void build_scrub_map(ScrubMap &map);
-  void build_inc_scrub_map(ScrubMap &map, eversion_t v);
+  void _request_scrub_map(int replica, eversion_t version,
+			  hobject_t start, hobject_t end);
+  void build_scrub_map(ScrubMap &map, bool deep);
+  void build_inc_scrub_map(ScrubMap &map, eversion_t v, bool deep);
+  int build_scrub_map_chunk(ScrubMap &map, hobject_t start, hobject_t end,
+			    bool deep);
+  void dump_scrub_info(Formatter *f);
+  /// check one (chunk's) map, accumulating into scrub_cstat
   virtual int _scrub(ScrubMap &map, int& errors, int& fixed) { return 0; }
+  /// check scrub_cstat against the pg stats once every object is scrubbed
+  virtual void _scrub_finish(int& errors, int& fixed) { }
   virtual coll_t get_temp_coll() = 0;
   virtual bool have_temp_coll() = 0;
   void clear_scrub_reserved();
@@ -1442,13 +1501,13 @@ public:
 
   void write_if_dirty(ObjectStore::Transaction& t);
 
-  void add_log_entry(pg_log_entry_t& e, bufferlist& log_bl);
+  void add_log_entry(pg_log_entry_t& e);
   void append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStore::Transaction &t);
 
   void read_log(ObjectStore *store);
+  void read_old_log(ObjectStore *store);
   bool check_log_for_corruption(ObjectStore *store);
   void trim(ObjectStore::Transaction& t, eversion_t v);
-  void trim_ondisklog(ObjectStore::Transaction& t);
   void trim_peers();
 
   std::string get_corrupt_pg_log_name() const;
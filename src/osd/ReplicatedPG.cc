@@ -615,17 +615,18 @@ void ReplicatedPG::do_op(OpRequestRef op)
 
   dout(10) << "do_op " << *m << (m->may_write() ? " may_write" : "") << dendl;
 
-  if (scrub_block_writes && m->may_write()) {
+  // missing object?
+  hobject_t head(m->get_oid(), m->get_object_locator().key,
+		 CEPH_NOSNAP, m->get_pg().ps(),
+		 info.pgid.pool());
+
+  if (m->may_write() && write_blocked_by_scrub(head)) {
     dout(20) << __func__ << ": waiting for scrub" << dendl;
     waiting_for_active.push_back(op);
     op->mark_delayed();
     return;
   }
 
-  // missing object?
-  hobject_t head(m->get_oid(), m->get_object_locator().key,
-		 CEPH_NOSNAP, m->get_pg().ps(),
-		 info.pgid.pool());
   if (is_missing_object(head)) {
     wait_for_missing_object(head, op);
     return;
@@ -1332,6 +1333,7 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
   if (newsnaps.empty()) {
     // remove clone
     dout(10) << coid << " snaps " << snaps << " -> " << newsnaps << " ... deleting" << dendl;
+    obc->stale = true;  // no longer on disk
     t->remove(coll, coid);
     t->collection_remove(coll_t(info.pgid, snaps[0]), coid);
     if (snaps.size() > 1)
@@ -1358,6 +1360,8 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
     delta.num_object_clones--;
     delta.num_bytes -= snapset.clone_size[last];
     info.stats.stats.add(delta, obc->obs.oi.category);
+    if (scrub_chunky && coid < scrub_start)
+      scrub_cstat.add(delta, obc->obs.oi.category);
 
     snapset.clones.erase(p);
     snapset.clone_overlap.erase(last);
@@ -1589,6 +1593,12 @@ void ReplicatedPG::remove_watchers_and_notifies()
 
   dout(10) << "remove_watchers" << dendl;
 
+  // put_object_context below trims the lru, which erases idle contexts
+  // from object_contexts under the iterator.  Empty it first: then only
+  // contexts the loop has already visited can be trimmed, since the ones
+  // still ahead of it are all in use.
+  trim_object_context_lru(0);
+
   osd->watch_lock.Lock();
   for (map<hobject_t, ObjectContext*>::iterator oiter = object_contexts.begin();
        oiter != object_contexts.end();
@@ -3340,6 +3350,10 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
   ctx->obc->ssc->snapset = ctx->new_snapset;
   info.stats.stats.add(ctx->delta_stats, ctx->obc->obs.oi.category);
 
+  // chunky scrub has already counted this object; keep its tally current
+  if (scrub_chunky && soid < scrub_start)
+    scrub_cstat.add(ctx->delta_stats, ctx->obc->obs.oi.category);
+
   if (backfill_target >= 0) {
     pg_info_t& pinfo = peer_info[backfill_target];
     if (soid < pinfo.last_backfill)
@@ -3456,7 +3470,13 @@ void ReplicatedPG::op_applied(RepGather *repop)
     assert(info.last_update >= repop->v);
     assert(last_update_applied < repop->v);
     last_update_applied = repop->v;
-    if (last_update_applied == info.last_update && scrub_block_writes) {
+    if (scrub_chunky) {
+      if (scrub_state == SCRUB_WAIT_LAST_UPDATE &&
+	  last_update_applied == scrub_subset_last_update) {
+	dout(10) << "requeueing scrub, chunk updates applied" << dendl;
+	osd->scrub_wq.queue(this);
+      }
+    } else if (last_update_applied == info.last_update && scrub_block_writes) {
       dout(10) << "requeueing scrub for cleanup" << dendl;
       finalizing_scrub = true;
       scrub_gather_replica_maps();
@@ -3934,7 +3954,11 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
     obc = p->second;
     dout(10) << "get_object_context " << obc << " " << soid << " " << obc->ref
 	     << " -> " << (obc->ref+1) << dendl;
+    if (obc->lru_item.is_on_list())
+      obc->lru_item.remove_myself();
+    osd->logger->inc(l_osd_obc_hit);
   } else {
+    osd->logger->inc(l_osd_obc_miss);
     // check disk
     bufferlist bv;
     int r = osd->store->getattr(coll, soid, OI_ATTR, bv);
@@ -3977,6 +4001,14 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
 void ReplicatedPG::context_registry_on_change()
 {
   remove_watchers_and_notifies();
+
+  // whatever the new interval does to these objects, it won't be
+  // through contexts that are in use now; don't keep them afterwards
+  for (map<hobject_t, ObjectContext*>::iterator p = object_contexts.begin();
+       p != object_contexts.end();
+       ++p)
+    p->second->stale = true;
+  trim_object_context_lru(0);
 }
 
 
@@ -4091,18 +4123,58 @@ void ReplicatedPG::put_object_context(ObjectContext *obc)
 
   --obc->ref;
   if (obc->ref == 0) {
-    if (obc->ssc)
-      put_snapset_context(obc->ssc);
+    unsigned max = g_conf->osd_pg_object_context_cache_count;
+    if (obc->registered && obc->obs.exists && !obc->stale && max) {
+      // keep it around for the next op on this object
+      if (obc->lru_item.is_on_list())
+	obc->lru_item.remove_myself();
+      object_context_lru.push_front(&obc->lru_item);
+      trim_object_context_lru(max);
+      if (object_contexts.size() == (unsigned)object_context_lru.size())
+	kick();
+      return;
+    }
+    evict_object_context(obc);
+  }
+}
 
-    if (obc->registered)
-      object_contexts.erase(obc->obs.oi.soid);
-    delete obc;
+void ReplicatedPG::evict_object_context(ObjectContext *obc)
+{
+  assert(obc->ref == 0);
+  if (obc->lru_item.is_on_list())
+    obc->lru_item.remove_myself();
+  if (obc->ssc)
+    put_snapset_context(obc->ssc);
 
-    if (object_contexts.empty())
-      kick();
+  if (obc->registered)
+    object_contexts.erase(obc->obs.oi.soid);
+  delete obc;
+
+  if (object_contexts.empty())
+    kick();
+}
+
+void ReplicatedPG::trim_object_context_lru(unsigned max)
+{
+  while ((unsigned)object_context_lru.size() > max) {
+    ObjectContext *obc = object_context_lru.back();
+    obc->lru_item.remove_myself();
+    if (obc->ref)
+      continue;  // in use again; requeued when it is put
+    dout(20) << "trim_object_context_lru " << obc << " " << obc->obs.oi.soid << dendl;
+    evict_object_context(obc);
   }
 }
 
+void ReplicatedPG::invalidate_object_context(const hobject_t& soid)
+{
+  map<hobject_t, ObjectContext*>::iterator p = object_contexts.find(soid);
+  if (p == object_contexts.end() || p->second->ref)
+    return;
+  dout(20) << "invalidate_object_context " << p->second << " " << soid << dendl;
+  evict_object_context(p->second);
+}
+
 void ReplicatedPG::put_object_contexts(map<hobject_t,ObjectContext*>& obcv)
 {
   if (obcv.empty())
@@ -4354,8 +4426,7 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
     assert(info.last_update >= m->version);
     assert(last_update_applied < m->version);
     last_update_applied = m->version;
-    if (finalizing_scrub) {
-      assert(active_rep_scrub);
+    if (active_rep_scrub) {
       if (last_update_applied == active_rep_scrub->scrub_to) {
 	osd->rep_scrub_wq.queue(active_rep_scrub);
 	active_rep_scrub = 0;
@@ -5740,14 +5811,14 @@ void ReplicatedPG::on_removal()
 {
   dout(10) << "on_removal" << dendl;
   apply_and_flush_repops(false);
-  remove_watchers_and_notifies();
+  context_registry_on_change();
 }
 
 void ReplicatedPG::on_shutdown()
 {
   dout(10) << "on_shutdown" << dendl;
   apply_and_flush_repops(false);
-  remove_watchers_and_notifies();
+  context_registry_on_change();
 }
 
 void ReplicatedPG::on_activate()
@@ -5772,11 +5843,19 @@ void ReplicatedPG::on_change()
   clear_scrub_reserved();
 
   // clear scrub state
-  if (scrub_block_writes) {
+  if (scrub_active) {
     scrub_clear_state();
   } else if (is_scrubbing()) {
     state_clear(PG_STATE_SCRUBBING);
     state_clear(PG_STATE_REPAIR);
+    state_clear(PG_STATE_DEEP_SCRUB);
+  }
+
+  // drop any replica scrub waiting on an update from the old interval
+  if (active_rep_scrub) {
+    active_rep_scrub->put();
+    active_rep_scrub = NULL;
+    finalizing_scrub = false;
   }
 
   context_registry_on_change();
@@ -6470,6 +6549,7 @@ void ReplicatedPG::scan_range(hobject_t begin, int min, int max, BackfillInterva
 
 void ReplicatedPG::remove_object_with_snap_hardlinks(ObjectStore::Transaction& t, const hobject_t& soid)
 {
+  invalidate_object_context(soid);
   t.remove(coll, soid);
   if (soid.snap < CEPH_MAXSNAP) {
     bufferlist ba;
@@ -6533,8 +6613,6 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
   SnapSet snapset;
   vector<snapid_t>::reverse_iterator curclone;
 
-  object_stat_collection_t cstat;
-
   bufferlist last_data;
 
   for (map<hobject_t,ScrubMap::object>::reverse_iterator p = scrubmap.objects.rbegin(); 
@@ -6588,7 +6666,7 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
     }
     if (soid.snap == CEPH_SNAPDIR) {
       string cat;
-      cstat.add(stat, cat);
+      scrub_cstat.add(stat, cat);
       continue;
     }
 
@@ -6655,9 +6733,19 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
     }
 
     string cat; // fixme
-    cstat.add(stat, cat);
+    scrub_cstat.add(stat, cat);
   }  
   
+  dout(10) << "_scrub (" << mode << ") finish" << dendl;
+  return errors;
+}
+
+void ReplicatedPG::_scrub_finish(int& errors, int& fixed)
+{
+  bool repair = state_test(PG_STATE_REPAIR);
+  const char *mode = repair ? "repair":"scrub";
+  object_stat_collection_t &cstat = scrub_cstat;
+
   dout(10) << mode << " got "
 	   << cstat.sum.num_objects << "/" << info.stats.stats.sum.num_objects << " objects, "
 	   << cstat.sum.num_object_clones << "/" << info.stats.stats.sum.num_object_clones << " clones, "
@@ -6681,9 +6769,6 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
       share_pg_info();
     }
   }
-
-  dout(10) << "_scrub (" << mode << ") finish" << dendl;
-  return errors;
 }
 
 /*---SnapTrimmer Logging---*/
@@ -268,6 +268,11 @@ public:
 
     SnapSetContext *ssc;  // may be null
 
+    // on object_context_lru while idle (ref == 0) and cached
+    xlist<ObjectContext*>::item lru_item;
+    bool stale;  // free rather than cache once idle
+
+
   private:
     Mutex lock;
   public:
@@ -285,6 +290,7 @@ public:
 
     ObjectContext(const object_info_t &oi_, bool exists_, SnapSetContext *ssc_)
       : ref(0), registered(false), obs(oi_, exists_), ssc(ssc_),
+	lru_item(this), stale(false),
 	lock("ReplicatedPG::ObjectContext::lock"),
 	unstable_writes(0), readers(0), writers_waiting(0), readers_waiting(0),
 	blocked_by(0) {}
@@ -516,6 +522,19 @@ protected:
   map<hobject_t, ObjectContext*> object_contexts;
   map<object_t, SnapSetContext*> snapset_contexts;
 
+  /*
+   * Contexts for existing objects are not freed when their last ref
+   * is put; they stay registered, pinning their SnapSetContext, on this
+   * list (most recently used first) so the next op on the object need
+   * not re-read its attrs.  Anything that changes an object behind the
+   * obc's back must invalidate it.  An entry may have picked up a ref
+   * since it was queued; trimming skips and unlinks those.
+   */
+  xlist<ObjectContext*> object_context_lru;
+  void evict_object_context(ObjectContext *obc);
+  void trim_object_context_lru(unsigned max);
+  void invalidate_object_context(const hobject_t& soid);
+
   void populate_obc_watchers(ObjectContext *obc);
   void register_unconnected_watcher(void *obc,
 				    entity_name_t entity,
@@ -540,6 +559,7 @@ protected:
 				    bool can_create);
   void register_object_context(ObjectContext *obc) {
     if (!obc->registered) {
+      invalidate_object_context(obc->obs.oi.soid);
       assert(object_contexts.count(obc->obs.oi.soid) == 0);
       obc->registered = true;
       object_contexts[obc->obs.oi.soid] = obc;
@@ -906,6 +926,7 @@ protected:
 
   // -- scrub --
   virtual int _scrub(ScrubMap& map, int& errors, int& fixed);
+  virtual void _scrub_finish(int& errors, int& fixed);
 
   void apply_and_flush_repops(bool requeue);
 
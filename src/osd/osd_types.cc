@@ -408,6 +408,8 @@ std::string pg_state_string(int state)
     oss << "remapped+";
   if (state & PG_STATE_SCRUBBING)
     oss << "scrubbing+";
+  if (state & PG_STATE_DEEP_SCRUB)
+    oss << "deep+";
   if (state & PG_STATE_SCRUBQ)
     oss << "scrubq+";
   if (state & PG_STATE_INCONSISTENT)
@@ -973,6 +975,8 @@ void pg_stat_t::dump(Formatter *f) const
   f->dump_unsigned("parent_split_bits", parent_split_bits);
   f->dump_stream("last_scrub") << last_scrub;
   f->dump_stream("last_scrub_stamp") << last_scrub_stamp;
+  f->dump_stream("last_deep_scrub") << last_deep_scrub;
+  f->dump_stream("last_deep_scrub_stamp") << last_deep_scrub_stamp;
   f->dump_unsigned("log_size", log_size);
   f->dump_unsigned("ondisk_log_size", ondisk_log_size);
   stats.dump(f);
@@ -988,7 +992,7 @@ void pg_stat_t::dump(Formatter *f) const
 
 void pg_stat_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(9, 8, bl);
+  ENCODE_START(10, 8, bl);
   ::encode(version, bl);
   ::encode(reported, bl);
   ::encode(state, bl);
@@ -1011,12 +1015,14 @@ void pg_stat_t::encode(bufferlist &bl) const
   ::encode(last_clean, bl);
   ::encode(last_unstale, bl);
   ::encode(mapping_epoch, bl);
+  ::encode(last_deep_scrub, bl);
+  ::encode(last_deep_scrub_stamp, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_stat_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(9, 8, 8, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(10, 8, 8, bl);
   ::decode(version, bl);
   ::decode(reported, bl);
   ::decode(state, bl);
@@ -1075,6 +1081,10 @@ void pg_stat_t::decode(bufferlist::iterator &bl)
       ::decode(last_unstale, bl);
       ::decode(mapping_epoch, bl);
     }
+    if (struct_v >= 10) {
+      ::decode(last_deep_scrub, bl);
+      ::decode(last_deep_scrub_stamp, bl);
+    }
   }
   DECODE_FINISH(bl);
 }
@@ -1101,6 +1111,8 @@ void pg_stat_t::generate_test_instances(list<pg_stat_t*>& o)
   a.parent_split_bits = 12;
   a.last_scrub = eversion_t(9, 10);
   a.last_scrub_stamp = utime_t(11, 12);
+  a.last_deep_scrub = eversion_t(13, 14);
+  a.last_deep_scrub_stamp = utime_t(15, 16);
   list<object_stat_collection_t*> l;
   object_stat_collection_t::generate_test_instances(l);
   a.stats = *l.back();
@@ -1179,7 +1191,7 @@ void pool_stat_t::generate_test_instances(list<pool_stat_t*>& o)
 
 void pg_history_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(4, 4, bl);
+  ENCODE_START(5, 4, bl);
   ::encode(epoch_created, bl);
   ::encode(last_epoch_started, bl);
   ::encode(last_epoch_clean, bl);
@@ -1189,12 +1201,14 @@ void pg_history_t::encode(bufferlist &bl) const
   ::encode(same_primary_since, bl);
   ::encode(last_scrub, bl);
   ::encode(last_scrub_stamp, bl);
+  ::encode(last_deep_scrub, bl);
+  ::encode(last_deep_scrub_stamp, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_history_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(4, 4, 4, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(5, 4, 4, bl);
   ::decode(epoch_created, bl);
   ::decode(last_epoch_started, bl);
   if (struct_v >= 3)
@@ -1209,6 +1223,10 @@ void pg_history_t::decode(bufferlist::iterator &bl)
     ::decode(last_scrub, bl);
     ::decode(last_scrub_stamp, bl);
   }
+  if (struct_v >= 5) {
+    ::decode(last_deep_scrub, bl);
+    ::decode(last_deep_scrub_stamp, bl);
+  }
   DECODE_FINISH(bl);
 }
 
@@ -1223,6 +1241,8 @@ void pg_history_t::dump(Formatter *f) const
   f->dump_int("same_primary_since", same_primary_since);
   f->dump_stream("last_scrub") << last_scrub;
   f->dump_stream("last_scrub_stamp") << last_scrub_stamp;
+  f->dump_stream("last_deep_scrub") << last_deep_scrub;
+  f->dump_stream("last_deep_scrub_stamp") << last_deep_scrub_stamp;
 }
 
 void pg_history_t::generate_test_instances(list<pg_history_t*>& o)
@@ -1238,6 +1258,8 @@ void pg_history_t::generate_test_instances(list<pg_history_t*>& o)
   o.back()->same_primary_since = 7;
   o.back()->last_scrub = eversion_t(8, 9);
   o.back()->last_scrub_stamp = utime_t(10, 11);  
+  o.back()->last_deep_scrub = eversion_t(12, 13);
+  o.back()->last_deep_scrub_stamp = utime_t(14, 15);
 }
 
 
@@ -1550,8 +1572,40 @@ void pg_query_t::generate_test_instances(list<pg_query_t*>& o)
 }
 
 
+// -- eversion_t --
+
+string eversion_t::get_key_name() const
+{
+  char key[32];
+  snprintf(key, sizeof(key), "%010u.%020llu", epoch,
+	   (long long unsigned)version);
+  return string(key);
+}
+
+
 // -- pg_log_entry_t --
 
+void pg_log_entry_t::encode_with_checksum(bufferlist &bl) const
+{
+  bufferlist ebl(sizeof(*this)*2);
+  encode(ebl);
+  __u32 crc = ebl.crc32c(0);
+  ::encode(ebl, bl);
+  ::encode(crc, bl);
+}
+
+void pg_log_entry_t::decode_with_checksum(bufferlist::iterator &p)
+{
+  bufferlist ebl;
+  ::decode(ebl, p);
+  __u32 crc;
+  ::decode(crc, p);
+  if (crc != ebl.crc32c(0))
+    throw buffer::malformed_input("bad checksum on pg_log_entry_t");
+  bufferlist::iterator q = ebl.begin();
+  decode(q);
+}
+
 void pg_log_entry_t::encode(bufferlist &bl) const
 {
   ENCODE_START(5, 4, bl);
@@ -2593,19 +2647,31 @@ void ScrubMap::generate_test_instances(list<ScrubMap*>& o)
 
 void ScrubMap::object::encode(bufferlist& bl) const
 {
-  ENCODE_START(2, 2, bl);
+  ENCODE_START(3, 2, bl);
   ::encode(size, bl);
   ::encode(negative, bl);
   ::encode(attrs, bl);
+  ::encode(digest, bl);
+  ::encode(digest_present, bl);
+  ::encode(omap_digest, bl);
+  ::encode(omap_digest_present, bl);
+  ::encode(read_error, bl);
   ENCODE_FINISH(bl);
 }
 
 void ScrubMap::object::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(2, 2, 2, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(3, 2, 2, bl);
   ::decode(size, bl);
   ::decode(negative, bl);
   ::decode(attrs, bl);
+  if (struct_v >= 3) {
+    ::decode(digest, bl);
+    ::decode(digest_present, bl);
+    ::decode(omap_digest, bl);
+    ::decode(omap_digest_present, bl);
+    ::decode(read_error, bl);
+  }
   DECODE_FINISH(bl);
 }
 
@@ -2613,6 +2679,11 @@ void ScrubMap::object::dump(Formatter *f) const
 {
   f->dump_int("size", size);
   f->dump_int("negative", negative);
+  if (digest_present)
+    f->dump_unsigned("digest", digest);
+  if (omap_digest_present)
+    f->dump_unsigned("omap_digest", omap_digest);
+  f->dump_int("read_error", read_error);
   f->open_array_section("attrs");
   for (map<string,bufferptr>::const_iterator p = attrs.begin(); p != attrs.end(); ++p) {
     f->open_object_section("attr");
@@ -2632,6 +2703,12 @@ void ScrubMap::object::generate_test_instances(list<object*>& o)
   o.back()->size = 123;
   o.back()->attrs["foo"] = buffer::copy("foo", 3);
   o.back()->attrs["bar"] = buffer::copy("barval", 6);
+  o.push_back(new object);
+  o.back()->size = 456;
+  o.back()->digest = 0x12345678;
+  o.back()->digest_present = true;
+  o.back()->omap_digest = 0x9abcdef0;
+  o.back()->omap_digest_present = true;
 }
 
 // -- OSDOp --
@@ -38,6 +38,7 @@
 #define CEPH_OSD_FEATURE_INCOMPAT_CATEGORIES  CompatSet::Feature(5, "categories")
 #define CEPH_OSD_FEATURE_INCOMPAT_HOBJECTPOOL  CompatSet::Feature(6, "hobjectpool")
 #define CEPH_OSD_FEATURE_INCOMPAT_BIGINFO CompatSet::Feature(7, "biginfo")
+#define CEPH_OSD_FEATURE_INCOMPAT_LEVELDBLOG CompatSet::Feature(8, "leveldblog")
 
 
 typedef hobject_t collection_list_handle_t;
@@ -448,6 +449,9 @@ public:
     version++;
   }
 
+  /// omap key for this version; keys sort in eversion order
+  string get_key_name() const;
+
   void encode(bufferlist &bl) const {
     ::encode(version, bl);
     ::encode(epoch, bl);
@@ -564,6 +568,7 @@ inline ostream& operator<<(ostream& out, const osd_stat_t& s) {
 #define PG_STATE_INCOMPLETE   (1<<16) // incomplete content, peering failed.
 #define PG_STATE_STALE        (1<<17) // our state for this pg is stale, unknown.
 #define PG_STATE_REMAPPED     (1<<18) // pg is explicitly remapped to different OSDs than CRUSH
+#define PG_STATE_DEEP_SCRUB   (1<<19) // deep scrub: check object data and omap
 
 std::string pg_state_string(int state);
 
@@ -862,7 +867,9 @@ struct pg_stat_t {
   __u32 parent_split_bits;
 
   eversion_t last_scrub;
+  eversion_t last_deep_scrub;
   utime_t last_scrub_stamp;
+  utime_t last_deep_scrub_stamp;
 
   object_stat_collection_t stats;
 
@@ -951,7 +958,9 @@ struct pg_history_t {
   epoch_t same_primary_since;  // same primary at least back through this epoch.
 
   eversion_t last_scrub;
+  eversion_t last_deep_scrub;
   utime_t last_scrub_stamp;
+  utime_t last_deep_scrub_stamp;
 
   pg_history_t()
     : epoch_created(0),
@@ -985,6 +994,14 @@ struct pg_history_t {
       last_scrub_stamp = other.last_scrub_stamp;
       modified = true;
     }
+    if (other.last_deep_scrub > last_deep_scrub) {
+      last_deep_scrub = other.last_deep_scrub;
+      modified = true;
+    }
+    if (other.last_deep_scrub_stamp > last_deep_scrub_stamp) {
+      last_deep_scrub_stamp = other.last_deep_scrub_stamp;
+      modified = true;
+    }
     return modified;
   }
 
@@ -1233,17 +1250,14 @@ struct pg_log_entry_t {
   bool invalid_hash; // only when decoding sobject_t based entries
   bool invalid_pool; // only when decoding pool-less hobject based entries
 
-  uint64_t offset;   // [soft state] my offset on disk
-      
   pg_log_entry_t()
-    : op(0), invalid_hash(false), offset(0) {}
+    : op(0), invalid_hash(false), invalid_pool(false) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 const osd_reqid_t& rid, const utime_t& mt)
     : op(_op), soid(_soid), version(v),
       prior_version(pv),
-      reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false),
-      offset(0) {}
+      reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false) {}
       
   bool is_clone() const { return op == CLONE; }
   bool is_modify() const { return op == MODIFY; }
@@ -1263,6 +1277,13 @@ struct pg_log_entry_t {
     return reqid != osd_reqid_t() && (op == MODIFY || op == DELETE);
   }
 
+  string get_key_name() const {
+    return version.get_key_name();
+  }
+  /// encode wrapped in a bufferlist and followed by its crc32c
+  void encode_with_checksum(bufferlist &bl) const;
+  void decode_with_checksum(bufferlist::iterator &p);
+
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
   void dump(Formatter *f) const;
@@ -1777,8 +1798,14 @@ struct ScrubMap {
     uint64_t size;
     bool negative;
     map<string,bufferptr> attrs;
-
-    object(): size(0), negative(false) {}
+    __u32 digest;
+    bool digest_present;
+    __u32 omap_digest;         ///< omap crc32c
+    bool omap_digest_present;  ///< true if omap_digest is set
+    bool read_error;           ///< deep scrub could not read the object
+
+    object(): size(0), negative(false), digest(0), digest_present(false),
+	      omap_digest(0), omap_digest_present(false), read_error(false) {}
 
     void encode(bufferlist& bl) const;
     void decode(bufferlist::iterator& bl);
@@ -212,13 +212,17 @@ void Objecter::init()
   schedule_tick();
   maybe_request_map();
 
+  rwlock.get_write();
   initialized = true;
+  rwlock.put_write();
 }
 
 void Objecter::shutdown() 
 {
   assert(client_lock.is_locked());
   assert(initialized);
+
+  rwlock.get_write();
   initialized = false;
 
   map<int,OSDSession*>::iterator p;
@@ -226,6 +230,7 @@ void Objecter::shutdown()
     p = osd_sessions.begin();
     close_session(p->second);
   }
+  rwlock.put_write();
 
   if (tick_event) {
     timer.cancel_event(tick_event);
@@ -261,24 +266,28 @@ void Objecter::send_linger(LingerOp *info)
   o->should_resend = false;
 
   if (info->session) {
-    int r = recalc_op_target(o);
-    if (r == RECALC_OP_TARGET_POOL_DNE) {
+    pg_t pgid;
+    vector<int> acting;
+    int osd;
+    bool used_replica;
+    if (calc_target(o, &pgid, &acting, &osd, &used_replica) == -ENOENT)
       linger_check_for_latest_map(info);
-    }
   }
 
   if (info->register_tid) {
     // repeat send.  cancel old registeration op, if any.
-    if (ops.count(info->register_tid)) {
-      Op *o = ops[info->register_tid];
-      cancel_op(o);
-    }
-    info->register_tid = _op_submit(o);
-  } else {
-    // first send
-    info->register_tid = op_submit(o);
+    Op *old = find_op(info->register_tid);
+    if (old)
+      cancel_op(old);
   }
 
+  // we hold the write lock, so we cannot block on the budget here;
+  // registrations are not throttled.
+  tid_t tid;
+  int r = _op_submit(o, true, &tid);
+  assert(r == 0);
+  info->register_tid = tid;
+
   OSDSession *s = o->session;
   if (info->session != s) {
     info->session_item.remove_myself();
@@ -294,29 +303,44 @@ void Objecter::send_linger(LingerOp *info)
 void Objecter::_linger_ack(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_ack " << info->linger_id << dendl;
-  if (info->on_reg_ack) {
-    info->on_reg_ack->finish(r);
-    delete info->on_reg_ack;
-    info->on_reg_ack = NULL;
+  rwlock.get_write();
+  Context *onack = info->on_reg_ack;
+  info->on_reg_ack = NULL;
+  rwlock.put_write();
+
+  if (onack) {
+    onack->finish(r);
+    delete onack;
   }
 }
 
 void Objecter::_linger_commit(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_commit " << info->linger_id << dendl;
-  if (info->on_reg_commit) {
-    info->on_reg_commit->finish(r);
-    delete info->on_reg_commit;
-    info->on_reg_commit = NULL;
-  }
+  rwlock.get_write();
+  Context *oncommit = info->on_reg_commit;
+  info->on_reg_commit = NULL;
 
   // only tell the user the first time we do this
   info->registered = true;
   info->registering = false;
   info->pobjver = NULL;
+  rwlock.put_write();
+
+  if (oncommit) {
+    oncommit->finish(r);
+    delete oncommit;
+  }
 }
 
 void Objecter::unregister_linger(uint64_t linger_id)
+{
+  rwlock.get_write();
+  _unregister_linger(linger_id);
+  rwlock.put_write();
+}
+
+void Objecter::_unregister_linger(uint64_t linger_id)
 {
   map<uint64_t, LingerOp*>::iterator iter = linger_ops.find(linger_id);
   if (iter != linger_ops.end()) {
@@ -348,14 +372,17 @@ tid_t Objecter::linger(const object_t& oid, const object_locator_t& oloc,
   info->on_reg_ack = onack;
   info->on_reg_commit = onfinish;
 
-  info->linger_id = ++max_linger_id;
-  linger_ops[info->linger_id] = info;
+  rwlock.get_write();
+  uint64_t linger_id = ++max_linger_id;
+  info->linger_id = linger_id;
+  linger_ops[linger_id] = info;
 
   logger->set(l_osdc_linger_active, linger_ops.size());
 
   send_linger(info);
+  rwlock.put_write();
 
-  return info->linger_id;
+  return linger_id;
 }
 
 void Objecter::dispatch(Message *m)
@@ -399,6 +426,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
     return;
   }
 
+  rwlock.get_write();
+
   bool was_pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
   bool was_pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || osdmap->test_flag(CEPH_OSDMAP_FULL);
   
@@ -449,6 +478,20 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  continue;
 	}
 	logger->set(l_osdc_map_epoch, osdmap->get_epoch());
+
+	// osd addr changes?  closing a session leaves its ops homeless,
+	// so do this first and retarget them below.
+	for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+	     p != osd_sessions.end(); ) {
+	  OSDSession *s = p->second;
+	  p++;
+	  if (osdmap->is_up(s->osd)) {
+	    if (s->con && s->con->get_peer_addr() != osdmap->get_inst(s->osd).addr)
+	      close_session(s);
+	  } else {
+	    close_session(s);
+	  }
+	}
 	
 	// check for changed linger mappings (_before_ regular ops)
 	for (map<tid_t,LingerOp*>::iterator p = linger_ops.begin();
@@ -473,11 +516,14 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  }
 	}
 
-	// check for changed request mappings
-	for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-	     p != ops.end();
+	// check for changed request mappings.  recalc_op_target() moves
+	// ops between sessions, so collect them first.
+	list<Op*> all_ops;
+	get_all_ops(&all_ops);
+	for (list<Op*>::iterator p = all_ops.begin();
+	     p != all_ops.end();
 	     ++p) {
-	  Op *op = p->second;
+	  Op *op = *p;
 	  ldout(cct, 10) << " checking op " << op->tid << dendl;
 	  int r = recalc_op_target(op);
 	  if (skipped_map)
@@ -496,19 +542,6 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  }
 	}
 
-	// osd addr changes?
-	for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
-	     p != osd_sessions.end(); ) {
-	  OSDSession *s = p->second;
-	  p++;
-	  if (osdmap->is_up(s->osd)) {
-	    if (s->con && s->con->get_peer_addr() != osdmap->get_inst(s->osd).addr)
-	      close_session(s);
-	  } else {
-	    close_session(s);
-	  }
-	}
-
 	assert(e == osdmap->get_epoch());
       }
       
@@ -534,16 +567,19 @@ void Objecter::handle_osd_map(MOSDMap *m)
   
   // unpause requests?
   if ((was_pauserd && !pauserd) ||
-      (was_pausewr && !pausewr))
-    for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-	 p != ops.end();
-	 p++) {
-      Op *op = p->second;
+      (was_pausewr && !pausewr)) {
+    list<Op*> all_ops;
+    get_all_ops(&all_ops);
+    for (list<Op*>::iterator p = all_ops.begin();
+	 p != all_ops.end();
+	 ++p) {
+      Op *op = *p;
       if (op->paused &&
 	  !((op->flags & CEPH_OSD_FLAG_READ) && pauserd) &&   // not still paused as a read
 	  !((op->flags & CEPH_OSD_FLAG_WRITE) && pausewr))    // not still paused as a write
 	need_resend[op->tid] = op;
     }
+  }
 
   // resend requests
   for (map<tid_t, Op*>::iterator p = need_resend.begin(); p != need_resend.end(); p++) {
@@ -565,25 +601,31 @@ void Objecter::handle_osd_map(MOSDMap *m)
     }
   }
 
-  dump_active();
+  _dump_active();
   
-  // finish any Contexts that were waiting on a map update
+  // finish any Contexts that were waiting on a map update, once we
+  // have dropped our lock
+  list<pair<Context*, int> > waiters;
   map<epoch_t,list< pair< Context*, int > > >::iterator p =
     waiting_for_map.begin();
   while (p != waiting_for_map.end() &&
 	 p->first <= osdmap->get_epoch()) {
-    //go through the list and call the onfinish methods
-    for (list<pair<Context*, int> >::iterator i = p->second.begin();
-	 i != p->second.end(); ++i) {
-      i->first->finish(i->second);
-      delete i->first;
-    }
+    waiters.splice(waiters.end(), p->second);
     waiting_for_map.erase(p++);
   }
+  epoch_t epoch = osdmap->get_epoch();
+  rwlock.put_write();
+
+  //go through the list and call the onfinish methods
+  for (list<pair<Context*, int> >::iterator i = waiters.begin();
+       i != waiters.end(); ++i) {
+    i->first->finish(i->second);
+    delete i->first;
+  }
 
   m->put();
 
-  monc->sub_got("osdmap", osdmap->get_epoch());
+  monc->sub_got("osdmap", epoch);
 }
 
 void Objecter::C_Op_Map_Latest::finish(int r)
@@ -592,26 +634,36 @@ void Objecter::C_Op_Map_Latest::finish(int r)
     return;
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<tid_t, Op*>::iterator iter =
     objecter->check_latest_map_ops.find(tid);
   if (iter == objecter->check_latest_map_ops.end()) {
+    objecter->rwlock.put_write();
     return;
   }
 
   Op *op = iter->second;
   objecter->check_latest_map_ops.erase(iter);
 
+  Context *onack = NULL, *oncommit = NULL;
   if (r == 0) { // we had the latest map
-    if (op->onack) {
-      op->onack->complete(-ENOENT);
-    }
-    if (op->oncommit) {
-      op->oncommit->complete(-ENOENT);
-    }
-    op->session_item.remove_myself();
-    objecter->ops.erase(op->tid);
-    delete op;
+    onack = op->onack;
+    oncommit = op->oncommit;
+    op->onack = op->oncommit = NULL;
+    if (onack)
+      objecter->num_unacked.dec();
+    if (oncommit)
+      objecter->num_uncommitted.dec();
+    objecter->finish_op(op);
+  }
+  objecter->rwlock.put_write();
+
+  if (onack) {
+    onack->complete(-ENOENT);
+  }
+  if (oncommit) {
+    oncommit->complete(-ENOENT);
   }
 }
 
@@ -621,24 +673,32 @@ void Objecter::C_Linger_Map_Latest::finish(int r)
     return;
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<uint64_t, LingerOp*>::iterator iter =
     objecter->check_latest_map_lingers.find(linger_id);
   if (iter == objecter->check_latest_map_lingers.end()) {
+    objecter->rwlock.put_write();
     return;
   }
 
   LingerOp *op = iter->second;
   objecter->check_latest_map_lingers.erase(iter);
 
+  Context *onack = NULL, *oncommit = NULL;
   if (r == 0) { // we had the latest map
-    if (op->on_reg_ack) {
-      op->on_reg_ack->complete(-ENOENT);
-    }
-    if (op->on_reg_commit) {
-      op->on_reg_commit->complete(-ENOENT);
-    }
-    objecter->unregister_linger(op->linger_id);
+    onack = op->on_reg_ack;
+    oncommit = op->on_reg_commit;
+    op->on_reg_ack = op->on_reg_commit = NULL;
+    objecter->_unregister_linger(op->linger_id);
+  }
+  objecter->rwlock.put_write();
+
+  if (onack) {
+    onack->complete(-ENOENT);
+  }
+  if (oncommit) {
+    oncommit->complete(-ENOENT);
   }
   op->put();
 }
@@ -678,12 +738,20 @@ void Objecter::linger_cancel_map_check(LingerOp *op)
   }
 }
 
-Objecter::OSDSession *Objecter::get_session(int osd)
+Objecter::OSDSession *Objecter::lookup_session(int osd)
 {
   map<int,OSDSession*>::iterator p = osd_sessions.find(osd);
   if (p != osd_sessions.end())
     return p->second;
-  OSDSession *s = new OSDSession(osd);
+  return NULL;
+}
+
+Objecter::OSDSession *Objecter::get_session(int osd)
+{
+  OSDSession *s = lookup_session(osd);
+  if (s)
+    return s;
+  s = new OSDSession(osd);
   osd_sessions[osd] = s;
   s->con = messenger->get_connection(osdmap->get_inst(osd));
   logger->inc(l_osdc_osd_session_open);
@@ -713,8 +781,19 @@ void Objecter::close_session(OSDSession *s)
     s->con->put();
     logger->inc(l_osdc_osd_session_close);
   }
-  s->ops.clear();
-  s->linger_ops.clear();
+  // leave its ops homeless, with no acting set, so that the next
+  // recalc_op_target() finds them a new session
+  while (!s->ops.empty()) {
+    Op *op = s->ops.begin()->second;
+    op->acting.clear();
+    session_op_assign(NULL, op);
+  }
+  while (!s->linger_ops.empty()) {
+    LingerOp *info = s->linger_ops.front();
+    info->acting.clear();
+    info->session = NULL;
+    info->session_item.remove_myself();
+  }
   osd_sessions.erase(s->osd);
   delete s;
 
@@ -723,13 +802,18 @@ void Objecter::close_session(OSDSession *s)
 
 void Objecter::wait_for_osd_map()
 {
-  if (osdmap->get_epoch()) return;
+  rwlock.get_write();
+  if (osdmap->get_epoch()) {
+    rwlock.put_write();
+    return;
+  }
   Mutex lock("");
   Cond cond;
   bool done;
   lock.Lock();
   C_SafeCond *context = new C_SafeCond(&lock, &cond, &done, NULL);
   waiting_for_map[0].push_back(pair<Context*, int>(context, 0));
+  rwlock.put_write();
   while (!done)
     cond.Wait(lock);
   lock.Unlock();
@@ -758,8 +842,9 @@ void Objecter::kick_requests(OSDSession *session)
   ldout(cct, 10) << "kick_requests for osd." << session->osd << dendl;
 
   // resend ops
-  for (xlist<Op*>::iterator p = session->ops.begin(); !p.end();) {
-    Op *op = *p;
+  for (map<tid_t,Op*>::iterator p = session->ops.begin();
+       p != session->ops.end(); ) {
+    Op *op = p->second;
     ++p;
     logger->inc(l_osdc_op_resend);
     if (op->should_resend) {
@@ -799,15 +884,21 @@ void Objecter::tick()
   utime_t cutoff = ceph_clock_now(cct);
   cutoff -= cct->_conf->objecter_timeout;  // timeout
 
+  rwlock.get_write();
+
   unsigned laggy_ops = 0;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-       p != ops.end();
-       p++) {
-    Op *op = p->second;
-    if (op->session && op->stamp < cutoff) {
-      ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd << " is laggy" << dendl;
-      toping.insert(op->session);
-      ++laggy_ops;
+  for (map<int,OSDSession*>::iterator s = osd_sessions.begin();
+       s != osd_sessions.end();
+       ++s) {
+    for (map<tid_t,Op*>::iterator p = s->second->ops.begin();
+	 p != s->second->ops.end();
+	 ++p) {
+      Op *op = p->second;
+      if (op->stamp < cutoff) {
+	ldout(cct, 2) << " tid " << p->first << " on osd." << s->first << " is laggy" << dendl;
+	toping.insert(s->second);
+	++laggy_ops;
+      }
     }
   }
   for (map<uint64_t,LingerOp*>::iterator p = linger_ops.begin();
@@ -824,7 +915,7 @@ void Objecter::tick()
   logger->set(l_osdc_op_laggy, laggy_ops);
   logger->set(l_osdc_osd_laggy, toping.size());
 
-  if (num_homeless_ops || !toping.empty())
+  if (!homeless_session->ops.empty() || !toping.empty())
     maybe_request_map();
 
   if (!toping.empty()) {
@@ -836,6 +927,8 @@ void Objecter::tick()
       messenger->send_message(new MPing, (*i)->con);
     }
   }
+
+  rwlock.put_write();
     
   // reschedule
   schedule_tick();
@@ -875,47 +968,83 @@ void Objecter::resend_mon_ops()
 
 tid_t Objecter::op_submit(Op *op)
 {
-  assert(client_lock.is_locked());
   assert(initialized);
 
   assert(op->ops.size() == op->out_bl.size());
   assert(op->ops.size() == op->out_rval.size());
   assert(op->ops.size() == op->out_handler.size());
 
-  // throttle.  before we look at any state, because
-  // take_op_budget() may drop our lock while it blocks.
-  take_op_budget(op);
+  // throttle.  before we take any of our locks, because
+  // take_op_budget() may block.  a resubmitted op keeps its budget.
+  if (!op->budgeted)
+    take_op_budget(op);
 
-  return _op_submit(op);
+  // the read lock is enough unless we need a new session or must
+  // check whether the pool exists
+  tid_t tid;
+  rwlock.get_read();
+  int r = _op_submit(op, false, &tid);
+  rwlock.put_read();
+  if (r == -EAGAIN) {
+    rwlock.get_write();
+    r = _op_submit(op, true, &tid);
+    rwlock.put_write();
+  }
+  assert(r == 0);
+  return tid;
 }
 
-tid_t Objecter::_op_submit(Op *op)
+/*
+ * Submit op with rwlock held, for write if wlocked.  Returns -EAGAIN,
+ * having changed nothing, if the op needs the write lock.  The op may
+ * be completed and freed as soon as we drop the session lock, so the
+ * tid is returned in *ptid.
+ */
+int Objecter::_op_submit(Op *op, bool wlocked, tid_t *ptid)
 {
-  // pick tid
-  tid_t mytid = ++last_tid;
-  op->tid = mytid;
   assert(client_inc >= 0);
 
   // pick target
   bool check_for_latest_map = false;
-  num_homeless_ops++;  // initially; recalc_op_target() will decrement if it finds a target
-  int r = recalc_op_target(op);
-  check_for_latest_map = (r == RECALC_OP_TARGET_POOL_DNE);
+  pg_t pgid;
+  vector<int> acting;
+  int osd;
+  bool used_replica;
+  int r = calc_target(op, &pgid, &acting, &osd, &used_replica);
+  if (r == -ENOENT) {
+    if (!wlocked)
+      return -EAGAIN;
+    check_for_latest_map = true;
+  }
+  OSDSession *s = homeless_session;
+  if (osd >= 0) {
+    s = lookup_session(osd);
+    if (!s) {
+      if (!wlocked)
+	return -EAGAIN;
+      s = get_session(osd);
+    }
+  }
+  if (!check_for_latest_map) {
+    op->pgid = pgid;
+    op->acting = acting;
+    op->used_replica = used_replica;
+  }
 
   // add to gather set(s)
   if (op->onack) {
-    ++num_unacked;
+    num_unacked.inc();
   } else {
     ldout(cct, 20) << " note: not requesting ack" << dendl;
   }
   if (op->oncommit) {
-    ++num_uncommitted;
+    num_uncommitted.inc();
   } else {
     ldout(cct, 20) << " note: not requesting commit" << dendl;
   }
-  ops[op->tid] = op;
+  num_in_flight.inc();
 
-  logger->set(l_osdc_op_active, ops.size());
+  logger->set(l_osdc_op_active, num_in_flight.read());
 
   logger->inc(l_osdc_op);
   if ((op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE)) == (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE))
@@ -960,6 +1089,15 @@ tid_t Objecter::_op_submit(Op *op)
       logger->inc(code);
   }
 
+  assert(op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE));
+
+  // pick tid and add to the session
+  s->lock.Lock();
+  op->tid = last_tid.inc();
+  *ptid = op->tid;
+  s->ops[op->tid] = op;
+  op->session = (s == homeless_session) ? NULL : s;
+
   // send?
   ldout(cct, 10) << "op_submit oid " << op->oid
            << " " << op->oloc 
@@ -967,21 +1105,19 @@ tid_t Objecter::_op_submit(Op *op)
            << " osd." << (op->session ? op->session->osd : -1)
            << dendl;
 
-  assert(op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE));
-
   if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
       osdmap->test_flag(CEPH_OSDMAP_PAUSEWR)) {
-    ldout(cct, 10) << " paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused modify " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_READ) &&
 	     osdmap->test_flag(CEPH_OSDMAP_PAUSERD)) {
-    ldout(cct, 10) << " paused read " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused read " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
 	     osdmap->test_flag(CEPH_OSDMAP_FULL)) {
-    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if (op->session) {
@@ -993,10 +1129,12 @@ tid_t Objecter::_op_submit(Op *op)
   if (check_for_latest_map) {
     op_check_for_latest_map(op);
   }
+  s->lock.Unlock();
 
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read()
+		<< " uncommitted" << dendl;
   
-  return op->tid;
+  return 0;
 }
 
 bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
@@ -1012,69 +1150,126 @@ bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
   return false;      // same primary (tho replicas may have changed)
 }
 
-int Objecter::recalc_op_target(Op *op)
+/*
+ * Work out where op should go in the current map, without changing
+ * anything.  *osd is -1 if the pg has no acting set; returns -ENOENT
+ * if the pool does not exist.
+ */
+int Objecter::calc_target(Op *op, pg_t *pgid, vector<int> *acting, int *osd,
+			  bool *used_replica)
 {
-  vector<int> acting;
-  pg_t pgid = op->pgid;
+  *pgid = op->pgid;
+  *osd = -1;
+  *used_replica = false;
   if (!op->precalc_pgid) {
-    int ret = osdmap->object_locator_to_pg(op->oid, op->oloc, pgid);
+    int ret = osdmap->object_locator_to_pg(op->oid, op->oloc, *pgid);
     if (ret == -ENOENT)
-      return RECALC_OP_TARGET_POOL_DNE;
-  }
-  osdmap->pg_to_acting_osds(pgid, acting);
+      return ret;
+  }
+  osdmap->pg_to_acting_osds(*pgid, *acting);
+  if (acting->empty())
+    return 0;
+
+  bool read = (op->flags & CEPH_OSD_FLAG_READ) && (op->flags & CEPH_OSD_FLAG_WRITE) == 0;
+  if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
+    int p = rand() % acting->size();
+    if (p)
+      *used_replica = true;
+    *osd = (*acting)[p];
+    ldout(cct, 10) << " chose random osd." << *osd << " of " << *acting << dendl;
+  } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
+    // look for a local replica
+    int i;
+    /* loop through the OSD replicas and see if any are local to read from.
+     * We don't need to check the primary since we default to it. (Be
+     * careful to preserve that default, which is why we iterate in reverse
+     * order.) */
+    for (i = acting->size()-1; i > 0; --i) {
+      if (osdmap->get_addr((*acting)[i]).is_same_host(messenger->get_myaddr())) {
+	*used_replica = true;
+	ldout(cct, 10) << " chose local osd." << (*acting)[i] << " of " << *acting << dendl;
+	break;
+      }
+    }
+    *osd = (*acting)[i];
+  } else
+    *osd = (*acting)[0];
+  return 0;
+}
+
+/* rwlock must be held for write */
+int Objecter::recalc_op_target(Op *op)
+{
+  pg_t pgid;
+  vector<int> acting;
+  int osd;
+  bool used_replica;
+  int r = calc_target(op, &pgid, &acting, &osd, &used_replica);
+  if (r == -ENOENT)
+    return RECALC_OP_TARGET_POOL_DNE;
 
   if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica)) {
     op->pgid = pgid;
     op->acting = acting;
+    op->used_replica = used_replica;
     ldout(cct, 10) << "recalc_op_target tid " << op->tid
 	     << " pgid " << pgid << " acting " << acting << dendl;
 
-    OSDSession *s = NULL;
-    op->used_replica = false;
-    if (acting.size()) {
-      int osd;
-      bool read = (op->flags & CEPH_OSD_FLAG_READ) && (op->flags & CEPH_OSD_FLAG_WRITE) == 0;
-      if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
-	int p = rand() % acting.size();
-	if (p)
-	  op->used_replica = true;
-	osd = acting[p];
-	ldout(cct, 10) << " chose random osd." << osd << " of " << acting << dendl;
-      } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
-	// look for a local replica
-	int i;
-	/* loop through the OSD replicas and see if any are local to read from.
-	 * We don't need to check the primary since we default to it. (Be
-         * careful to preserve that default, which is why we iterate in reverse
-         * order.) */
-	for (i = acting.size()-1; i > 0; --i) {
-	  if (osdmap->get_addr(acting[i]).is_same_host(messenger->get_myaddr())) {
-	    op->used_replica = true;
-	    ldout(cct, 10) << " chose local osd." << acting[i] << " of " << acting << dendl;
-	    break;
-	  }
-	}
-	osd = acting[i];
-      } else
-	osd = acting[0];
-      s = get_session(osd);
-    }
-
-    if (op->session != s) {
-      if (!op->session)
-	num_homeless_ops--;
-      op->session_item.remove_myself();
-      op->session = s;
-      if (s)
-	s->ops.push_back(&op->session_item);
-      else
-	num_homeless_ops++;
-    }
+    OSDSession *s = osd >= 0 ? get_session(osd) : NULL;
+    if (op->session != s)
+      session_op_assign(s, op);
     return RECALC_OP_TARGET_NEED_RESEND;
   }
   return RECALC_OP_TARGET_NO_ACTION;
 }
 
+void Objecter::session_op_assign(OSDSession *s, Op *op)
+{
+  session_op_remove(op);
+  if (!s)
+    s = homeless_session;
+  s->ops[op->tid] = op;
+  op->session = (s == homeless_session) ? NULL : s;
+}
+
+/* rwlock held for write, or for read with the op's session locked */
+void Objecter::session_op_remove(Op *op)
+{
+  OSDSession *s = op->session ? op->session : homeless_session;
+  s->ops.erase(op->tid);
+  op->session = NULL;
+}
+
+Objecter::Op *Objecter::find_op(tid_t tid)
+{
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p) {
+    map<tid_t,Op*>::iterator q = p->second->ops.find(tid);
+    if (q != p->second->ops.end())
+      return q->second;
+  }
+  map<tid_t,Op*>::iterator q = homeless_session->ops.find(tid);
+  if (q != homeless_session->ops.end())
+    return q->second;
+  return NULL;
+}
+
+void Objecter::get_all_ops(list<Op*> *ls)
+{
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p)
+    for (map<tid_t,Op*>::iterator q = p->second->ops.begin();
+	 q != p->second->ops.end();
+	 ++q)
+      ls->push_back(q->second);
+  for (map<tid_t,Op*>::iterator q = homeless_session->ops.begin();
+       q != homeless_session->ops.end();
+       ++q)
+    ls->push_back(q->second);
+}
+
 bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
 {
   vector<int> acting;
@@ -1120,14 +1315,14 @@ void Objecter::finish_op(Op *op)
 {
   ldout(cct, 15) << "finish_op " << op->tid << dendl;
 
-  op->session_item.remove_myself();
+  session_op_remove(op);
   if (op->budgeted)
     put_op_budget(op);
   if (op->con)
     op->con->put();
 
-  ops.erase(op->tid);
-  logger->set(l_osdc_op_active, ops.size());
+  num_in_flight.dec();
+  logger->set(l_osdc_op_active, num_in_flight.read());
 
   delete op;
 }
@@ -1208,32 +1403,37 @@ void Objecter::throttle_op(Op *op, int op_budget)
 {
   if (!op_budget)
     op_budget = calc_op_budget(op);
-  if (!op_throttle_bytes.get_or_fail(op_budget)) { //couldn't take right now
-    client_lock.Unlock();
-    op_throttle_bytes.get(op_budget);
-    client_lock.Lock();
-  }
-  if (!op_throttle_ops.get_or_fail(1)) { //couldn't take right now
-    client_lock.Unlock();
-    op_throttle_ops.get(1);
-    client_lock.Lock();
-  }
+  op_throttle_bytes.get(op_budget);
+  op_throttle_ops.get(1);
 }
 
 /* This function DOES put the passed message before returning */
 void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 {
-  assert(client_lock.is_locked());
-  assert(initialized);
   ldout(cct, 10) << "in handle_osd_op_reply" << dendl;
 
   // get pio
   tid_t tid = m->get_tid();
 
-  if (ops.count(tid) == 0) {
+  rwlock.get_read();
+  if (!initialized) {
+    rwlock.put_read();
+    m->put();
+    return;
+  }
+
+  // the op is on the session of the osd that replied, if anywhere
+  OSDSession *s = lookup_session(m->get_source().num());
+  if (s)
+    s->lock.Lock();
+  map<tid_t,Op*>::iterator iter;
+  if (!s || (iter = s->ops.find(tid)) == s->ops.end()) {
     ldout(cct, 7) << "handle_osd_op_reply " << tid
 	    << (m->is_ondisk() ? " ondisk":(m->is_onnvram() ? " onnvram":" ack"))
 	    << " ... stray" << dendl;
+    if (s)
+      s->lock.Unlock();
+    rwlock.put_read();
     m->put();
     return;
   }
@@ -1243,14 +1443,16 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		<< " v " << m->get_version() << " in " << m->get_pg()
 		<< " attempt " << m->get_retry_attempt()
 		<< dendl;
-  Op *op = ops[tid];
+  Op *op = iter->second;
 
   if (m->get_retry_attempt() >= 0) {
     if (m->get_retry_attempt() != (op->attempts - 1)) {
       ldout(cct, 7) << " ignoring reply from attempt " << m->get_retry_attempt()
 		    << " from " << m->get_source_inst()
 		    << "; last attempt " << (op->attempts - 1) << " sent to "
-		    << op->session->con->get_peer_addr() << dendl;
+		    << s->con->get_peer_addr() << dendl;
+      s->lock.Unlock();
+      rwlock.put_read();
       m->put();
       return;
     }
@@ -1268,10 +1470,15 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
   if (rc == -EAGAIN) {
     ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
     if (op->onack)
-      num_unacked--;
+      num_unacked.dec();
     if (op->oncommit)
-      num_uncommitted--;
-    op_submit(op);
+      num_uncommitted.dec();
+    num_in_flight.dec();
+    session_op_remove(op);
+    s->lock.Unlock();
+    rwlock.put_read();
+
+    op_submit(op);  // keeps its budget
     m->put();
     return;
   }
@@ -1290,6 +1497,8 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		  << " != request ops " << op->ops
 		  << " from " << m->get_source_inst() << dendl;
 
+  // handlers are called once we drop our locks
+  list<pair<Context*, int> > handlers;
   vector<bufferlist*>::iterator pb = op->out_bl.begin();
   vector<int*>::iterator pr = op->out_rval.begin();
   vector<Context*>::iterator ph = op->out_handler.begin();
@@ -1307,7 +1516,8 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
       **pr = p->rval;
     if (*ph) {
       ldout(cct, 10) << " op " << i << " handler " << *ph << dendl;
-      (*ph)->complete(p->rval);
+      handlers.push_back(make_pair(*ph, p->rval));
+      *ph = NULL;
     }
   }
 
@@ -1317,14 +1527,14 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     op->version = m->get_version();
     onack = op->onack;
     op->onack = 0;  // only do callback once
-    num_unacked--;
+    num_unacked.dec();
     logger->inc(l_osdc_op_ack);
   }
   if (op->oncommit && (m->is_ondisk() || rc)) {
     ldout(cct, 15) << "handle_osd_op_reply safe" << dendl;
     oncommit = op->oncommit;
     op->oncommit = 0;
-    num_uncommitted--;
+    num_uncommitted.dec();
     logger->inc(l_osdc_op_commit);
   }
 
@@ -1341,10 +1551,17 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     ldout(cct, 15) << "handle_osd_op_reply completed tid " << tid << dendl;
     finish_op(op);
   }
+  s->lock.Unlock();
+  rwlock.put_read();
   
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read()
+		<< " uncommitted" << dendl;
 
   // do callbacks
+  for (list<pair<Context*, int> >::iterator p = handlers.begin();
+       p != handlers.end();
+       ++p)
+    p->first->complete(p->second);
   if (onack) {
     onack->finish(rc);
     delete onack;
@@ -1375,8 +1592,10 @@ void Objecter::list_objects(ListContext *list_context, Context *onfinish) {
     return;
   }
 
+  rwlock.get_read();
   const pg_pool_t *pool = osdmap->get_pg_pool(list_context->pool_id);
   int pg_num = pool->get_pg_num();
+  rwlock.put_read();
 
   if (list_context->starting_pg_num == 0) {     // there can't be zero pgs!
     list_context->starting_pg_num = pg_num;
@@ -1493,7 +1712,7 @@ int Objecter::create_pool_snap(int64_t pool, string& snapName, Context *onfinish
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snapName;
   op->onfinish = onfinish;
@@ -1526,7 +1745,7 @@ int Objecter::allocate_selfmanaged_snap(int64_t pool, snapid_t *psnapid,
   ldout(cct, 10) << "allocate_selfmanaged_snap; pool: " << pool << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   C_SelfmanagedSnap *fin = new C_SelfmanagedSnap(psnapid, onfinish);
   op->onfinish = fin;
@@ -1544,7 +1763,7 @@ int Objecter::delete_pool_snap(int64_t pool, string& snapName, Context *onfinish
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snapName;
   op->onfinish = onfinish;
@@ -1562,7 +1781,7 @@ int Objecter::delete_selfmanaged_snap(int64_t pool, snapid_t snap,
 	   << snap << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->onfinish = onfinish;
   op->pool_op = POOL_OP_DELETE_UNMANAGED_SNAP;
@@ -1581,7 +1800,7 @@ int Objecter::create_pool(string& name, Context *onfinish, uint64_t auid,
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = 0;
   op->name = name;
   op->onfinish = onfinish;
@@ -1601,7 +1820,7 @@ int Objecter::delete_pool(int64_t pool, Context *onfinish)
 
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "delete";
   op->onfinish = onfinish;
@@ -1624,7 +1843,7 @@ int Objecter::change_pool_auid(int64_t pool, Context *onfinish, uint64_t auid)
   ldout(cct, 10) << "change_pool_auid " << pool << " to " << auid << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "change_pool_auid";
   op->onfinish = onfinish;
@@ -1702,7 +1921,7 @@ void Objecter::get_pool_stats(list<string>& pools, map<string,pool_stat_t> *resu
   ldout(cct, 10) << "get_pool_stats " << pools << dendl;
 
   PoolStatOp *op = new PoolStatOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pools = pools;
   op->pool_stats = result;
   op->onfinish = onfinish;
@@ -1755,7 +1974,7 @@ void Objecter::get_fs_stats(ceph_statfs& result, Context *onfinish)
   ldout(cct, 10) << "get_fs_stats" << dendl;
 
   StatfsOp *op = new StatfsOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->stats = &result;
   op->onfinish = onfinish;
   statfs_ops[op->tid] = op;
@@ -1925,13 +2144,12 @@ void Objecter::ms_handle_connect(Connection *con)
 void Objecter::ms_handle_reset(Connection *con)
 {
   if (con->get_peer_type() == CEPH_ENTITY_TYPE_OSD) {
-    //
+    rwlock.get_write();
     int osd = osdmap->identify_osd(con->get_peer_addr());
     if (osd >= 0) {
       ldout(cct, 1) << "ms_handle_reset on osd." << osd << dendl;
-      map<int,OSDSession*>::iterator p = osd_sessions.find(osd);
-      if (p != osd_sessions.end()) {
-	OSDSession *session = p->second;
+      OSDSession *session = lookup_session(osd);
+      if (session) {
 	reopen_session(session);
 	kick_requests(session);
 	maybe_request_map();
@@ -1939,6 +2157,7 @@ void Objecter::ms_handle_reset(Connection *con)
     } else {
       ldout(cct, 10) << "ms_handle_reset on unknown osd addr " << con->get_peer_addr() << dendl;
     }
+    rwlock.put_write();
   }
 }
 
@@ -1953,14 +2172,24 @@ void Objecter::ms_handle_remote_reset(Connection *con)
 
 void Objecter::dump_active()
 {
-  ldout(cct, 20) << "dump_active .. " << num_homeless_ops << " homeless" << dendl;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin(); p != ops.end(); p++) {
-    Op *op = p->second;
+  rwlock.get_write();
+  _dump_active();
+  rwlock.put_write();
+}
+
+void Objecter::_dump_active()
+{
+  ldout(cct, 20) << "dump_active .. " << homeless_session->ops.size() << " homeless" << dendl;
+  list<Op*> all_ops;
+  get_all_ops(&all_ops);
+  for (list<Op*>::iterator p = all_ops.begin(); p != all_ops.end(); ++p) {
+    Op *op = *p;
     ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << (op->session ? op->session->osd : -1)
 	    << "\t" << op->oid << "\t" << op->ops << dendl;
   }
 }
 
+/* client_lock and rwlock (for read) must be held */
 void Objecter::dump_requests(Formatter& fmt) const
 {
   assert(client_lock.is_locked());
@@ -1977,8 +2206,23 @@ void Objecter::dump_requests(Formatter& fmt) const
 void Objecter::dump_ops(Formatter& fmt) const
 {
   fmt.open_array_section("ops");
-  for (hash_map<tid_t,Op*>::const_iterator p = ops.begin();
-       p != ops.end();
+  for (map<int,OSDSession*>::const_iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p) {
+    p->second->lock.Lock();
+    dump_session_ops(p->second, fmt);
+    p->second->lock.Unlock();
+  }
+  homeless_session->lock.Lock();
+  dump_session_ops(homeless_session, fmt);
+  homeless_session->lock.Unlock();
+  fmt.close_section(); // ops array
+}
+
+void Objecter::dump_session_ops(const OSDSession *s, Formatter& fmt) const
+{
+  for (map<tid_t,Op*>::const_iterator p = s->ops.begin();
+       p != s->ops.end();
        ++p) {
     Op *op = p->second;
     fmt.open_object_section("op");
@@ -2003,7 +2247,6 @@ void Objecter::dump_ops(Formatter& fmt) const
 
     fmt.close_section(); // op object
   }
-  fmt.close_section(); // ops array
 }
 
 void Objecter::dump_linger_ops(Formatter& fmt) const
@@ -2097,7 +2340,9 @@ bool Objecter::RequestStateHook::call(std::string command, std::string args, buf
   stringstream ss;
   JSONFormatter formatter(true);
   m_objecter->client_lock.Lock();
+  m_objecter->rwlock.get_read();
   m_objecter->dump_requests(formatter);
+  m_objecter->rwlock.put_read();
   m_objecter->client_lock.Unlock();
   formatter.flush(ss);
   out.append(ss);
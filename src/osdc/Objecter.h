@@ -24,6 +24,8 @@
 
 #include "common/admin_socket.h"
 #include "common/Timer.h"
+#include "common/RWLock.h"
+#include "include/atomic.h"
 
 #include <list>
 #include <map>
@@ -456,6 +458,15 @@ struct ObjectOperation {
     add_call(CEPH_OSD_OP_CALL, cname, method, indata);
   }
 
+  void call(const char *cname, const char *method, bufferlist &indata,
+	    bufferlist *outdata, Context *ctx, int *prval) {
+    add_call(CEPH_OSD_OP_CALL, cname, method, indata);
+    unsigned p = ops.size() - 1;
+    out_handler[p] = ctx;
+    out_bl[p] = outdata;
+    out_rval[p] = prval;
+  }
+
   // watch/notify
   void watch(uint64_t cookie, uint64_t ver, bool set) {
     bufferlist inbl;
@@ -504,6 +515,24 @@ struct ObjectOperation {
 // ----------------
 
 
+/**
+ * Objecter locking
+ *
+ * OSD ops do not need the owner's lock.  rwlock protects the osdmap as
+ * the Objecter sees it, the session table and lingering ops; it is
+ * taken for write when any of those change and for read to submit an
+ * op or handle an op reply.  Each OSDSession has a lock protecting the
+ * ops in flight on it while rwlock is held for read; holding rwlock
+ * for write covers every session.  Op completions are called with none
+ * of these locks held.
+ *
+ * client_lock is the owner's lock.  The owner holds it around
+ * handle_osd_map() and everything other than op submission and
+ * handle_osd_op_reply(), so it may keep reading osdmap directly under
+ * it.  Pool, statfs and pool stat requests to the monitors are still
+ * serialized by it alone, and timer events and map-check callbacks
+ * take it.
+ */
 class Objecter {
  public:  
   Messenger *messenger;
@@ -514,11 +543,12 @@ class Objecter {
   bool initialized;
  
  private:
-  tid_t last_tid;
+  atomic_t last_tid;
   int client_inc;
   uint64_t max_linger_id;
-  int num_unacked;
-  int num_uncommitted;
+  atomic_t num_unacked;
+  atomic_t num_uncommitted;
+  atomic_t num_in_flight;
   int global_op_flags; // flags which are applied to each IO op
   bool keep_balanced_budget;
   bool honor_osdmap_full;
@@ -528,6 +558,7 @@ class Objecter {
   version_t last_seen_osdmap_version;
   version_t last_seen_pgmap_version;
 
+  RWLock rwlock;
   Mutex &client_lock;
   SafeTimer &timer;
 
@@ -560,8 +591,7 @@ public:
   class OSDSession;
 
   struct Op {
-    OSDSession *session;
-    xlist<Op*>::item session_item;
+    OSDSession *session;   // NULL if we have no target yet
     int incarnation;
     
     object_t oid;
@@ -607,7 +637,7 @@ public:
 
     Op(const object_t& o, const object_locator_t& ol, vector<OSDOp>& op,
        int f, Context *ac, Context *co, eversion_t *ov) :
-      session(NULL), session_item(this), incarnation(0),
+      session(NULL), incarnation(0),
       oid(o), oloc(ol),
       used_replica(false), con(NULL),
       snapid(CEPH_NOSNAP),
@@ -836,21 +866,23 @@ public:
 
   // -- osd sessions --
   struct OSDSession {
-    xlist<Op*> ops;
-    xlist<LingerOp*> linger_ops;
+    Mutex lock;
+    map<tid_t,Op*> ops;
+    xlist<LingerOp*> linger_ops;  // protected by rwlock
     int osd;
     int incarnation;
     Connection *con;
 
-    OSDSession(int o) : osd(o), incarnation(0), con(NULL) {}
+    OSDSession(int o) :
+      lock("Objecter::OSDSession::lock"),
+      osd(o), incarnation(0), con(NULL) {}
   };
   map<int,OSDSession*> osd_sessions;
 
 
  private:
-  // pending ops
-  hash_map<tid_t,Op*>       ops;
-  int                       num_homeless_ops;
+  // pending ops; those without a target live in homeless_session
+  OSDSession                *homeless_session;
   map<uint64_t, LingerOp*>  linger_ops;
   map<tid_t,PoolStatOp*>    poolstat_ops;
   map<tid_t,StatfsOp*>      statfs_ops;
@@ -872,12 +904,21 @@ public:
     RECALC_OP_TARGET_NEED_RESEND,
     RECALC_OP_TARGET_POOL_DNE,
   };
+  int calc_target(Op *op, pg_t *pgid, vector<int> *acting, int *osd,
+		  bool *used_replica);
   int recalc_op_target(Op *op);
   bool recalc_linger_op_target(LingerOp *op);
 
+  /// move op to session s (NULL for homeless); rwlock held for write
+  void session_op_assign(OSDSession *s, Op *op);
+  void session_op_remove(Op *op);
+  Op *find_op(tid_t tid);
+  void get_all_ops(list<Op*> *ls);
+
   void send_linger(LingerOp *info);
   void _linger_ack(LingerOp *info, int r);
   void _linger_commit(LingerOp *info, int r);
+  void _unregister_linger(uint64_t linger_id);
 
   void op_check_for_latest_map(Op *op);
   void op_cancel_map_check(Op *op);
@@ -886,6 +927,7 @@ public:
 
   void kick_requests(OSDSession *session);
 
+  OSDSession *lookup_session(int osd);
   OSDSession *get_session(int osd);
   void reopen_session(OSDSession *session);
   void close_session(OSDSession *session);
@@ -899,7 +941,7 @@ public:
    * handle a budget for in-flight ops
    * budget is taken whenever an op goes into the ops map
    * and returned whenever an op is removed from the map
-   * If throttle_op needs to throttle it will unlock client_lock.
+   * throttle_op may block, so it is called without any of our locks.
    */
   int calc_op_budget(Op *op);
   void throttle_op(Op *op, int op_size=0);
@@ -927,15 +969,16 @@ public:
     messenger(m), monc(mc), osdmap(om), cct(cct_),
     initialized(false),
     last_tid(0), client_inc(-1), max_linger_id(0),
-    num_unacked(0), num_uncommitted(0),
+    num_unacked(0), num_uncommitted(0), num_in_flight(0),
     global_op_flags(0),
     keep_balanced_budget(false), honor_osdmap_full(true),
     last_seen_osdmap_version(0),
     last_seen_pgmap_version(0),
+    rwlock("Objecter::rwlock"),
     client_lock(l), timer(t),
     logger(NULL), tick_event(NULL),
     m_request_state_hook(NULL),
-    num_homeless_ops(0),
+    homeless_session(new OSDSession(-1)),
     op_throttle_bytes(cct, "objecter_bytes", cct->_conf->objecter_inflight_op_bytes),
     op_throttle_ops(cct, "objecter_ops", cct->_conf->objecter_inflight_ops)
   { }
@@ -943,6 +986,7 @@ public:
     assert(!tick_event);
     assert(!m_request_state_hook);
     assert(!logger);
+    delete homeless_session;
   }
 
   void init();
@@ -950,10 +994,10 @@ public:
 
   /**
    * Tell the objecter to throttle outgoing ops according to its
-   * budget (in _conf). If you do this, ops can block, in
-   * which case it will unlock client_lock and sleep until
-   * incoming messages reduce the used budget low enough for
-   * the ops to continue going; then it will lock client_lock again.
+   * budget (in _conf). If you do this, ops can block until
+   * incoming replies reduce the used budget low enough for the
+   * ops to continue going, so the caller must not hold a lock that
+   * the reply path needs.
    */
   void set_balanced_budget() { keep_balanced_budget = true; }
   void unset_balanced_budget() { keep_balanced_budget = false; }
@@ -971,20 +1015,26 @@ public:
 private:
   // low-level
   tid_t op_submit(Op *op);
-  tid_t _op_submit(Op *op);
+  int _op_submit(Op *op, bool wlocked, tid_t *ptid);
 
   // public interface
  public:
   bool is_active() {
-    return !(ops.empty() && linger_ops.empty() && poolstat_ops.empty() && statfs_ops.empty());
+    rwlock.get_read();
+    bool active = num_in_flight.read() || !linger_ops.empty() ||
+      !poolstat_ops.empty() || !statfs_ops.empty();
+    rwlock.put_read();
+    return active;
   }
 
   /**
    * Output in-flight requests
    */
   void dump_active();
+  void _dump_active();
   void dump_requests(Formatter& fmt) const;
   void dump_ops(Formatter& fmt) const;
+  void dump_session_ops(const OSDSession *s, Formatter& fmt) const;
   void dump_linger_ops(Formatter& fmt) const;
   void dump_pool_ops(Formatter& fmt) const;
   void dump_pool_stat_ops(Formatter& fmt) const;
@@ -994,9 +1044,16 @@ private:
   void set_client_incarnation(int inc) { client_inc = inc; }
 
   void wait_for_new_map(Context *c, epoch_t epoch, int replyCode=0) {
+    rwlock.get_write();
+    _wait_for_new_map(c, epoch, replyCode);
+    rwlock.put_write();
+  }
+private:
+  void _wait_for_new_map(Context *c, epoch_t epoch, int replyCode=0) {
     maybe_request_map(epoch);
     waiting_for_map[epoch].push_back(pair<Context *, int>(c, replyCode));
   }
+public:
 
   /** Get the current set of global op flags */
   int get_global_op_flags() { return global_op_flags; }
@@ -1014,6 +1071,8 @@ private:
     o->priority = op.priority;
     o->mtime = mtime;
     o->snapc = snapc;
+    o->out_rval.swap(op.out_rval);
+    o->out_handler.swap(op.out_handler);
     return op_submit(o);
   }
   tid_t read(const object_t& oid, const object_locator_t& oloc,
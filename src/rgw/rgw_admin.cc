@@ -46,6 +46,8 @@ void _usage()
   cerr << "  bucket unlink              unlink bucket from specified user\n";
   cerr << "  bucket stats               returns bucket statistics\n";
   cerr << "  bucket info                show bucket information\n";
+  cerr << "  bucket reshard             split the bucket index across --num-shards objects\n";
+  cerr << "                             (stop writes to the bucket first)\n";
   cerr << "  pool add                   add an existing pool for data placement\n";
   cerr << "  pool rm                    remove an existing pool from data placement set\n";
   cerr << "  pools list                 list placement active set\n";
@@ -78,6 +80,8 @@ void _usage()
   cerr << "   --start-date=<date>\n";
   cerr << "   --end-date=<date>\n";
   cerr << "   --bucket-id=<bucket-id>\n";
+  cerr << "   --num-shards=<num>        number of bucket index shards, 0 for a single\n";
+  cerr << "                             index object\n";
   cerr << "   --format=<format>         specify output format for certain operations: xml,\n";
   cerr << "                             json\n";
   cerr << "   --purge-data              when specified, user removal will also purge all the\n";
@@ -124,6 +128,7 @@ enum {
   OPT_BUCKET_LINK,
   OPT_BUCKET_UNLINK,
   OPT_BUCKET_STATS,
+  OPT_BUCKET_RESHARD,
   OPT_POLICY,
   OPT_POOL_ADD,
   OPT_POOL_RM,
@@ -253,6 +258,8 @@ static int get_cmd(const char *cmd, const char *prev_cmd, bool *need_more)
       return OPT_BUCKET_UNLINK;
     if (strcmp(cmd, "stats") == 0)
       return OPT_BUCKET_STATS;
+    if (strcmp(cmd, "reshard") == 0)
+      return OPT_BUCKET_RESHARD;
   } else if (strcmp(prev_cmd, "log") == 0) {
     if (strcmp(cmd, "list") == 0)
       return OPT_LOG_LIST;
@@ -588,6 +595,7 @@ int main(int argc, char **argv)
   int purge_keys = false;
   int yes_i_really_mean_it = false;
   int max_buckets = -1;
+  int num_shards = -1;
 
   std::string val;
   std::ostringstream errs;
@@ -644,6 +652,8 @@ int main(int argc, char **argv)
       auid = tmp;
     } else if (ceph_argparse_witharg(args, i, &val, "--max-buckets", (char*)NULL)) {
       max_buckets = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--num-shards", (char*)NULL)) {
+      num_shards = atoi(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--date", "--time", (char*)NULL)) {
       date = val;
       if (end_date.empty())
@@ -1094,6 +1104,64 @@ int main(int argc, char **argv)
     return -r;
   }
 
+  if (opt_cmd == OPT_BUCKET_RESHARD) {
+    if (bucket_name.empty()) {
+      cerr << "bucket name was not specified" << std::endl;
+      return usage();
+    }
+    if (num_shards < 0) {
+      cerr << "number of shards was not specified" << std::endl;
+      return usage();
+    }
+
+    RGWBucketInfo info;
+    map<string, bufferlist> attrs;
+    int r = rgwstore->get_bucket_info(NULL, bucket_name, info, &attrs);
+    if (r < 0) {
+      cerr << "could not get bucket info for bucket=" << bucket_name << std::endl;
+      return -r;
+    }
+    if (info.bucket.num_shards == (uint32_t)num_shards) {
+      cerr << "bucket index already has " << num_shards << " shards" << std::endl;
+      return 0;
+    }
+
+    rgw_bucket old_bucket = info.bucket;
+    info.bucket.num_shards = num_shards;
+    r = rgwstore->copy_bucket_index(old_bucket, info.bucket);
+    if (r < 0) {
+      cerr << "error copying bucket index: " << cpp_strerror(-r) << std::endl;
+      rgwstore->remove_bucket_index(info.bucket);
+      return -r;
+    }
+    r = rgwstore->put_bucket_info(bucket_name, info, false, &attrs);
+    if (r < 0) {
+      cerr << "error updating bucket info: " << cpp_strerror(-r) << std::endl;
+      rgwstore->remove_bucket_index(info.bucket);
+      return -r;
+    }
+
+    // the owner's bucket list keeps its own copy of the bucket for stats
+    RGWUserBuckets buckets;
+    r = rgw_read_user_buckets(info.owner, buckets, false);
+    if (r >= 0) {
+      map<string, RGWBucketEnt>& m = buckets.get_buckets();
+      map<string, RGWBucketEnt>::iterator iter = m.find(bucket_name);
+      if (iter != m.end())
+        r = rgw_add_bucket(info.owner, info.bucket, iter->second.mtime);
+    }
+    if (r < 0)
+      cerr << "WARNING: could not update bucket list of user " << info.owner
+           << ": " << cpp_strerror(-r) << std::endl;
+
+    r = rgwstore->remove_bucket_index(old_bucket);
+    if (r < 0) {
+      cerr << "error removing old bucket index: " << cpp_strerror(-r) << std::endl;
+      return -r;
+    }
+    return 0;
+  }
+
   if (opt_cmd == OPT_TEMP_REMOVE) {
     if (date.empty()) {
       cerr << "date wasn't specified" << std::endl;
@@ -0,0 +1,86 @@
+#include <errno.h>
+#include <stdio.h>
+
+#include "include/ceph_hash.h"
+
+#include "rgw_bucket_index.h"
+
+static string dir_oid_prefix = ".dir.";
+
+string rgw_bucket_index_oid(const rgw_bucket& bucket, uint32_t shard)
+{
+  string oid = dir_oid_prefix;
+  oid.append(bucket.marker);
+  if (bucket.num_shards) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), ".%u.%u", bucket.num_shards, shard);
+    oid.append(buf);
+  }
+  return oid;
+}
+
+uint32_t rgw_bucket_index_shard(const rgw_bucket& bucket, const string& name)
+{
+  if (!bucket.num_shards)
+    return 0;
+  return ceph_str_hash_linux(name.c_str(), name.size()) % bucket.num_shards;
+}
+
+void rgw_bucket_index_oids(const rgw_bucket& bucket, vector<string>& oids)
+{
+  uint32_t n = bucket.num_shards ? bucket.num_shards : 1;
+  oids.clear();
+  for (uint32_t i = 0; i < n; i++)
+    oids.push_back(rgw_bucket_index_oid(bucket, i));
+}
+
+bool rgw_merge_bucket_list(vector<struct rgw_cls_list_ret>& rets, uint32_t num,
+                           map<string, uint32_t>& merged)
+{
+  bool truncated = false;
+  merged.clear();
+  for (uint32_t i = 0; i < rets.size(); i++) {
+    if (rets[i].is_truncated)
+      truncated = true;
+    map<string, struct rgw_bucket_dir_entry>& dm = rets[i].dir.m;
+    for (map<string, struct rgw_bucket_dir_entry>::iterator diter = dm.begin(); diter != dm.end(); ++diter)
+      merged[diter->first] = i;
+  }
+  if (merged.size() > num) {
+    truncated = true;
+    map<string, uint32_t>::iterator miter = merged.begin();
+    for (uint32_t i = 0; i < num; i++)
+      ++miter;
+    merged.erase(miter, merged.end());
+  }
+  return truncated;
+}
+
+int rgw_reshard_index_entries(const rgw_bucket& dst, map<string, bufferlist>& vals,
+                              vector<map<string, bufferlist> >& batch,
+                              vector<struct rgw_bucket_dir_header>& headers,
+                              string *bad)
+{
+  batch.clear();
+  batch.resize(headers.size());
+  for (map<string, bufferlist>::iterator viter = vals.begin(); viter != vals.end(); ++viter) {
+    struct rgw_bucket_dir_entry entry;
+    try {
+      bufferlist::iterator eiter = viter->second.begin();
+      ::decode(entry, eiter);
+    } catch (buffer::error& err) {
+      if (bad)
+        *bad = viter->first;
+      return -EIO;
+    }
+    uint32_t shard = rgw_bucket_index_shard(dst, viter->first);
+    if (entry.exists) {
+      struct rgw_bucket_category_stats& stats = headers[shard].stats[entry.meta.category];
+      stats.num_entries++;
+      stats.total_size += entry.meta.size;
+      stats.total_size_rounded += cls_rgw_get_rounded_size(entry.meta.size);
+    }
+    batch[shard][viter->first].claim(viter->second);
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef CEPH_RGW_BUCKET_INDEX_H
+#define CEPH_RGW_BUCKET_INDEX_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "include/types.h"
+#include "rgw_common.h"
+#include "rgw_cls_api.h"
+
+/*
+ * A bucket with num_shards == 0 keeps its whole index in .dir.<marker>.
+ * Otherwise entries are spread over .dir.<marker>.<num_shards>.<shard>
+ * by hash of the entry name; the shard count is part of the name so that
+ * a reshard never writes into an object of the layout it replaces.
+ */
+extern string rgw_bucket_index_oid(const rgw_bucket& bucket, uint32_t shard);
+extern uint32_t rgw_bucket_index_shard(const rgw_bucket& bucket, const string& name);
+extern void rgw_bucket_index_oids(const rgw_bucket& bucket, vector<string>& oids);
+
+/**
+ * Merge the bucket_list replies of every shard, given in shard order.
+ * Each shard returned its own first num entries after the same start, so
+ * the first num entries of their union are the first num of the bucket.
+ *
+ * @param rets the decoded replies
+ * @param num the number of entries that was asked for
+ * @param merged [out] the first num entry names, each with its shard
+ * @return true if the bucket has more entries after the last one merged
+ */
+extern bool rgw_merge_bucket_list(vector<struct rgw_cls_list_ret>& rets, uint32_t num,
+                                  map<string, uint32_t>& merged);
+
+/**
+ * Route a batch of raw index entries into the shards of dst and add the
+ * ones that exist to the stats of the shard they go to.
+ *
+ * @param dst the bucket with the layout being copied into
+ * @param vals the entries, as omap keys and values; they are claimed
+ * @param batch [out] the entries per dst shard, sized to its shard count
+ * @param headers [in,out] the dst shard headers being rebuilt
+ * @param bad [out] the key of an entry that failed to decode
+ * @return 0 on success, -EIO if an entry could not be decoded
+ */
+extern int rgw_reshard_index_entries(const rgw_bucket& dst, map<string, bufferlist>& vals,
+                                     vector<map<string, bufferlist> >& batch,
+                                     vector<struct rgw_bucket_dir_header>& headers,
+                                     string *bad);
+
+#endif
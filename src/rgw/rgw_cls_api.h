@@ -13,6 +13,14 @@
 #define CEPH_RGW_UPDATE 'u'
 #define CEPH_RGW_TAG_TIMEOUT 60*60*24
 
+#define CEPH_RGW_ROUND_BLOCK_SIZE 4096
+
+/* space an entry is accounted for in total_size_rounded */
+static inline uint64_t cls_rgw_get_rounded_size(uint64_t size)
+{
+  return (size + CEPH_RGW_ROUND_BLOCK_SIZE - 1) & ~(uint64_t)(CEPH_RGW_ROUND_BLOCK_SIZE - 1);
+}
+
 enum RGWPendingState {
   CLS_RGW_STATE_PENDING_MODIFY = 0,
   CLS_RGW_STATE_COMPLETE       = 1,
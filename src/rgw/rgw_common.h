@@ -440,33 +440,36 @@ struct rgw_bucket {
   std::string pool;
   std::string marker;
   std::string bucket_id;
+  uint32_t num_shards;  // index objects; 0 means the single .dir.<marker>
 
-  rgw_bucket() { }
-  rgw_bucket(const char *n) : name(n) {
+  rgw_bucket() : num_shards(0) { }
+  rgw_bucket(const char *n) : name(n), num_shards(0) {
     assert(*n == '.'); // only rgw private buckets should be initialized without pool
     pool = n;
     marker = "";
   }
   rgw_bucket(const char *n, const char *p, const char *m, const char *id) :
-    name(n), pool(p), marker(m), bucket_id(id) {}
+    name(n), pool(p), marker(m), bucket_id(id), num_shards(0) {}
 
   void clear() {
     name = "";
     pool = "";
     marker = "";
     bucket_id = "";
+    num_shards = 0;
   }
 
   void encode(bufferlist& bl) const {
-     ENCODE_START(4, 3, bl);
+     ENCODE_START(5, 3, bl);
     ::encode(name, bl);
     ::encode(pool, bl);
     ::encode(marker, bl);
     ::encode(bucket_id, bl);
+    ::encode(num_shards, bl);
     ENCODE_FINISH(bl);
   }
   void decode(bufferlist::iterator& bl) {
-    DECODE_START_LEGACY_COMPAT_LEN(4, 3, 3, bl);
+    DECODE_START_LEGACY_COMPAT_LEN(5, 3, 3, bl);
     ::decode(name, bl);
     ::decode(pool, bl);
     if (struct_v >= 2) {
@@ -481,6 +484,10 @@ struct rgw_bucket {
         ::decode(bucket_id, bl);
       }
     }
+    if (struct_v >= 5)
+      ::decode(num_shards, bl);
+    else
+      num_shards = 0;
     DECODE_FINISH(bl);
   }
   void dump(Formatter *f) const;
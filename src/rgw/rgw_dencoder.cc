@@ -765,6 +765,9 @@ void rgw_bucket::generate_test_instances(list<rgw_bucket*>& o)
 {
   rgw_bucket *b = new rgw_bucket("name", "pool", "marker", "123");
   o.push_back(b);
+  b = new rgw_bucket("name", "pool", "marker", "124");
+  b->num_shards = 8;
+  o.push_back(b);
   o.push_back(new rgw_bucket);
 }
 
@@ -774,6 +777,7 @@ void rgw_bucket::dump(Formatter *f) const
   f->dump_string("pool", pool);
   f->dump_string("marker", marker);
   f->dump_string("bucket_id", bucket_id);
+  f->dump_unsigned("num_shards", num_shards);
 }
 
 void RGWBucketInfo::generate_test_instances(list<RGWBucketInfo*>& o)
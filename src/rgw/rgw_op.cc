@@ -342,6 +342,11 @@ void RGWGetObj::execute()
 
   perfcounter->inc(l_rgw_get_b, end - ofs);
 
+  ret = read_ahead(&handle, start_time);
+  if (ret < 0)
+    goto done;
+
+  // whatever is left after a race with an overwrite is read one chunk at a time
   while (ofs <= end) {
     ret = rgwstore->get_obj(s->obj_ctx, &handle, obj, bl, ofs, end);
     if (ret < 0) {
@@ -358,6 +363,7 @@ void RGWGetObj::execute()
     start_time = ceph_clock_now(s->cct);
   }
 
+  rgwstore->finish_get_obj(&handle);
   return;
 
 done:
@@ -365,6 +371,89 @@ done:
   rgwstore->finish_get_obj(&handle);
 }
 
+struct get_obj_aio_info {
+  void *handle;
+  off_t ofs;
+  uint64_t len;
+  bufferlist bl;
+
+  get_obj_aio_info() : handle(NULL), ofs(0), len(0) {}
+};
+
+static void drain_get_obj_aio(list<struct get_obj_aio_info>& pending)
+{
+  while (!pending.empty()) {
+    if (pending.front().handle)
+      rgwstore->aio_wait(pending.front().handle);
+    pending.pop_front();
+  }
+}
+
+/*
+ * Send the object to the client while keeping up to
+ * rgw_get_obj_window_size bytes of the following chunks in flight, so
+ * that a large object costs one round trip per window rather than one
+ * per chunk.  Chunks are sent in order as they complete.  Returns with
+ * ofs at the first byte not yet sent, which is end + 1 unless the head
+ * raced with an overwrite, and leaves the rest to the plain get_obj
+ * loop.
+ */
+int RGWGetObj::read_ahead(void **handle, utime_t& start_time)
+{
+  list<struct get_obj_aio_info> pending;
+  uint64_t window = s->cct->_conf->rgw_get_obj_window_size;
+  uint64_t pending_len = 0;
+  off_t read_ofs = ofs;
+  int r;
+
+  while (ofs <= end) {
+    while (read_ofs <= end && (pending.empty() || pending_len < window)) {
+      pending.push_back(get_obj_aio_info());
+      struct get_obj_aio_info& info = pending.back();
+      info.ofs = read_ofs;
+      r = rgwstore->aio_get_obj(s->obj_ctx, handle, obj, &info.bl, read_ofs, end, &info.handle);
+      if (r <= 0) {
+        pending.pop_back();
+        drain_get_obj_aio(pending);
+        return (r < 0 ? r : -EIO);
+      }
+      info.len = r;
+      read_ofs += r;
+      pending_len += r;
+    }
+
+    struct get_obj_aio_info& info = pending.front();
+    r = 0;
+    if (info.handle) {
+      r = rgwstore->aio_wait(info.handle);
+      info.handle = NULL;
+    }
+    if (r == -ECANCELED || (r >= 0 && info.bl.length() != info.len)) {
+      ldout(s->cct, 0) << "NOTICE: RGWGetObj::read_ahead: object changed under read at ofs=" << ofs
+                       << ", falling back to synchronous reads" << dendl;
+      drain_get_obj_aio(pending);
+      return 0;
+    }
+    if (r < 0) {
+      drain_get_obj_aio(pending);
+      return r;
+    }
+
+    len = info.len;
+    ofs += len;
+    pending_len -= len;
+    ret = 0;
+
+    perfcounter->finc(l_rgw_get_lat,
+                     (ceph_clock_now(s->cct) - start_time));
+    send_response(info.bl);
+    start_time = ceph_clock_now(s->cct);
+    pending.pop_front();
+  }
+
+  return 0;
+}
+
 int RGWGetObj::init_common()
 {
   if (range_str) {
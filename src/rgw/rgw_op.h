@@ -69,6 +69,7 @@ protected:
   rgw_obj obj;
 
   int init_common();
+  int read_ahead(void **handle, utime_t& start_time);
 public:
   RGWGetObj() {}
 
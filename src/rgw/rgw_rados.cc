@@ -9,10 +9,12 @@
 #include "rgw_acl.h"
 
 #include "rgw_cls_api.h"
+#include "rgw_bucket_index.h"
 
 #include "rgw_tools.h"
 
 #include "common/Clock.h"
+#include "include/ceph_hash.h"
 
 #include "include/rados/librados.hpp"
 using namespace librados;
@@ -40,7 +42,6 @@ RGWRados* RGWRados::store;
 
 static string notify_oid = "notify";
 static string shadow_ns = "shadow";
-static string dir_oid_prefix = ".dir.";
 static string default_storage_pool = ".rgw.buckets";
 static string avail_pools = ".pools.avail";
 
@@ -48,6 +49,7 @@ static rgw_bucket pi_buckets_rados = RGW_ROOT_BUCKET;
 
 
 static RGWObjCategory shadow_category = RGW_OBJ_CATEGORY_SHADOW;
+
 static RGWObjCategory main_category = RGW_OBJ_CATEGORY_MAIN;
 
 #define RGW_USAGE_OBJ_PREFIX "usage."
@@ -617,15 +619,18 @@ int RGWRados::create_bucket(string& owner, rgw_bucket& bucket,
     snprintf(buf, sizeof(buf), "%llu.%llu", (long long)iid, (long long)bid); 
     bucket.marker = buf;
     bucket.bucket_id = bucket.marker;
-
-    string dir_oid =  dir_oid_prefix;
-    dir_oid.append(bucket.marker);
-
-    librados::ObjectWriteOperation op;
-    op.create(true);
-    r = cls_rgw_init_index(io_ctx, op, dir_oid);
-    if (r < 0 && r != -EEXIST)
-      return r;
+    int shards = cct->_conf->rgw_bucket_index_shards;
+    bucket.num_shards = shards > 0 ? shards : 0;
+
+    vector<string> dir_oids;
+    rgw_bucket_index_oids(bucket, dir_oids);
+    for (vector<string>::iterator iter = dir_oids.begin(); iter != dir_oids.end(); ++iter) {
+      librados::ObjectWriteOperation op;
+      op.create(true);
+      r = cls_rgw_init_index(io_ctx, op, *iter);
+      if (r < 0 && r != -EEXIST)
+        return r;
+    }
 
     RGWBucketInfo info;
     info.bucket = bucket;
@@ -1180,16 +1185,113 @@ int RGWRados::delete_bucket(rgw_bucket& bucket)
   if (r < 0)
     return r;
 
-  ObjectWriteOperation op;
-  op.remove();
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
-  librados::AioCompletion *completion = rados->aio_create_completion(NULL, NULL, NULL);
-  r = list_ctx.aio_operate(oid, completion, &op);
-  completion->release();
+  return remove_bucket_index(bucket);
+}
+
+/**
+ * Remove every index object of the bucket's current layout.
+ * The removals are sent off without waiting for them.
+ */
+int RGWRados::remove_bucket_index(rgw_bucket& bucket)
+{
+  librados::IoCtx io_ctx;
+  int r = open_bucket_ctx(bucket, io_ctx);
   if (r < 0)
     return r;
 
+  vector<string> oids;
+  rgw_bucket_index_oids(bucket, oids);
+  for (vector<string>::iterator iter = oids.begin(); iter != oids.end(); ++iter) {
+    ObjectWriteOperation op;
+    op.remove();
+    librados::AioCompletion *completion = rados->aio_create_completion(NULL, NULL, NULL);
+    r = io_ctx.aio_operate(*iter, completion, &op);
+    completion->release();
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+/**
+ * Copy the index of src into the layout of dst, which must be the same
+ * bucket with a different num_shards.  Entries are copied as they are
+ * and each new shard's header is rebuilt from the entries it receives.
+ * The caller switches the bucket info over to dst and then removes the
+ * old index; nothing may write to the bucket in the meantime or the
+ * update is lost.
+ */
+int RGWRados::copy_bucket_index(rgw_bucket& src, rgw_bucket& dst)
+{
+  if (src.marker.empty() || src.marker != dst.marker ||
+      src.num_shards == dst.num_shards)
+    return -EINVAL;
+
+  librados::IoCtx io_ctx;
+  int r = open_bucket_ctx(src, io_ctx);
+  if (r < 0)
+    return r;
+
+  vector<string> src_oids, dst_oids;
+  rgw_bucket_index_oids(src, src_oids);
+  rgw_bucket_index_oids(dst, dst_oids);
+
+  // start over from anything an interrupted reshard left behind
+  for (vector<string>::iterator iter = dst_oids.begin(); iter != dst_oids.end(); ++iter) {
+    r = io_ctx.remove(*iter);
+    if (r < 0 && r != -ENOENT)
+      return r;
+    librados::ObjectWriteOperation op;
+    op.create(true);
+    r = cls_rgw_init_index(io_ctx, op, *iter);
+    if (r < 0)
+      return r;
+  }
+
+  vector<struct rgw_bucket_dir_header> headers(dst_oids.size());
+  uint64_t count = 0;
+  for (vector<string>::iterator iter = src_oids.begin(); iter != src_oids.end(); ++iter) {
+    string marker;
+    bool done = false;
+    while (!done) {
+#define RESHARD_BATCH 1000
+      map<string, bufferlist> vals;
+      r = io_ctx.omap_get_vals(*iter, marker, RESHARD_BATCH, &vals);
+      if (r < 0)
+        return r;
+      done = (vals.size() < RESHARD_BATCH);
+      if (vals.empty())
+        break;
+      marker = vals.rbegin()->first;
+
+      vector<map<string, bufferlist> > batch;
+      string bad;
+      r = rgw_reshard_index_entries(dst, vals, batch, headers, &bad);
+      if (r < 0) {
+        ldout(cct, 0) << "ERROR: failed to decode index entry " << bad << " in " << *iter << dendl;
+        return r;
+      }
+      for (uint32_t i = 0; i < batch.size(); i++) {
+        if (batch[i].empty())
+          continue;
+        r = io_ctx.omap_set(dst_oids[i], batch[i]);
+        if (r < 0)
+          return r;
+      }
+      count += vals.size();
+    }
+  }
+
+  for (uint32_t i = 0; i < dst_oids.size(); i++) {
+    bufferlist bl;
+    ::encode(headers[i], bl);
+    r = io_ctx.omap_set_header(dst_oids[i], bl);
+    if (r < 0)
+      return r;
+  }
+
+  ldout(cct, 10) << "copy_bucket_index " << src << " copied " << count << " entries from "
+                 << src_oids.size() << " to " << dst_oids.size() << " index objects" << dendl;
   return 0;
 }
 
@@ -2057,37 +2159,39 @@ int RGWRados::clone_objs(void *ctx, rgw_obj& dst_obj,
 }
 
 
-int RGWRados::get_obj(void *ctx, void **handle, rgw_obj& obj,
-                      bufferlist& bl, off_t ofs, off_t end)
+/**
+ * Work out where the next chunk of obj at ofs comes from: the head
+ * object itself, or the manifest part covering ofs.  Points io_ctx's
+ * locator at it and, when reading the head, adds the atomic test to op.
+ * Shared by get_obj() and aio_get_obj().
+ *
+ * @param actual_obj Output param: the rados object to read.
+ * @param read_ofs, len Output params: the range to read from it, at most
+ * RGW_MAX_CHUNK_SIZE.
+ * @param pstate Output param: obj's state.
+ */
+int RGWRados::prepare_get_obj_read(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io_ctx,
+                                   off_t ofs, off_t end, ObjectReadOperation& op,
+                                   string& actual_obj, uint64_t *read_ofs, uint64_t *len,
+                                   RGWObjState **pstate)
 {
   rgw_bucket bucket;
-  std::string oid, key;
+  std::string key;
   rgw_obj read_obj = obj;
-  uint64_t read_ofs = ofs;
-  uint64_t len;
-  RGWRadosCtx *rctx = (RGWRadosCtx *)ctx;
-  RGWRadosCtx *new_ctx = NULL;
   bool reading_from_head = true;
-  ObjectReadOperation op;
 
-  GetObjState *state = *(GetObjState **)handle;
-  RGWObjState *astate = NULL;
+  get_obj_bucket_and_oid_key(obj, bucket, actual_obj, key);
 
-  get_obj_bucket_and_oid_key(obj, bucket, oid, key);
-
-  if (!rctx) {
-    new_ctx = new RGWRadosCtx();
-    rctx = new_ctx;
-  }
-
-  int r = get_obj_state(rctx, obj, state->io_ctx, oid, &astate);
+  int r = get_obj_state(rctx, obj, io_ctx, actual_obj, pstate);
   if (r < 0)
-    goto done_ret;
+    return r;
+  RGWObjState *astate = *pstate;
 
+  *read_ofs = ofs;
   if (end < 0)
-    len = 0;
+    *len = 0;
   else
-    len = end - ofs + 1;
+    *len = end - ofs + 1;
 
   if (astate->has_manifest) {
     /* now get the relevant object part */
@@ -2101,28 +2205,55 @@ int RGWRados::get_obj(void *ctx, void **handle, rgw_obj& obj,
     RGWObjManifestPart& part = iter->second;
     uint64_t part_ofs = iter->first;
     read_obj = part.loc;
-    len = min(len, part.size - (ofs - part_ofs));
-    read_ofs = part.loc_ofs + (ofs - part_ofs);
+    *len = min(*len, part.size - (ofs - part_ofs));
+    *read_ofs = part.loc_ofs + (ofs - part_ofs);
     reading_from_head = (read_obj == obj);
 
     if (!reading_from_head) {
-      get_obj_bucket_and_oid_key(read_obj, bucket, oid, key);
+      get_obj_bucket_and_oid_key(read_obj, bucket, actual_obj, key);
     }
   }
 
-  if (len > RGW_MAX_CHUNK_SIZE)
-    len = RGW_MAX_CHUNK_SIZE;
+  if (*len > RGW_MAX_CHUNK_SIZE)
+    *len = RGW_MAX_CHUNK_SIZE;
 
-
-  state->io_ctx.locator_set_key(key);
+  /* the locator is taken when the read is sent, so aio_get_obj can
+   * change it again for the next part while this one is in flight */
+  io_ctx.locator_set_key(key);
 
   if (reading_from_head) {
     /* only when reading from the head object do we need to do the atomic test */
-    r = append_atomic_test(rctx, read_obj, state->io_ctx, oid, op, &astate);
+    r = append_atomic_test(rctx, read_obj, io_ctx, actual_obj, op, pstate);
     if (r < 0)
-      goto done_ret;
+      return r;
   }
 
+  return 0;
+}
+
+int RGWRados::get_obj(void *ctx, void **handle, rgw_obj& obj,
+                      bufferlist& bl, off_t ofs, off_t end)
+{
+  std::string oid;
+  uint64_t read_ofs;
+  uint64_t len;
+  RGWRadosCtx *rctx = (RGWRadosCtx *)ctx;
+  RGWRadosCtx *new_ctx = NULL;
+  ObjectReadOperation op;
+
+  GetObjState *state = *(GetObjState **)handle;
+  RGWObjState *astate = NULL;
+
+  if (!rctx) {
+    new_ctx = new RGWRadosCtx();
+    rctx = new_ctx;
+  }
+
+  int r = prepare_get_obj_read(rctx, obj, state->io_ctx, ofs, end, op,
+                               oid, &read_ofs, &len, &astate);
+  if (r < 0)
+    goto done_ret;
+
   if (!ofs && astate && astate->data.length() >= len) {
     bl = astate->data;
     goto done;
@@ -2138,7 +2269,7 @@ int RGWRados::get_obj(void *ctx, void **handle, rgw_obj& obj,
     /* a race! object was replaced, we need to set attr on the original obj */
     ldout(cct, 0) << "NOTICE: RGWRados::get_obj: raced with another process, going to the shadow obj instead" << dendl;
     string loc = obj.loc();
-    rgw_obj shadow(bucket, astate->shadow_obj, loc, shadow_ns);
+    rgw_obj shadow(obj.bucket, astate->shadow_obj, loc, shadow_ns);
     r = get_obj(NULL, handle, shadow, bl, ofs, end);
     goto done_ret;
   }
@@ -2158,6 +2289,57 @@ done_ret:
   return r;
 }
 
+int RGWRados::aio_get_obj(void *ctx, void **handle, rgw_obj& obj,
+                          bufferlist *pbl, off_t ofs, off_t end,
+                          void **aio_handle)
+{
+  std::string oid;
+  uint64_t read_ofs;
+  uint64_t len;
+  RGWRadosCtx *rctx = (RGWRadosCtx *)ctx;
+  RGWRadosCtx *new_ctx = NULL;
+  ObjectReadOperation op;
+  AioCompletion *c;
+
+  GetObjState *state = *(GetObjState **)handle;
+  RGWObjState *astate = NULL;
+
+  *aio_handle = NULL;
+
+  if (!rctx) {
+    new_ctx = new RGWRadosCtx();
+    rctx = new_ctx;
+  }
+
+  int r = prepare_get_obj_read(rctx, obj, state->io_ctx, ofs, end, op,
+                               oid, &read_ofs, &len, &astate);
+  if (r < 0)
+    goto done_ret;
+
+  if (!ofs && astate && astate->data.length() >= len) {
+    pbl->substr_of(astate->data, 0, len);
+    r = len;
+    goto done_ret;
+  }
+
+  ldout(cct, 20) << "rados->aio_read obj-ofs=" << ofs << " read_ofs=" << read_ofs << " read_len=" << len << dendl;
+  op.read(read_ofs, len, pbl, NULL);
+
+  c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+  r = state->io_ctx.aio_operate(oid, c, &op, NULL);
+  if (r < 0) {
+    c->release();
+    goto done_ret;
+  }
+  *aio_handle = c;
+  r = len;
+
+done_ret:
+  delete new_ctx;
+
+  return r;
+}
+
 void RGWRados::finish_get_obj(void **handle)
 {
   if (*handle) {
@@ -2505,8 +2687,7 @@ int RGWRados::cls_obj_prepare_op(rgw_bucket& bucket, uint8_t op, string& tag,
   if (r < 0)
     return r;
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
+  string oid = rgw_bucket_index_oid(bucket, rgw_bucket_index_shard(bucket, name));
 
   bufferlist in, out;
   struct rgw_cls_obj_prepare_op call;
@@ -2534,8 +2715,7 @@ int RGWRados::cls_obj_complete_op(rgw_bucket& bucket, uint8_t op, string& tag, u
   if (r < 0)
     return r;
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
+  string oid = rgw_bucket_index_oid(bucket, rgw_bucket_index_shard(bucket, ent.name));
 
   bufferlist in;
   struct rgw_cls_obj_complete_op call;
@@ -2592,37 +2772,31 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, string start, string prefix,
     return -EIO;
   }
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
+  vector<string> oids;
+  rgw_bucket_index_oids(bucket, oids);
 
-  bufferlist in, out;
   struct rgw_cls_list_op call;
   call.start_obj = start;
   call.filter_prefix = prefix;
   call.num_entries = num;
-  ::encode(call, in);
-  r = io_ctx.exec(oid, "rgw", "bucket_list", in, out);
+  vector<struct rgw_cls_list_ret> rets;
+  r = cls_bucket_list_shards(io_ctx, oids, call, rets);
   if (r < 0)
     return r;
 
-  struct rgw_cls_list_ret ret;
-  try {
-    bufferlist::iterator iter = out.begin();
-    ::decode(ret, iter);
-  } catch (buffer::error& err) {
-    ldout(cct, 0) << "ERROR: failed to decode bucket_list returned buffer" << dendl;
-    return -EIO;
-  }
-
+  map<string, uint32_t> merged; // entry name -> shard
+  bool truncated = rgw_merge_bucket_list(rets, num, merged);
   if (is_truncated != NULL)
-    *is_truncated = ret.is_truncated;
+    *is_truncated = truncated;
+
+  vector<bufferlist> updates(oids.size());
+  map<string, uint32_t>::iterator miter;
+  for (miter = merged.begin(); miter != merged.end(); ++miter) {
+    if (last_entry)
+      *last_entry = miter->first;
 
-  struct rgw_bucket_dir& dir = ret.dir;
-  map<string, struct rgw_bucket_dir_entry>::iterator miter;
-  bufferlist updates;
-  for (miter = dir.m.begin(); miter != dir.m.end(); ++miter) {
     RGWObjEnt e;
-    rgw_bucket_dir_entry& dirent = miter->second;
+    rgw_bucket_dir_entry& dirent = rets[miter->second].dir.m[miter->first];
 
     // fill it in with initial values; we may correct later
     e.name = dirent.name;
@@ -2644,7 +2818,7 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, string start, string prefix,
        * and if the tags are old we need to do cleanup as well. */
       librados::IoCtx sub_ctx;
       sub_ctx.dup(io_ctx);
-      r = check_disk_state(sub_ctx, bucket, dirent, e, updates);
+      r = check_disk_state(sub_ctx, bucket, dirent, e, updates[miter->second]);
       if (r < 0) {
         if (r == -ENOENT)
           continue;
@@ -2656,19 +2830,65 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, string start, string prefix,
     ldout(cct, 10) << "RGWRados::cls_bucket_list: got " << e.name << dendl;
   }
 
-  if (dir.m.size()) {
-    *last_entry = dir.m.rbegin()->first;
-  }
-
-  if (updates.length()) {
+  for (uint32_t i = 0; i < updates.size(); i++) {
+    if (!updates[i].length())
+      continue;
     // we don't care if we lose suggested updates, send them off blindly
     AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
-    r = io_ctx.aio_exec(oid, c, "rgw", "dir_suggest_changes", updates, NULL);
+    r = io_ctx.aio_exec(oids[i], c, "rgw", "dir_suggest_changes", updates[i], NULL);
     c->release();
   }
   return m.size();
 }
 
+/**
+ * Send the same bucket_list call to every index object at once and
+ * decode the replies, in the order of oids.
+ */
+int RGWRados::cls_bucket_list_shards(librados::IoCtx& io_ctx, vector<string>& oids,
+                                     struct rgw_cls_list_op& call,
+                                     vector<struct rgw_cls_list_ret>& rets)
+{
+  bufferlist in;
+  ::encode(call, in);
+
+  vector<bufferlist> outs(oids.size());
+  vector<AioCompletion *> completions;
+  int ret = 0;
+  for (uint32_t i = 0; i < oids.size(); i++) {
+    AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+    int r = io_ctx.aio_exec(oids[i], c, "rgw", "bucket_list", in, &outs[i]);
+    if (r < 0) {
+      c->release();
+      ret = r;
+      break;
+    }
+    completions.push_back(c);
+  }
+  // wait for everything that was sent, outs must outlive the replies
+  for (uint32_t i = 0; i < completions.size(); i++) {
+    completions[i]->wait_for_complete();
+    int r = completions[i]->get_return_value();
+    completions[i]->release();
+    if (r < 0 && ret == 0)
+      ret = r;
+  }
+  if (ret < 0)
+    return ret;
+
+  rets.resize(oids.size());
+  for (uint32_t i = 0; i < oids.size(); i++) {
+    try {
+      bufferlist::iterator iter = outs[i].begin();
+      ::decode(rets[i], iter);
+    } catch (buffer::error& err) {
+      ldout(cct, 0) << "ERROR: failed to decode bucket_list returned buffer from " << oids[i] << dendl;
+      return -EIO;
+    }
+  }
+  return 0;
+}
+
 int RGWRados::cls_obj_usage_log_add(const string& oid, rgw_usage_log_info& info)
 {
   librados::IoCtx io_ctx;
@@ -2805,28 +3025,28 @@ int RGWRados::cls_bucket_head(rgw_bucket& bucket, struct rgw_bucket_dir_header&
     return -EIO;
   }
 
-  string oid = dir_oid_prefix;
-  oid.append(bucket.marker);
+  vector<string> oids;
+  rgw_bucket_index_oids(bucket, oids);
 
-  bufferlist in, out;
   struct rgw_cls_list_op call;
   call.num_entries = 0;
-  ::encode(call, in);
-  r = io_ctx.exec(oid, "rgw", "bucket_list", in, out);
+  vector<struct rgw_cls_list_ret> rets;
+  r = cls_bucket_list_shards(io_ctx, oids, call, rets);
   if (r < 0)
     return r;
 
-  struct rgw_cls_list_ret ret;
-  try {
-    bufferlist::iterator iter = out.begin();
-    ::decode(ret, iter);
-  } catch (buffer::error& err) {
-    ldout(cct, 0) << "ERROR: failed to decode bucket_list returned buffer" << dendl;
-    return -EIO;
+  header.stats.clear();
+  for (uint32_t i = 0; i < rets.size(); i++) {
+    map<uint8_t, struct rgw_bucket_category_stats>& stats = rets[i].dir.header.stats;
+    for (map<uint8_t, struct rgw_bucket_category_stats>::iterator iter = stats.begin();
+         iter != stats.end(); ++iter) {
+      struct rgw_bucket_category_stats& total = header.stats[iter->first];
+      total.num_entries += iter->second.num_entries;
+      total.total_size += iter->second.total_size;
+      total.total_size_rounded += iter->second.total_size_rounded;
+    }
   }
 
-  header = ret.dir.header;
-
   return 0;
 }
 
@@ -2983,17 +3203,7 @@ int RGWRados::process_intent_log(rgw_bucket& bucket, string& oid,
         complete = false;
         break;
       } else {
-        librados::IoCtx io_ctx;
-        int r = open_bucket_ctx(entry.obj.bucket, io_ctx);
-        if (r < 0)
-          return r;
-        ObjectWriteOperation op;
-        op.remove();
-        string oid = dir_oid_prefix;
-        oid.append(entry.obj.bucket.marker);
-        librados::AioCompletion *completion = rados->aio_create_completion(NULL, NULL, NULL);
-        r = io_ctx.aio_operate(oid, completion, &op);
-        completion->release();
+        int r = remove_bucket_index(entry.obj.bucket);
         if (r < 0 && r != -ENOENT) {
           cerr << "failed to remove pool: " << entry.obj.bucket.pool << std::endl;
           complete = false;
@@ -239,6 +239,10 @@ class RGWRados
                          string& actual_obj, librados::ObjectWriteOperation& op, RGWObjState **pstate);
   int prepare_atomic_for_write(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io_ctx,
                          string& actual_obj, librados::ObjectWriteOperation& op, RGWObjState **pstate);
+  int prepare_get_obj_read(RGWRadosCtx *rctx, rgw_obj& obj, librados::IoCtx& io_ctx,
+                           off_t ofs, off_t end, librados::ObjectReadOperation& op,
+                           string& actual_obj, uint64_t *read_ofs, uint64_t *len,
+                           RGWObjState **pstate);
 
   void atomic_write_finish(RGWObjState *state, int r) {
     if (state && r == -ECANCELED) {
@@ -501,6 +505,19 @@ public:
 
   virtual int get_obj(void *ctx, void **handle, rgw_obj& obj,
                       bufferlist& bl, off_t ofs, off_t end);
+  /**
+   * Start reading the next chunk of obj at ofs, like get_obj, without
+   * waiting for it.  pbl must stay around until the read is waited for
+   * with aio_wait(*aio_handle); *aio_handle is NULL if the data was
+   * already at hand.  The handle is never freed here, so several reads
+   * can be in flight; release it with finish_get_obj.  A read of the
+   * head that races with an overwrite fails with -ECANCELED, in which
+   * case the caller should go back to get_obj.
+   * Returns: -ERR# on failure, otherwise the length being read
+   */
+  virtual int aio_get_obj(void *ctx, void **handle, rgw_obj& obj,
+                          bufferlist *pbl, off_t ofs, off_t end,
+                          void **aio_handle);
 
   virtual void finish_get_obj(void **handle);
 
@@ -564,6 +581,8 @@ public:
                       map<string, RGWObjEnt>& m, bool *is_truncated,
                       string *last_entry = NULL);
   int cls_bucket_head(rgw_bucket& bucket, struct rgw_bucket_dir_header& header);
+  int remove_bucket_index(rgw_bucket& bucket);
+  int copy_bucket_index(rgw_bucket& src, rgw_bucket& dst);
   int prepare_update_index(RGWObjState *state, rgw_bucket& bucket,
                            rgw_obj& oid, string& tag);
   int complete_update_index(rgw_bucket& bucket, string& oid, string& tag, uint64_t epoch, uint64_t size,
@@ -606,6 +625,10 @@ public:
                        RGWObjEnt& object,
                        bufferlist& suggested_updates);
 
+  int cls_bucket_list_shards(librados::IoCtx& io_ctx, vector<string>& oids,
+                             struct rgw_cls_list_op& call,
+                             vector<struct rgw_cls_list_ret>& rets);
+
   bool bucket_is_system(rgw_bucket& bucket) {
     return (bucket.name[0] == '.');
   }
@@ -265,7 +265,7 @@ int rgw_write_buckets_attr(string user_id, RGWUserBuckets& buckets)
   return ret;
 }
 
-int rgw_add_bucket(string user_id, rgw_bucket& bucket)
+int rgw_add_bucket(string user_id, rgw_bucket& bucket, time_t creation_time)
 {
   int ret;
    string& bucket_name = bucket.name;
@@ -276,7 +276,10 @@ int rgw_add_bucket(string user_id, rgw_bucket& bucket)
     RGWBucketEnt new_bucket;
     new_bucket.bucket = bucket;
     new_bucket.size = 0;
-    time(&new_bucket.mtime);
+    if (creation_time)
+      new_bucket.mtime = creation_time;
+    else
+      time(&new_bucket.mtime);
     ::encode(new_bucket, bl);
 
     string buckets_obj_id;
@@ -300,7 +303,10 @@ int rgw_add_bucket(string user_id, rgw_bucket& bucket)
     case -ENODATA:
       new_bucket.bucket = bucket;
       new_bucket.size = 0;
-      time(&new_bucket.mtime);
+      if (creation_time)
+        new_bucket.mtime = creation_time;
+      else
+        time(&new_bucket.mtime);
       buckets.add(new_bucket);
       ret = rgw_write_buckets_attr(user_id, buckets);
       break;
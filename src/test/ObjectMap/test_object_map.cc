@@ -710,6 +710,52 @@ TEST_F(ObjectMapTest, OddEvenClone) {
   db->clear(hoid2);
 }
 
+TEST_F(ObjectMapTest, HeaderCache) {
+  DBObjectMap *dbmap = static_cast<DBObjectMap*>(db.get());
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  uint64_t hits, misses;
+  string result;
+
+  dbmap->set_header_cache_size(16);
+  tester.set_key(hoid, "foo", "bar");
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+  dbmap->get_header_cache_stats(&hits, &misses);
+  ASSERT_GT(hits, 0u);
+
+  // clone rewrites the source's header and makes it a parent
+  db->clone(hoid, hoid2);
+  tester.set_key(hoid2, "foo2", "bar2");
+  ASSERT_EQ(1, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ("bar", result);
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+  ASSERT_EQ("bar", result);
+  ASSERT_EQ(0, tester.get_key(hoid, "foo2", &result));
+
+  // copying up drops the parent from hoid's cached header
+  tester.remove_key(hoid, "foo");
+  ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo", &result));
+
+  // a cleared object must not come back from the cache
+  db->clear(hoid);
+  ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+  tester.set_key(hoid, "baz", "bar");
+  ASSERT_EQ(1, tester.get_key(hoid, "baz", &result));
+  ASSERT_EQ(0, tester.get_key(hoid, "foo", &result));
+
+  // and with the cache off everything is read from the store
+  dbmap->set_header_cache_size(0);
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo2", &result));
+  ASSERT_EQ("bar2", result);
+  dbmap->get_header_cache_stats(&hits, &misses);
+  ASSERT_EQ(0u, hits);
+  ASSERT_GT(misses, 0u);
+
+  db->clear(hoid);
+  db->clear(hoid2);
+}
+
 TEST_F(ObjectMapTest, RandomTest) {
   tester.def_init();
   for (unsigned i = 0; i < 5000; ++i) {
@@ -0,0 +1,94 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * allocate and free buffers of the pooled sizes (and one that is not)
+ * from several threads, handing half of them to another thread to
+ * free, the way messages move from the messenger to the dispatcher.
+ *
+ * run with CEPH_BUFFER_NOPOOL=1 to compare against plain malloc, and
+ * with CEPH_BUFFER_TRACK=1 to include (and check) alloc accounting.
+ */
+
+#include "include/types.h"
+#include "include/buffer.h"
+#include "common/Thread.h"
+#include "common/Mutex.h"
+#include "common/Clock.h"
+#include "common/environment.h"
+
+static unsigned sizes[] = { 4096, 65536, 1000 };
+
+struct T : public Thread {
+  int num;
+  Mutex lock;
+  list<bufferptr> handoff;  // freed by the next thread
+  T *next;
+  T(int n) : num(n), lock("bench_buffer::T::lock"), next(0) {}
+
+  void *entry() {
+    for (int i = 0; i < num; i++) {
+      unsigned len = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+      bufferptr a(buffer::create(len));
+      bufferptr b(buffer::create_page_aligned(len));
+      a[0] = b[0] = i;
+
+      // a message-sized list of small segments
+      bufferlist bl;
+      for (int j = 0; j < 8; j++)
+	bl.append(a, j * 64, 64);
+      bl.append(b);
+
+      next->lock.Lock();
+      next->handoff.push_back(b);
+      next->lock.Unlock();
+
+      if ((i & 63) == 0) {
+	list<bufferptr> ls;
+	lock.Lock();
+	ls.swap(handoff);
+	lock.Unlock();
+      }
+    }
+    return 0;
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  if (argc < 3) {
+    cerr << "usage: bench_buffer <threads> <buffers per thread>" << std::endl;
+    return 1;
+  }
+  int threads = atoi(argv[1]);
+  int num = atoi(argv[2]);
+
+  cout << threads << " threads, " << num << " buffers per thread, pools "
+       << (get_env_bool("CEPH_BUFFER_NOPOOL") ? "off" : "on")
+       << ", tracking "
+       << (get_env_bool("CEPH_BUFFER_TRACK") ? "on" : "off") << std::endl;
+
+  utime_t start = ceph_clock_now(NULL);
+
+  vector<T*> ls;
+  for (int i=0; i<threads; i++)
+    ls.push_back(new T(num));
+  for (int i=0; i<threads; i++)
+    ls[i]->next = ls[(i + 1) % threads];
+  for (int i=0; i<threads; i++)
+    ls[i]->create();
+  for (int i=0; i<threads; i++)
+    ls[i]->join();
+
+  utime_t dur = ceph_clock_now(NULL) - start;
+  for (int i=0; i<threads; i++)
+    delete ls[i];
+
+  cout << dur << " s, "
+       << (double)threads * num * 2 / (double)dur / 1000000.0
+       << " M buffers/s" << std::endl;
+
+  int left = buffer::get_total_alloc();
+  cout << "buffer bytes still allocated: " << left << std::endl;
+  return left ? 1 : 0;
+}
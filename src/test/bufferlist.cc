@@ -10,6 +10,78 @@
 #define MAX_TEST 1000000
 
 
+TEST(BufferPtr, PooledSizes) {
+  unsigned sizes[] = { 4096, 65536, 4095, 65537 };
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    for (int n = 0; n < 3; n++) {   // again, from the free list
+      bufferptr a(buffer::create(sizes[i]));
+      bufferptr b(buffer::create_page_aligned(sizes[i]));
+      ASSERT_EQ(sizes[i], a.length());
+      ASSERT_EQ(sizes[i], b.length());
+      ASSERT_TRUE(b.is_page_aligned());
+      memset(a.c_str(), 'a' + n, a.length());
+      memset(b.c_str(), 'b' + n, b.length());
+
+      bufferptr c(a.clone());
+      ASSERT_EQ(0, memcmp(a.c_str(), c.c_str(), a.length()));
+      bufferptr d(buffer::copy(b.c_str(), b.length()));
+      ASSERT_EQ(0, memcmp(b.c_str(), d.c_str(), b.length()));
+    }
+  }
+}
+
+TEST(BufferList, CachedCrc) {
+  buffer::track_cached_crc(true);
+  bufferptr a(buffer::create_page_aligned(65536));
+  bufferptr b(buffer::create(8192));
+  for (unsigned i = 0; i < a.length(); i++)
+    a[i] = random();
+  for (unsigned i = 0; i < b.length(); i++)
+    b[i] = random();
+  bufferlist bl;
+  bl.append(a);
+  bl.append(b);
+  bufferlist small;
+  small.append("front", 5);
+
+  __u32 crc = bl.crc32c(0);
+  int base = buffer::get_cached_crc();
+  int base_adjusted = buffer::get_cached_crc_adjusted();
+
+  // same segments, same seeds
+  ASSERT_EQ(crc, bl.crc32c(0));
+  ASSERT_EQ(base + 2, buffer::get_cached_crc());
+
+  // a copy shares the raw buffers
+  bufferlist copy(bl);
+  ASSERT_EQ(crc, copy.crc32c(0));
+  ASSERT_EQ(base + 4, buffer::get_cached_crc());
+
+  // different seeds are adjusted rather than recomputed
+  bufferlist both(small);
+  both.append(bl);
+  __u32 expect = bl.crc32c(small.crc32c(0));
+  ASSERT_EQ(expect, both.crc32c(0));
+  const bufferptr &ca = a, &cb = b;  // don't invalidate
+  ASSERT_EQ(expect, ceph_crc32c_le(ceph_crc32c_le(ceph_crc32c_le(0,
+	(unsigned char*)"front", 5),
+	(unsigned char*)ca.c_str(), ca.length()),
+	(unsigned char*)cb.c_str(), cb.length()));
+  ASSERT_LT(base_adjusted, buffer::get_cached_crc_adjusted());
+
+  // writes invalidate
+  int hits = buffer::get_cached_crc() + buffer::get_cached_crc_adjusted();
+  b[100] = b[100] + 1;
+  __u32 changed = bl.crc32c(0);
+  ASSERT_NE(crc, changed);
+  bufferlist fresh;
+  ASSERT_EQ(hits + 1, buffer::get_cached_crc() + buffer::get_cached_crc_adjusted());  // only a
+  fresh.append(ca.c_str(), ca.length());
+  fresh.append(cb.c_str(), cb.length());
+  ASSERT_EQ(fresh.crc32c(0), changed);
+  buffer::track_cached_crc(false);
+}
+
 TEST(BufferList, EmptyAppend) {
   bufferlist bl;
   bufferptr ptr;
@@ -7,13 +7,22 @@
                            specify output for for (de)compilation
      --build --num_osds N layer1 ...
                            build a new map, where each 'layer' is
-                             'name (uniform|straw|list|tree) size'
+                             'name (uniform|straw|straw_tree|list|tree) size'
      -i mapfn --test       test a range of inputs on the map
         [--min-x x] [--max-x x] [--x x]
         [--min-rule r] [--max-rule r] [--rule r]
         [--num-rep n]
         [--batches b]      split the CRUSH mapping into b rounds
       --simulate           simulate placements using a RNG
+        [--threads n]      map the inputs on n threads
+     -i mapfn --stats      like --test, but only count per-device utilization
+                           and data movement, for large input ranges
+        [--compare mapfn2] count replicas that moved relative to mapfn2
+        [--stats-out file] write per-device results to file (default stdout)
+        [--stats-format csv|json]
+        [--checkpoint file]
+                           save progress to file, and resume from it if
+                           it exists
         [--weight|-w devno weight]
                            where weight is 0 to 1.0
      -i mapfn --add-item id weight name [--loc type name ...]
@@ -34,6 +43,9 @@
      --show-statistics     show chi squared statistics
      --show-bad-mappings   show bad mappings
      --show-choose-tries   show choose tries histogram
+     --show-movement       with --test, also map the inputs with the map as
+                           it was before --add-item, --reweight-item etc.
+                           and report how many replicas moved
      --set-choose-local-tries N
                            set choose local retries before re-descent
      --set-choose-local-fallback-tries N
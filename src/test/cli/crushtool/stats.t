@@ -0,0 +1,95 @@
+# the maps before and after reweighting a few devices
+  $ crushtool -c "$TESTDIR/multitype.before" -o before > /dev/null
+  $ crushtool -c "$TESTDIR/multitype.after" -o after > /dev/null
+  $ crushtool -i after --stats --threads 0
+  --threads must be at least 1
+  [1]
+  $ crushtool -i after --stats --stats-format xml
+  unknown stats format 'xml'
+  [1]
+# per-device counts, and what moved since the old map
+  $ crushtool -i after --stats --rule 0 --num-rep 2 --max-x 9999 --compare before --checkpoint cp --stats-out out.csv
+  rule 0 (data) num_rep 2 x 0..9999: placed 20000 on 9 devices, stddev 362.46 (0.163107 of mean), max/expected 1.17588, moved 5049 (25.245%)
+  $ cat out.csv
+  rule,num_rep,device,weight,expected,stored,deviation,moved_in,moved_out
+  0,2,0,2,3478.26,3948,0.13505,1185,149
+  0,2,1,1,1739.13,1958,0.12585,198,1030
+  0,2,3,2,3478.26,3994,0.148275,1241,121
+  0,2,4,1,1739.13,2045,0.175875,177,1007
+  0,2,5,1,1739.13,1459,-0.161075,449,629
+  0,2,6,2,3478.26,2939,-0.155038,1304,144
+  0,2,7,0.5,869.565,770,-0.1145,26,976
+  0,2,8,1,1739.13,1431,-0.177175,408,699
+  0,2,9,1,1739.13,1456,-0.1628,61,294
+# the run is in the checkpoint, so this only reads it back
+  $ crushtool -i after --stats --rule 0 --num-rep 2 --max-x 9999 --compare before --checkpoint cp --stats-out again.csv
+  resuming from cp
+  rule 0 (data) num_rep 2 x 0..9999: placed 20000 on 9 devices, stddev 362.46 (0.163107 of mean), max/expected 1.17588, moved 5049 (25.245%)
+  $ cmp out.csv again.csv
+# but not for other inputs
+  $ crushtool -i after --stats --rule 0 --num-rep 2 --max-x 19999 --compare before --checkpoint cp
+  checkpoint cp was made with different maps, weights or inputs; remove it to start over
+  [1]
+# the thread count does not change the counts
+  $ crushtool -i after --stats --rule 0 --num-rep 2 --max-x 9999 --threads 4 --stats-out threads.csv 2> /dev/null
+  $ cut -d, -f1-6 out.csv > one
+  $ cut -d, -f1-6 threads.csv > four
+  $ cmp one four
+  $ crushtool -i after --stats --rule 0 --num-rep 2 --max-x 999 --stats-format json
+  rule 0 (data) num_rep 2 x 0..999: placed 2000 on 9 devices, stddev 34.2619 (0.154178 of mean), max/expected 1.17875
+  [
+      { "rule": 0,
+        "rule_name": "data",
+        "num_rep": 2,
+        "min_x": 0,
+        "max_x": 999,
+        "placed": 2000,
+        "stddev": "34.261850",
+        "max_overload": "1.178750",
+        "devices": [
+              { "id": 0,
+                "weight": "2.000000",
+                "expected": "347.826087",
+                "stored": 388,
+                "deviation": "0.115500"},
+              { "id": 1,
+                "weight": "1.000000",
+                "expected": "173.913043",
+                "stored": 191,
+                "deviation": "0.098250"},
+              { "id": 3,
+                "weight": "2.000000",
+                "expected": "347.826087",
+                "stored": 399,
+                "deviation": "0.147125"},
+              { "id": 4,
+                "weight": "1.000000",
+                "expected": "173.913043",
+                "stored": 205,
+                "deviation": "0.178750"},
+              { "id": 5,
+                "weight": "1.000000",
+                "expected": "173.913043",
+                "stored": 162,
+                "deviation": "-0.068500"},
+              { "id": 6,
+                "weight": "2.000000",
+                "expected": "347.826087",
+                "stored": 298,
+                "deviation": "-0.143250"},
+              { "id": 7,
+                "weight": "0.500000",
+                "expected": "86.956522",
+                "stored": 78,
+                "deviation": "-0.103000"},
+              { "id": 8,
+                "weight": "1.000000",
+                "expected": "173.913043",
+                "stored": 139,
+                "deviation": "-0.200750"},
+              { "id": 9,
+                "weight": "1.000000",
+                "expected": "173.913043",
+                "stored": 140,
+                "deviation": "-0.195000"}]}]
+  $ rm before after cp out.csv again.csv threads.csv one four
@@ -17,6 +17,8 @@
     bucket unlink              unlink bucket from specified user
     bucket stats               returns bucket statistics
     bucket info                show bucket information
+    bucket reshard             split the bucket index across --num-shards objects
+                               (stop writes to the bucket first)
     pool add                   add an existing pool for data placement
     pool rm                    remove an existing pool from data placement set
     pools list                 list placement active set
@@ -49,6 +51,8 @@
      --start-date=<date>
      --end-date=<date>
      --bucket-id=<bucket-id>
+     --num-shards=<num>        number of bucket index shards, 0 for a single
+                               index object
      --format=<format>         specify output format for certain operations: xml,
                                json
      --purge-data              when specified, user removal will also purge all the
@@ -0,0 +1,87 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/crc32c.h"
+#include "common/Clock.h"
+#include "gtest/gtest.h"
+
+TEST(Crc32c, Small) {
+  const char *a = "foo bar baz";
+  const char *b = "whiz bang boom";
+  ASSERT_EQ(4119623852u, ceph_crc32c_le(0, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(881700046u, ceph_crc32c_le(1234, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(2360230088u, ceph_crc32c_le(0, (unsigned char *)b, strlen(b)));
+  ASSERT_EQ(3743019208u, ceph_crc32c_le(5678, (unsigned char *)b, strlen(b)));
+}
+
+TEST(Crc32c, Iscsi) {
+  // the standard check value, without the final inversion
+  const char *a = "123456789";
+  ASSERT_EQ(0xE3069283u, ~ceph_crc32c_le(-1, (unsigned char *)a, strlen(a)));
+}
+
+TEST(Crc32c, Unaligned) {
+  // every implementation must agree for all alignments and tail lengths
+  unsigned char buf[4096 + 16];
+  for (unsigned i = 0; i < sizeof(buf); ++i)
+    buf[i] = rand();
+  ceph_crc32c_func_t best = ceph_choose_crc32();
+  for (unsigned off = 0; off < 16; ++off) {
+    for (unsigned len = 0; len < 300; ++len) {
+      uint32_t c = ceph_crc32c_sctp(off, buf + off, len);
+      ASSERT_EQ(c, best(off, buf + off, len));
+      ASSERT_EQ(c, ceph_crc32c_le(off, buf + off, len));
+    }
+    uint32_t c = ceph_crc32c_sctp(-1, buf + off, 4096);
+    ASSERT_EQ(c, best(-1, buf + off, 4096));
+  }
+}
+
+TEST(Crc32c, Zeros) {
+  unsigned char *zeros = new unsigned char[1 << 20];
+  memset(zeros, 0, 1 << 20);
+  unsigned char buf[5000];
+  for (unsigned i = 0; i < sizeof(buf); ++i)
+    buf[i] = rand();
+  unsigned lens[] = { 0, 1, 7, 64, 1000, 4096, 5000, 65537, 1 << 20 };
+  for (unsigned i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+    uint32_t s = rand();
+    ASSERT_EQ(ceph_crc32c_le(s, zeros, lens[i]), ceph_crc32c_zeros(s, lens[i]));
+    if (lens[i] <= sizeof(buf)) {
+      // reseed an existing crc
+      uint32_t a = rand(), b = rand();
+      ASSERT_EQ(ceph_crc32c_le(b, buf, lens[i]),
+		ceph_crc32c_le(a, buf, lens[i]) ^ ceph_crc32c_zeros(a ^ b, lens[i]));
+    }
+  }
+  delete[] zeros;
+}
+
+static double rate(ceph_crc32c_func_t f, unsigned char *buf, unsigned len, int loops)
+{
+  utime_t start = ceph_clock_now(NULL);
+  uint32_t crc = 0;
+  for (int i = 0; i < loops; ++i)
+    crc = f(crc, buf, len);
+  utime_t end = ceph_clock_now(NULL);
+  return (double)len * loops / (1024*1024) / (double)(end - start);
+}
+
+TEST(Crc32c, Performance) {
+  unsigned len = 4 << 20;
+  unsigned char *buf = new unsigned char[len];
+  for (unsigned i = 0; i < len; ++i)
+    buf[i] = rand();
+  std::cout << "sctp slice-by-8: " << rate(ceph_crc32c_sctp, buf, len, 50)
+	    << " MB/sec" << std::endl;
+  if (ceph_crc32c_intel_probe())
+    std::cout << "sse4.2: " << rate(ceph_crc32c_intel, buf, len, 50)
+	      << " MB/sec" << std::endl;
+  else
+    std::cout << "sse4.2: not supported by this cpu" << std::endl;
+  delete[] buf;
+}
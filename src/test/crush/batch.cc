@@ -0,0 +1,115 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "crush/CrushWrapper.h"
+#include "gtest/gtest.h"
+
+static const int algs[] = {
+  CRUSH_BUCKET_UNIFORM,
+  CRUSH_BUCKET_LIST,
+  CRUSH_BUCKET_TREE,
+  CRUSH_BUCKET_STRAW,
+  CRUSH_BUCKET_STRAW_TREE,
+};
+static const int num_algs = sizeof(algs) / sizeof(algs[0]);
+
+/// hosts of each bucket type under a root of each bucket type, with
+/// a firstn and an indep leaf rule per root
+static int build_map(CrushWrapper& c)
+{
+  c.create();
+  int num_dev = 0;
+  int hosts[32], host_weights[32];
+  for (int h = 0; h < 32; h++) {
+    int alg = algs[h % num_algs];
+    int n = 2 + h % 6;
+    int items[8], weights[8];
+    for (int i = 0; i < n; i++) {
+      items[i] = num_dev++;
+      weights[i] = 0x10000 * (alg == CRUSH_BUCKET_UNIFORM ? 1 : 1 + i % 3);
+    }
+    hosts[h] = c.add_bucket(0, alg, CRUSH_HASH_DEFAULT, 1, n, items, weights);
+    host_weights[h] = c.get_bucket_weight(hosts[h]);
+  }
+  for (int a = 0; a < num_algs; a++) {
+    int weights[32];
+    for (int h = 0; h < 32; h++)
+      weights[h] = algs[a] == CRUSH_BUCKET_UNIFORM ? 0x10000 : host_weights[h];
+    int root = c.add_bucket(0, algs[a], CRUSH_HASH_DEFAULT, 2, 32, hosts, weights);
+    for (int indep = 0; indep < 2; indep++) {
+      int rule = c.add_rule(3, a * 2 + indep, 1, 1, 10, -1);
+      c.set_rule_step_take(rule, 0, root);
+      if (indep)
+	c.set_rule_step_choose_leaf_indep(rule, 1, 0, 1);
+      else
+	c.set_rule_step_choose_leaf_firstn(rule, 1, 0, 1);
+      c.set_rule_step_emit(rule, 2);
+    }
+  }
+  c.set_max_devices(num_dev);
+  c.finalize();
+  return num_dev;
+}
+
+static void check_batch(CrushWrapper& c, const vector<__u32>& weight,
+			int num_x, int threads)
+{
+  vector<int> x;
+  for (int i = 0; i < num_x; i++)
+    x.push_back(i * 7919);
+  for (int r = 0; r < c.get_max_rules(); r++) {
+    for (int nr = 1; nr <= 5; nr++) {
+      vector<vector<int> > batch;
+      c.do_rule_batch(r, x, batch, nr, weight, threads);
+      ASSERT_EQ(x.size(), batch.size());
+      for (unsigned i = 0; i < x.size(); i++) {
+	vector<int> out;
+	c.do_rule(r, x[i], out, nr, weight);
+	ASSERT_EQ(out, batch[i]);
+      }
+    }
+  }
+}
+
+TEST(CrushBatch, MatchesDoRule)
+{
+  CrushWrapper c;
+  int num_dev = build_map(c);
+  vector<__u32> weight(num_dev, 0x10000);
+  check_batch(c, weight, 2000, 1);
+}
+
+TEST(CrushBatch, MatchesDoRuleReweighted)
+{
+  CrushWrapper c;
+  int num_dev = build_map(c);
+  // some out, some partially in, to force retries and perm choices
+  vector<__u32> weight(num_dev, 0x10000);
+  for (int i = 0; i < num_dev; i++) {
+    if (i % 7 == 0)
+      weight[i] = 0;
+    else if (i % 5 == 0)
+      weight[i] = 0x8000;
+  }
+  check_batch(c, weight, 2000, 1);
+}
+
+TEST(CrushBatch, MatchesDoRuleThreaded)
+{
+  CrushWrapper c;
+  int num_dev = build_map(c);
+  vector<__u32> weight(num_dev, 0x10000);
+  weight[3] = 0;
+  check_batch(c, weight, 10000, 4);
+}
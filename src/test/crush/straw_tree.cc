@@ -0,0 +1,151 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <math.h>
+
+#include "crush/CrushWrapper.h"
+#include "gtest/gtest.h"
+
+static const int num_dev = 200;
+static const int num_x = 100000;
+
+/// one flat straw_tree bucket of num_dev devices weighted 1, 2 or 3
+static int build_map(CrushWrapper& c)
+{
+  c.create();
+  int items[num_dev], weights[num_dev];
+  for (int i = 0; i < num_dev; i++) {
+    items[i] = i;
+    weights[i] = 0x10000 * (1 + i % 3);
+  }
+  int root = c.add_bucket(0, CRUSH_BUCKET_STRAW_TREE, CRUSH_HASH_DEFAULT, 1,
+			  num_dev, items, weights);
+  int rule = c.add_rule(3, 0, 1, 1, 10, -1);
+  c.set_rule_step_take(rule, 0, root);
+  c.set_rule_step_choose_firstn(rule, 1, 1, 0);
+  c.set_rule_step_emit(rule, 2);
+  c.set_max_devices(num_dev + 1);
+  c.finalize();
+  return root;
+}
+
+static void map_all(CrushWrapper& c, vector<int>& out)
+{
+  vector<__u32> weight(num_dev + 1, 0x10000);
+  out.resize(num_x);
+  for (int x = 0; x < num_x; x++) {
+    vector<int> o;
+    c.do_rule(0, x, o, 1, weight);
+    ASSERT_EQ(1u, o.size());
+    out[x] = o[0];
+  }
+}
+
+TEST(CrushStrawTree, Distribution)
+{
+  CrushWrapper c;
+  int root = build_map(c);
+  ASSERT_EQ(0x10000 * 399, c.get_bucket_weight(root));
+
+  vector<int> out;
+  map_all(c, out);
+  vector<int> count(num_dev);
+  for (int x = 0; x < num_x; x++)
+    count[out[x]]++;
+  for (int i = 0; i < num_dev; i++) {
+    double expected = (double)num_x * (1 + i % 3) / 399.0;
+    ASSERT_LT(fabs(count[i] - expected), 5 * sqrt(expected)) << "device " << i;
+  }
+}
+
+TEST(CrushStrawTree, ReweightMovesWithinGroup)
+{
+  CrushWrapper c;
+  int root = build_map(c);
+  vector<int> before, after;
+  map_all(c, before);
+
+  // 37 goes from 2 to 3; anything that moves goes to 37's group of
+  // CRUSH_STRAW_TREE_FANOUT
+  ASSERT_EQ(0x10000, crush_bucket_adjust_item_weight(c.crush->buckets[-1-root],
+						     37, 3 * 0x10000));
+  ASSERT_EQ(0x10000 * 400, c.get_bucket_weight(root));
+  map_all(c, after);
+  int group = 37 / CRUSH_STRAW_TREE_FANOUT;
+  int moved = 0, to_item = 0;
+  for (int x = 0; x < num_x; x++) {
+    if (before[x] == after[x])
+      continue;
+    moved++;
+    ASSERT_EQ(group, after[x] / CRUSH_STRAW_TREE_FANOUT) << "x " << x;
+    if (after[x] == 37)
+      to_item++;
+  }
+  ASSERT_GT(moved, 0);
+  ASSERT_GT(to_item, 0);
+}
+
+TEST(CrushStrawTree, AddRemoveKeepsOtherGroups)
+{
+  CrushWrapper c;
+  int root = build_map(c);
+  vector<int> before, after;
+  map_all(c, before);
+
+  // a new device joins the last group; inputs only move into it
+  crush_bucket *b = c.crush->buckets[-1-root];
+  ASSERT_EQ(0, crush_bucket_add_item(b, num_dev, 0x10000));
+  c.finalize();  // max_devices, or do_rule won't return the new device
+  map_all(c, after);
+  int group = num_dev / CRUSH_STRAW_TREE_FANOUT;
+  for (int x = 0; x < num_x; x++) {
+    if (before[x] != after[x]) {
+      ASSERT_EQ(group, after[x] / CRUSH_STRAW_TREE_FANOUT) << "x " << x;
+    }
+  }
+
+  // and removing it again restores the original mapping
+  ASSERT_EQ(0, crush_bucket_remove_item(b, num_dev));
+  c.finalize();
+  map_all(c, after);
+  ASSERT_EQ(before, after);
+}
+
+TEST(CrushStrawTree, EncodeDecode)
+{
+  CrushWrapper c;
+  build_map(c);
+  bufferlist bl;
+  c.encode(bl);
+
+  CrushWrapper d;
+  bufferlist::iterator p = bl.begin();
+  d.decode(p);
+  // the monitor won't take it until every daemon can decode it
+  ASSERT_TRUE(d.has_straw_tree_buckets());
+  vector<int> a, b;
+  map_all(c, a);
+  map_all(d, b);
+  ASSERT_EQ(a, b);
+}
+
+TEST(CrushStrawTree, NoStrawTreeBuckets)
+{
+  CrushWrapper c;
+  c.create();
+  int items[2] = { 0, 1 }, weights[2] = { 0x10000, 0x10000 };
+  c.add_bucket(0, CRUSH_BUCKET_STRAW, CRUSH_HASH_DEFAULT, 1, 2, items, weights);
+  c.finalize();
+  ASSERT_FALSE(c.has_straw_tree_buckets());
+}
@@ -0,0 +1,43 @@
+#! /bin/sh -x
+
+#
+# Push a few hundred osdmap epochs through the osds and dump their heaps
+# before and after, to see what the map cache (osd_map_cache_size) costs.
+# Compare the two with pprof --base, and against a build without
+# shared map pieces.
+# This test isn't very smart -- run it from your src dir.
+#
+# usage: test_osdmap_memuse_tcmalloc.sh <num osds> <num epochs>
+#
+
+set -e
+
+CEPH_NUM_MON=1 CEPH_NUM_MDS=0 CEPH_NUM_OSD=$1 ./vstart.sh -n -d
+
+num_osd=$1
+maxosd=$((num_osd-1))
+for osd_num in `seq 0 $maxosd`; do
+    ./ceph osd tell $osd_num heap start_profiler
+done
+
+dump_heaps() {
+    eval "rm out/*.heap" || echo "no heap dumps to rm"
+    mkdir -p out/$1
+    for osd_num in `seq 0 $maxosd`; do
+	./ceph osd tell $osd_num heap dump
+	sleep 1
+	eval "mv out/*.heap out/$1"
+    done
+}
+
+dump_heaps maps_before
+
+# each of these is an epoch that only changes the flags, so nearly all
+# of it can be shared with the one before
+for i in `seq 1 $(($2/2))`; do
+    ./ceph osd set noout
+    ./ceph osd unset noout
+done
+sleep 5
+
+dump_heaps maps_after
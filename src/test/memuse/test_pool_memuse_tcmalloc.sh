@@ -12,7 +12,7 @@ CEPH_NUM_MON=1 CEPH_NUM_MDS=1 CEPH_NUM_OSD=$2 ./vstart.sh -n -d
 num_osd=$2
 maxosd=$((num_osd-1))
 for osd_num in `seq 0 $maxosd`; do
-    ./ceph osd tell $osd_num start_profiler
+    ./ceph osd tell $osd_num heap start_profiler
 done
 
 for i in `seq 0 $1`; do
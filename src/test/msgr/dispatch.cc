@@ -0,0 +1,246 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <pthread.h>
+
+#include "msg/SimpleMessenger.h"
+#include "messages/MPing.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/ceph_context.h"
+#include "test/unit.h"
+
+/// records which threads deliver what for each connection
+class ThreadRecorder : public Dispatcher {
+public:
+  bool fast;
+  bool decline;  ///< hand every other fast ping back to be queued
+  bool rx_buffers;  ///< supply page aligned buffers for message data
+  Mutex lock;
+  Cond cond;
+  map<Connection*, set<pthread_t> > dispatch_threads;
+  map<Connection*, set<pthread_t> > reset_threads;
+  map<Connection*, uint64_t> last_seq;
+  map<Connection*, int> declined;  ///< declined and not yet dispatched
+  set<const char*> rx_given;
+  int dispatched, resets, out_of_order, queued, rx_used;
+
+  ThreadRecorder(CephContext *cct, bool f, bool d = false)
+    : Dispatcher(cct), fast(f), decline(d), rx_buffers(false),
+      lock("ThreadRecorder::lock"),
+      dispatched(0), resets(0), out_of_order(0), queued(0), rx_used(0) {}
+
+  void got(Message *m) {
+    Mutex::Locker l(lock);
+    Connection *con = m->get_connection();
+    dispatch_threads[con].insert(pthread_self());
+    if (m->get_seq() <= last_seq[con])
+      out_of_order++;
+    last_seq[con] = m->get_seq();
+    bufferlist& data = m->get_data();
+    if (data.length() && data.buffers().size() == 1 &&
+	rx_given.count(data.buffers().front().c_str()))
+      rx_used++;
+    dispatched++;
+    cond.Signal();
+  }
+  bool ms_dispatch(Message *m) {
+    if (m->get_type() != CEPH_MSG_PING)
+      return false;
+    if (fast) {
+      Mutex::Locker l(lock);
+      queued++;
+      if (declined[m->get_connection()] > 0)
+	declined[m->get_connection()]--;
+    }
+    got(m);
+    m->put();
+    return true;
+  }
+  bool ms_can_fast_dispatch(Message *m) {
+    return fast && m->get_type() == CEPH_MSG_PING;
+  }
+  bool ms_fast_dispatch(Message *m) {
+    if (decline) {
+      // like the OSD, let nothing overtake a declined message
+      Mutex::Locker l(lock);
+      int& d = declined[m->get_connection()];
+      if (d > 0 || m->get_seq() % 2 == 0) {
+	d++;
+	return false;
+      }
+    }
+    got(m);
+    m->put();
+    return true;
+  }
+  bool ms_get_rx_buffer(Connection *con, const ceph_msg_header& header,
+			bufferlist& data) {
+    unsigned len = le32_to_cpu(header.data_len);
+    if (!rx_buffers || !len)
+      return false;
+    bufferptr bp = buffer::create_page_aligned(ROUND_UP_TO(len, CEPH_PAGE_SIZE));
+    Mutex::Locker l(lock);
+    rx_given.insert(bp.c_str());
+    data.push_back(bp);
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) {
+    Mutex::Locker l(lock);
+    reset_threads[con].insert(pthread_self());
+    resets++;
+    cond.Signal();
+    return true;
+  }
+  void ms_handle_remote_reset(Connection *con) {}
+
+  /// wait up to 30 seconds for *counter to reach n
+  bool wait_for(int *counter, int n) {
+    Mutex::Locker l(lock);
+    utime_t until = ceph_clock_now(cct);
+    until += 30.0;
+    while (*counter < n) {
+      if (cond.WaitUntil(lock, until) != 0 && *counter < n)
+	return false;
+    }
+    return true;
+  }
+};
+
+/*
+ * Start a server with ms_dispatch_threads, connect num_clients clients
+ * that send it pings_each pings each (with data_len bytes of data), and
+ * then drop them all so that the server sees a reset on every
+ * connection.
+ */
+static void run_clients(ThreadRecorder& sd, int num_clients, int pings_each,
+			unsigned data_len = 0)
+{
+  SimpleMessenger *server = new SimpleMessenger(g_ceph_context, entity_name_t::OSD(0),
+						"server", getpid());
+  server->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+  server->add_dispatcher_head(&sd);
+  entity_addr_t addr;
+  ASSERT_TRUE(addr.parse("127.0.0.1"));
+  ASSERT_EQ(0, server->bind(addr));
+  ASSERT_EQ(0, server->start());
+
+  // clients need a dispatcher too, or they never start their dispatch
+  // threads and wait() never returns
+  ThreadRecorder cd(g_ceph_context, false);
+  vector<SimpleMessenger*> clients;
+  for (int i = 0; i < num_clients; i++) {
+    SimpleMessenger *client = new SimpleMessenger(g_ceph_context, entity_name_t::CLIENT(i),
+						  "client", getpid() + 1 + i);
+    client->set_default_policy(Messenger::Policy::client(0, 0));
+    client->add_dispatcher_head(&cd);
+    ASSERT_EQ(0, client->start());
+    clients.push_back(client);
+  }
+  for (int j = 0; j < pings_each; j++)
+    for (int i = 0; i < num_clients; i++) {
+      MPing *m = new MPing;
+      if (data_len) {
+	bufferlist bl;
+	bl.append_zero(data_len);
+	m->set_data(bl);
+      }
+      clients[i]->send_message(m, server->get_myinst());
+    }
+  ASSERT_TRUE(sd.wait_for(&sd.dispatched, num_clients * pings_each));
+
+  for (int i = 0; i < num_clients; i++)
+    clients[i]->mark_down_all();
+  ASSERT_TRUE(sd.wait_for(&sd.resets, num_clients));
+
+  for (int i = 0; i < num_clients; i++) {
+    clients[i]->shutdown();
+    clients[i]->wait();
+    delete clients[i];
+  }
+  server->shutdown();
+  server->wait();
+  delete server;
+}
+
+/*
+ * With several dispatch threads, a connection's reset must come from the
+ * thread that dispatched its messages, or the dispatcher could see the
+ * reset before messages that arrived ahead of it.
+ */
+TEST(DispatchThreads, ResetOnConnectionThread)
+{
+  g_ceph_context->_conf->set_val("ms_dispatch_threads", "4");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ThreadRecorder sd(g_ceph_context, false);
+  run_clients(sd, 8, 20);
+
+  set<pthread_t> all;
+  ASSERT_EQ(8u, sd.dispatch_threads.size());
+  for (map<Connection*, set<pthread_t> >::iterator p = sd.dispatch_threads.begin();
+       p != sd.dispatch_threads.end();
+       ++p) {
+    ASSERT_EQ(1u, p->second.size());
+    ASSERT_EQ(1u, sd.reset_threads.count(p->first));
+    ASSERT_EQ(p->second, sd.reset_threads[p->first]);
+    all.insert(*p->second.begin());
+  }
+  // round-robin over 4 queues
+  ASSERT_EQ(4u, all.size());
+  ASSERT_EQ(0, sd.out_of_order);
+
+  g_ceph_context->_conf->set_val("ms_dispatch_threads", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+/*
+ * Fast dispatched messages skip the dispatch queues but still arrive in
+ * order on each connection.
+ */
+TEST(DispatchThreads, FastDispatchInOrder)
+{
+  ThreadRecorder sd(g_ceph_context, true);
+  run_clients(sd, 4, 200);
+  ASSERT_EQ(4u, sd.dispatch_threads.size());
+  ASSERT_EQ(0, sd.out_of_order);
+  ASSERT_EQ(0, sd.queued);
+}
+
+/*
+ * Messages the Dispatcher won't fast dispatch go through the dispatch
+ * queue instead, behind anything queued before them.
+ */
+TEST(DispatchThreads, FastDispatchDeclined)
+{
+  ThreadRecorder sd(g_ceph_context, true, true);
+  run_clients(sd, 4, 200);
+  ASSERT_EQ(4u, sd.dispatch_threads.size());
+  ASSERT_EQ(0, sd.out_of_order);
+  ASSERT_LE(400, sd.queued);
+  ASSERT_GT(800, sd.queued);
+}
+
+/*
+ * Message data is read straight into the page aligned buffers the
+ * Dispatcher supplies, the way the OSD has write payloads laid out for
+ * the journal, and reaches ms_dispatch in them.
+ */
+TEST(DispatchThreads, RxBuffers)
+{
+  ThreadRecorder sd(g_ceph_context, false);
+  sd.rx_buffers = true;
+  run_clients(sd, 2, 20, 3 * CEPH_PAGE_SIZE + 100);
+  ASSERT_EQ(40, sd.rx_used);
+}
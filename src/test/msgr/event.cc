@@ -0,0 +1,109 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "msg/SimpleMessenger.h"
+#include "messages/MPing.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/ceph_context.h"
+#include "test/unit.h"
+
+/// counts pings; the server also answers each one
+class PingCounter : public Dispatcher {
+public:
+  Messenger *msgr;
+  bool reply;
+  Mutex lock;
+  Cond cond;
+  int count;
+
+  PingCounter(CephContext *cct, Messenger *m, bool r)
+    : Dispatcher(cct), msgr(m), reply(r), lock("PingCounter::lock"), count(0) {}
+
+  bool ms_dispatch(Message *m) {
+    if (m->get_type() != CEPH_MSG_PING)
+      return false;
+    if (reply)
+      msgr->send_message(new MPing, m->get_source_inst());
+    m->put();
+    Mutex::Locker l(lock);
+    count++;
+    cond.Signal();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return true; }
+  void ms_handle_remote_reset(Connection *con) {}
+
+  /// wait up to 30 seconds for count to reach n
+  bool wait_for(int n) {
+    Mutex::Locker l(lock);
+    utime_t until = ceph_clock_now(cct);
+    until += 30.0;
+    while (count < n) {
+      if (cond.WaitUntil(lock, until) != 0 && count < n)
+	return false;
+    }
+    return true;
+  }
+};
+
+/*
+ * Replies queued on a Pipe while its worker drops it must still go out
+ * once it reconnects: a stale kick must not swallow the later ones.
+ * Faults are injected on both ends, and the client keeps a few pings in
+ * flight so that sends race with decodes and faults.
+ */
+TEST(EventMessenger, KicksSurviveReconnect)
+{
+  g_ceph_context->_conf->set_val("ms_event_workers", "2");
+  g_ceph_context->_conf->set_val("ms_inject_socket_failures", "50");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  SimpleMessenger *server = new SimpleMessenger(g_ceph_context, entity_name_t::OSD(0),
+						"server", getpid());
+  SimpleMessenger *client = new SimpleMessenger(g_ceph_context, entity_name_t::OSD(1),
+						"client", getpid() + 1);
+  // like osd peers: either end may reconnect and resend
+  server->set_default_policy(Messenger::Policy::lossless_peer(0, 0));
+  client->set_default_policy(Messenger::Policy::lossless_peer(0, 0));
+  PingCounter sd(g_ceph_context, server, true), cd(g_ceph_context, client, false);
+  server->add_dispatcher_head(&sd);
+  client->add_dispatcher_head(&cd);
+
+  entity_addr_t addr;
+  ASSERT_TRUE(addr.parse("127.0.0.1"));
+  ASSERT_EQ(0, server->bind(addr));
+  ASSERT_EQ(0, client->bind(addr));
+  ASSERT_EQ(0, server->start());
+  ASSERT_EQ(0, client->start());
+
+  const int rounds = 50, in_flight = 8;
+  for (int i = 0; i < rounds; i++) {
+    for (int j = 0; j < in_flight; j++)
+      client->send_message(new MPing, server->get_myinst());
+    ASSERT_TRUE(cd.wait_for((i + 1) * in_flight)) << "round " << i;
+  }
+  ASSERT_EQ(rounds * in_flight, sd.count);
+
+  client->shutdown();
+  client->wait();
+  server->shutdown();
+  server->wait();
+  delete client;
+  delete server;
+
+  g_ceph_context->_conf->set_val("ms_inject_socket_failures", "0");
+  g_ceph_context->_conf->set_val("ms_event_workers", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
@@ -18,12 +18,17 @@
 #include "common/Cond.h"
 #include "include/utime.h"
 #include "global/global_context.h"
+#include "global/global_init.h"
 #include "common/ceph_argparse.h"
+#include "common/config.h"
+#include "os/DBObjectMap.h"
+#include "os/LevelDBStore.h"
 #include "omap_bench.hpp"
 
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <errno.h>
 #include <climits>
 #include <cmath>
 
@@ -47,7 +52,7 @@ int OmapBench::setup(int argc, const char** argv) {
       } else if (strcmp(args[i], "--valsize") == 0) {
 	omap_value_size = atoi(args[i+1]);
       } else if (strcmp(args[i], "--inc") == 0) {
-	increment = atoi(args[i+1]);
+	increment = atof(args[i+1]);
       } else if (strcmp(args[i], "--omaptype") == 0) {
 	if(strcmp("rand",args[i+1]) == 0) {
 	  omap_generator = OmapBench::generate_non_uniform_omap;
@@ -57,6 +62,11 @@ int OmapBench::setup(int argc, const char** argv) {
 	}
       } else if (strcmp(args[i], "--name") == 0) {
 	rados_id = args[i+1];
+      } else if (strcmp(args[i], "--local") == 0) {
+	local_dir = args[i+1];
+	test = &OmapBench::test_header_cache_locally;
+      } else if (strcmp(args[i], "--reads") == 0) {
+	reads = atoi(args[i+1]);
       }
     } else if (strcmp(args[i], "--help") == 0) {
       cout << "\nUsage: omapbench [options]\n"
@@ -86,10 +96,22 @@ int OmapBench::setup(int argc, const char** argv) {
       	   << " to be specified size.\n"
       	   << "                        (default "<<omap_value_size;
       cout <<"\n  --name          the rados id to use (default "<<rados_id;
+      cout << ")\n"
+	   << "	--local         instead of a cluster, use a DBObjectMap in this\n"
+	   << "                        directory and compare read latency with\n"
+	   << "                        the omap header cache off and on\n"
+	   << "	--reads         rounds of reads over all objects with --local "
+	   << "(default " << reads;
       cout<<")\n";
       exit(1);
     }
   }
+  if (is_local()) {
+    global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT,
+		CODE_ENVIRONMENT_UTILITY, 0);
+    common_init_finish(g_ceph_context);
+    return 0;
+  }
   int r = rados.init(rados_id.c_str());
   if (r < 0) {
     cout << "error during init" << std::endl;
@@ -166,20 +188,27 @@ void AioWriter::set_aioc(librados::callback_t complete,
 void OmapBench::aio_is_safe(rados_completion_t c, void *arg) {
   AioWriter *aiow = reinterpret_cast<AioWriter *>(arg);
   aiow->stop_time();
-  Mutex * data_lock = &aiow->ob->data_lock;
   Mutex * thread_is_free_lock = &aiow->ob->thread_is_free_lock;
   Cond * thread_is_free = &aiow->ob->thread_is_free;
   int &busythreads_count = aiow->ob->busythreads_count;
-  omap_bench_data &data = aiow->ob->data;
-  int INCREMENT = aiow->ob->increment;
   int err = aiow->get_aioc()->get_return_value();
   if (err < 0) {
     cout << "error writing AioCompletion";
     return;
   }
   double time = aiow->get_time();
+  OmapBench *ob = aiow->ob;
   delete aiow;
-  data_lock->Lock();
+  ob->record_latency(time);
+
+  thread_is_free_lock->Lock();
+  busythreads_count--;
+  thread_is_free->Signal();
+  thread_is_free_lock->Unlock();
+}
+
+void OmapBench::record_latency(double time) {
+  Mutex::Locker l(data_lock);
   data.avg_latency = (data.avg_latency * data.completed_ops + time) / (data.completed_ops + 1);
   data.completed_ops++;
   if (time < data.min_latency) {
@@ -189,17 +218,11 @@ void OmapBench::aio_is_safe(rados_completion_t c, void *arg) {
     data.max_latency = time;
   }
   data.total_latency += time;
-  ++(data.freq_map[time / INCREMENT]);
-  if(data.freq_map[time/INCREMENT] > data.mode.second) {
-    data.mode.first = time/INCREMENT;
-    data.mode.second = data.freq_map[time/INCREMENT];
+  ++(data.freq_map[time / increment]);
+  if(data.freq_map[time/increment] > data.mode.second) {
+    data.mode.first = time/increment;
+    data.mode.second = data.freq_map[time/increment];
   }
-  data_lock->Unlock();
-
-  thread_is_free_lock->Lock();
-  busythreads_count--;
-  thread_is_free->Signal();
-  thread_is_free_lock->Unlock();
 }
 
 string OmapBench::random_string(int len) {
@@ -319,6 +342,90 @@ int OmapBench::write_objects_in_parallel(omap_generator_t omap_gen) {
   return 0;
 }
 
+int OmapBench::test_header_cache_locally(omap_generator_t omap_gen) {
+  LevelDBStore *store = new LevelDBStore(local_dir);
+  stringstream err;
+  if (store->init(err)) {
+    cout << "error opening leveldb in " << local_dir << ": " << err.str()
+	 << std::endl;
+    delete store;
+    return -EINVAL;
+  }
+  DBObjectMap dbmap(store);
+  int r = dbmap.init();
+  if (r < 0) {
+    cout << "error initializing DBObjectMap: " << r << std::endl;
+    return r;
+  }
+
+  // clone each object so that reads also walk to a parent header,
+  // as they do for snapshotted objects
+  vector<hobject_t> oids;
+  vector<set<string> > keys;
+  for (int i = 0; i < objects; i++) {
+    std::map<std::string,bufferlist> omap;
+    r = omap_gen(omap_entries, omap_key_size, omap_value_size, &omap);
+    if (r < 0)
+      return r;
+    stringstream name;
+    name << prefix << i;
+    hobject_t hoid(sobject_t(name.str(), CEPH_NOSNAP));
+    hobject_t clone(sobject_t(name.str() + ".clone", CEPH_NOSNAP));
+    r = dbmap.set_keys(hoid, omap);
+    if (r < 0) {
+      cout << "writing omap failed with code " << r << std::endl;
+      return r;
+    }
+    r = dbmap.clone(hoid, clone);
+    if (r < 0) {
+      cout << "cloning omap failed with code " << r << std::endl;
+      return r;
+    }
+    oids.push_back(hoid);
+    keys.push_back(set<string>());
+    for (std::map<std::string,bufferlist>::iterator p = omap.begin();
+	 p != omap.end();
+	 ++p)
+      keys.back().insert(p->first);
+  }
+
+  size_t cache_sizes[] = { 0, g_conf->filestore_omap_header_cache_size };
+  for (unsigned c = 0; c < sizeof(cache_sizes) / sizeof(cache_sizes[0]); c++) {
+    dbmap.set_header_cache_size(cache_sizes[c]);
+    data = omap_bench_data();
+    for (int round = 0; round < reads; round++) {
+      for (unsigned i = 0; i < oids.size(); i++) {
+	std::map<std::string,bufferlist> out;
+	utime_t start = ceph_clock_now(g_ceph_context);
+	r = dbmap.get_values(oids[i], keys[i], &out);
+	if (r < 0) {
+	  cout << "reading omap failed with code " << r << std::endl;
+	  return r;
+	}
+	record_latency((ceph_clock_now(g_ceph_context) - start) * 1000);
+      }
+    }
+
+    uint64_t hits, misses;
+    dbmap.get_header_cache_stats(&hits, &misses);
+    cout << "\nomap header cache size " << cache_sizes[c]
+	 << ", " << reads << " reads of each object" << std::endl;
+    print_results();
+    cout << "Header cache hits:\t" << hits;
+    cout << "\nHeader cache misses:\t" << misses;
+    cout << "\nHit rate:\t\t"
+	 << (hits + misses ? 100.0 * hits / (hits + misses) : 0.0) << "%"
+	 << std::endl;
+  }
+
+  for (unsigned i = 0; i < oids.size(); i++) {
+    dbmap.clear(oids[i]);
+    dbmap.clear(hobject_t(sobject_t(oids[i].oid.name + ".clone",
+				    CEPH_NOSNAP)));
+  }
+  return 0;
+}
+
 int OmapBench::run() {
   return (((OmapBench *)this)->*OmapBench::test)(omap_generator);
 }
@@ -414,7 +521,8 @@ int main(int argc, const char** argv) {
     return err;
   }
 
-  ob.print_results();
+  if (!ob.is_local())
+    ob.print_results();
 
   //uncomment to show omaps
   /*err = ob.return print_written_omap();
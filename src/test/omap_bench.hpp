@@ -103,6 +103,8 @@ protected:
   int omap_key_size;
   int omap_value_size;
   double increment;
+  string local_dir;
+  int reads;
 
   friend class Writer;
   friend class AioWriter;
@@ -119,13 +121,25 @@ public:
       rados_id("admin"),
       prefix(rados_id+".obj."),
       threads(3), objects(100), omap_entries(10), omap_key_size(10),
-      omap_value_size(100), increment(10)
+      omap_value_size(100), increment(10), reads(10)
   {}
   /**
-   * Parses command line args, initializes rados and ioctx
+   * Parses command line args, initializes rados and ioctx (or, with
+   * --local, just the global context)
    */
   int setup(int argc, const char** argv);
 
+  bool is_local() const {
+    return !local_dir.empty();
+  }
+
+  /**
+   * Adds one op's latency to data.
+   *
+   * @param time latency in ms
+   */
+  void record_latency(double time);
+
   /**
    * Callback for when an AioCompletion (called from an AioWriter)
    * is safe. deletes the AioWriter that called it,
@@ -177,6 +191,18 @@ public:
    */
   int write_objects_in_parallel(omap_generator_t omap_gen);
 
+  /*
+   * Writes omaps generated by omap_gen to OBJECTS objects in a
+   * DBObjectMap on a LevelDB in local_dir, clones each, then times
+   * READS rounds of reading every object's values back, once with the
+   * omap header cache off and once with it on
+   * (filestore_omap_header_cache_size), printing latencies and cache
+   * hit rates for each.
+   *
+   * @param omap_gen the method used to generate the omaps.
+   */
+  int test_header_cache_locally(omap_generator_t omap_gen);
+
   /*
    * runs the test specified by test using the omap generator specified by
    * omap_generator
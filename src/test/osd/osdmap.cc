@@ -0,0 +1,281 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "osd/OSDMap.h"
+#include "common/ceph_context.h"
+#include "common/Thread.h"
+#include "test/unit.h"
+
+static const int num_osds = 12;
+
+/// a map with every osd up and in, decoded the way daemons get it
+static void build_map(OSDMap *osdmap)
+{
+  uuid_d fsid;
+  OSDMap m;
+  m.build_simple(g_ceph_context, 0, fsid, num_osds, 4, 4);
+  OSDMap::Incremental inc(m.get_epoch() + 1);
+  inc.fsid = m.get_fsid();
+  for (int i = 0; i < num_osds; i++) {
+    inc.new_up_client[i] = entity_addr_t();
+    inc.new_up_internal[i] = entity_addr_t();
+    inc.new_weight[i] = CEPH_OSD_IN;
+  }
+  m.apply_incremental(inc);
+
+  bufferlist bl;
+  m.encode(bl);
+  osdmap->decode(bl);
+}
+
+/// an identical map with fresh mapping tables, so every lookup runs crush
+static void uncached_copy(const OSDMap& osdmap, OSDMap *copy)
+{
+  bufferlist bl;
+  osdmap.encode(bl);
+  copy->decode(bl);
+}
+
+static void check_same_mappings(const OSDMap& a, const OSDMap& b)
+{
+  const map<int64_t,pg_pool_t>& pools = a.get_pools();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p) {
+    for (unsigned ps = 0; ps < p->second.get_pg_num() * 2; ps++) {
+      pg_t pgid(ps, p->first, -1);  // also raw pgs above pg_num
+      vector<int> aup, aacting, bup, bacting;
+      a.pg_to_up_acting_osds(pgid, aup, aacting);
+      b.pg_to_up_acting_osds(pgid, bup, bacting);
+      ASSERT_EQ(aup, bup);
+      ASSERT_EQ(aacting, bacting);
+    }
+  }
+}
+
+static void brute_force_changed(const OSDMap& a, const OSDMap& b, set<pg_t> *changed)
+{
+  const map<int64_t,pg_pool_t>& pools = b.get_pools();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p) {
+    for (unsigned ps = 0; ps < p->second.get_pg_num(); ps++) {
+      pg_t pgid(ps, p->first, -1);
+      vector<int> aup, aacting, bup, bacting;
+      a.pg_to_up_acting_osds(pgid, aup, aacting);
+      b.pg_to_up_acting_osds(pgid, bup, bacting);
+      if (aup != bup || aacting != bacting)
+	changed->insert(pgid);
+    }
+  }
+}
+
+TEST(OSDMap, CachedMappingMatchesCrush)
+{
+  OSDMap osdmap, uncached;
+  build_map(&osdmap);
+  uncached_copy(osdmap, &uncached);
+  check_same_mappings(osdmap, uncached);
+  // and again, now served from the table
+  check_same_mappings(osdmap, uncached);
+}
+
+TEST(OSDMap, MarkDownKeepsTable)
+{
+  OSDMap osdmap;
+  build_map(&osdmap);
+  OSDMap oldmap = osdmap;
+
+  OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+  inc.fsid = osdmap.get_fsid();
+  inc.new_state[3] = CEPH_OSD_UP;   // toggle: down
+  pg_t temp_pg(1, 0, -1);
+  inc.new_pg_temp[temp_pg].push_back(5);
+  inc.new_pg_temp[temp_pg].push_back(3);
+  ASSERT_EQ(0, osdmap.apply_incremental(inc));
+  ASSERT_FALSE(osdmap.is_up(3));
+
+  OSDMap uncached;
+  uncached_copy(osdmap, &uncached);
+  check_same_mappings(osdmap, uncached);
+
+  set<pg_t> changed, expected;
+  OSDMap::get_changed_pgs(oldmap, osdmap, &changed);
+  brute_force_changed(oldmap, osdmap, &expected);
+  ASSERT_FALSE(expected.empty());
+  ASSERT_EQ(expected, changed);
+  ASSERT_TRUE(changed.count(temp_pg));
+}
+
+TEST(OSDMap, ReweightRebuildsTable)
+{
+  OSDMap osdmap;
+  build_map(&osdmap);
+  OSDMap oldmap = osdmap;
+  check_same_mappings(oldmap, oldmap);  // fill the shared tables
+
+  OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+  inc.fsid = osdmap.get_fsid();
+  inc.new_weight[7] = CEPH_OSD_OUT;
+  ASSERT_EQ(0, osdmap.apply_incremental(inc));
+
+  OSDMap uncached;
+  uncached_copy(osdmap, &uncached);
+  check_same_mappings(osdmap, uncached);
+
+  set<pg_t> changed, expected;
+  OSDMap::get_changed_pgs(oldmap, osdmap, &changed);
+  brute_force_changed(oldmap, osdmap, &expected);
+  ASSERT_FALSE(expected.empty());
+  ASSERT_EQ(expected, changed);
+}
+
+TEST(OSDMap, ReweightDownDropsOnlyItsEntries)
+{
+  OSDMap osdmap;
+  build_map(&osdmap);
+  OSDMap oldmap = osdmap;
+  check_same_mappings(oldmap, oldmap);  // fill the shared tables
+
+  // half weight: entries without osd 7 stay, those with it are redone
+  OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+  inc.fsid = osdmap.get_fsid();
+  inc.new_weight[7] = CEPH_OSD_IN / 2;
+  ASSERT_EQ(0, osdmap.apply_incremental(inc));
+
+  OSDMap uncached, olduncached;
+  uncached_copy(osdmap, &uncached);
+  uncached_copy(oldmap, &olduncached);
+  check_same_mappings(osdmap, uncached);
+  check_same_mappings(oldmap, olduncached);  // the shared table was copied
+
+  set<pg_t> changed, expected;
+  OSDMap::get_changed_pgs(oldmap, osdmap, &changed);
+  brute_force_changed(oldmap, osdmap, &expected);
+  ASSERT_FALSE(expected.empty());
+  ASSERT_EQ(expected, changed);
+}
+
+class MappingThread : public Thread {
+public:
+  const OSDMap& osdmap;
+  bool ok;
+  MappingThread(const OSDMap& m) : osdmap(m), ok(true) {}
+  void *entry() {
+    OSDMap uncached;
+    uncached_copy(osdmap, &uncached);
+    for (int i = 0; i < 20 && ok; i++) {
+      const map<int64_t,pg_pool_t>& pools = osdmap.get_pools();
+      for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+	   p != pools.end();
+	   ++p) {
+	for (unsigned ps = 0; ps < p->second.get_pg_num(); ps++) {
+	  vector<int> a, b;
+	  osdmap.pg_to_osds(pg_t(ps, p->first, -1), a);
+	  uncached.pg_to_osds(pg_t(ps, p->first, -1), b);
+	  if (a != b)
+	    ok = false;
+	}
+      }
+    }
+    return 0;
+  }
+};
+
+TEST(OSDMap, ConcurrentLookups)
+{
+  OSDMap osdmap;
+  build_map(&osdmap);
+  vector<MappingThread*> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.push_back(new MappingThread(osdmap));
+    threads.back()->create();
+  }
+  for (unsigned i = 0; i < threads.size(); i++) {
+    threads[i]->join();
+    ASSERT_TRUE(threads[i]->ok);
+    delete threads[i];
+  }
+}
+
+TEST(OSDMap, DedupSharesTable)
+{
+  OSDMap a, b;
+  build_map(&a);
+  build_map(&b);
+  check_same_mappings(a, a);
+
+  OSDMap::Incremental inc(b.get_epoch() + 1);
+  inc.fsid = b.get_fsid();
+  inc.new_up_thru[2] = b.get_epoch();
+  ASSERT_EQ(0, b.apply_incremental(inc));
+  OSDMap::dedup(&a, &b);
+
+  set<pg_t> changed;
+  OSDMap::get_changed_pgs(a, b, &changed);
+  ASSERT_TRUE(changed.empty());
+  check_same_mappings(a, b);
+}
+
+TEST(OSDMap, CopySharesUnchangedPieces)
+{
+  OSDMap a;
+  build_map(&a);
+
+  // what the osd does for an incremental: copy the last epoch, apply
+  OSDMap b = a;
+  OSDMap::Incremental inc(b.get_epoch() + 1);
+  inc.fsid = b.get_fsid();
+  inc.new_up_thru[2] = b.get_epoch();
+  ASSERT_EQ(0, b.apply_incremental(inc));
+
+  ASSERT_EQ(&a.get_pools(), &b.get_pools());
+  ASSERT_EQ(&a.get_addr(0), &b.get_addr(0));
+  ASSERT_EQ(a.crush.get(), b.crush.get());
+
+  // osd_info changed; the old epoch's must not have
+  ASSERT_NE(&a.get_info(0), &b.get_info(0));
+  ASSERT_EQ(b.get_epoch() - 1, b.get_up_thru(2));
+  ASSERT_NE(a.get_up_thru(2), b.get_up_thru(2));
+
+  // a pool change copies the pools and leaves the old epoch alone
+  OSDMap c = b;
+  OSDMap::Incremental inc2(c.get_epoch() + 1);
+  inc2.fsid = c.get_fsid();
+  inc2.new_pools[0] = *c.get_pg_pool(0);
+  inc2.new_pools[0].set_pgp_num(1);
+  ASSERT_EQ(0, c.apply_incremental(inc2));
+  ASSERT_NE(&b.get_pools(), &c.get_pools());
+  ASSERT_NE(1u, b.get_pg_pool(0)->get_pgp_num());
+  ASSERT_EQ(1u, c.get_pg_pool(0)->get_pgp_num());
+  check_same_mappings(a, b);
+}
+
+TEST(OSDMap, DedupSharesPoolsAndInfo)
+{
+  OSDMap a, b;
+  build_map(&a);
+  build_map(&b);
+  ASSERT_NE(&a.get_pools(), &b.get_pools());
+
+  OSDMap::Incremental inc(b.get_epoch() + 1);
+  inc.fsid = b.get_fsid();
+  inc.new_flags = CEPH_OSDMAP_NOOUT;
+  ASSERT_EQ(0, b.apply_incremental(inc));
+  OSDMap::dedup(&a, &b);
+
+  ASSERT_EQ(&a.get_pools(), &b.get_pools());
+  ASSERT_EQ(&a.get_info(0), &b.get_info(0));
+  ASSERT_EQ(a.crush.get(), b.crush.get());
+}
@@ -0,0 +1,75 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "gtest/gtest.h"
+
+#include "common/PrioritizedQueue.h"
+
+TEST(PrioritizedQueue, Fifo)
+{
+  PrioritizedQueue<int> pq;
+  ASSERT_TRUE(pq.empty());
+  for (int i = 0; i < 10; ++i)
+    pq.enqueue(5, i);
+  ASSERT_EQ(10u, pq.length());
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(i, pq.dequeue());
+  ASSERT_TRUE(pq.empty());
+}
+
+TEST(PrioritizedQueue, Weighted)
+{
+  PrioritizedQueue<int> pq;
+  for (int i = 0; i < 1000; ++i) {
+    pq.enqueue(3, 3);
+    pq.enqueue(1, 1);
+  }
+  // each round hands out three high priority items per low priority one
+  int high = 0, low = 0;
+  for (int i = 0; i < 400; ++i) {
+    if (pq.dequeue() == 3)
+      ++high;
+    else
+      ++low;
+  }
+  ASSERT_EQ(300, high);
+  ASSERT_EQ(100, low);
+}
+
+TEST(PrioritizedQueue, NoStarvation)
+{
+  PrioritizedQueue<int> pq;
+  for (int i = 0; i < 1000; ++i)
+    pq.enqueue(63, 63);
+  pq.enqueue(1, 1);
+  bool seen = false;
+  for (int i = 0; i < 64 && !seen; ++i)
+    seen = (pq.dequeue() == 1);
+  ASSERT_TRUE(seen);
+}
+
+TEST(PrioritizedQueue, Remove)
+{
+  PrioritizedQueue<int> pq;
+  pq.enqueue(10, 1);
+  pq.enqueue(10, 2);
+  pq.enqueue(5, 1);
+  pq.enqueue(5, 3);
+  ASSERT_EQ(2u, pq.remove(1));
+  ASSERT_EQ(0u, pq.remove(1));
+  ASSERT_EQ(2u, pq.length());
+  ASSERT_EQ(2, pq.dequeue());
+  ASSERT_EQ(3, pq.dequeue());
+  ASSERT_TRUE(pq.empty());
+}
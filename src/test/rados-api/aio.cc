@@ -7,6 +7,7 @@
 #include <semaphore.h>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <boost/scoped_ptr.hpp>
 
 using std::ostringstream;
@@ -672,6 +673,45 @@ TEST(LibRadosAio, FlushPP) {
   delete my_completion2;
 }
 
+TEST(LibRadosAio, AppendOrderPP) {
+  // ops of one client reach the osd on one connection and must be
+  // applied in the order sent, whichever way the osd takes them in
+  AioTestDataPP test_data;
+  ASSERT_EQ("", test_data.init());
+  const int num = 500;
+  const char *oids[] = { "foo", "bar", "baz" };
+  std::vector<AioCompletion*> completions;
+  for (int i = 0; i < num; i++) {
+    for (int j = 0; j < 3; j++) {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%08d", i);
+      bufferlist bl;
+      bl.append(buf, 8);
+      AioCompletion *c = test_data.m_cluster.aio_create_completion(
+	  (void*)&test_data, NULL, NULL);
+      ASSERT_EQ(0, test_data.m_ioctx.aio_append(oids[j], c, bl, 8));
+      completions.push_back(c);
+    }
+  }
+  {
+    TestAlarm alarm;
+    for (unsigned i = 0; i < completions.size(); i++) {
+      ASSERT_EQ(0, completions[i]->wait_for_complete());
+      ASSERT_EQ(0, completions[i]->get_return_value());
+      completions[i]->release();
+    }
+  }
+  for (int j = 0; j < 3; j++) {
+    bufferlist bl;
+    ASSERT_EQ(num * 8, test_data.m_ioctx.read(oids[j], bl, num * 8, 0));
+    for (int i = 0; i < num; i++) {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%08d", i);
+      ASSERT_EQ(0, memcmp(buf, bl.c_str() + i * 8, 8)) << oids[j] << " at " << i;
+    }
+  }
+}
+
 TEST(LibRadosAio, RoundTripWriteFull) {
   AioTestData test_data;
   rados_completion_t my_completion, my_completion2, my_completion3;
@@ -0,0 +1,232 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/rados/librados.h"
+#include "test/rados-api/test.h"
+
+#include "gtest/gtest.h"
+#include <errno.h>
+#include <string.h>
+#include <string>
+
+TEST(LibRadosCOps, WriteOps) {
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  rados_write_op_t op = rados_create_write_op();
+  ASSERT_TRUE(op);
+  rados_write_op_create(op, LIBRADOS_CREATE_EXCLUSIVE, NULL);
+  rados_write_op_write_full(op, "hello", 5);
+  rados_write_op_append(op, " world", 6);
+  rados_write_op_setxattr(op, "attr", "val", 3);
+  const char *keys[] = {"k1", "k2"};
+  const char *vals[] = {"v1", "value2"};
+  size_t lens[] = {2, 6};
+  rados_write_op_omap_set(op, keys, vals, lens, 2);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, "foo", NULL));
+  rados_release_write_op(op);
+
+  // exclusive create of an existing object fails the whole op
+  op = rados_create_write_op();
+  rados_write_op_create(op, LIBRADOS_CREATE_EXCLUSIVE, NULL);
+  rados_write_op_write_full(op, "bye", 3);
+  ASSERT_EQ(-EEXIST, rados_write_op_operate(op, ioctx, "foo", NULL));
+  rados_release_write_op(op);
+
+  // so does a failed comparison, leaving the xattr alone
+  op = rados_create_write_op();
+  rados_write_op_cmpxattr(op, "attr", LIBRADOS_CMPXATTR_OP_EQ, "nope", 4);
+  rados_write_op_rmxattr(op, "attr");
+  ASSERT_EQ(-ECANCELED, rados_write_op_operate(op, ioctx, "foo", NULL));
+  rados_release_write_op(op);
+
+  char buf[64];
+  ASSERT_EQ(11, rados_read(ioctx, "foo", buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(buf, "hello world", 11));
+  ASSERT_EQ(3, rados_getxattr(ioctx, "foo", "attr", buf, sizeof(buf)));
+
+  op = rados_create_write_op();
+  rados_write_op_cmpxattr(op, "attr", LIBRADOS_CMPXATTR_OP_EQ, "val", 3);
+  rados_write_op_rmxattr(op, "attr");
+  rados_write_op_omap_rm_keys(op, keys, 1);
+  rados_write_op_truncate(op, 5);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, "foo", NULL));
+  rados_release_write_op(op);
+  ASSERT_EQ(-ENODATA, rados_getxattr(ioctx, "foo", "attr", buf, sizeof(buf)));
+  ASSERT_EQ(5, rados_read(ioctx, "foo", buf, sizeof(buf), 0));
+
+  op = rados_create_write_op();
+  rados_write_op_remove(op);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, "foo", NULL));
+  rados_release_write_op(op);
+  ASSERT_EQ(-ENOENT, rados_read(ioctx, "foo", buf, sizeof(buf), 0));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRadosCOps, ReadOps) {
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  rados_write_op_t wop = rados_create_write_op();
+  rados_write_op_write_full(wop, "hello world", 11);
+  rados_write_op_setxattr(wop, "attr", "val", 3);
+  const char *keys[] = {"k1", "k2", "k3"};
+  const char *vals[] = {"v1", "v2", "v3"};
+  size_t lens[] = {2, 2, 2};
+  rados_write_op_omap_set(wop, keys, vals, lens, 3);
+  ASSERT_EQ(0, rados_write_op_operate(wop, ioctx, "foo", NULL));
+  rados_release_write_op(wop);
+
+  rados_read_op_t op = rados_create_read_op();
+  ASSERT_TRUE(op);
+  uint64_t size = 0;
+  time_t mtime = 0;
+  int stat_rval = 1, read_rval = 1, xattrs_rval = 1;
+  int vals_rval = 1, keys_rval = 1, by_keys_rval = 1;
+  char buf[64];
+  size_t bytes_read = 0;
+  rados_xattrs_iter_t xattrs;
+  rados_omap_iter_t vals_iter, keys_iter, by_keys_iter;
+  rados_read_op_cmpxattr(op, "attr", LIBRADOS_CMPXATTR_OP_EQ, "val", 3);
+  rados_read_op_stat(op, &size, &mtime, &stat_rval);
+  rados_read_op_read(op, 6, sizeof(buf), buf, &bytes_read, &read_rval);
+  rados_read_op_getxattrs(op, &xattrs, &xattrs_rval);
+  rados_read_op_omap_get_vals(op, "k1", NULL, 10, &vals_iter, &vals_rval);
+  rados_read_op_omap_get_keys(op, NULL, 10, &keys_iter, &keys_rval);
+  rados_read_op_omap_get_vals_by_keys(op, keys + 2, 1, &by_keys_iter,
+				      &by_keys_rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, "foo"));
+  rados_release_read_op(op);
+
+  ASSERT_EQ(0, stat_rval);
+  ASSERT_EQ(11u, size);
+  ASSERT_NE(0, mtime);
+  ASSERT_EQ(0, read_rval);
+  ASSERT_EQ(5u, bytes_read);
+  ASSERT_EQ(0, memcmp(buf, "world", 5));
+
+  ASSERT_EQ(0, xattrs_rval);
+  const char *name, *val;
+  size_t len;
+  ASSERT_EQ(0, rados_getxattrs_next(xattrs, &name, &val, &len));
+  ASSERT_EQ(std::string("attr"), name);
+  ASSERT_EQ(std::string("val"), std::string(val, len));
+  ASSERT_EQ(0, rados_getxattrs_next(xattrs, &name, &val, &len));
+  ASSERT_TRUE(name == NULL);
+  rados_getxattrs_end(xattrs);
+
+  char *key, *v;
+  ASSERT_EQ(0, vals_rval);
+  ASSERT_EQ(0, rados_omap_get_next(vals_iter, &key, &v, &len));
+  ASSERT_EQ(std::string("k2"), key);
+  ASSERT_EQ(std::string("v2"), std::string(v, len));
+  ASSERT_EQ(0, rados_omap_get_next(vals_iter, &key, &v, &len));
+  ASSERT_EQ(std::string("k3"), key);
+  ASSERT_EQ(0, rados_omap_get_next(vals_iter, &key, &v, &len));
+  ASSERT_TRUE(key == NULL);
+  rados_omap_get_end(vals_iter);
+
+  ASSERT_EQ(0, keys_rval);
+  int nkeys = 0;
+  while (true) {
+    ASSERT_EQ(0, rados_omap_get_next(keys_iter, &key, &v, &len));
+    if (!key)
+      break;
+    ASSERT_TRUE(v == NULL);
+    ASSERT_EQ(0u, len);
+    ++nkeys;
+  }
+  ASSERT_EQ(3, nkeys);
+  rados_omap_get_end(keys_iter);
+
+  ASSERT_EQ(0, by_keys_rval);
+  ASSERT_EQ(0, rados_omap_get_next(by_keys_iter, &key, &v, &len));
+  ASSERT_EQ(std::string("k3"), key);
+  ASSERT_EQ(std::string("v3"), std::string(v, len));
+  ASSERT_EQ(0, rados_omap_get_next(by_keys_iter, &key, &v, &len));
+  ASSERT_TRUE(key == NULL);
+  rados_omap_get_end(by_keys_iter);
+
+  // exec output that does not fit the buffer reports -ERANGE
+  op = rados_create_read_op();
+  char features[8], small[4];
+  size_t features_len = 0, small_len = 1;
+  int features_rval = 1, small_rval = 0;
+  rados_read_op_exec(op, "rbd", "get_all_features", NULL, 0,
+		     features, sizeof(features), &features_len, &features_rval);
+  rados_read_op_exec(op, "rbd", "get_all_features", NULL, 0,
+		     small, sizeof(small), &small_len, &small_rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, "foo"));
+  rados_release_read_op(op);
+  ASSERT_EQ(0, features_rval);
+  ASSERT_EQ(sizeof(features), features_len);
+  ASSERT_EQ(-ERANGE, small_rval);
+  ASSERT_EQ(0u, small_len);
+
+  op = rados_create_read_op();
+  rados_read_op_cmpxattr(op, "attr", LIBRADOS_CMPXATTR_OP_EQ, "nope", 4);
+  rados_read_op_stat(op, &size, NULL, NULL);
+  ASSERT_EQ(-ECANCELED, rados_read_op_operate(op, ioctx, "foo"));
+  rados_release_read_op(op);
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRadosCOps, AioOps) {
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  rados_completion_t c;
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c));
+  rados_write_op_t wop = rados_create_write_op();
+  rados_write_op_write_full(wop, "hello", 5);
+  rados_write_op_setxattr(wop, "attr", "val", 3);
+  ASSERT_EQ(0, rados_aio_write_op_operate(wop, ioctx, c, "foo", NULL));
+  ASSERT_EQ(0, rados_aio_wait_for_safe(c));
+  ASSERT_EQ(0, rados_aio_get_return_value(c));
+  rados_aio_release(c);
+  rados_release_write_op(wop);
+
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c));
+  rados_read_op_t op = rados_create_read_op();
+  char buf[64];
+  size_t bytes_read = 0;
+  int read_rval = 1;
+  rados_read_op_cmpxattr(op, "attr", LIBRADOS_CMPXATTR_OP_EQ, "val", 3);
+  rados_read_op_read(op, 0, sizeof(buf), buf, &bytes_read, &read_rval);
+  ASSERT_EQ(0, rados_aio_read_op_operate(op, ioctx, c, "foo"));
+  ASSERT_EQ(0, rados_aio_wait_for_complete(c));
+  ASSERT_EQ(0, rados_aio_get_return_value(c));
+  rados_aio_release(c);
+  rados_release_read_op(op);
+
+  ASSERT_EQ(0, read_rval);
+  ASSERT_EQ(5u, bytes_read);
+  ASSERT_EQ(0, memcmp(buf, "hello", 5));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
@@ -86,3 +86,42 @@ TEST(LibRadosWatchNotify, WatchNotifyTimeoutTestPP) {
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
   sem_destroy(&sem);
 }
+
+TEST(LibRadosWatchNotify, WatchCachedContextsPoolDeletePP) {
+  // more idle objects than the osd keeps cached per pg, interleaved with
+  // watched ones, so that dropping the watches on removal trims the cache
+  // while the osd walks the pg's contexts
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  bufferlist bl;
+  bl.append("foo");
+  const int num_objects = 1024;
+  WatchNotifyTestCtx ctx;
+  TestAlarm alarm;
+  for (int i = 0; i < num_objects; i++) {
+    char oid[32];
+    snprintf(oid, sizeof(oid), "obj%d", i);
+    ASSERT_EQ((int)bl.length(), ioctx.write(oid, bl, bl.length(), 0));
+    if (i % 4 == 0) {
+      uint64_t handle;
+      ASSERT_EQ(0, ioctx.watch(oid, 0, &handle, &ctx));
+    }
+  }
+  ioctx.close();
+  ASSERT_EQ(0, cluster.pool_delete(pool_name.c_str()));
+
+  // the osds that held the pool must still serve io
+  std::string pool_name2 = get_temp_pool_name();
+  ASSERT_EQ(0, cluster.pool_create(pool_name2.c_str()));
+  cluster.ioctx_create(pool_name2.c_str(), ioctx);
+  for (int i = 0; i < num_objects; i += 16) {
+    char oid[32];
+    snprintf(oid, sizeof(oid), "obj%d", i);
+    ASSERT_EQ((int)bl.length(), ioctx.write(oid, bl, bl.length(), 0));
+  }
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name2, cluster));
+}
@@ -0,0 +1,245 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank Storage, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <set>
+
+#include "rgw/rgw_bucket_index.h"
+#include "gtest/gtest.h"
+
+/*
+ * The index objects of one bucket, each an omap of encoded entries, and
+ * enough of the rgw class to list them the way bucket_list does.
+ */
+typedef vector<map<string, bufferlist> > index_t;
+
+static rgw_bucket make_bucket(uint32_t num_shards)
+{
+  rgw_bucket bucket("bucket", ".rgw.buckets", "marker", "id");
+  bucket.num_shards = num_shards;
+  return bucket;
+}
+
+static void add_entry(const rgw_bucket& bucket, index_t& index, const string& name,
+		      uint64_t size, bool exists)
+{
+  struct rgw_bucket_dir_entry entry;
+  entry.name = name;
+  entry.exists = exists;
+  entry.meta.category = RGW_OBJ_CATEGORY_MAIN;
+  entry.meta.size = size;
+  ::encode(entry, index[rgw_bucket_index_shard(bucket, name)][name]);
+}
+
+static struct rgw_cls_list_ret shard_list(map<string, bufferlist>& omap, const string& start,
+					  const string& prefix, uint32_t num)
+{
+  struct rgw_cls_list_ret ret;
+  map<string, bufferlist>::iterator iter = omap.upper_bound(start);
+  while (iter != omap.end() && iter->first.compare(0, prefix.size(), prefix) != 0)
+    ++iter;
+  for (uint32_t i = 0; i < num && iter != omap.end(); ++i) {
+    bufferlist::iterator p = iter->second.begin();
+    ::decode(ret.dir.m[iter->first], p);
+    do {
+      ++iter;
+    } while (iter != omap.end() && iter->first.compare(0, prefix.size(), prefix) != 0);
+  }
+  ret.is_truncated = (iter != omap.end());
+  return ret;
+}
+
+/// list the whole bucket num entries at a time, the way list_objects pages
+static void list_all(const rgw_bucket& bucket, index_t& index, const string& prefix,
+		     uint32_t num, vector<string>& names)
+{
+  string marker;
+  bool truncated = true;
+  while (truncated) {
+    vector<struct rgw_cls_list_ret> rets;
+    for (uint32_t i = 0; i < index.size(); i++)
+      rets.push_back(shard_list(index[i], marker, prefix, num));
+    map<string, uint32_t> merged;
+    truncated = rgw_merge_bucket_list(rets, num, merged);
+    ASSERT_GE(num, merged.size());
+    if (truncated) {
+      ASSERT_EQ(num, merged.size());
+    }
+    for (map<string, uint32_t>::iterator iter = merged.begin(); iter != merged.end(); ++iter) {
+      ASSERT_EQ(rgw_bucket_index_shard(bucket, iter->first), iter->second);
+      names.push_back(iter->first);
+      marker = iter->first;
+    }
+  }
+}
+
+static void make_names(int n, set<string>& names)
+{
+  for (int i = 0; i < n; i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s/obj%d", (i % 3) ? "dir" : "other", i);
+    names.insert(buf);
+  }
+}
+
+TEST(BucketIndex, Oids)
+{
+  vector<string> oids;
+  rgw_bucket_index_oids(make_bucket(0), oids);
+  ASSERT_EQ(1u, oids.size());
+  ASSERT_EQ(".dir.marker", oids[0]);
+
+  rgw_bucket_index_oids(make_bucket(3), oids);
+  ASSERT_EQ(3u, oids.size());
+  ASSERT_EQ(".dir.marker.3.0", oids[0]);
+  ASSERT_EQ(".dir.marker.3.2", oids[2]);
+
+  ASSERT_EQ(0u, rgw_bucket_index_shard(make_bucket(0), "foo"));
+  for (int i = 0; i < 100; i++) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "obj%d", i);
+    ASSERT_GT(3u, rgw_bucket_index_shard(make_bucket(3), buf));
+  }
+}
+
+TEST(BucketIndex, MergeTruncates)
+{
+  vector<struct rgw_cls_list_ret> rets(2);
+  rets[0].dir.m["a"];
+  rets[0].dir.m["c"];
+  rets[1].dir.m["b"];
+  rets[1].dir.m["d"];
+
+  map<string, uint32_t> merged;
+  ASSERT_FALSE(rgw_merge_bucket_list(rets, 4, merged));
+  ASSERT_EQ(4u, merged.size());
+
+  ASSERT_TRUE(rgw_merge_bucket_list(rets, 3, merged));
+  ASSERT_EQ(3u, merged.size());
+  ASSERT_EQ(0u, merged["a"]);
+  ASSERT_EQ(1u, merged["b"]);
+  ASSERT_EQ(0u, merged["c"]);
+
+  // a shard with more than it returned truncates the whole listing
+  rets[1].is_truncated = true;
+  ASSERT_TRUE(rgw_merge_bucket_list(rets, 10, merged));
+}
+
+TEST(BucketIndex, ListAcrossShards)
+{
+  set<string> names;
+  make_names(200, names);
+
+  rgw_bucket bucket = make_bucket(7);
+  index_t index(7);
+  for (set<string>::iterator iter = names.begin(); iter != names.end(); ++iter)
+    add_entry(bucket, index, *iter, 1, true);
+  for (uint32_t i = 0; i < index.size(); i++)
+    ASSERT_FALSE(index[i].empty()) << "shard " << i;
+
+  uint32_t pages[] = { 1, 6, 7, 50, 199, 200, 1000 };
+  for (unsigned p = 0; p < sizeof(pages) / sizeof(pages[0]); p++) {
+    vector<string> listed;
+    list_all(bucket, index, "", pages[p], listed);
+    ASSERT_EQ(vector<string>(names.begin(), names.end()), listed) << "page " << pages[p];
+
+    vector<string> prefixed, expected;
+    list_all(bucket, index, "dir/", pages[p], prefixed);
+    for (set<string>::iterator iter = names.begin(); iter != names.end(); ++iter)
+      if (iter->compare(0, 4, "dir/") == 0)
+	expected.push_back(*iter);
+    ASSERT_EQ(expected, prefixed) << "page " << pages[p];
+  }
+}
+
+/// copy index as rgw copies it, from src's layout to dst's
+static void reshard(const rgw_bucket& dst, index_t& index, index_t& out,
+		    vector<struct rgw_bucket_dir_header>& headers)
+{
+  uint32_t n = dst.num_shards ? dst.num_shards : 1;
+  out.clear();
+  out.resize(n);
+  headers.clear();
+  headers.resize(n);
+  for (uint32_t i = 0; i < index.size(); i++) {
+    // in small batches, so that headers add up over several calls
+    map<string, bufferlist>::iterator iter = index[i].begin();
+    while (iter != index[i].end()) {
+      map<string, bufferlist> vals;
+      for (int j = 0; j < 7 && iter != index[i].end(); j++, ++iter)
+	vals[iter->first] = iter->second;
+      vector<map<string, bufferlist> > batch;
+      ASSERT_EQ(0, rgw_reshard_index_entries(dst, vals, batch, headers, NULL));
+      ASSERT_EQ(n, batch.size());
+      for (uint32_t j = 0; j < n; j++)
+	out[j].insert(batch[j].begin(), batch[j].end());
+    }
+  }
+}
+
+TEST(BucketIndex, Reshard)
+{
+  set<string> names;
+  make_names(300, names);
+
+  rgw_bucket bucket = make_bucket(0);
+  index_t index(1);
+  uint64_t num = 0, size = 0;
+  int i = 0;
+  for (set<string>::iterator iter = names.begin(); iter != names.end(); ++iter, ++i) {
+    // every tenth is a pending create that must not be counted
+    bool exists = (i % 10) != 0;
+    add_entry(bucket, index, *iter, i * 1000, exists);
+    if (exists) {
+      num++;
+      size += i * 1000;
+    }
+  }
+
+  uint32_t layouts[] = { 5, 3, 0 };
+  for (unsigned l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+    rgw_bucket dst = make_bucket(layouts[l]);
+    index_t out;
+    vector<struct rgw_bucket_dir_header> headers;
+    reshard(dst, index, out, headers);
+
+    uint64_t got_num = 0, got_size = 0;
+    for (uint32_t j = 0; j < out.size(); j++) {
+      for (map<string, bufferlist>::iterator iter = out[j].begin(); iter != out[j].end(); ++iter)
+	ASSERT_EQ(j, rgw_bucket_index_shard(dst, iter->first));
+      struct rgw_bucket_category_stats& stats = headers[j].stats[RGW_OBJ_CATEGORY_MAIN];
+      got_num += stats.num_entries;
+      got_size += stats.total_size;
+    }
+    ASSERT_EQ(num, got_num) << "layout " << layouts[l];
+    ASSERT_EQ(size, got_size) << "layout " << layouts[l];
+
+    vector<string> listed;
+    list_all(dst, out, "", 40, listed);
+    ASSERT_EQ(vector<string>(names.begin(), names.end()), listed) << "layout " << layouts[l];
+    index.swap(out);
+  }
+}
+
+TEST(BucketIndex, ReshardBadEntry)
+{
+  map<string, bufferlist> vals;
+  vals["garbage"].append("x");
+  vector<map<string, bufferlist> > batch;
+  vector<struct rgw_bucket_dir_header> headers(4);
+  string bad;
+  ASSERT_EQ(-EIO, rgw_reshard_index_entries(make_bucket(4), vals, batch, headers, &bad));
+  ASSERT_EQ("garbage", bad);
+}
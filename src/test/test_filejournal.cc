@@ -10,6 +10,8 @@
 #include "include/Context.h"
 #include "common/Mutex.h"
 #include "common/safe_io.h"
+#include "common/perf_counters.h"
+#include "os/ObjectStore.h"
 
 Finisher *finisher;
 Cond sync_cond;
@@ -348,3 +350,285 @@ TEST(TestFileJournal, WriteTrimSmall) {
 
   j.close();
 }
+
+/*
+ * Write payloads reach the journal in whole, page aligned pages when the
+ * OSD lays out their receive buffers (OSD::ms_get_rx_buffer).  An
+ * O_DIRECT journal must then copy only the few pages around them, not
+ * the data itself; data that arrives unaligned is copied in full.
+ */
+TEST(TestFileJournal, WriteAlignedData) {
+  // the journal updates the other os counters too; give them somewhere to go
+  PerfCountersBuilder plb(g_ceph_context, "test_filejournal", l_os_first, l_os_last);
+  for (int i = l_os_first + 1; i < l_os_last; i++)
+    plb.add_u64_counter(i, i == l_os_j_wr_realign_bytes ? "journal_wr_realign_bytes" : "unused");
+  PerfCounters *logger = plb.create_perf_counters();
+
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  j.logger = logger;
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  const unsigned len = 1 << 20;
+  bufferlist aligned;
+  for (unsigned i = 0; i < len / 65536; i++)
+    aligned.push_back(buffer::create_page_aligned(65536));
+  aligned.zero();
+  bufferptr bp(buffer::create(len + 1));
+  bp.zero();
+  bufferlist unaligned;
+  unaligned.push_back(bufferptr(bp, 1, len));
+
+  bufferlist *data[2] = { &aligned, &unaligned };
+  uint64_t copied[2];
+  for (int i = 0; i < 2; i++) {
+    // as JournalingObjectStore::_op_journal_transactions submits it
+    ObjectStore::Transaction t;
+    t.write(coll_t(), hobject_t(sobject_t("foo", CEPH_NOSNAP)), 0, len, *data[i]);
+    bufferlist tbl;
+    ::encode(t, tbl);
+    uint64_t before = logger->get(l_os_j_wr_realign_bytes);
+    {
+      C_Sync s;
+      j.submit_entry(i + 1, tbl, t.get_data_alignment() & ~CEPH_PAGE_MASK, s.c);
+    }
+    copied[i] = logger->get(l_os_j_wr_realign_bytes) - before;
+  }
+  if (directio) {
+    ASSERT_GE(4 * CEPH_PAGE_SIZE, copied[0]);
+    ASSERT_LE(len, copied[1]);
+  } else {
+    ASSERT_EQ(0u, copied[0]);
+    ASSERT_EQ(0u, copied[1]);
+  }
+
+  j.close();
+  j.logger = NULL;
+  delete logger;
+}
+
+/*
+ * Writes that pile up while the writer is busy go out together, as many
+ * aios per io_submit as journal_aio_queue_depth allows, and replay like
+ * any others.
+ */
+TEST(TestFileJournal, AioBatch) {
+  g_ceph_context->_conf->set_val("journal_aio_queue_depth", "4");
+  g_ceph_context->_conf->set_val("journal_max_write_entries", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  PerfCountersBuilder plb(g_ceph_context, "test_filejournal", l_os_first, l_os_last);
+  for (int i = l_os_first + 1; i < l_os_last; i++)
+    plb.add_u64_counter(i, "unused");
+  PerfCounters *logger = plb.create_perf_counters();
+
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  j.logger = logger;
+  ASSERT_EQ(0, j.create());
+
+  // queue them all before the writer starts, so that it finds them together
+  const unsigned num = 8;
+  char foo[65536];
+  list<C_Sync*> ls;
+  for (unsigned i = 0; i < num; i++) {
+    memset(foo, i + 1, sizeof(foo));
+    bufferlist bl;
+    bl.append(foo, sizeof(foo));
+    ls.push_back(new C_Sync);
+    j.submit_entry(i + 1, bl, 0, ls.back()->c);
+  }
+  j.make_writeable();
+  while (ls.size()) {
+    delete ls.front();
+    ls.pop_front();
+  }
+
+#ifdef HAVE_LIBAIO
+  if (aio && directio) {
+    // submits by aios in flight: <=1, <=2, <=4, <=8, <=16, more
+    uint64_t submits = 0;
+    for (int i = 0; i < 6; i++)
+      submits += logger->get(l_os_j_aio_depth_hist + i);
+    ASSERT_GT((uint64_t)num, submits);
+    // the first io_submit filled the queue depth, and none went past it
+    ASSERT_LE(1u, logger->get(l_os_j_aio_depth_hist + 2));
+    for (int i = 3; i < 6; i++)
+      ASSERT_EQ(0u, logger->get(l_os_j_aio_depth_hist + i));
+  }
+#endif
+  j.close();
+
+  j.open(0);
+  bufferlist inbl;
+  uint64_t rseq = 0;
+  for (uint64_t s = 1; s <= num; s++) {
+    inbl.clear();
+    ASSERT_TRUE(j.read_entry(inbl, rseq)) << "seq " << s;
+    ASSERT_EQ(s, rseq);
+    ASSERT_EQ(sizeof(foo), inbl.length());
+    ASSERT_EQ((char)s, inbl[0]);
+    ASSERT_EQ((char)s, inbl[sizeof(foo) - 1]);
+  }
+  ASSERT_TRUE(!j.read_entry(inbl, rseq));
+  j.make_writeable();
+  j.close();
+  j.logger = NULL;
+  delete logger;
+
+  g_ceph_context->_conf->set_val("journal_aio_queue_depth", "32");
+  g_ceph_context->_conf->set_val("journal_max_write_entries", "100");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+/// read one counter back from FileJournal::dump_discard()
+static uint64_t discard_stat(FileJournal& j, const char *name)
+{
+  ostringstream ss;
+  j.dump_discard(ss);
+  string out = ss.str();
+  string key = string("\"") + name + "\": ";
+  size_t p = out.find(key);
+  if (p == string::npos)
+    return 0;
+  return strtoull(out.c_str() + p + key.length(), NULL, 10);
+}
+
+/*
+ * Trimmed space waits for discard until the writer is idle; by then the
+ * writer may have wrapped around into it.  Let the whole journal's worth
+ * pile up, then discard it all and check that nothing we still need to
+ * replay went with it.
+ */
+TEST(TestFileJournal, DiscardWrap) {
+  g_ceph_context->_conf->set_val("journal_discard", "true");
+  g_ceph_context->_conf->set_val("journal_debug_discard_file", "true");
+  g_ceph_context->_conf->set_val("journal_discard_min_bytes", "1000000000000");
+  g_ceph_context->_conf->set_val("journal_discard_max_bytes_per_sec", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  list<C_Sync*> ls;
+  char foo[1024*1024];
+  uint64_t seq = 1, committed = 0;
+
+  for (unsigned i=0; i<size_mb*2; i++) {
+    memset(foo, seq, sizeof(foo));
+    bufferlist bl;
+    bl.append(foo, sizeof(foo));
+    ls.push_back(new C_Sync);
+    j.submit_entry(seq++, bl, 0, ls.back()->c);
+
+    while (ls.size() > size_mb/2) {
+      delete ls.front();
+      ls.pop_front();
+      committed++;
+      j.committed_thru(committed);
+    }
+  }
+  while (ls.size()) {
+    delete ls.front();
+    ls.pop_front();
+  }
+
+  // discard everything queued, then wait for the writer to get to it
+  g_ceph_context->_conf->set_val("journal_discard_min_bytes", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+  {
+    C_Sync s;
+    bufferlist bl;
+    bl.append("last");
+    j.submit_entry(seq++, bl, 0, s.c);
+  }
+  for (int i = 0; i < 100; i++) {
+    ostringstream ss;
+    j.dump_discard(ss);
+    if (ss.str().find("\"ready_bytes\": 0,") != string::npos)
+      break;
+    usleep(100000);
+  }
+  j.close();
+
+  j.open(committed);
+  bufferlist inbl;
+  uint64_t rseq = 0;
+  for (uint64_t s = committed + 1; s < seq - 1; s++) {
+    inbl.clear();
+    ASSERT_TRUE(j.read_entry(inbl, rseq)) << "seq " << s;
+    ASSERT_EQ(s, rseq);
+    ASSERT_EQ(sizeof(foo), inbl.length());
+    ASSERT_EQ((char)s, inbl[0]);
+    ASSERT_EQ((char)s, inbl[sizeof(foo) - 1]);
+  }
+  inbl.clear();
+  ASSERT_TRUE(j.read_entry(inbl, rseq));
+  ASSERT_EQ(seq - 1, rseq);
+  ASSERT_TRUE(!j.read_entry(inbl, rseq));
+  j.make_writeable();
+  j.close();
+
+  g_ceph_context->_conf->set_val("journal_discard", "false");
+  g_ceph_context->_conf->set_val("journal_debug_discard_file", "false");
+  g_ceph_context->_conf->set_val("journal_discard_min_bytes", "16777216");
+  g_ceph_context->_conf->set_val("journal_discard_max_bytes_per_sec", "268435456");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+/*
+ * A big backlog of trimmed space is discarded journal_discard_min_bytes
+ * at a time, so that new writes never wait long behind it.
+ */
+TEST(TestFileJournal, DiscardPieces) {
+  g_ceph_context->_conf->set_val("journal_discard", "true");
+  g_ceph_context->_conf->set_val("journal_debug_discard_file", "true");
+  g_ceph_context->_conf->set_val("journal_discard_min_bytes", "1000000000000");
+  g_ceph_context->_conf->set_val("journal_discard_max_bytes_per_sec", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  char foo[1024*1024];
+  memset(foo, 1, sizeof(foo));
+  uint64_t seq = 1;
+  for (unsigned i=0; i<size_mb/2; i++) {
+    C_Sync s;
+    bufferlist bl;
+    bl.append(foo, sizeof(foo));
+    j.submit_entry(seq, bl, 0, s.c);
+    j.committed_thru(seq++);
+  }
+
+  g_ceph_context->_conf->set_val("journal_discard_min_bytes", "1048576");
+  g_ceph_context->_conf->apply_changes(NULL);
+  {
+    C_Sync s;
+    bufferlist bl;
+    bl.append("last");
+    j.submit_entry(seq++, bl, 0, s.c);
+  }
+  for (int i = 0; i < 100; i++) {
+    if (discard_stat(j, "ready_bytes") < 1048576)
+      break;
+    usleep(100000);
+  }
+  ASSERT_GT(1048576u, discard_stat(j, "ready_bytes"));
+  uint64_t bytes = discard_stat(j, "discarded_bytes");
+  uint64_t discards = discard_stat(j, "discards");
+  ASSERT_LT((uint64_t)1 << 20, bytes);
+  ASSERT_LE(bytes, discards << 20);
+  j.close();
+
+  g_ceph_context->_conf->set_val("journal_discard", "false");
+  g_ceph_context->_conf->set_val("journal_debug_discard_file", "false");
+  g_ceph_context->_conf->set_val("journal_discard_min_bytes", "16777216");
+  g_ceph_context->_conf->set_val("journal_discard_max_bytes_per_sec", "268435456");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
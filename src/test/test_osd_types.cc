@@ -122,3 +122,51 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(eversion_t, KeyNameOrder)
+{
+  // omap iterates keys in byte order; the log relies on that being
+  // eversion order
+  eversion_t v[] = {
+    eversion_t(0, 0),
+    eversion_t(1, 9),
+    eversion_t(1, 10),
+    eversion_t(2, 1),
+    eversion_t(10, 0),
+    eversion_t(10, 1ull << 40),
+    eversion_t(1u << 31, 5),
+  };
+  unsigned n = sizeof(v) / sizeof(v[0]);
+  for (unsigned i = 1; i < n; i++) {
+    ASSERT_TRUE(v[i-1] < v[i]);
+    ASSERT_LT(v[i-1].get_key_name(), v[i].get_key_name());
+  }
+}
+
+TEST(pg_log_entry_t, Checksum)
+{
+  hobject_t oid(object_t("objname"), "key", 123, 456, 0);
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, oid, eversion_t(3, 4),
+		   eversion_t(1, 2), osd_reqid_t(entity_name_t::CLIENT(777), 8, 999),
+		   utime_t(8, 9));
+  ASSERT_EQ(e.version.get_key_name(), e.get_key_name());
+
+  bufferlist bl;
+  e.encode_with_checksum(bl);
+
+  pg_log_entry_t d;
+  bufferlist::iterator p = bl.begin();
+  d.decode_with_checksum(p);
+  ASSERT_TRUE(p.end());
+  ASSERT_EQ(e.soid, d.soid);
+  ASSERT_EQ(e.version, d.version);
+  ASSERT_EQ(e.prior_version, d.prior_version);
+  ASSERT_EQ(e.reqid, d.reqid);
+
+  // flip a bit in the entry
+  bufferlist bad;
+  bad.append(bl.c_str(), bl.length());
+  bad.c_str()[bl.length() / 2] ^= 1;
+  p = bad.begin();
+  ASSERT_THROW(d.decode_with_checksum(p), buffer::malformed_input);
+}
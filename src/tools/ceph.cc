@@ -99,6 +99,7 @@ static void usage()
   cout << "  ceph osd pool rename <pool> <new pool name>\n";
   cout << "  ceph osd pool set <pool> <field> <value>\n";
   cout << "  ceph osd scrub <osd-id>\n";
+  cout << "  ceph osd deep-scrub <osd-id>\n";
   cout << "  ceph osd repair <osd-id>\n";
   cout << "  ceph osd tell N bench [bytes per write] [total bytes]\n";
   cout << "\n";
@@ -106,6 +107,7 @@ static void usage()
   cout << "  ceph pg dump\n";
   cout << "  ceph pg <pg-id> query\n";
   cout << "  ceph pg scrub <pg-id>\n";
+  cout << "  ceph pg deep-scrub <pg-id>\n";
   cout << "  ceph pg map <pg-id>\n";
   cout << "\n";
   cout << "OPTIONS\n";